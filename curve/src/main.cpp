@@ -12,11 +12,83 @@ void Log(LPCWSTR format, ...) {
   va_end(v);
 }
 
+static bool ParseThreshold(LPCWSTR arg, PerceptualThreshold &threshold) {
+  return swscanf_s(arg, L"%u/%u",
+                   &threshold.sameBelow, &threshold.differentFrom) == 2;
+}
+
+static bool ParsePyramid(LPCWSTR arg, DiffOptions &options) {
+  return swscanf_s(arg, L"%u/%lf",
+                   &options.pyramidFactor, &options.pyramidThreshold) == 2
+         && (options.pyramidFactor == 4 || options.pyramidFactor == 8);
+}
+
+static bool ParseFailThreshold(LPCWSTR arg, FailThreshold &threshold) {
+  return swscanf_s(arg, L"%lf/%I64u",
+                   &threshold.minPSNR, &threshold.maxChangedPixels) == 2;
+}
+
+static bool ParseSample(LPCWSTR arg, DiffOptions &options) {
+  return swscanf_s(arg, L"%u/%u",
+                   &options.sampleTiles, &options.sampleSeed) == 2
+         && options.sampleTiles >= 2;
+}
+
+static bool ParseBitCount(LPCWSTR arg, WORD &bitCount) {
+  bitCount = static_cast<WORD>(_wtoi(arg));
+  return bitCount == 8 || bitCount == 24 || bitCount == 32;
+}
+
+static bool ParseColorSpace(LPCWSTR arg, bool &ycbcr) {
+  ycbcr = wcscmp(arg, L"ycbcr") == 0;
+  return ycbcr || wcscmp(arg, L"bgr") == 0;
+}
+
+// Reads a difference of levels, 0 to 255.
+static bool ParseLevel(LPCWSTR arg, BYTE &level) {
+  UINT value;
+  if (swscanf_s(arg, L"%u", &value) != 1 || value > 255) return false;
+  level = static_cast<BYTE>(value);
+  return true;
+}
+
+// Reads a number of row edits, at most DiffOptions::maxAlignRowEdits.
+static bool ParseRowEdits(LPCWSTR arg, UINT &edits) {
+  return swscanf_s(arg, L"%u", &edits) == 1
+         && edits <= DiffOptions::maxAlignRowEdits;
+}
+
+static bool ParseBaselineUpdate(LPCWSTR arg, BaselineUpdate &update) {
+  static const LPCWSTR names[] = {L"keep", L"missing", L"all"};
+  for (UINT i = 0; i < ARRAYSIZE(names); ++i) {
+    if (wcscmp(arg, names[i]) == 0) {
+      update = static_cast<BaselineUpdate>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Reads a comma-separated list of algorithms into bits of 1 << algo.
+static bool ParseMetrics(LPCWSTR arg, UINT &metrics) {
+  metrics = 0;
+  for (;;) {
+    wchar_t *end;
+    const auto algo = wcstoul(arg, &end, 10);
+    if (end == arg || algo > erosionDiff) return false;
+    metrics |= 1 << algo;
+    if (*end == 0) return true;
+    if (*end != L',') return false;
+    arg = end + 1;
+  }
+}
+
 void show_usage() {
   std::wcout
     << L"Usage: curve [command] [args...]" << std::endl
     << std::endl
-    << L"  -s <endpoint>  Run as an RPC server" << std::endl
+    << L"  -s <endpoint> [cacheTTL]  Run as an RPC server" << std::endl
+    << L"     (cacheTTL: msec to reuse a rendered frame, 0=disabled)" << std::endl
     << std::endl
     << L"Command as an RPC client:" << std::endl
     << L"  -q <endpoint>                                  -- Quit RPC server" << std::endl
@@ -26,16 +98,98 @@ void show_usage() {
     << L"  -c <endpoint> <bitCount> <captureLocal>        -- Capture the window" << std::endl
     << L"  -d <endpoint1> <endpoint2>" << std::endl
     << L"     <url> <wait> <viewWidth> <viewHeight>" << std::endl
-    << L"     <backFile1> <backFile1> <algo> [diffImage]  -- Image diff'ing" << std::endl
-    << L"     (algo: 0=skip | 1=average | 2=max | 3=min | 4=triangle | 5=erosion)" << std::endl
-    << L"  -batch <endpoint> <bitCount>" << std::endl
-    << L"         <backFile1> <backFile1>                 -- Batch run" << std::endl
+    << L"     <backFile1> <backFile1> <algo>" << std::endl
+    << L"     [diffImage] [cacheFile] [options]           -- Image diff'ing" << std::endl
+    << L"     (algo: 0=skip | 1=average | 2=max | 3=min | 4=triangle | 5=erosion" << std::endl
+    << L"            | 6=ssim | 7=msssim | 8=antialias | 9=edge)" << std::endl
+    << L"     --phash <same>/<different>  Decide by perceptual hash distance" << std::endl
+    << L"                                 without diffing (0=disabled)" << std::endl
+    << L"     --tiles <file>              Write statistics of 32x32 tiles" << std::endl
+    << L"     --pyramid <factor>/<mse>    Diff at 1/factor (4 or 8) first and" << std::endl
+    << L"                                 refine only tiles above the MSE" << std::endl
+    << L"     --fail <psnr>/<pixels>      Fail below the PSNR or above the number" << std::endl
+    << L"                                 of changed pixels, and stop diffing" << std::endl
+    << L"                                 as soon as failed (0=disabled)" << std::endl
+    << L"     --sample <tiles>/<seed>     Estimate the score from random tiles" << std::endl
+    << L"                                 and diff in full only when it is" << std::endl
+    << L"                                 too close to call against --fail" << std::endl
+    << L"     --align <pixels>            Diff the region the frames share when" << std::endl
+    << L"                                 one is offset by up to the pixels" << std::endl
+    << L"     --align-rows <edits>        Pair rows by their hashes and report" << std::endl
+    << L"                                 bands of up to <edits> inserted and" << std::endl
+    << L"                                 deleted rows instead of diffing them" << std::endl
+    << L"                                 (at most 2048 edits)" << std::endl
+    << L"     --mask <rects|file>         Leave out rectangles x,y,w,h;... from" << std::endl
+    << L"                                 the top left, or the black pixels of" << std::endl
+    << L"                                 a 1bpp bitmap (batch: 6th column)" << std::endl
+    << L"     --masks <dir>               Without --mask, use the mask learned" << std::endl
+    << L"                                 for the URL by -learn if any" << std::endl
+    << L"     --changes <file>            Write pixels that differ beyond the" << std::endl
+    << L"                                 tolerance as a 1bpp bitmap" << std::endl
+    << L"     --regions <file>            Write bounding boxes of the regions" << std::endl
+    << L"                                 of those pixels, largest first" << std::endl
+    << L"     --tolerance <levels>        Tolerance of --changes and --regions" << std::endl
+    << L"                                 (default: 0)" << std::endl
+    << L"     --histogram <tolerance>     Report percentiles of the absolute" << std::endl
+    << L"                                 differences and the pixels that" << std::endl
+    << L"                                 differ beyond the tolerance" << std::endl
+    << L"     --bits <8|24|32>            Capture in gray (default) or colors," << std::endl
+    << L"                                 and diff each color channel" << std::endl
+    << L"     --color-space <bgr|ycbcr>   Diff colors as they are (default) or" << std::endl
+    << L"                                 as luma and chroma 4:2:0" << std::endl
+    << L"     --edges <0|1>               Score the Sobel edges of the frames" << std::endl
+    << L"                                 as well as <algo> (1=enabled)" << std::endl
+    << L"     --baseline <dir>            Capture only <endpoint1> and diff the" << std::endl
+    << L"                                 frame against the one stored in <dir>" << std::endl
+    << L"                                 for the URL and viewport instead" << std::endl
+    << L"     --update-baseline <keep|missing|all>  Fail without a stored frame" << std::endl
+    << L"                                 (default), store the frame when there" << std::endl
+    << L"                                 is none, or store every frame" << std::endl
+    << L"     --metrics <algo,...>        Compute the listed algorithms together" << std::endl
+    << L"                                 in one pass instead of <algo>" << std::endl
+    << L"  -batch <endpoint1> <endpoint2>" << std::endl
+    << L"         <backFile1> <backFile2> [options]       -- Batch run" << std::endl
+    << L"     --manifest <file>  Read rows from a file instead of stdin" << std::endl
+    << L"     --algo <algo>      Same as <algo> of -d (default: 5=erosion)" << std::endl
+    << L"     --shard <i>/<n>    Process only rows whose id hashes to shard i" << std::endl
+    << L"     --cache <file>     Reuse diff results of unchanged frames" << std::endl
+    << L"     --phash <same>/<different>  Same as -d" << std::endl
+    << L"     --pyramid <factor>/<mse>    Same as -d" << std::endl
+    << L"     --fail <psnr>/<pixels>      Same as -d" << std::endl
+    << L"     --sample <tiles>/<seed>     Same as -d" << std::endl
+    << L"     --align <pixels>            Same as -d" << std::endl
+    << L"     --align-rows <edits>        Same as -d" << std::endl
+    << L"     --masks <dir>               Same as -d" << std::endl
+    << L"     --histogram <tolerance>     Same as -d (logged as H>)" << std::endl
+    << L"     --bits <8|24|32>            Same as -d" << std::endl
+    << L"     --color-space <bgr|ycbcr>   Same as -d" << std::endl
+    << L"     --edges <0|1>               Same as -d (logged as D>)" << std::endl
+    << L"     --baseline <dir>            Same as -d, by the id of the row" << std::endl
+    << L"     --update-baseline <keep|missing|all>  Same as -d (logged as N>)" << std::endl
+    << L"     --group <bits>     Group failures by perceptual hash distance" << std::endl
+    << L"     --worst-tiles <n>  Log the n worst 32x32 tiles of each failure" << std::endl
+    << L"     --failure-metrics <algo,...>  Log the listed algorithms of each failure" << std::endl
+    << L"  -matrix <n> <endpoint1> <backFile1>" << std::endl
+    << L"          ... <endpointN> <backFileN> [options] -- Pairwise diff" << std::endl
+    << L"     Capture each URL of the manifest once from every endpoint and log" << std::endl
+    << L"     the PSNR of every pair of frames as X> <id> (1,2) (1,3) ... (2,3) ..." << std::endl
+    << L"     --manifest <file>  Read rows from a file instead of stdin" << std::endl
+    << L"     --shard <i>/<n>    Same as -batch" << std::endl
+    << L"  -learn <endpoint> <backFile> <dir> [options]  -- Learn masks" << std::endl
+    << L"     Capture each URL of the manifest several times and save a mask" << std::endl
+    << L"     of the pixels that vary to <dir> for --masks.  Each capture is" << std::endl
+    << L"     rendered again even if <endpoint> runs with a cacheTTL" << std::endl
+    << L"     --manifest <file>  Read rows from a file instead of stdin" << std::endl
+    << L"     --captures <n>     Captures of each URL (default: 5)" << std::endl
+    << L"     --stddev <levels>  Mask pixels that vary more (default: 1)" << std::endl
+    << L"  -bench [width] [height] [iterations]          -- Time each algorithm" << std::endl
+    << L"     (default: 3840 2160 10)" << std::endl
     << std::endl;
 }
 
 int wmain(int argc, wchar_t *argv[]) {
   if (argc >= 3 && wcscmp(argv[1], L"-s") == 0) {
-    RunAsServer(argv[2]);
+    RunAsServer(argv[2], argc >= 4 ? _wtoi(argv[3]) : 0);
   }
   else if (argc >= 3 && wcscmp(argv[1], L"-q") == 0) {
     Shutdown(argv[2]);
@@ -64,7 +218,7 @@ int wmain(int argc, wchar_t *argv[]) {
     Capture(argv[2], _wtoi(argv[3]), argv[4]);
   }
   else if (argc >= 11 && wcscmp(argv[1], L"-d") == 0) {
-    DiffInput in;
+    DiffInput in = {0};
     in.endpoint1 = argv[2];
     in.endpoint2 = argv[3];
     in.url = argv[4];
@@ -74,21 +228,389 @@ int wmain(int argc, wchar_t *argv[]) {
     in.backFile1 = argv[8];
     in.backFile2 = argv[9];
     in.algo = static_cast<DiffAlgorithm>(_wtoi(argv[10]));
-    in.diffImage = argc >= 12 ? argv[11] : nullptr;
+    UINT metrics = 0;
+    int positional = 0;
+    for (int i = 11; i < argc; ++i) {
+      if (wcscmp(argv[i], L"--phash") == 0) {
+        if (i + 1 >= argc
+            || !ParseThreshold(argv[++i], in.options.prefilter)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--pyramid") == 0) {
+        if (i + 1 >= argc || !ParsePyramid(argv[++i], in.options)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--fail") == 0) {
+        if (i + 1 >= argc
+            || !ParseFailThreshold(argv[++i], in.options.failThreshold)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--sample") == 0) {
+        if (i + 1 >= argc || !ParseSample(argv[++i], in.options)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--align") == 0) {
+        if (i + 1 >= argc) {
+          show_usage();
+          return 1;
+        }
+        in.options.alignMaxOffset = _wtoi(argv[++i]);
+      }
+      else if (wcscmp(argv[i], L"--align-rows") == 0) {
+        if (i + 1 >= argc
+            || !ParseRowEdits(argv[++i], in.options.alignRowEdits)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--mask") == 0) {
+        if (i + 1 >= argc) {
+          show_usage();
+          return 1;
+        }
+        in.mask = argv[++i];
+      }
+      else if (wcscmp(argv[i], L"--masks") == 0) {
+        if (i + 1 >= argc) {
+          show_usage();
+          return 1;
+        }
+        in.options.maskDirectory = argv[++i];
+      }
+      else if (wcscmp(argv[i], L"--changes") == 0) {
+        if (i + 1 >= argc) {
+          show_usage();
+          return 1;
+        }
+        in.changeMask = argv[++i];
+      }
+      else if (wcscmp(argv[i], L"--regions") == 0) {
+        if (i + 1 >= argc) {
+          show_usage();
+          return 1;
+        }
+        in.regionFile = argv[++i];
+      }
+      else if (wcscmp(argv[i], L"--tolerance") == 0) {
+        if (i + 1 >= argc || !ParseLevel(argv[++i], in.changeTolerance)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--histogram") == 0) {
+        if (i + 1 >= argc
+            || !ParseLevel(argv[++i], in.options.histogramTolerance)) {
+          show_usage();
+          return 1;
+        }
+        in.options.histogram = true;
+      }
+      else if (wcscmp(argv[i], L"--bits") == 0) {
+        if (i + 1 >= argc || !ParseBitCount(argv[++i], in.options.bitCount)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--color-space") == 0) {
+        if (i + 1 >= argc || !ParseColorSpace(argv[++i], in.options.ycbcr)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--edges") == 0) {
+        if (i + 1 >= argc) {
+          show_usage();
+          return 1;
+        }
+        in.options.edgeScore = _wtoi(argv[++i]) != 0;
+      }
+      else if (wcscmp(argv[i], L"--baseline") == 0) {
+        if (i + 1 >= argc) {
+          show_usage();
+          return 1;
+        }
+        in.options.baselineDirectory = argv[++i];
+      }
+      else if (wcscmp(argv[i], L"--update-baseline") == 0) {
+        if (i + 1 >= argc
+            || !ParseBaselineUpdate(argv[++i], in.options.baselineUpdate)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--metrics") == 0) {
+        if (i + 1 >= argc || !ParseMetrics(argv[++i], metrics)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--tiles") == 0) {
+        if (i + 1 >= argc) {
+          show_usage();
+          return 1;
+        }
+        in.tileFile = argv[++i];
+      }
+      else if (positional++ == 0) {
+        in.diffImage = *argv[i] ? argv[i] : nullptr;
+      }
+      else {
+        in.cacheFile = argv[i];
+      }
+    }
+    DiffMetricsOutput metricsOut;
     DiffOutput out;
-    if (SUCCEEDED(DiffImage(in, out))) {
+    if (metrics) {
+      if (DiffMetrics(in, metrics, metricsOut) == S_OK) {
+        for (UINT algo = skipDiff; algo <= erosionDiff; ++algo) {
+          if (!(metricsOut.metrics & (1 << algo))) continue;
+
+          const auto &result = metricsOut.results[algo];
+          Log(L"Diff score (algo %u): %f %f %f\n",
+              algo,
+              result.psnr_area_vs_smooth,
+              result.psnr_target_vs_area,
+              result.psnr_target_vs_smooth);
+        }
+      }
+    }
+    else if (DiffImage(in, out) == S_OK) {
       Log(L"Diff score: %f %f %f\n",
           out.psnr_area_vs_smooth,
           out.psnr_target_vs_area,
           out.psnr_target_vs_smooth);
+      if (out.verdict == verdictSame || out.verdict == verdictDifferent) {
+        Log(L"Decided by perceptual hash: %s\n",
+            out.verdict == verdictSame ? L"same" : L"different");
+      }
+      else if (out.verdict != verdictNone) {
+        Log(L"%s after diffing %.1f%% of the frame\n",
+            out.verdict == verdictPassed ? L"Passed" : L"Failed",
+            out.coverage * 100);
+      }
+      if (in.options.sampleTiles
+          && out.verdict != verdictSame
+          && out.verdict != verdictDifferent) {
+        Log(L"Sampled score interval: %f %f%s\n",
+            out.score_at_min_sse,
+            out.score_at_max_sse,
+            out.escalated ? L" (escalated to a full diff)" : L"");
+      }
+      if (out.inserted_rows || out.deleted_rows) {
+        Log(L"Rows inserted: %u, deleted: %u\n",
+            out.inserted_rows,
+            out.deleted_rows);
+      }
+      if (out.offset_x || out.offset_y) {
+        Log(L"Aligned by (%d, %d)\n", out.offset_x, out.offset_y);
+      }
+      if (in.algo == antialiasDiff) {
+        Log(L"Changed pixels: %I64u (%I64u anti-aliased)\n",
+            out.changedPixels,
+            out.antialiasedPixels);
+      }
+      else if (in.changeMask || in.regionFile) {
+        Log(L"Changed pixels: %I64u\n", out.changedPixels);
+      }
+      if (in.regionFile) {
+        Log(L"Changed regions: %u\n", out.changedRegions);
+      }
+      if (in.options.bitCount == 24 || in.options.bitCount == 32) {
+        Log(in.options.ycbcr
+              ? L"Channel PSNR (Y Cb Cr): %f %f %f\n"
+              : L"Channel PSNR (blue green red): %f %f %f\n",
+            out.channel_psnr[0],
+            out.channel_psnr[1],
+            out.channel_psnr[2]);
+      }
+      if (in.options.edgeScore) {
+        Log(L"Edge score: %f\n", out.edge_psnr);
+      }
+      if (in.options.histogram && out.distribution.pixels) {
+        const auto &distribution = out.distribution;
+        Log(L"Absolute differences: p50 %u, p95 %u, p99 %u, max %u\n",
+            distribution.p50,
+            distribution.p95,
+            distribution.p99,
+            distribution.maxAbsDiff);
+        Log(L"Pixels over %u: %I64u of %I64u\n",
+            in.options.histogramTolerance,
+            distribution.overTolerance,
+            distribution.pixels);
+      }
     }
   }
   else if (argc >= 6 && wcscmp(argv[1], L"-batch") == 0) {
-    BatchRun(std::cin, argv[2], argv[3], argv[4], argv[5]);
-    //std::ifstream is("BATCH");
-    //if (is.is_open()) {
-    //  BatchRun(is, argv[2], argv[3], argv[4], argv[5]);
-    //}
+    BatchInput in = {0};
+    in.endpoint1 = argv[2];
+    in.endpoint2 = argv[3];
+    in.backFile1 = argv[4];
+    in.backFile2 = argv[5];
+    in.shardCount = 1;
+    in.algo = erosionDiff;
+    for (int i = 6; i + 1 < argc; i += 2) {
+      if (wcscmp(argv[i], L"--manifest") == 0) {
+        in.manifest = argv[i + 1];
+      }
+      else if (wcscmp(argv[i], L"--cache") == 0) {
+        in.cacheFile = argv[i + 1];
+      }
+      else if (wcscmp(argv[i], L"--algo") == 0) {
+        in.algo = static_cast<DiffAlgorithm>(_wtoi(argv[i + 1]));
+      }
+      else if (wcscmp(argv[i], L"--phash") == 0) {
+        if (!ParseThreshold(argv[i + 1], in.options.prefilter)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--pyramid") == 0) {
+        if (!ParsePyramid(argv[i + 1], in.options)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--fail") == 0) {
+        if (!ParseFailThreshold(argv[i + 1], in.options.failThreshold)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--sample") == 0) {
+        if (!ParseSample(argv[i + 1], in.options)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--align") == 0) {
+        in.options.alignMaxOffset = _wtoi(argv[i + 1]);
+      }
+      else if (wcscmp(argv[i], L"--align-rows") == 0) {
+        if (!ParseRowEdits(argv[i + 1], in.options.alignRowEdits)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--masks") == 0) {
+        in.options.maskDirectory = argv[i + 1];
+      }
+      else if (wcscmp(argv[i], L"--histogram") == 0) {
+        if (!ParseLevel(argv[i + 1], in.options.histogramTolerance)) {
+          show_usage();
+          return 1;
+        }
+        in.options.histogram = true;
+      }
+      else if (wcscmp(argv[i], L"--bits") == 0) {
+        if (!ParseBitCount(argv[i + 1], in.options.bitCount)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--color-space") == 0) {
+        if (!ParseColorSpace(argv[i + 1], in.options.ycbcr)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--edges") == 0) {
+        in.options.edgeScore = _wtoi(argv[i + 1]) != 0;
+      }
+      else if (wcscmp(argv[i], L"--baseline") == 0) {
+        in.options.baselineDirectory = argv[i + 1];
+      }
+      else if (wcscmp(argv[i], L"--update-baseline") == 0) {
+        if (!ParseBaselineUpdate(argv[i + 1], in.options.baselineUpdate)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--group") == 0) {
+        in.groupRadius = _wtoi(argv[i + 1]);
+      }
+      else if (wcscmp(argv[i], L"--worst-tiles") == 0) {
+        in.worstTiles = _wtoi(argv[i + 1]);
+      }
+      else if (wcscmp(argv[i], L"--failure-metrics") == 0) {
+        if (!ParseMetrics(argv[i + 1], in.failureMetrics)) {
+          show_usage();
+          return 1;
+        }
+      }
+      else if (wcscmp(argv[i], L"--shard") == 0) {
+        if (swscanf_s(argv[i + 1], L"%u/%u",
+                      &in.shardIndex, &in.shardCount) != 2
+            || in.shardCount == 0
+            || in.shardIndex >= in.shardCount) {
+          show_usage();
+          return 1;
+        }
+      }
+    }
+    BatchRun(in, std::cin);
+  }
+  else if (argc >= 3 && wcscmp(argv[1], L"-matrix") == 0) {
+    MatrixInput in = {0};
+    in.count = _wtoi(argv[2]);
+    in.shardCount = 1;
+    if (in.count < 2
+        || in.count > MatrixInput::maxEndpoints
+        || static_cast<UINT>(argc) < 3 + 2 * in.count) {
+      show_usage();
+      return 1;
+    }
+    for (UINT i = 0; i < in.count; ++i) {
+      in.endpoints[i] = argv[3 + 2 * i];
+      in.backFiles[i] = argv[4 + 2 * i];
+    }
+    for (int i = 3 + 2 * in.count; i + 1 < argc; i += 2) {
+      if (wcscmp(argv[i], L"--manifest") == 0) {
+        in.manifest = argv[i + 1];
+      }
+      else if (wcscmp(argv[i], L"--shard") == 0) {
+        if (swscanf_s(argv[i + 1], L"%u/%u",
+                      &in.shardIndex, &in.shardCount) != 2
+            || in.shardCount == 0
+            || in.shardIndex >= in.shardCount) {
+          show_usage();
+          return 1;
+        }
+      }
+    }
+    MatrixRun(in, std::cin);
+  }
+  else if (argc >= 5 && wcscmp(argv[1], L"-learn") == 0) {
+    LearnMaskInput in = {0};
+    in.endpoint = argv[2];
+    in.backFile = argv[3];
+    in.maskDirectory = argv[4];
+    in.captures = 5;
+    in.maxStdDev = 1;
+    for (int i = 5; i + 1 < argc; i += 2) {
+      if (wcscmp(argv[i], L"--manifest") == 0) {
+        in.manifest = argv[i + 1];
+      }
+      else if (wcscmp(argv[i], L"--captures") == 0) {
+        in.captures = _wtoi(argv[i + 1]);
+      }
+      else if (wcscmp(argv[i], L"--stddev") == 0) {
+        in.maxStdDev = _wtof(argv[i + 1]);
+      }
+    }
+    LearnMasks(in, std::cin);
+  }
+  else if (argc >= 2 && wcscmp(argv[1], L"-bench") == 0) {
+    BenchmarkDiff(argc >= 3 ? _wtoi(argv[2]) : 3840,
+                  argc >= 4 ? _wtoi(argv[3]) : 2160,
+                  argc >= 5 ? _wtoi(argv[4]) : 10);
   }
   else {
     show_usage();
@@ -0,0 +1,662 @@
+#include <windows.h>
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "blob.h"
+#include "curvecore.h"
+#include "fingerprint.h"
+#include "resample.h"
+#include "align.h"
+
+static const double pi = 3.14159265358979323846;
+
+// Frames smaller than this on either axis are not aligned.
+static const DWORD minSize = 16;
+
+// The crop that refines a coarse offset only has to cover the error of the
+// reduction, so it is smaller than the coarse grid.
+static const DWORD refineSize = 128;
+
+FFTPlan::FFTPlan() : size_(0) {}
+
+bool FFTPlan::Init(DWORD size) {
+  if (size == size_) {
+    return true;
+  }
+  if (size < 2 || (size & (size - 1)) != 0) {
+    return false;
+  }
+
+  DWORD bits = 0;
+  while ((1u << bits) < size) ++bits;
+  reversed_.resize(size);
+  for (DWORD i = 0; i < size; ++i) {
+    DWORD reversed = 0;
+    for (DWORD b = 0; b < bits; ++b) {
+      if (i & (1 << b)) reversed |= 1 << (bits - 1 - b);
+    }
+    reversed_[i] = reversed;
+  }
+  twiddles_.resize(size / 2);
+  for (DWORD i = 0; i < size / 2; ++i) {
+    const double angle = -2 * pi * i / size;
+    twiddles_[i] = {static_cast<float>(cos(angle)),
+                    static_cast<float>(sin(angle))};
+  }
+  size_ = size;
+  return true;
+}
+
+DWORD FFTPlan::Size() const {
+  return size_;
+}
+
+void FFTPlan::Transform(Complex *data, bool inverse) const {
+  for (DWORD i = 0; i < size_; ++i) {
+    const DWORD j = reversed_[i];
+    if (i < j) std::swap(data[i], data[j]);
+  }
+  const float sign = inverse ? -1.0f : 1.0f;
+  for (DWORD half = 1; half < size_; half *= 2) {
+    const DWORD step = size_ / (half * 2);
+    for (DWORD start = 0; start < size_; start += half * 2) {
+      auto even = data + start;
+      auto odd = even + half;
+      for (DWORD k = 0; k < half; ++k) {
+        const auto &w = twiddles_[k * step];
+        const float wIm = w.im * sign;
+        const float re = w.re * odd[k].re - wIm * odd[k].im;
+        const float im = w.re * odd[k].im + wIm * odd[k].re;
+        odd[k] = {even[k].re - re, even[k].im - im};
+        even[k] = {even[k].re + re, even[k].im + im};
+      }
+    }
+  }
+}
+
+// Writes a |width| x |height| block of |source| into |signal|, whose lines
+// are |columns| long, without its mean and tapered by a Hann window so that
+// the edges of the block do not correlate.  The rest of |signal| is zero.
+template<typename T>
+static void LoadSignal(const T *source,
+                       LONG stride,
+                       DWORD width,
+                       DWORD height,
+                       DWORD columns,
+                       std::vector<float> &signal) {
+  double sum = 0;
+  for (DWORD y = 0; y < height; ++y) {
+    const T *line = source + static_cast<LONG_PTR>(y) * stride;
+    for (DWORD x = 0; x < width; ++x) {
+      sum += line[x];
+    }
+  }
+  const float mean = static_cast<float>(sum / (width * height));
+
+  std::vector<float> windowX(width);
+  for (DWORD x = 0; x < width; ++x) {
+    windowX[x] = static_cast<float>(.5 - .5 * cos(2 * pi * x / (width - 1)));
+  }
+  std::fill(signal.begin(), signal.end(), 0.0f);
+  for (DWORD y = 0; y < height; ++y) {
+    const T *line = source + static_cast<LONG_PTR>(y) * stride;
+    const float windowY =
+      static_cast<float>(.5 - .5 * cos(2 * pi * y / (height - 1)));
+    auto out = signal.data() + static_cast<SIZE_T>(y) * columns;
+    for (DWORD x = 0; x < width; ++x) {
+      out[x] = (line[x] - mean) * windowX[x] * windowY;
+    }
+  }
+}
+
+bool PhaseCorrelator::Prepare(DWORD width, DWORD height) {
+  DWORD columns = 2, rows = 2;
+  while (columns < width) columns *= 2;
+  while (rows < height) rows *= 2;
+  if (!rows_.Init(columns) || !columns_.Init(rows)) {
+    return false;
+  }
+  const SIZE_T size = static_cast<SIZE_T>(columns) * rows;
+  spectrum_.resize(size);
+  cross_.resize(size);
+  column_.resize(rows);
+  signal1_.resize(size);
+  signal2_.resize(size);
+  return true;
+}
+
+void PhaseCorrelator::Transform(std::vector<FFTPlan::Complex> &data,
+                                bool inverse) {
+  const DWORD columns = rows_.Size();
+  const DWORD rows = columns_.Size();
+  for (DWORD y = 0; y < rows; ++y) {
+    rows_.Transform(data.data() + static_cast<SIZE_T>(y) * columns, inverse);
+  }
+  for (DWORD x = 0; x < columns; ++x) {
+    for (DWORD y = 0; y < rows; ++y) {
+      column_[y] = data[static_cast<SIZE_T>(y) * columns + x];
+    }
+    columns_.Transform(column_.data(), inverse);
+    for (DWORD y = 0; y < rows; ++y) {
+      data[static_cast<SIZE_T>(y) * columns + x] = column_[y];
+    }
+  }
+}
+
+// Correlates |signal1_| and |signal2_|.  Both are real, so they are packed
+// into one complex signal and transformed together.
+void PhaseCorrelator::Correlate(LONG &dx, LONG &dy, double &peak) {
+  const DWORD columns = rows_.Size();
+  const DWORD rows = columns_.Size();
+  const SIZE_T size = static_cast<SIZE_T>(columns) * rows;
+  for (SIZE_T i = 0; i < size; ++i) {
+    spectrum_[i] = {signal1_[i], signal2_[i]};
+  }
+  Transform(spectrum_, /*inverse*/false);
+
+  // With Z the spectrum of the packed signal and M its value at the
+  // opposite frequency, the spectra of the two signals are
+  // A = (Z + conj(M)) / 2 and B = (Z - conj(M)) / 2i.  The cross-power
+  // spectrum B conj(A) / |B conj(A)| peaks at the offset of signal 2.
+  for (DWORD v = 0; v < rows; ++v) {
+    const DWORD opposite = ((rows - v) & (rows - 1)) * columns;
+    for (DWORD u = 0; u < columns; ++u) {
+      const auto &z = spectrum_[v * columns + u];
+      const auto &m = spectrum_[opposite + ((columns - u) & (columns - 1))];
+      const float aRe = z.re + m.re, aIm = z.im - m.im;
+      const float bRe = z.im + m.im, bIm = m.re - z.re;
+      const float re = bRe * aRe + bIm * aIm;
+      const float im = bIm * aRe - bRe * aIm;
+      const float magnitude = sqrtf(re * re + im * im);
+      cross_[v * columns + u] = magnitude > 1e-6f
+                                ? FFTPlan::Complex{re / magnitude,
+                                                   im / magnitude}
+                                : FFTPlan::Complex{0, 0};
+    }
+  }
+  Transform(cross_, /*inverse*/true);
+
+  // The first of equal peaks wins, so that no offset is preferred on ties.
+  SIZE_T best = 0;
+  for (SIZE_T i = 1; i < size; ++i) {
+    if (cross_[i].re > cross_[best].re) best = i;
+  }
+  const LONG x = static_cast<LONG>(best % columns);
+  const LONG y = static_cast<LONG>(best / columns);
+  dx = x < static_cast<LONG>(columns / 2) ? x : x - static_cast<LONG>(columns);
+  dy = y < static_cast<LONG>(rows / 2) ? y : y - static_cast<LONG>(rows);
+  peak = cross_[best].re / size;
+}
+
+bool PhaseCorrelator::Estimate(const curve::SimpleBitmap &image1,
+                               const curve::SimpleBitmap &image2,
+                               LONG &dx,
+                               LONG &dy,
+                               double &peak) {
+  if (image1.bitCount_ != 8 || image2.bitCount_ != 8
+      || image1.width_ != image2.width_
+      || image1.height_ != image2.height_
+      || image1.width_ < minSize || image1.height_ < minSize) {
+    return false;
+  }
+
+  const DWORD width = image1.width_;
+  const DWORD height = image1.height_;
+  const LONG stride = static_cast<LONG>(image1.GetLineSize());
+  const DWORD factorX = (width + maxSize - 1) / maxSize;
+  const DWORD factorY = (height + maxSize - 1) / maxSize;
+  const DWORD factor = factorX > factorY ? factorX : factorY;
+  if (factor == 1) {
+    if (!Prepare(width, height)) {
+      return false;
+    }
+    LoadSignal(image1.bits_, stride, width, height, rows_.Size(), signal1_);
+    LoadSignal(image2.bits_, stride, width, height, rows_.Size(), signal2_);
+    Correlate(dx, dy, peak);
+    return true;
+  }
+
+  const DWORD reducedWidth = width / factor;
+  const DWORD reducedHeight = height / factor;
+  if (reducedWidth < minSize || reducedHeight < minSize
+      || !resampler_.Init(Resampler::area,
+                          width,
+                          height,
+                          reducedWidth,
+                          reducedHeight)
+      || !Prepare(reducedWidth, reducedHeight)) {
+    return false;
+  }
+  const SIZE_T pixels = static_cast<SIZE_T>(reducedWidth) * reducedHeight;
+  levels1_.resize(pixels);
+  levels2_.resize(pixels);
+  resampler_.Resample(image1.bits_, stride, levels1_.data(), reducedWidth);
+  resampler_.Resample(image2.bits_, stride, levels2_.data(), reducedWidth);
+  LoadSignal(levels1_.data(),
+             static_cast<LONG>(reducedWidth),
+             reducedWidth,
+             reducedHeight,
+             rows_.Size(),
+             signal1_);
+  LoadSignal(levels2_.data(),
+             static_cast<LONG>(reducedWidth),
+             reducedWidth,
+             reducedHeight,
+             rows_.Size(),
+             signal2_);
+  LONG coarseX, coarseY;
+  Correlate(coarseX, coarseY, peak);
+  dx = coarseX * static_cast<LONG>(factor);
+  dy = coarseY * static_cast<LONG>(factor);
+
+  // The coarse offset is only as precise as the reduction, so a crop of
+  // the center of the overlap is correlated again at full resolution.
+  const DWORD absX = dx < 0 ? -dx : dx;
+  const DWORD absY = dy < 0 ? -dy : dy;
+  if (absX + minSize > width || absY + minSize > height) {
+    return true;
+  }
+  const DWORD overlapWidth = width - absX;
+  const DWORD overlapHeight = height - absY;
+  const DWORD cropWidth =
+    overlapWidth < refineSize ? overlapWidth : refineSize;
+  const DWORD cropHeight =
+    overlapHeight < refineSize ? overlapHeight : refineSize;
+  const LONG x1 = (dx < 0 ? -dx : 0) + (overlapWidth - cropWidth) / 2;
+  const LONG y1 = (dy < 0 ? -dy : 0) + (overlapHeight - cropHeight) / 2;
+  if (!Prepare(cropWidth, cropHeight)) {
+    return false;
+  }
+  LoadSignal(image1.bits_ + static_cast<LONG_PTR>(y1) * stride + x1,
+             stride,
+             cropWidth,
+             cropHeight,
+             rows_.Size(),
+             signal1_);
+  LoadSignal(image2.bits_ + static_cast<LONG_PTR>(y1 + dy) * stride + x1 + dx,
+             stride,
+             cropWidth,
+             cropHeight,
+             rows_.Size(),
+             signal2_);
+  LONG fineX, fineY;
+  Correlate(fineX, fineY, peak);
+  dx += fineX;
+  dy += fineY;
+  return true;
+}
+
+bool FrameAligner::Align(UINT maxOffset,
+                         curve::SimpleBitmap &image1,
+                         curve::SimpleBitmap &image2,
+                         LONG &dx,
+                         LONG &dy) {
+  dx = dy = 0;
+  LONG offsetX, offsetY;
+  double peak;
+  if (!correlator_.Estimate(image1, image2, offsetX, offsetY, peak)
+      || (offsetX == 0 && offsetY == 0)) {
+    return true;
+  }
+  const DWORD absX = offsetX < 0 ? -offsetX : offsetX;
+  const DWORD absY = offsetY < 0 ? -offsetY : offsetY;
+  if (absX > maxOffset || absY > maxOffset
+      || absX >= image1.width_ || absY >= image1.height_) {
+    return true;
+  }
+
+  curve::SimpleBitmap overlap1(8,
+                               image1.width_ - absX,
+                               image1.height_ - absY,
+                               nullptr);
+  curve::SimpleBitmap overlap2 = overlap1;
+  const SIZE_T lineSize = overlap1.GetLineSize();
+  const SIZE_T size = lineSize * overlap1.height_;
+  if ((overlap1_.Size() < size && !overlap1_.Alloc(size))
+      || (overlap2_.Size() < size && !overlap2_.Alloc(size))) {
+    return false;
+  }
+
+  const LONG_PTR stride = image1.GetLineSize();
+  LPCBYTE source1 = image1.bits_
+                    + (offsetY < 0 ? -offsetY : 0) * stride
+                    + (offsetX < 0 ? -offsetX : 0);
+  LPCBYTE source2 = image2.bits_
+                    + (offsetY > 0 ? offsetY : 0) * stride
+                    + (offsetX > 0 ? offsetX : 0);
+  for (DWORD y = 0; y < overlap1.height_; ++y) {
+    memcpy(overlap1_.As<BYTE>() + y * lineSize,
+           source1 + y * stride,
+           overlap1.width_);
+    memcpy(overlap2_.As<BYTE>() + y * lineSize,
+           source2 + y * stride,
+           overlap2.width_);
+  }
+  overlap1.bits_ = overlap1_;
+  overlap2.bits_ = overlap2_;
+  image1 = overlap1;
+  image2 = overlap2;
+  dx = offsetX;
+  dy = offsetY;
+  return true;
+}
+
+// Row hashes of a frame, from its fingerprint if it has one.
+static void LoadRowHashes(const curve::SimpleBitmap &image,
+                          std::vector<ULONGLONG> &hashes) {
+  if (image.fingerprint_) {
+    hashes.assign(image.fingerprint_->rowHashes,
+                  image.fingerprint_->rowHashes + image.height_);
+    return;
+  }
+  hashes.resize(image.height_);
+  for (DWORD y = 0; y < image.height_; ++y) {
+    hashes[y] = HashRow(image, y);
+  }
+}
+
+// Finds the runs of equal rows of the shortest edit script between
+// |hashes1_| and |hashes2_| by Myers' algorithm.  The common prefix and
+// suffix are taken first, so the search only covers the rows in between.
+// Returns false if the script has more than |maxEdits| edits.
+bool FrameAligner::MatchRows(DWORD height1, DWORD height2, DWORD maxEdits) {
+  const auto a = hashes1_.data();
+  const auto b = hashes2_.data();
+  runs_.clear();
+  DWORD prefix = 0;
+  while (prefix < height1 && prefix < height2 && a[prefix] == b[prefix]) {
+    ++prefix;
+  }
+  DWORD suffix = 0;
+  while (prefix + suffix < height1 && prefix + suffix < height2
+         && a[height1 - 1 - suffix] == b[height2 - 1 - suffix]) {
+    ++suffix;
+  }
+  if (prefix) {
+    runs_.push_back({0, 0, prefix});
+  }
+
+  // v[k] is the furthest row of |a| reached on diagonal k = x - y.  The
+  // diagonals [-d - 1, d + 1] are saved before every step d to trace the
+  // path back.
+  const auto a0 = a + prefix;
+  const auto b0 = b + prefix;
+  const LONG n = static_cast<LONG>(height1 - prefix - suffix);
+  const LONG m = static_cast<LONG>(height2 - prefix - suffix);
+  const LONG limit = n + m < static_cast<LONG>(maxEdits)
+                     ? n + m : static_cast<LONG>(maxEdits);
+  const LONG offset = limit + 1;
+  std::vector<LONG> v(2 * limit + 3);
+  trace_.clear();
+  LONG edits = -1;
+  for (LONG d = 0; d <= limit && edits < 0; ++d) {
+    trace_.insert(trace_.end(),
+                  v.begin() + offset - d - 1,
+                  v.begin() + offset + d + 2);
+    for (LONG k = -d; k <= d; k += 2) {
+      LONG x = k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1])
+               ? v[offset + k + 1]
+               : v[offset + k - 1] + 1;
+      LONG y = x - k;
+      while (x < n && y < m && a0[x] == b0[y]) {
+        ++x;
+        ++y;
+      }
+      v[offset + k] = x;
+      if (x >= n && y >= m) {
+        edits = d;
+        break;
+      }
+    }
+  }
+  if (edits < 0) {
+    return false;
+  }
+
+  // Each step back is an edit preceded by a run of equal rows, which is
+  // collected from the last to the first.
+  const SIZE_T firstRun = runs_.size();
+  LONG x = n, y = m;
+  for (LONG d = edits; d >= 0; --d) {
+    const LONG *saved = trace_.data() + d * d + 2 * d;
+    const auto furthest = [&](LONG k) { return saved[k + d + 1]; };
+    const LONG k = x - y;
+    const bool down = k == -d || (k != d && furthest(k - 1) < furthest(k + 1));
+    const LONG previousK = down ? k + 1 : k - 1;
+    const LONG previousX = furthest(previousK);
+    const LONG start = down ? previousX : previousX + 1;
+    if (x > start) {
+      runs_.push_back({static_cast<DWORD>(start) + prefix,
+                       static_cast<DWORD>(start - k) + prefix,
+                       static_cast<DWORD>(x - start)});
+    }
+    x = previousX;
+    y = previousX - previousK;
+  }
+  std::reverse(runs_.begin() + firstRun, runs_.end());
+
+  if (suffix) {
+    runs_.push_back({height1 - suffix, height2 - suffix, suffix});
+  }
+  return true;
+}
+
+bool FrameAligner::AlignRows(UINT maxEdits,
+                             curve::SimpleBitmap &image1,
+                             curve::SimpleBitmap &image2,
+                             DWORD &insertedRows,
+                             DWORD &deletedRows) {
+  insertedRows = deletedRows = 0;
+  bands_.clear();
+  if (image1.bitCount_ != image2.bitCount_
+      || image1.width_ != image2.width_
+      || !image1.bits_ || !image2.bits_) {
+    return true;
+  }
+
+  LoadRowHashes(image1, hashes1_);
+  LoadRowHashes(image2, hashes2_);
+  if (maxEdits > curve::DiffOptions::maxAlignRowEdits) {
+    maxEdits = curve::DiffOptions::maxAlignRowEdits;
+  }
+  if (!MatchRows(image1.height_, image2.height_, maxEdits)) {
+    return true;
+  }
+
+  // Rows between two runs are paired from the top, and those left over on
+  // either side are a band.
+  runs_.push_back({image1.height_, image2.height_, 0});
+  DWORD y1 = 0, y2 = 0;
+  for (const auto &run : runs_) {
+    const DWORD gap1 = run.first1 - y1;
+    const DWORD gap2 = run.first2 - y2;
+    const DWORD paired = gap1 < gap2 ? gap1 : gap2;
+    if (gap1 > paired) {
+      bands_.push_back({/*inserted*/false, y1 + paired, gap1 - paired});
+      deletedRows += gap1 - paired;
+    }
+    if (gap2 > paired) {
+      bands_.push_back({/*inserted*/true, y2 + paired, gap2 - paired});
+      insertedRows += gap2 - paired;
+    }
+    y1 = run.first1 + run.count;
+    y2 = run.first2 + run.count;
+  }
+  const DWORD pairedRows = image1.height_ - deletedRows;
+  if (bands_.empty() || pairedRows == 0) {
+    bands_.clear();
+    insertedRows = deletedRows = 0;
+    return true;
+  }
+
+  const SIZE_T lineSize = image1.GetLineSize();
+  const SIZE_T size = lineSize * pairedRows;
+  if ((rows1_.Size() < size && !rows1_.Alloc(size))
+      || (rows2_.Size() < size && !rows2_.Alloc(size))) {
+    return false;
+  }
+  LPBYTE out1 = rows1_;
+  LPBYTE out2 = rows2_;
+  const auto copyRows = [&](DWORD from1, DWORD from2, DWORD count) {
+    memcpy(out1, image1.bits_ + from1 * lineSize, count * lineSize);
+    memcpy(out2, image2.bits_ + from2 * lineSize, count * lineSize);
+    out1 += count * lineSize;
+    out2 += count * lineSize;
+  };
+  y1 = y2 = 0;
+  for (const auto &run : runs_) {
+    const DWORD gap1 = run.first1 - y1;
+    const DWORD gap2 = run.first2 - y2;
+    copyRows(y1, y2, gap1 < gap2 ? gap1 : gap2);
+    copyRows(run.first1, run.first2, run.count);
+    y1 = run.first1 + run.count;
+    y2 = run.first2 + run.count;
+  }
+
+  image1 = curve::SimpleBitmap(image1.bitCount_,
+                               image1.width_,
+                               pairedRows,
+                               rows1_);
+  image2 = curve::SimpleBitmap(image2.bitCount_,
+                               image2.width_,
+                               pairedRows,
+                               rows2_);
+  return true;
+}
+
+const std::vector<FrameAligner::Band> &FrameAligner::Bands() const {
+  return bands_;
+}
+
+void FrameAligner::ClearBands() {
+  bands_.clear();
+}
+
+void Test_PhaseCorrelator() {
+  // Blocks of noise, which is the same in both frames but moved by
+  // (dx, dy) in the second one.
+  const DWORD width = 600, height = 300, lineSize = 600;
+  static BYTE bits1[lineSize * height];
+  static BYTE bits2[lineSize * height];
+  DWORD seed = 1;
+  for (DWORD i = 0; i < sizeof(bits1); ++i) {
+    seed = seed * 1103515245 + 12345;
+    bits1[i] = static_cast<BYTE>(seed >> 16);
+  }
+  const LONG offsets[][2] = {{0, 0}, {3, -2}, {-17, 9}, {1, 0}};
+  for (const auto &offset : offsets) {
+    for (DWORD y = 0; y < height; ++y) {
+      for (DWORD x = 0; x < width; ++x) {
+        const LONG sx = static_cast<LONG>(x) - offset[0];
+        const LONG sy = static_cast<LONG>(y) - offset[1];
+        bits2[y * lineSize + x] =
+          sx >= 0 && sx < static_cast<LONG>(width)
+          && sy >= 0 && sy < static_cast<LONG>(height)
+          ? bits1[sy * lineSize + sx]
+          : 0;
+      }
+    }
+    curve::SimpleBitmap image1(8, width, height, bits1);
+    curve::SimpleBitmap image2(8, width, height, bits2);
+
+    PhaseCorrelator correlator;
+    LONG dx, dy;
+    double peak;
+    assert(correlator.Estimate(image1, image2, dx, dy, peak));
+    assert(dx == offset[0] && dy == offset[1]);
+    assert(peak > .1);
+
+    // The overlap of aligned frames is identical.
+    FrameAligner aligner;
+    assert(aligner.Align(/*maxOffset*/20, image1, image2, dx, dy));
+    assert(dx == offset[0] && dy == offset[1]);
+    assert(image1.width_ == width - (dx < 0 ? -dx : dx));
+    assert(image1.height_ == height - (dy < 0 ? -dy : dy));
+    for (DWORD y = 0; y < image1.height_; ++y) {
+      assert(memcmp(image1.bits_ + y * image1.GetLineSize(),
+                    image2.bits_ + y * image2.GetLineSize(),
+                    image1.width_) == 0);
+    }
+  }
+
+  // An offset beyond the limit leaves the frames as they are.
+  curve::SimpleBitmap image1(8, width, height, bits1);
+  curve::SimpleBitmap image2(8, width, height, bits2);
+  FrameAligner aligner;
+  LONG dx, dy;
+  assert(aligner.Align(/*maxOffset*/0, image1, image2, dx, dy));
+  assert(dx == 0 && dy == 0 && image1.bits_ == bits1);
+}
+
+void Test_AlignRows() {
+  // Rows of distinct values, and a band of 5 new rows inserted at row 10
+  // of the second frame, which pushes the last 5 rows out.
+  const DWORD width = 8, height = 40, lineSize = 8;
+  BYTE bits1[lineSize * height];
+  BYTE bits2[lineSize * height];
+  for (DWORD y = 0; y < height; ++y) {
+    memset(bits1 + y * lineSize, static_cast<int>(y), lineSize);
+    const DWORD source = y < 10 ? y : y < 15 ? 0 : y - 5;
+    memset(bits2 + y * lineSize,
+           y >= 10 && y < 15 ? 0x80 + static_cast<int>(y) : source,
+           lineSize);
+  }
+  // A row changed in place is paired, not a band.
+  bits2[30 * lineSize + 3] = 0xff;
+
+  curve::SimpleBitmap image1(8, width, height, bits1);
+  curve::SimpleBitmap image2(8, width, height, bits2);
+  FrameAligner aligner;
+  DWORD inserted, deleted;
+  assert(aligner.AlignRows(/*maxEdits*/20, image1, image2, inserted, deleted));
+  assert(inserted == 5 && deleted == 5);
+  const auto &bands = aligner.Bands();
+  assert(bands.size() == 2);
+  assert(bands[0].inserted && bands[0].first == 10 && bands[0].count == 5);
+  assert(!bands[1].inserted && bands[1].first == 35 && bands[1].count == 5);
+  assert(image1.height_ == 35 && image2.height_ == 35);
+  for (DWORD y = 0; y < image1.height_; ++y) {
+    assert(memcmp(image1.bits_ + y * lineSize,
+                  image2.bits_ + y * lineSize,
+                  lineSize) == 0 || y == 25);
+  }
+
+  // Frames that need more edits than the limit are left as they are.
+  image1 = curve::SimpleBitmap(8, width, height, bits1);
+  image2 = curve::SimpleBitmap(8, width, height, bits2);
+  assert(aligner.AlignRows(/*maxEdits*/9, image1, image2, inserted, deleted));
+  assert(inserted == 0 && deleted == 0 && image1.bits_ == bits1);
+
+  // Frames whose rows pair up as they are stay as they are.
+  curve::SimpleBitmap same1(8, width, height, bits1);
+  curve::SimpleBitmap same2(8, width, height, bits1);
+  assert(aligner.AlignRows(/*maxEdits*/20, same1, same2, inserted, deleted));
+  assert(inserted == 0 && deleted == 0 && aligner.Bands().empty());
+  assert(same1.bits_ == bits1 && same1.height_ == height);
+
+  // A band of rows inserted at the top of the second frame and another
+  // deleted from the bottom of the first, which together are more edits
+  // than the cap, are not looked for however high the limit.
+  const DWORD band = curve::DiffOptions::maxAlignRowEdits / 2 + 1;
+  const DWORD tall = 2 * band;
+  std::vector<BYTE> tall1(lineSize * tall), tall2(lineSize * tall);
+  for (DWORD y = 0; y < tall; ++y) {
+    const auto row1 = tall1.data() + y * lineSize;
+    const auto row2 = tall2.data() + y * lineSize;
+    row1[0] = static_cast<BYTE>(y);
+    row1[1] = static_cast<BYTE>(y >> 8);
+    row2[0] = static_cast<BYTE>(y - band);
+    row2[1] = static_cast<BYTE>((y - band) >> 8);
+    row2[2] = y < band ? 1 : 0;
+  }
+  curve::SimpleBitmap shifted1(8, width, tall, tall1.data());
+  curve::SimpleBitmap shifted2(8, width, tall, tall2.data());
+  assert(aligner.AlignRows(/*maxEdits*/10 * tall,
+                           shifted1,
+                           shifted2,
+                           inserted,
+                           deleted));
+  assert(inserted == 0 && deleted == 0 && shifted1.bits_ == tall1.data());
+}
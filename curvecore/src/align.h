@@ -0,0 +1,126 @@
+// Radix-2 FFT of one size.  The bit-reversed order and the twiddle factors
+// are computed once by Init and reused for every transform of the size.
+class FFTPlan {
+public:
+  struct Complex {
+    float re;
+    float im;
+  };
+
+private:
+  DWORD size_;
+  std::vector<DWORD> reversed_;
+  std::vector<Complex> twiddles_;
+
+public:
+  FFTPlan();
+  // |size| must be a power of 2.  Keeps the plan if it is of the same size.
+  bool Init(DWORD size);
+  DWORD Size() const;
+  // Transforms |Size()| values in place.  The inverse is not divided by
+  // the size.
+  void Transform(Complex *data, bool inverse) const;
+};
+
+// Estimates the global offset between two frames of the same size by phase
+// correlation.  Both frames are reduced by area to fit in |maxSize| x
+// |maxSize| for a coarse estimate, which a second correlation of a crop of
+// the center at full resolution refines, so the FFT is never larger than
+// |maxSize| on either axis.  The plans and buffers are kept for the next
+// pair of frames.
+class PhaseCorrelator {
+public:
+  static const DWORD maxSize = 256;
+
+private:
+  FFTPlan rows_;
+  FFTPlan columns_;
+  std::vector<FFTPlan::Complex> spectrum_;
+  std::vector<FFTPlan::Complex> cross_;
+  std::vector<FFTPlan::Complex> column_;
+  std::vector<float> signal1_;
+  std::vector<float> signal2_;
+  Resampler resampler_;
+  std::vector<WORD> levels1_;
+  std::vector<WORD> levels2_;
+
+  bool Prepare(DWORD width, DWORD height);
+  void Transform(std::vector<FFTPlan::Complex> &data, bool inverse);
+  void Correlate(LONG &dx, LONG &dy, double &peak);
+
+public:
+  // Sets |dx| and |dy| so that pixel (x, y) of |image1| is seen at
+  // (x + dx, y + dy) of |image2|.  |peak| is the height of the correlation
+  // peak at that offset, up to 1 for frames that only moved.  Returns false
+  // if the frames are not 8bpp frames of the same size, or too small.
+  bool Estimate(const curve::SimpleBitmap &image1,
+                const curve::SimpleBitmap &image2,
+                LONG &dx,
+                LONG &dy,
+                double &peak);
+};
+
+// Aligns two frames before they are diffed.
+class FrameAligner {
+public:
+  // Rows that only one of the frames has.
+  struct Band {
+    bool inserted; // Only in the second frame if true, the first otherwise
+    DWORD first;   // Row in the frame that has it
+    DWORD count;
+  };
+
+private:
+  struct Run {
+    DWORD first1;
+    DWORD first2;
+    DWORD count;
+  };
+
+  PhaseCorrelator correlator_;
+  Blob overlap1_;
+  Blob overlap2_;
+  std::vector<ULONGLONG> hashes1_;
+  std::vector<ULONGLONG> hashes2_;
+  std::vector<LONG> trace_;
+  std::vector<Run> runs_;
+  std::vector<Band> bands_;
+  Blob rows1_;
+  Blob rows2_;
+
+  bool MatchRows(DWORD height1, DWORD height2, DWORD maxEdits);
+
+public:
+  // Replaces |image1| and |image2| with copies of the region they share
+  // when |image2| is offset from |image1| by no more than |maxOffset|
+  // pixels on either axis, and sets the offset.  Frames that are not
+  // offset, or cannot be aligned, are left as they are with an offset of
+  // (0, 0).  Returns false only if the copies could not be allocated.
+  bool Align(UINT maxOffset,
+             curve::SimpleBitmap &image1,
+             curve::SimpleBitmap &image2,
+             LONG &dx,
+             LONG &dy);
+
+  // Matches the rows of two frames of the same width by the shortest
+  // script of inserted and deleted rows between their row hashes, taken
+  // from the fingerprints if the frames have them.  Rows between matches
+  // are paired in order, and the rest make up the bands of Bands().  When
+  // there are bands, |image1| and |image2| are replaced with copies of the
+  // paired rows, which are of the same size.  Frames that need more than
+  // |maxEdits| inserted and deleted rows, or cannot be aligned, are left as
+  // they are.  Returns false only if the copies could not be allocated.
+  //
+  // The script is found in O((height1 + height2) * edits) time, so pages
+  // that mostly match take about as long as hashing them.  Tracing it back
+  // keeps (edits + 1) * (edits + 3) LONGs, so |maxEdits| is capped at
+  // DiffOptions::maxAlignRowEdits, about 16MB.
+  bool AlignRows(UINT maxEdits,
+                 curve::SimpleBitmap &image1,
+                 curve::SimpleBitmap &image2,
+                 DWORD &insertedRows,
+                 DWORD &deletedRows);
+  // Bands of the last AlignRows, in the order of the rows.
+  const std::vector<Band> &Bands() const;
+  void ClearBands();
+};
@@ -0,0 +1,191 @@
+#include <windows.h>
+#include <intrin.h>
+#include <emmintrin.h>
+#include <assert.h>
+#include <iostream>
+#include <vector>
+#include "blob.h"
+#include "curvecore.h"
+#include "tiles.h"
+#include "resample.h"
+#include "parallel.h"
+#include "antialias.h"
+
+static BYTE PixelAt(const Plane &plane, DWORD x, DWORD y) {
+  return plane.bits[static_cast<LONG_PTR>(y) * plane.stride + x];
+}
+
+// True if three or more of the neighbors of a pixel are equal to it.  The
+// edge of the frame counts as one, as the frame is as flat there as the
+// eye can tell.
+static bool HasManySiblings(const Plane &plane, DWORD x, DWORD y) {
+  const DWORD left = x > 0 ? x - 1 : x;
+  const DWORD right = x + 1 < plane.width ? x + 1 : x;
+  const DWORD top = y > 0 ? y - 1 : y;
+  const DWORD bottom = y + 1 < plane.height ? y + 1 : y;
+  int siblings = (x == 0 || x + 1 == plane.width
+                  || y == 0 || y + 1 == plane.height) ? 1 : 0;
+  const BYTE value = PixelAt(plane, x, y);
+  for (DWORD ny = top; ny <= bottom; ++ny) {
+    for (DWORD nx = left; nx <= right; ++nx) {
+      if ((nx != x || ny != y) && PixelAt(plane, nx, ny) == value) {
+        if (++siblings > 2) return true;
+      }
+    }
+  }
+  return false;
+}
+
+// True if a pixel of |plane| is on a gradient between its darkest and
+// brightest neighbors, one of which is flat in both |plane| and |other|.
+static bool IsAntialiased(const Plane &plane,
+                          const Plane &other,
+                          DWORD x,
+                          DWORD y) {
+  const DWORD left = x > 0 ? x - 1 : x;
+  const DWORD right = x + 1 < plane.width ? x + 1 : x;
+  const DWORD top = y > 0 ? y - 1 : y;
+  const DWORD bottom = y + 1 < plane.height ? y + 1 : y;
+  int zeroes = (x == 0 || x + 1 == plane.width
+                || y == 0 || y + 1 == plane.height) ? 1 : 0;
+  const int value = PixelAt(plane, x, y);
+  int darkest = 0, brightest = 0;
+  DWORD darkestX = 0, darkestY = 0, brightestX = 0, brightestY = 0;
+  for (DWORD ny = top; ny <= bottom; ++ny) {
+    for (DWORD nx = left; nx <= right; ++nx) {
+      if (nx == x && ny == y) continue;
+
+      const int delta = PixelAt(plane, nx, ny) - value;
+      if (delta == 0) {
+        // Too many equal neighbors make a flat area, not an edge.
+        if (++zeroes > 2) return false;
+      }
+      else if (delta < darkest) {
+        darkest = delta;
+        darkestX = nx;
+        darkestY = ny;
+      }
+      else if (delta > brightest) {
+        brightest = delta;
+        brightestX = nx;
+        brightestY = ny;
+      }
+    }
+  }
+  if (darkest == 0 || brightest == 0) {
+    return false;
+  }
+  return (HasManySiblings(plane, darkestX, darkestY)
+          && HasManySiblings(other, darkestX, darkestY))
+         || (HasManySiblings(plane, brightestX, brightestY)
+             && HasManySiblings(other, brightestX, brightestY));
+}
+
+bool AntialiasDiff(const curve::SimpleBitmap &image1,
+                   const curve::SimpleBitmap &image2,
+                   AntialiasDiffResult &result,
+                   TileGrid *tiles) {
+  PlanePair pair;
+  if (!pair.Init(image1, image2)
+      || (tiles && !tiles->Reset(image1.width_, image1.height_))) {
+    return false;
+  }
+
+  const auto &plane1 = pair.First();
+  const auto &plane2 = pair.Second();
+  const LONG tileRows =
+    static_cast<LONG>((plane1.height + TileGrid::tileSize - 1)
+                      / TileGrid::tileSize);
+  std::vector<AntialiasDiffResult> rows(tileRows);
+  auto diffTileRow = [&](LONG tileRow) {
+    AntialiasDiffResult row = {};
+    const DWORD top = tileRow * TileGrid::tileSize;
+    const DWORD bottom = top + TileGrid::tileSize < plane1.height
+                         ? top + TileGrid::tileSize : plane1.height;
+    for (DWORD y = top; y < bottom; ++y) {
+      const auto line1 = plane1.bits + static_cast<LONG_PTR>(y) * plane1.stride;
+      const auto line2 = plane2.bits + static_cast<LONG_PTR>(y) * plane2.stride;
+      for (DWORD x = 0; x < plane1.width; x += 16) {
+        // Bits of the differing pixels among the next 16
+        DWORD differing;
+        if (x + 16 <= plane1.width) {
+          const __m128i a =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(line1 + x));
+          const __m128i b =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(line2 + x));
+          differing = ~_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) & 0xffff;
+        }
+        else {
+          differing = 0;
+          for (DWORD i = 0; x + i < plane1.width; ++i) {
+            if (line1[x + i] != line2[x + i]) differing |= 1 << i;
+          }
+        }
+
+        for (; differing; differing &= differing - 1) {
+          DWORD i;
+          _BitScanForward(&i, differing);
+          const DWORD px = x + i;
+          const double diff = static_cast<double>(line2[px]) - line1[px];
+          row.totalSSE += diff * diff;
+          if (IsAntialiased(plane1, plane2, px, y)
+              || IsAntialiased(plane2, plane1, px, y)) {
+            ++row.antialiasedPixels;
+          }
+          else {
+            ++row.realPixels;
+            row.realSSE += diff * diff;
+            if (tiles) {
+              tiles->Add(px, y, diff);
+            }
+          }
+        }
+      }
+    }
+    rows[tileRow] = row;
+  };
+  ParallelFor(tileRows, diffTileRow);
+
+  result = {};
+  for (const auto &row : rows) {
+    result.realSSE += row.realSSE;
+    result.totalSSE += row.totalSSE;
+    result.realPixels += row.realPixels;
+    result.antialiasedPixels += row.antialiasedPixels;
+  }
+  return true;
+}
+
+void Test_AntialiasDiff() {
+  // A dark vertical bar on a white background, whose left edge is drawn
+  // with a different level of gray in the second frame.
+  const DWORD width = 40, height = 12, lineSize = 40;
+  BYTE bits1[lineSize * height];
+  BYTE bits2[lineSize * height];
+  for (DWORD y = 0; y < height; ++y) {
+    for (DWORD x = 0; x < width; ++x) {
+      const BYTE value = x >= 20 && x < 24 ? 0x10 : 0xff;
+      bits1[y * lineSize + x] = bits2[y * lineSize + x] = value;
+    }
+    bits1[y * lineSize + 19] = 0x80;
+    bits2[y * lineSize + 19] = 0xa0;
+  }
+  curve::SimpleBitmap image1(8, width, height, bits1);
+  curve::SimpleBitmap image2(8, width, height, bits2);
+
+  AntialiasDiffResult result;
+  TileGrid tiles;
+  assert(AntialiasDiff(image1, image2, result, &tiles));
+  assert(result.antialiasedPixels == height);
+  assert(result.realPixels == 0 && result.realSSE == 0);
+  assert(result.totalSSE == 32.0 * 32 * height);
+  assert(tiles.At(0, 0).changedPixels == 0);
+
+  // A pixel missing from the middle of the bar is a real difference.
+  bits2[5 * lineSize + 22] = 0xff;
+  assert(AntialiasDiff(image1, image2, result, &tiles));
+  assert(result.realPixels == 1);
+  assert(result.realSSE == 0xef * 0xef);
+  assert(tiles.At(0, 0).changedPixels == 1);
+  assert(tiles.At(0, 0).maxAbsDiff == 0xef);
+}
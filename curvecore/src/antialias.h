@@ -0,0 +1,23 @@
+struct AntialiasDiffResult {
+  double realSSE;  // Squared differences of the pixels that really changed
+  double totalSSE; // Including anti-aliasing
+  ULONGLONG realPixels;
+  ULONGLONG antialiasedPixels;
+};
+
+// Compares two 8bpp frames and tells the differing pixels that look like
+// anti-aliasing apart from the others.  A pixel is anti-aliased if, in
+// either frame, it sits on a gradient between a darker and a brighter
+// neighbor, and that neighbor is inside a flat area of three or more equal
+// siblings in both frames, as the edge of a glyph or a shape is.  Lines
+// are compared 16 pixels at a time to skip the equal ones, and rows of
+// tiles run in parallel.  Frames of different sizes are compared at the
+// size of the smaller one, |image1|, to which the larger one is reduced by
+// area.
+//
+// With |tiles|, which must cover |image1|, they hold the statistics of the
+// real differences only.
+bool AntialiasDiff(const curve::SimpleBitmap &image1,
+                   const curve::SimpleBitmap &image2,
+                   AntialiasDiffResult &result,
+                   TileGrid *tiles);
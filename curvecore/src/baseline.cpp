@@ -0,0 +1,252 @@
+#include <windows.h>
+#include <assert.h>
+#include <fstream>
+#include <string_view>
+#include <vector>
+#include "blob.h"
+#include "filemapping.h"
+#include "curvecore.h"
+#include "fingerprint.h"
+#include "baseline.h"
+
+void Log(LPCWSTR format, ...);
+
+struct BaselineStore::Header {
+  static const DWORD validMagic = 0x314c5342; // 'BSL1'
+
+  DWORD magic;
+  WORD bitCount;
+  WORD reserved;
+  DWORD width;
+  DWORD height;
+  ULONGLONG check; // Hash of the id with another seed than the file name
+};
+
+// Ids are hashed so that any id, such as a URL, makes a valid file name.
+static ULONGLONG HashId(std::string_view id, ULONGLONG seed) {
+  return HashBytes(reinterpret_cast<LPCBYTE>(id.data()), id.size(), seed);
+}
+
+BaselineStore::BaselineStore() {
+  directory_[0] = 0;
+}
+
+bool BaselineStore::Open(LPCWSTR directory) {
+  Unmap();
+  if (!CreateDirectory(directory, /*lpSecurityAttributes*/nullptr)
+      && GetLastError() != ERROR_ALREADY_EXISTS) {
+    Log(L"CreateDirectory(%s) failed - %08x\n", directory, GetLastError());
+    return false;
+  }
+  swprintf_s(directory_, L"%s", directory);
+  return true;
+}
+
+void BaselineStore::GetPath(std::string_view id,
+                            LPWSTR path,
+                            SIZE_T count) const {
+  swprintf_s(path, count, L"%s\\%016I64x.frame", directory_, HashId(id, 0));
+}
+
+void BaselineStore::Unmap() {
+  view_ = FileMapping::View();
+  mapping_ = FileMapping();
+}
+
+BaselineStore::Status BaselineStore::Load(std::string_view id,
+                                          curve::SimpleBitmap &frame) {
+  Unmap();
+  WCHAR path[MAX_PATH];
+  GetPath(id, path, ARRAYSIZE(path));
+  if (GetFileAttributes(path) == INVALID_FILE_ATTRIBUTES) {
+    return absent;
+  }
+
+  ULARGE_INTEGER fileSize;
+  if (!mapping_.CreateReadOnly(path, fileSize)
+      || fileSize.QuadPart < sizeof(Header)) {
+    Log(L"%s is not a baseline.\n", path);
+    Unmap();
+    return unusable;
+  }
+  view_ = mapping_.CreateMappedView(FILE_MAP_READ, /*sizeToMap*/0);
+  const LPBYTE bits = view_;
+  if (!bits) {
+    Unmap();
+    return unusable;
+  }
+
+  // The pixels are sized in 64 bits, before SimpleBitmap computes a line
+  // in a DWORD, so that a broken header cannot wrap around.
+  const auto header = reinterpret_cast<const Header*>(bits);
+  const ULONGLONG size = fileSize.QuadPart - sizeof(Header);
+  const ULONGLONG lineSize =
+    (static_cast<ULONGLONG>(header->width) * header->bitCount + 31) / 32 * 4;
+  if (header->magic != Header::validMagic
+      || header->check != HashId(id, 1)
+      || (header->bitCount != 8
+          && header->bitCount != 24
+          && header->bitCount != 32)
+      || header->width > MAXDWORD / 32
+      || lineSize * header->height > size) {
+    Log(L"%s is not the baseline of the row.\n", path);
+    Unmap();
+    return unusable;
+  }
+  curve::SimpleBitmap stored(header->bitCount,
+                             header->width,
+                             header->height,
+                             bits + sizeof(Header));
+  stored.fingerprint_ =
+    FindFingerprint(stored, static_cast<SIZE_T>(size));
+  frame = stored;
+  return loaded;
+}
+
+bool BaselineStore::Save(std::string_view id,
+                         const curve::SimpleBitmap &frame) {
+  Unmap();
+  const SIZE_T offset = FrameFingerprint::GetOffset(frame);
+  const SIZE_T size =
+    sizeof(Header) + offset + FrameFingerprint::GetSize(frame.height_);
+  if (buffer_.Size() < size && !buffer_.Alloc(size)) {
+    return false;
+  }
+  ZeroMemory(buffer_, size);
+
+  const auto header = buffer_.As<Header>();
+  header->magic = Header::validMagic;
+  header->bitCount = frame.bitCount_;
+  header->width = frame.width_;
+  header->height = frame.height_;
+  header->check = HashId(id, 1);
+  const LPBYTE bits = buffer_ + sizeof(Header);
+  memcpy(bits,
+         frame.bits_,
+         static_cast<SIZE_T>(frame.GetLineSize()) * frame.height_);
+  if (frame.fingerprint_) {
+    memcpy(bits + offset,
+           frame.fingerprint_,
+           FrameFingerprint::GetSize(frame.height_));
+  }
+  else {
+    curve::SimpleBitmap copy = frame;
+    copy.bits_ = bits;
+    std::vector<ULONGLONG> rowHashes(frame.height_);
+    for (DWORD y = 0; y < frame.height_; ++y) {
+      rowHashes[y] = HashRow(copy, y);
+    }
+    WriteFingerprint(copy, rowHashes.data(), bits, size - sizeof(Header));
+  }
+
+  // A reader never sees a file half written, nor loses the old reference
+  // if the write fails.
+  WCHAR path[MAX_PATH], temporary[MAX_PATH];
+  GetPath(id, path, ARRAYSIZE(path));
+  swprintf_s(temporary, L"%s.tmp", path);
+  {
+    std::ofstream os(temporary, std::ios::binary | std::ios::trunc);
+    if (!os.is_open() || !os.write(buffer_.As<char>(), size)) {
+      Log(L"Failed to write %s\n", temporary);
+      return false;
+    }
+  }
+  if (!MoveFileEx(temporary, path, MOVEFILE_REPLACE_EXISTING)) {
+    Log(L"MoveFileEx(%s) failed - %08x\n", path, GetLastError());
+    DeleteFile(temporary);
+    return false;
+  }
+  return true;
+}
+
+// Draws a page of |seed| the way a renderer would, a header bar, lines of
+// glyph-like strokes, and a box whose left edge is at |boxLeft|, so that
+// baselines are tested without a browser.
+static void RenderStandIn(DWORD seed,
+                          DWORD boxLeft,
+                          curve::SimpleBitmap &frame) {
+  const LONG lineSize = frame.GetLineSize();
+  for (DWORD y = 0; y < frame.height_; ++y) {
+    const DWORD top = frame.height_ - 1 - y;
+    const auto line = frame.bits_ + static_cast<LONG_PTR>(y) * lineSize;
+    for (DWORD x = 0; x < frame.width_; ++x) {
+      BYTE level = 0xff;
+      if (top < 12) {
+        level = 0x30;
+      }
+      else if (top % 16 < 9 && ((x + seed) * 2654435761u >> 28) < 5) {
+        level = 0x20;
+      }
+      if (x >= boxLeft && x < boxLeft + 24 && top >= 40 && top < 64) {
+        level = 0x80;
+      }
+      line[x] = level;
+    }
+  }
+}
+
+void Test_BaselineStore() {
+  const DWORD width = 100, height = 80, lineSize = 100;
+  std::vector<BYTE> capture(lineSize * height);
+  curve::SimpleBitmap captured(8, width, height, capture.data());
+  WCHAR temp[MAX_PATH], directory[MAX_PATH];
+  assert(GetTempPath(ARRAYSIZE(temp), temp));
+  swprintf_s(directory, L"%scurve.baseline.%u", temp, GetCurrentProcessId());
+  BaselineStore store;
+  assert(store.Open(directory));
+
+  // A row without a baseline takes its first capture.
+  curve::SimpleBitmap baseline;
+  RenderStandIn(7, 30, captured);
+  assert(store.Load("row0", baseline) == BaselineStore::absent);
+  assert(!baseline.bits_);
+  assert(store.Save("row1", captured));
+
+  // The same page again is identical to its baseline, which is mapped with
+  // its fingerprint.
+  assert(store.Load("row1", baseline) == BaselineStore::loaded);
+  assert(baseline.bitCount_ == 8);
+  assert(baseline.width_ == width && baseline.height_ == height);
+  assert(memcmp(baseline.bits_, capture.data(), capture.size()) == 0);
+  assert(baseline.fingerprint_);
+  assert(baseline.fingerprint_->frameHash == HashFrame(captured));
+
+  // A moved box differs until the baseline is refreshed from the capture,
+  // which replaces the file that is mapped.
+  RenderStandIn(7, 31, captured);
+  assert(store.Load("row1", baseline) == BaselineStore::loaded);
+  assert(memcmp(baseline.bits_, capture.data(), capture.size()) != 0);
+  assert(store.Save("row1", captured));
+  assert(store.Load("row1", baseline) == BaselineStore::loaded);
+  assert(memcmp(baseline.bits_, capture.data(), capture.size()) == 0);
+
+  // A header of the row whose pixels do not fit in the file, even when the
+  // size of a line wraps around in 32 bits, or with a bit count that is not
+  // captured, makes the file unusable rather than absent.
+  WCHAR path[MAX_PATH];
+  store.GetPath("row2", path, ARRAYSIZE(path));
+  const DWORD magic = 0x314c5342; // 'BSL1'
+  const ULONGLONG check = HashId("row2", 1);
+  const DWORD low = static_cast<DWORD>(check);
+  const DWORD high = static_cast<DWORD>(check >> 32);
+  const DWORD headers[][6] = {
+    {magic, 8, 0x40000000, height, low, high},
+    {magic, 7, width, height, low, high},
+    {magic, 8, width, height, low, high},
+  };
+  for (const auto &header : headers) {
+    {
+      std::ofstream os(path, std::ios::binary | std::ios::trunc);
+      os.write(reinterpret_cast<const char*>(header), sizeof(header));
+      os.write(reinterpret_cast<const char*>(capture.data()), lineSize);
+    }
+    assert(store.Load("row2", baseline) == BaselineStore::unusable);
+  }
+
+  // Nothing is mapped after an unusable file, so the files can be deleted.
+  for (const auto id : {"row1", "row2"}) {
+    store.GetPath(id, path, ARRAYSIZE(path));
+    assert(DeleteFile(path));
+  }
+  assert(RemoveDirectory(directory));
+}
@@ -0,0 +1,38 @@
+// Reference frames of a known-good build, one file for each row id in a
+// directory, so that a run captures one endpoint and diffs it against the
+// reference instead of capturing a second browser.  A file holds a header,
+// the pixels as they were captured, and the fingerprint of the frame, in
+// the layout of the section a server captures into, so a frame is mapped
+// and diffed in place and its fingerprint is found as for a live capture.
+class BaselineStore {
+private:
+  struct Header;
+
+  WCHAR directory_[MAX_PATH];
+  FileMapping mapping_;
+  FileMapping::View view_;
+  Blob buffer_;
+
+  void Unmap();
+
+public:
+  enum Status {
+    absent,
+    loaded,
+    unusable, // A file that is not a valid frame for the id
+  };
+
+  BaselineStore();
+
+  // Creates |directory| if it does not exist yet.
+  bool Open(LPCWSTR directory);
+  // Maps the reference frame of |id| into |frame|, which is valid until
+  // the next call of Load or Save.
+  Status Load(std::string_view id, curve::SimpleBitmap &frame);
+  // Saves |frame| as the reference frame of |id|, replacing the old one.
+  // The frame of the last Load is unmapped first, so a capture can replace
+  // the reference it was just diffed against.
+  bool Save(std::string_view id, const curve::SimpleBitmap &frame);
+  // The file of the reference frame of |id|.
+  void GetPath(std::string_view id, LPWSTR path, SIZE_T count) const;
+};
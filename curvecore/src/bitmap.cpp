@@ -3,6 +3,8 @@
 #include <assert.h>
 #include "blob.h"
 #include "bitmap.h"
+#include "curvecore.h"
+#include "fingerprint.h"
 
 void Log(LPCWSTR format, ...);
 
@@ -333,7 +335,9 @@ DIB DIB::CaptureFromHDC(HDC sourceDC,
   return dib;
 }
 
-bool DIB::ConvertToGrayscale(HDC dc, HANDLE section) {
+// If |rowHashes| is given, each converted line is hashed right after it is
+// written, while it is still in the cache.
+bool DIB::ConvertToGrayscale(HDC dc, HANDLE section, Blob *rowHashes) {
   bool ret = false;
   const auto &bi = GetBitmapInfo();
   if (bitmap_
@@ -348,15 +352,22 @@ bool DIB::ConvertToGrayscale(HDC dc, HANDLE section) {
                                height,
                                section,
                                /*initWithGrayscaleTable*/true);
+    if (rowHashes && !rowHashes->Alloc(sizeof(ULONGLONG) * height)) {
+      rowHashes = nullptr;
+    }
     auto bitsSrc = reinterpret_cast<CONST RGBQUAD *>(bits_);
     for (DWORD y = 0; y < height; ++y) {
-      auto bitsDst = reinterpret_cast<LPBYTE>(grayscale.bits_)
-                     + grayscale.lineSizeInBytes_ * y;
+      const auto lineStart = reinterpret_cast<LPBYTE>(grayscale.bits_)
+                             + grayscale.lineSizeInBytes_ * y;
+      auto bitsDst = lineStart;
       for (DWORD x = 0; x < width; ++x) {
         const int c = bitsSrc->rgbRed + bitsSrc->rgbGreen + bitsSrc->rgbBlue;
         *(bitsDst++) = static_cast<BYTE>(c / 3);
         ++bitsSrc;
       }
+      if (rowHashes) {
+        rowHashes->As<ULONGLONG>()[y] = HashBytes(lineStart, width, 0);
+      }
     }
     std::swap(*this, grayscale);
     ret = true;
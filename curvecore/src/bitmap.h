@@ -47,7 +47,7 @@ public:
   LPBYTE GetBits();
   std::ostream &Save(std::ostream &os) const;
   void CopyTo(Blob &blob) const;
-  bool ConvertToGrayscale(HDC dc, HANDLE section);
+  bool ConvertToGrayscale(HDC dc, HANDLE section, Blob *rowHashes);
   LPBYTE At(DWORD x, DWORD y);
   LPCBYTE At(DWORD x, DWORD y) const;
 };
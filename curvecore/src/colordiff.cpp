@@ -0,0 +1,477 @@
+#include <windows.h>
+#include <emmintrin.h>
+#include <assert.h>
+#include <vector>
+#include "blob.h"
+#include "curvecore.h"
+#include "parallel.h"
+#include "colordiff.h"
+
+struct Gray8 {
+  static const DWORD bytesPerPixel = 1;
+  static const DWORD channels = 1;
+};
+
+struct Bgr24 {
+  static const DWORD bytesPerPixel = 3;
+  static const DWORD channels = 3;
+};
+
+struct Bgrx32 {
+  static const DWORD bytesPerPixel = 4;
+  static const DWORD channels = 3;
+};
+
+// Channel sums of a band of lines.  The fourth is the unused byte of BGRX.
+struct ChannelSums {
+  ULONGLONG sse[4];
+  BYTE maxAbsDiff[4];
+};
+
+// A block of 16 pixels is |bytesPerPixel| vectors.  The squares of byte i
+// of a vector go to lane i % 4 of accumulator i / 4 of the vector, so each
+// lane of the 4 * |bytesPerPixel| accumulators sums one byte position of
+// the block, whose channel is that position modulo |bytesPerPixel|.  A lane
+// takes one square per block, which leaves room for lines of up to 66,000
+// blocks before the lanes are reduced at the end of the line.
+template<class Format>
+static void DiffLines(const curve::SimpleBitmap &image1,
+                      const curve::SimpleBitmap &image2,
+                      DWORD top,
+                      DWORD bottom,
+                      ChannelSums &sums) {
+  const DWORD bytesPerPixel = Format::bytesPerPixel;
+  const DWORD blockSize = 16 * bytesPerPixel;
+  const DWORD lineBytes = image1.width_ * bytesPerPixel;
+  const LONG lineSize1 = image1.GetLineSize();
+  const LONG lineSize2 = image2.GetLineSize();
+  const __m128i zero = _mm_setzero_si128();
+  sums = {};
+  for (DWORD y = top; y < bottom; ++y) {
+    const auto line1 = image1.bits_ + static_cast<LONG_PTR>(y) * lineSize1;
+    const auto line2 = image2.bits_ + static_cast<LONG_PTR>(y) * lineSize2;
+    __m128i squares[4 * bytesPerPixel];
+    __m128i maxima[bytesPerPixel];
+    for (DWORD i = 0; i < 4 * bytesPerPixel; ++i) squares[i] = zero;
+    for (DWORD i = 0; i < bytesPerPixel; ++i) maxima[i] = zero;
+
+    DWORD x = 0;
+    for (; x + blockSize <= lineBytes; x += blockSize) {
+      for (DWORD i = 0; i < bytesPerPixel; ++i) {
+        const __m128i a = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(line1 + x + 16 * i));
+        const __m128i b = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(line2 + x + 16 * i));
+        const __m128i d =
+          _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+        maxima[i] = _mm_max_epu8(maxima[i], d);
+        const __m128i lo = _mm_unpacklo_epi8(d, zero);
+        const __m128i hi = _mm_unpackhi_epi8(d, zero);
+        const __m128i squaresLo = _mm_mullo_epi16(lo, lo);
+        const __m128i squaresHi = _mm_mullo_epi16(hi, hi);
+        auto lanes = squares + 4 * i;
+        lanes[0] = _mm_add_epi32(lanes[0],
+                                 _mm_unpacklo_epi16(squaresLo, zero));
+        lanes[1] = _mm_add_epi32(lanes[1],
+                                 _mm_unpackhi_epi16(squaresLo, zero));
+        lanes[2] = _mm_add_epi32(lanes[2],
+                                 _mm_unpacklo_epi16(squaresHi, zero));
+        lanes[3] = _mm_add_epi32(lanes[3],
+                                 _mm_unpackhi_epi16(squaresHi, zero));
+      }
+    }
+
+    DWORD laneSums[4 * 4 * bytesPerPixel];
+    BYTE laneMaxima[16 * bytesPerPixel];
+    for (DWORD i = 0; i < 4 * bytesPerPixel; ++i) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(laneSums + 4 * i),
+                       squares[i]);
+    }
+    for (DWORD i = 0; i < bytesPerPixel; ++i) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(laneMaxima + 16 * i),
+                       maxima[i]);
+    }
+    for (DWORD i = 0; i < blockSize; ++i) {
+      const DWORD channel = i % bytesPerPixel;
+      sums.sse[channel] += laneSums[i];
+      if (laneMaxima[i] > sums.maxAbsDiff[channel]) {
+        sums.maxAbsDiff[channel] = laneMaxima[i];
+      }
+    }
+
+    for (; x < lineBytes; ++x) {
+      const DWORD channel = x % bytesPerPixel;
+      const BYTE d = line1[x] > line2[x]
+                     ? line1[x] - line2[x] : line2[x] - line1[x];
+      sums.sse[channel] += d * d;
+      if (d > sums.maxAbsDiff[channel]) sums.maxAbsDiff[channel] = d;
+    }
+  }
+}
+
+template<class Format>
+static void DiffFrames(const curve::SimpleBitmap &image1,
+                       const curve::SimpleBitmap &image2,
+                       ColorDiffResult &result) {
+  const DWORD bandHeight = 32;
+  const LONG bands =
+    static_cast<LONG>((image1.height_ + bandHeight - 1) / bandHeight);
+  std::vector<ChannelSums> sums(bands);
+  auto diffBand = [&](LONG band) {
+    const DWORD top = band * bandHeight;
+    const DWORD bottom = top + bandHeight < image1.height_
+                         ? top + bandHeight : image1.height_;
+    DiffLines<Format>(image1, image2, top, bottom, sums[band]);
+  };
+  ParallelFor(bands, diffBand);
+
+  result = {};
+  result.channels = Format::channels;
+  for (const auto &band : sums) {
+    for (DWORD channel = 0; channel < Format::channels; ++channel) {
+      result.sse[channel] += band.sse[channel];
+      if (band.maxAbsDiff[channel] > result.maxAbsDiff[channel]) {
+        result.maxAbsDiff[channel] = band.maxAbsDiff[channel];
+      }
+    }
+  }
+}
+
+bool ColorDiff(const curve::SimpleBitmap &image1,
+               const curve::SimpleBitmap &image2,
+               ColorDiffResult &result) {
+  if (image1.bitCount_ != image2.bitCount_
+      || image1.width_ != image2.width_
+      || image1.height_ != image2.height_
+      || image1.width_ == 0 || image1.height_ == 0) {
+    return false;
+  }
+  switch (image1.bitCount_) {
+  case 8:
+    DiffFrames<Gray8>(image1, image2, result);
+    return true;
+  case 24:
+    DiffFrames<Bgr24>(image1, image2, result);
+    return true;
+  case 32:
+    DiffFrames<Bgrx32>(image1, image2, result);
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Weights of BT.601 in 1/256 that add up to 256 for luma and 0 for chroma,
+// in the order of the channels, blue, green, and red.
+static const int lumaWeights[] = {29, 150, 77};
+static const int cbWeights[] = {128, -85, -43};
+static const int crWeights[] = {-21, -107, 128};
+
+static int RoundShift(int value, int bits) {
+  return (value + (1 << (bits - 1))) >> bits;
+}
+
+// Sums of a band of lines.  Cb and Cr of a block are the averages of its
+// pixels, taken as 4 / n times the sum of n pixels over 1024.
+struct YCbCrSums {
+  ULONGLONG lumaSSE;
+  ULONGLONG cbSSE;
+  ULONGLONG crSSE;
+};
+
+// One block of up to 2x2 pixels, starting at |x| of |line1a| and |line2a|,
+// with the next line |line1b| and |line2b| unless |twoLines| is false.
+template<class Format>
+static void DiffBlock(LPCBYTE line1a,
+                      LPCBYTE line2a,
+                      LPCBYTE line1b,
+                      LPCBYTE line2b,
+                      DWORD x,
+                      bool twoColumns,
+                      bool twoLines,
+                      YCbCrSums &sums) {
+  const DWORD bytesPerPixel = Format::bytesPerPixel;
+  int sum[3] = {};
+  int pixels = 0;
+  for (int line = 0; line < (twoLines ? 2 : 1); ++line) {
+    const auto p1 = (line ? line1b : line1a) + x * bytesPerPixel;
+    const auto p2 = (line ? line2b : line2a) + x * bytesPerPixel;
+    for (DWORD i = 0; i < (twoColumns ? 2u : 1u); ++i) {
+      int luma = 0;
+      for (int channel = 0; channel < 3; ++channel) {
+        const int d = p1[i * bytesPerPixel + channel]
+                      - p2[i * bytesPerPixel + channel];
+        luma += lumaWeights[channel] * d;
+        sum[channel] += d;
+      }
+      luma = RoundShift(luma, 8);
+      sums.lumaSSE += luma * luma;
+      ++pixels;
+    }
+  }
+  int cb = 0, cr = 0;
+  for (int channel = 0; channel < 3; ++channel) {
+    cb += cbWeights[channel] * sum[channel] * (4 / pixels);
+    cr += crWeights[channel] * sum[channel] * (4 / pixels);
+  }
+  cb = RoundShift(cb, 10);
+  cr = RoundShift(cr, 10);
+  sums.cbSSE += cb * cb;
+  sums.crSSE += cr * cr;
+}
+
+// Two blocks of 32bpp pixels, the same as DiffBlock of each.  The sums of
+// the weighted channels of a pixel land in two 32-bit lanes, which are
+// added to each other so that both hold the value.  The squares then come
+// out twice, and are halved when the line is done.
+static void DiffBlocks32(LPCBYTE line1a,
+                         LPCBYTE line2a,
+                         LPCBYTE line1b,
+                         LPCBYTE line2b,
+                         DWORD x,
+                         __m128i &luma,
+                         __m128i &chroma) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i lumaWeights16 = _mm_setr_epi16(29, 150, 77, 0,
+                                               29, 150, 77, 0);
+  const __m128i cbWeights16 = _mm_setr_epi16(128, -85, -43, 0,
+                                             128, -85, -43, 0);
+  const __m128i crWeights16 = _mm_setr_epi16(-21, -107, 128, 0,
+                                             -21, -107, 128, 0);
+  const __m128i lumaRound = _mm_set1_epi32(1 << 7);
+  const __m128i chromaRound = _mm_set1_epi32(1 << 9);
+  const LPCBYTE lines1[] = {line1a + x * 4, line1b + x * 4};
+  const LPCBYTE lines2[] = {line2a + x * 4, line2b + x * 4};
+  __m128i sumLo = zero;
+  __m128i sumHi = zero;
+  for (int line = 0; line < 2; ++line) {
+    const __m128i a =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(lines1[line]));
+    const __m128i b =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(lines2[line]));
+    const __m128i dLo = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero),
+                                      _mm_unpacklo_epi8(b, zero));
+    const __m128i dHi = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero),
+                                      _mm_unpackhi_epi8(b, zero));
+    sumLo = _mm_add_epi16(sumLo, dLo);
+    sumHi = _mm_add_epi16(sumHi, dHi);
+
+    __m128i yLo = _mm_madd_epi16(dLo, lumaWeights16);
+    __m128i yHi = _mm_madd_epi16(dHi, lumaWeights16);
+    yLo = _mm_add_epi32(yLo, _mm_shuffle_epi32(yLo, _MM_SHUFFLE(2, 3, 0, 1)));
+    yHi = _mm_add_epi32(yHi, _mm_shuffle_epi32(yHi, _MM_SHUFFLE(2, 3, 0, 1)));
+    yLo = _mm_srai_epi32(_mm_add_epi32(yLo, lumaRound), 8);
+    yHi = _mm_srai_epi32(_mm_add_epi32(yHi, lumaRound), 8);
+    const __m128i y = _mm_packs_epi32(yLo, yHi);
+    luma = _mm_add_epi32(luma, _mm_madd_epi16(y, y));
+  }
+
+  // Adds the two pixels of each block, and moves the second block next to
+  // the first.
+  sumLo = _mm_add_epi16(sumLo, _mm_srli_si128(sumLo, 8));
+  sumHi = _mm_add_epi16(sumHi, _mm_srli_si128(sumHi, 8));
+  const __m128i blocks = _mm_unpacklo_epi64(sumLo, sumHi);
+  __m128i cb = _mm_madd_epi16(blocks, cbWeights16);
+  __m128i cr = _mm_madd_epi16(blocks, crWeights16);
+  cb = _mm_add_epi32(cb, _mm_shuffle_epi32(cb, _MM_SHUFFLE(2, 3, 0, 1)));
+  cr = _mm_add_epi32(cr, _mm_shuffle_epi32(cr, _MM_SHUFFLE(2, 3, 0, 1)));
+  cb = _mm_srai_epi32(_mm_add_epi32(cb, chromaRound), 10);
+  cr = _mm_srai_epi32(_mm_add_epi32(cr, chromaRound), 10);
+  const __m128i c = _mm_packs_epi32(cb, cr);
+  chroma = _mm_add_epi32(chroma, _mm_madd_epi16(c, c));
+}
+
+template<class Format>
+static void DiffYCbCrLines(const curve::SimpleBitmap &image1,
+                           const curve::SimpleBitmap &image2,
+                           DWORD top,
+                           DWORD bottom,
+                           YCbCrSums &sums) {
+  const DWORD width = image1.width_;
+  const LONG lineSize1 = image1.GetLineSize();
+  const LONG lineSize2 = image2.GetLineSize();
+  sums = {};
+  for (DWORD y = top; y < bottom; y += 2) {
+    const bool twoLines = y + 1 < bottom;
+    const auto line1a = image1.bits_ + static_cast<LONG_PTR>(y) * lineSize1;
+    const auto line2a = image2.bits_ + static_cast<LONG_PTR>(y) * lineSize2;
+    const auto line1b = twoLines ? line1a + lineSize1 : line1a;
+    const auto line2b = twoLines ? line2a + lineSize2 : line2a;
+    DWORD x = 0;
+    if (Format::bytesPerPixel == 4 && twoLines) {
+      __m128i luma = _mm_setzero_si128();
+      __m128i chroma = _mm_setzero_si128();
+      for (; x + 4 <= width; x += 4) {
+        DiffBlocks32(line1a, line2a, line1b, line2b, x, luma, chroma);
+      }
+      DWORD lanes[8];
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), luma);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes + 4), chroma);
+      sums.lumaSSE +=
+        (static_cast<ULONGLONG>(lanes[0]) + lanes[1] + lanes[2] + lanes[3])
+        / 2;
+      sums.cbSSE += (static_cast<ULONGLONG>(lanes[4]) + lanes[5]) / 2;
+      sums.crSSE += (static_cast<ULONGLONG>(lanes[6]) + lanes[7]) / 2;
+    }
+    for (; x < width; x += 2) {
+      DiffBlock<Format>(line1a,
+                        line2a,
+                        line1b,
+                        line2b,
+                        x,
+                        /*twoColumns*/x + 1 < width,
+                        twoLines,
+                        sums);
+    }
+  }
+}
+
+template<class Format>
+static void DiffYCbCrFrames(const curve::SimpleBitmap &image1,
+                            const curve::SimpleBitmap &image2,
+                            YCbCrDiffResult &result) {
+  const DWORD bandHeight = 32; // Even, so that blocks stay in a band
+  const LONG bands =
+    static_cast<LONG>((image1.height_ + bandHeight - 1) / bandHeight);
+  std::vector<YCbCrSums> sums(bands);
+  auto diffBand = [&](LONG band) {
+    const DWORD top = band * bandHeight;
+    const DWORD bottom = top + bandHeight < image1.height_
+                         ? top + bandHeight : image1.height_;
+    DiffYCbCrLines<Format>(image1, image2, top, bottom, sums[band]);
+  };
+  ParallelFor(bands, diffBand);
+
+  result = {};
+  for (const auto &band : sums) {
+    result.lumaSSE += band.lumaSSE;
+    result.cbSSE += band.cbSSE;
+    result.crSSE += band.crSSE;
+  }
+  result.lumaSamples =
+    static_cast<ULONGLONG>(image1.width_) * image1.height_;
+  result.chromaSamples =
+    static_cast<ULONGLONG>((image1.width_ + 1) / 2)
+    * ((image1.height_ + 1) / 2);
+}
+
+bool YCbCrDiff(const curve::SimpleBitmap &image1,
+               const curve::SimpleBitmap &image2,
+               YCbCrDiffResult &result) {
+  if (image1.bitCount_ != image2.bitCount_
+      || image1.width_ != image2.width_
+      || image1.height_ != image2.height_
+      || image1.width_ == 0 || image1.height_ == 0) {
+    return false;
+  }
+  switch (image1.bitCount_) {
+  case 24:
+    DiffYCbCrFrames<Bgr24>(image1, image2, result);
+    return true;
+  case 32:
+    DiffYCbCrFrames<Bgrx32>(image1, image2, result);
+    return true;
+  default:
+    return false;
+  }
+}
+
+void Test_ColorDiff() {
+  // 21 pixels make a block of 16 and a tail of 5 in every format.
+  const DWORD width = 21, height = 3;
+  BYTE bits1[width * 4 * height] = {};
+  BYTE bits2[width * 4 * height] = {};
+  ColorDiffResult result;
+
+  // BGRX: the fourth byte is left out.
+  curve::SimpleBitmap image1(32, width, height, bits1);
+  curve::SimpleBitmap image2(32, width, height, bits2);
+  bits2[4 * 3 + 0] = 3;   // Blue of pixel 3
+  bits2[4 * 3 + 3] = 200; // Unused
+  bits2[4 * 20 + 2] = 10; // Red of pixel 20, in the tail
+  bits1[width * 4 * 2 + 4 * 7 + 1] = 0xff; // Green of pixel 7 of line 2
+  assert(ColorDiff(image1, image2, result));
+  assert(result.channels == 3);
+  assert(result.sse[0] == 9 && result.sse[1] == 255 * 255);
+  assert(result.sse[2] == 100);
+  assert(result.maxAbsDiff[0] == 3 && result.maxAbsDiff[1] == 0xff);
+  assert(result.maxAbsDiff[2] == 10);
+
+  // BGR: lines are padded to 64 bytes, and the padding is left out.
+  const DWORD lineSize = 64;
+  ZeroMemory(bits1, sizeof(bits1));
+  ZeroMemory(bits2, sizeof(bits2));
+  image1.bitCount_ = image2.bitCount_ = 24;
+  assert(image1.GetLineSize() == lineSize);
+  bits2[3 * 5 + 2] = 4;   // Red of pixel 5
+  bits2[3 * 16 + 1] = 2;  // Green of pixel 16, in the tail
+  bits2[3 * 21] = 50;     // Padding
+  bits1[lineSize + 3 * 15] = 6; // Blue of pixel 15 of line 1
+  assert(ColorDiff(image1, image2, result));
+  assert(result.sse[0] == 36 && result.sse[1] == 4 && result.sse[2] == 16);
+
+  // Gray takes one channel, and formats must match.
+  image1.bitCount_ = image2.bitCount_ = 8;
+  assert(ColorDiff(image1, image2, result));
+  assert(result.channels == 1);
+  image2.bitCount_ = 32;
+  assert(!ColorDiff(image1, image2, result));
+}
+
+void Test_YCbCrDiff() {
+  // 11x5 pixels make 4 pixels at a time, a tail, and odd edges.
+  const DWORD width = 11, height = 5, lineSize24 = 36;
+  BYTE bits1[width * 4 * height] = {};
+  BYTE bits2[width * 4 * height] = {};
+  curve::SimpleBitmap image1(32, width, height, bits1);
+  curve::SimpleBitmap image2(32, width, height, bits2);
+  YCbCrDiffResult result;
+
+  // A gray change is all luma.
+  for (DWORD i = 0; i < width * height; ++i) {
+    bits2[i * 4] = bits2[i * 4 + 1] = bits2[i * 4 + 2] = 10;
+  }
+  assert(YCbCrDiff(image1, image2, result));
+  assert(result.lumaSamples == 55 && result.chromaSamples == 6 * 3);
+  assert(result.lumaSSE == 55 * 100);
+  assert(result.cbSSE == 0 && result.crSSE == 0);
+
+  // A blue pixel is seen in its block of Cb as a quarter of its change.
+  ZeroMemory(bits2, sizeof(bits2));
+  bits2[(2 * width + 5) * 4] = 200;
+  assert(YCbCrDiff(image1, image2, result));
+  const int luma = (29 * -200 + 128) >> 8;
+  const int cb = (128 * -200 + 512) >> 10;
+  const int cr = (-21 * -200 + 512) >> 10;
+  assert(result.lumaSSE == static_cast<ULONGLONG>(luma * luma));
+  assert(result.cbSSE == static_cast<ULONGLONG>(cb * cb));
+  assert(result.crSSE == static_cast<ULONGLONG>(cr * cr));
+
+  // The 32bpp kernel matches the 24bpp one on the same pixels.
+  BYTE bits3[lineSize24 * height] = {};
+  BYTE bits4[lineSize24 * height] = {};
+  ULONGLONG state = 1;
+  for (DWORD y = 0; y < height; ++y) {
+    for (DWORD x = 0; x < width; ++x) {
+      for (DWORD channel = 0; channel < 3; ++channel) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        const BYTE a = static_cast<BYTE>(state >> 56);
+        const BYTE b = static_cast<BYTE>(state >> 48);
+        bits1[(y * width + x) * 4 + channel] = a;
+        bits2[(y * width + x) * 4 + channel] = b;
+        bits3[y * lineSize24 + x * 3 + channel] = a;
+        bits4[y * lineSize24 + x * 3 + channel] = b;
+      }
+    }
+  }
+  YCbCrDiffResult result24;
+  curve::SimpleBitmap image3(24, width, height, bits3);
+  curve::SimpleBitmap image4(24, width, height, bits4);
+  assert(YCbCrDiff(image1, image2, result));
+  assert(YCbCrDiff(image3, image4, result24));
+  assert(result.lumaSSE == result24.lumaSSE && result.lumaSSE > 0);
+  assert(result.cbSSE == result24.cbSSE && result.crSSE == result24.crSSE);
+
+  image1.bitCount_ = image2.bitCount_ = 8;
+  assert(!YCbCrDiff(image1, image2, result));
+}
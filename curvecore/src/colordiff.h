@@ -0,0 +1,33 @@
+struct ColorDiffResult {
+  DWORD channels; // 1 for 8bpp frames, 3 for 24 and 32bpp ones
+  ULONGLONG sse[3]; // Blue, green, and red, or gray
+  BYTE maxAbsDiff[3];
+};
+
+// Sums the squared differences of each channel of two frames of the same
+// size and format, 8bpp gray, 24bpp BGR, or 32bpp BGRX, whose fourth byte
+// is left out.  The kernel is a template of the format, so the format is
+// chosen once per frame, and 16 pixels are read at a time with SSE2 in
+// blocks of as many bytes as a pixel has, whose lanes always fall on the
+// same channels.  Bands of lines run in parallel.
+bool ColorDiff(const curve::SimpleBitmap &image1,
+               const curve::SimpleBitmap &image2,
+               ColorDiffResult &result);
+
+struct YCbCrDiffResult {
+  ULONGLONG lumaSSE;
+  ULONGLONG cbSSE;
+  ULONGLONG crSSE;
+  ULONGLONG lumaSamples;   // One a pixel
+  ULONGLONG chromaSamples; // One a block of 2x2 pixels, for each of Cb and Cr
+};
+
+// Sums the squared differences of two 24 or 32bpp frames of the same size
+// and format in YCbCr 4:2:0 of BT.601, luma for every pixel and chroma for
+// every block of 2x2 pixels.  The conversion is linear, so the differences
+// of the channels are converted instead of both frames, in the same pass
+// that reads them and without planes in between.  32bpp lines are read 4
+// pixels at a time with SSE2.  Blocks at an odd edge repeat its pixels.
+bool YCbCrDiff(const curve::SimpleBitmap &image1,
+               const curve::SimpleBitmap &image2,
+               YCbCrDiffResult &result);
@@ -6,10 +6,14 @@
 #define DLL_EXPORTIMPORT __declspec(dllimport)
 #endif
 
+struct FrameFingerprint;
+
 namespace curve {
 
+// Frames rendered within |renderCacheTtl| msec are served again without
+// rendering when the same URL and viewport are requested.  0 to disable.
 DLL_EXPORTIMPORT
-void RunAsServer(LPCWSTR endpoint);
+void RunAsServer(LPCWSTR endpoint, DWORD renderCacheTtl = 0);
 
 DLL_EXPORTIMPORT
 HRESULT Navigate(LPCWSTR endpoint,
@@ -36,6 +40,101 @@ enum DiffAlgorithm : unsigned int {
   minDiff,
   triangle,
   erosionDiff,
+  // Structural similarity.  Scores are 1 - SSIM so that 0 still means
+  // identical frames.  Not computed by DiffMetrics, and the sampling,
+  // threshold, and pyramid options do not apply.
+  ssim,
+  msssim,
+  // Differences that do not look like anti-aliasing.  Scores are the PSNR
+  // of those as erosionDiff's are, except psnr_target_vs_smooth, which
+  // includes anti-aliasing.  The same options do not apply as to ssim.
+  antialiasDiff,
+  // Differences of the Sobel gradient magnitudes of 8bpp frames of the same
+  // size, which tell moved borders and boxes from changes of levels.
+  // Scores are the PSNR of the edge maps.  The same options do not apply
+  // as to ssim.
+  edgeDiff,
+};
+
+// Frames whose perceptual hashes differ in fewer than |sameBelow| bits are
+// reported as the same, and in |differentFrom| bits or more as different,
+// without running the diff.  0 disables either verdict.
+struct PerceptualThreshold {
+  UINT sameBelow;
+  UINT differentFrom;
+};
+
+// A row fails when its mean squared error is above that of |minPSNR|, or
+// when more than |maxChangedPixels| pixels differ.  0 disables either limit.
+struct FailThreshold {
+  double minPSNR;
+  ULONGLONG maxChangedPixels;
+};
+
+// What becomes of the baselines when frames are diffed against them.
+enum BaselineUpdate : unsigned int {
+  baselineKeep = 0, // A frame without a baseline fails
+  baselineMissing, // A frame without a baseline becomes its baseline
+  baselineAll, // Every frame replaces its baseline after the diff
+};
+
+// How frames are diffed, shared by DiffImage and BatchRun.
+struct DiffOptions {
+  static const UINT maxAlignRowEdits = 2048;
+
+  PerceptualThreshold prefilter; // Not applied when a diff image is written
+  // 4 or 8 to diff frames of the same size at 1/pyramidFactor resolution
+  // first and revisit only 32x32 tiles whose estimated MSE is above
+  // |pyramidThreshold|.  0 to diff at full resolution.
+  UINT pyramidFactor;
+  double pyramidThreshold;
+  // Judges each row against the threshold, and stops diffing frames of the
+  // same size as soon as they fail.  Takes precedence over the pyramid.
+  FailThreshold failThreshold;
+  // Estimates the score of frames of the same size from |sampleTiles|
+  // 32x32 tiles chosen at random by |sampleSeed|, and diffs them in full
+  // only when the confidence interval straddles |failThreshold|.  Takes
+  // precedence over the threshold alone and the pyramid.  0 to diff all.
+  UINT sampleTiles;
+  UINT sampleSeed;
+  // Estimates the offset between frames of the same size by phase
+  // correlation, and diffs only the region they share when it is within
+  // |alignMaxOffset| pixels on both axes.  Tiles then cover that region.
+  // 0 to disable.
+  UINT alignMaxOffset;
+  // Pairs the rows of frames of the same width by their hashes before
+  // diffing, so that bands of rows inserted into or deleted from a frame
+  // are reported instead of diffed.  Gives up beyond |alignRowEdits|
+  // inserted and deleted rows, at most maxAlignRowEdits.  Applied before
+  // |alignMaxOffset|.  0 to disable.
+  UINT alignRowEdits;
+  // Diffs of a URL without a mask of its own load the mask that LearnMasks
+  // saved here for the URL and viewport, if there is one.  Optional.
+  LPCWSTR maskDirectory;
+  // Fills DiffOutput::distribution from a histogram of the differences of
+  // pixels taken in the same pass as the score, counting the pixels that
+  // differ by more than |histogramTolerance| levels.  Not for ssim and
+  // msssim.
+  bool histogram;
+  BYTE histogramTolerance;
+  // Bits per pixel of the captured frames, 8 (or 0) for gray.  24 or 32
+  // captures the colors, skipping the conversion to gray, and diffs each
+  // channel of frames of the same size whatever the algorithm is.  The
+  // other options and the mask do not apply to colors.
+  WORD bitCount;
+  // Diffs colors in YCbCr 4:2:0, luma for every pixel and chroma for every
+  // block of 2x2 pixels, instead of blue, green, and red.
+  bool ycbcr;
+  // Scores the edges of 8bpp frames of the same size as well, into
+  // DiffOutput::edge_psnr, whatever the algorithm is.  The edges are those
+  // of the frames as captured, before alignment and without the mask.
+  bool edgeScore;
+  // Captures only the first endpoint, and diffs the frame against the one
+  // saved here for the row id, or for the URL and viewport of DiffImage,
+  // instead of a frame of the second endpoint.  The second endpoint and
+  // its backing file are not used.  Optional.
+  LPCWSTR baselineDirectory;
+  BaselineUpdate baselineUpdate;
 };
 
 struct DiffInput {
@@ -49,12 +148,80 @@ struct DiffInput {
   LPCWSTR backFile2;
   DiffAlgorithm algo;
   LPCWSTR diffImage;
+  LPCWSTR cacheFile; // Optional result cache
+  DiffOptions options;
+  // Optional.  Statistics of 32x32 tiles with differences are written here
+  // as tab-separated values, unless the prefilter decided the diff.
+  LPCWSTR tileFile;
+  // Optional.  Regions left out of the diff, as the mask column of a batch
+  // manifest.  See BatchRun.
+  LPCWSTR mask;
+  // Optional.  Pixels that differ by more than |changeTolerance| levels,
+  // except those the mask leaves out, are written here as a 1bpp bitmap
+  // whose changed pixels are black.
+  LPCWSTR changeMask;
+  BYTE changeTolerance;
+  // Optional.  Bounding boxes of the regions of those pixels, touching
+  // each other including diagonally, are written here as tab-separated
+  // values, the largest first.
+  LPCWSTR regionFile;
+};
+
+enum DiffVerdict : unsigned int {
+  verdictNone = 0, // The diff was run
+  verdictSame,
+  verdictDifferent, // Scores are NaN
+  verdictPassed,
+  verdictFailed, // Scores are of the part diffed before the diff stopped
+};
+
+// Absolute differences of the pixels a diff compared.  Pixels of tiles
+// that the pyramid did not refine count as equal, and those after a
+// threshold stopped the diff or outside a sample are not counted.
+struct DiffDistribution {
+  ULONGLONG pixels;
+  ULONGLONG overTolerance;
+  BYTE p50;
+  BYTE p95;
+  BYTE p99;
+  BYTE maxAbsDiff;
 };
 
 struct DiffOutput {
   double psnr_area_vs_smooth;
   double psnr_target_vs_area;
   double psnr_target_vs_smooth;
+  DiffVerdict verdict;
+  double coverage; // Fraction of the frame diffed
+  // Scores at both ends of the 95% confidence interval of the SSE when the
+  // score was estimated from a sample, and whether the frames were diffed
+  // in full because the interval straddled the threshold.
+  double score_at_min_sse;
+  double score_at_max_sse;
+  bool escalated;
+  // Pixels that differ, and those of them that were told apart as
+  // anti-aliasing, for antialiasDiff.  For the other algorithms, pixels set
+  // in the change mask when DiffInput::changeMask or regionFile is given.
+  ULONGLONG changedPixels;
+  ULONGLONG antialiasedPixels;
+  // Regions written to DiffInput::regionFile.
+  DWORD changedRegions;
+  // Offset of the second frame from the first one when they were aligned.
+  LONG offset_x;
+  LONG offset_y;
+  // Rows that only the second or the first frame has when rows were
+  // aligned.
+  DWORD inserted_rows;
+  DWORD deleted_rows;
+  // Filled when DiffOptions::histogram is set.
+  DiffDistribution distribution;
+  // PSNR of blue, green, and red when DiffOptions::bitCount is 24 or 32,
+  // or of Y, Cb, and Cr with DiffOptions::ycbcr.  The scores above are then
+  // the PSNR of the three channels together.
+  double channel_psnr[3];
+  // PSNR of the edge maps as edgeDiff scores them when
+  // DiffOptions::edgeScore is set.
+  double edge_psnr;
 };
 
 struct SimpleBitmap {
@@ -62,22 +229,112 @@ struct SimpleBitmap {
   DWORD width_;
   DWORD height_;
   LPBYTE bits_;
-  SimpleBitmap() : bitCount_(0), width_(0), height_(0), bits_(nullptr) {}
+  const FrameFingerprint *fingerprint_; // Optional
+  SimpleBitmap()
+    : bitCount_(0),
+      width_(0),
+      height_(0),
+      bits_(nullptr),
+      fingerprint_(nullptr) {}
   SimpleBitmap(WORD bitCount, DWORD width, DWORD height, LPBYTE bits)
-    : bitCount_(bitCount), width_(width), height_(height), bits_(bits) {}
+    : bitCount_(bitCount),
+      width_(width),
+      height_(height),
+      bits_(bits),
+      fingerprint_(nullptr) {}
   DWORD GetLineSize() const {
     return static_cast<DWORD>((width_ * bitCount_ + 31) / 32) * 4;
   }
 };
 
+// Returns S_FALSE without diffing when the frame became the baseline of the
+// URL, as DiffOptions::baselineUpdate allows.
 DLL_EXPORTIMPORT
 HRESULT DiffImage(const DiffInput &input, DiffOutput &output);
 
+struct DiffMetricsOutput {
+  UINT metrics; // Algorithms computed, as bits of 1 << DiffAlgorithm
+  DiffOutput results[erosionDiff + 1]; // Indexed by DiffAlgorithm
+};
+
+// Computes every algorithm in |metrics| in one pass over the captured
+// frames.  The algorithm, options other than the baseline, cache, and
+// output files of |input| are not used.
+DLL_EXPORTIMPORT
+HRESULT DiffMetrics(const DiffInput &input,
+                    UINT metrics,
+                    DiffMetricsOutput &output);
+
+struct BatchInput {
+  LPCWSTR endpoint1;
+  LPCWSTR endpoint2;
+  LPCWSTR backFile1;
+  LPCWSTR backFile2;
+  LPCWSTR manifest; // Read from the given stream if nullptr
+  UINT shardIndex;
+  UINT shardCount;  // Rows are assigned to shards by the hash of their id
+  LPCWSTR cacheFile; // Optional result cache
+  DiffOptions options;
+  // Failing rows whose frames are within |groupRadius| bits of each other
+  // by perceptual hash are reported as a group at the end.  0 to disable.
+  UINT groupRadius;
+  UINT worstTiles; // Number of the worst tiles to log for each failing row
+  // Algorithms to compute together for each failing row, as bits of
+  // 1 << DiffAlgorithm.  0 to disable.
+  UINT failureMetrics;
+  DiffAlgorithm algo;
+};
+
+// Reads rows of id, URL, wait, width, height, and an optional mask from
+// the manifest.  A mask is rectangles "x,y,width,height" from the top left
+// of the page separated with ';', or the path of a 1bpp bitmap of the size
+// of the frames whose black pixels are left out.  Rows with a mask skip the
+// prefilter, alignment, sampling, and the pyramid, and fail for algorithms
+// after erosionDiff.  Rows whose frame became their baseline are logged as
+// N> instead of diffed.
+DLL_EXPORTIMPORT
+void BatchRun(const BatchInput &input, std::istream &is);
+
+struct MatrixInput {
+  static const UINT maxEndpoints = 8;
+
+  UINT count; // Endpoints, 2 to maxEndpoints
+  LPCWSTR endpoints[maxEndpoints];
+  LPCWSTR backFiles[maxEndpoints];
+  LPCWSTR manifest; // Read from the given stream if nullptr
+  UINT shardIndex;
+  UINT shardCount;  // Rows are assigned to shards as in BatchRun
+};
+
+// Reads the rows of a manifest as BatchRun does, captures each row once
+// from every endpoint in gray, and logs the PSNR of every pair of frames in
+// one line a row, "X> id" followed by the upper triangle of the matrix row
+// by row: (0, 1), (0, 2), ..., (1, 2), ....  All the pairs are diffed in
+// one pass over the frames.  Pairs with a frame of another size than that
+// of the first endpoint are NaN.  The mask column is not used.
+DLL_EXPORTIMPORT
+void MatrixRun(const MatrixInput &input, std::istream &is);
+
+struct LearnMaskInput {
+  LPCWSTR endpoint;
+  LPCWSTR backFile;
+  LPCWSTR manifest; // Read from the given stream if nullptr
+  LPCWSTR maskDirectory;
+  UINT captures;    // 2 or more
+  double maxStdDev; // In levels of gray
+};
+
+// Captures the URL of each row of the manifest |captures| times from one
+// endpoint, and saves a mask of the pixels whose standard deviation over
+// the captures is above |maxStdDev| to |maskDirectory|, where diffs with
+// DiffOptions::maskDirectory find it.  Frames are accumulated as they are
+// captured, so memory does not grow with |captures|.
+DLL_EXPORTIMPORT
+void LearnMasks(const LearnMaskInput &input, std::istream &is);
+
+// Logs the time each DiffAlgorithm takes on a pair of synthetic frames of
+// |width| x |height| that differ in anti-aliasing and in one block.
 DLL_EXPORTIMPORT
-void BatchRun(std::istream &is,
-              LPCWSTR endpoint1,
-              LPCWSTR endpoint2,
-              LPCWSTR backFile1,
-              LPCWSTR backFile2);
+void BenchmarkDiff(UINT width, UINT height, UINT iterations);
 
 } // namespace curve
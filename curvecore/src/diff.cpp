@@ -2,9 +2,22 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
 #include <fstream>
+#include <limits>
+#include <vector>
 #include "blob.h"
 #include "bitmap.h"
 #include "curvecore.h"
+#include "fingerprint.h"
+#include "tiles.h"
+#include "mask.h"
+#include "pyramid.h"
+#include "resample.h"
+#include "ssim.h"
+#include "antialias.h"
+#include "colordiff.h"
+#include "edges.h"
+#include "matrix.h"
+#include "diff.h"
 
 void Log(LPCWSTR format, ...);
 
@@ -97,11 +110,57 @@ static cv::Mat GenerateRedBlueDiffImage(const cv::Mat &im1, const cv::Mat &im2)
   return im_diff_color;
 }
 
+static const int erosion_size = 2;
+
+static const cv::Mat &GetErosionElement() {
+  static const auto erosion_area =
+    cv::getStructuringElement(cv::MORPH_ELLIPSE,
+                              cv::Size(2 * erosion_size + 1,
+                                       2 * erosion_size + 1),
+                              cv::Point(erosion_size, erosion_size));
+  return erosion_area;
+}
+
+static double SSEToPSNR(double sse, double total) {
+  if (sse <= 1e-10) // for small values return zero
+    return 0;
+  double mse = sse / total;
+  return 10.0 * log10((255 * 255) / mse);
+}
+
+// Scores a comparison of two frames of the same size from its SSE the way
+// each algorithm does.  Resizing to the same size is a copy, so both resized
+// images of triangle are the original one.
+static void ScoreSameSize(curve::DiffAlgorithm algo,
+                          double sse,
+                          double total,
+                          curve::DiffOutput &result) {
+  if (algo == curve::triangle) {
+    result.psnr_area_vs_smooth = 0;
+    result.psnr_target_vs_area
+      = result.psnr_target_vs_smooth
+      = SSEToPSNR(sse, total);
+  }
+  else if (algo == curve::erosionDiff) {
+    result.psnr_area_vs_smooth
+      = result.psnr_target_vs_area
+      = result.psnr_target_vs_smooth
+      = SSEToPSNR(sse, total);
+  }
+  else {
+    result.psnr_area_vs_smooth
+      = result.psnr_target_vs_area
+      = result.psnr_target_vs_smooth
+      = std::sqrt(sse);
+  }
+}
+
 static bool GrayscaleDiffOpenCV(curve::DiffAlgorithm algo,
                                 curve::SimpleBitmap &im_smaller,
                                 curve::SimpleBitmap &im_bigger,
                                 curve::DiffOutput &result,
-                                LPCSTR diffImagePath) {
+                                LPCSTR diffImagePath,
+                                TileGrid *tiles) {
   cv::Mat im1(im_smaller.height_,
               im_smaller.width_,
               CV_8UC1,
@@ -121,24 +180,34 @@ static bool GrayscaleDiffOpenCV(curve::DiffAlgorithm algo,
     result.psnr_area_vs_smooth = getPSNR(im_resize_area, im_resize_linear);
     result.psnr_target_vs_area = getPSNR(im2, im_resize_area);
     result.psnr_target_vs_smooth = getPSNR(im2, im_resize_linear);
+    if (tiles) {
+      tiles->Accumulate(im2.data,
+                        static_cast<LONG>(im2.step),
+                        im_resize_area.data,
+                        static_cast<LONG>(im_resize_area.step),
+                        /*top*/0,
+                        im2.rows);
+    }
     if (diffImagePath) {
       im_diff = GenerateRedBlueDiffImage(im2, im_resize_area);
     }
   }
   else if (algo == curve::erosionDiff) {
-    const int erosion_size = 2;
-    static const auto erosion_area =
-      cv::getStructuringElement(cv::MORPH_ELLIPSE,
-                                cv::Size(2 * erosion_size + 1,
-                                         2 * erosion_size + 1),
-                                cv::Point(erosion_size, erosion_size));
-
     cv::absdiff(im2, im_resize_linear, im_diff);
-    cv::erode(im_diff, im_diff, erosion_area);
+    cv::erode(im_diff, im_diff, GetErosionElement());
     result.psnr_area_vs_smooth
       = result.psnr_target_vs_area
       = result.psnr_target_vs_smooth
       = getPSNR(im_diff);
+    if (tiles) {
+      const cv::Mat zeros = cv::Mat::zeros(1, im_diff.cols, CV_8U);
+      tiles->Accumulate(im_diff.data,
+                        static_cast<LONG>(im_diff.step),
+                        zeros.data,
+                        /*stride2*/0,
+                        /*top*/0,
+                        im_diff.rows);
+    }
   }
 
   if (diffImagePath && im_diff.cols > 0) {
@@ -148,13 +217,85 @@ static bool GrayscaleDiffOpenCV(curve::DiffAlgorithm algo,
   return true;
 }
 
+// Same as GrayscaleDiffOpenCV for two frames of the same size, but reads
+// only the lines whose hashes differ.  An identical line has no difference,
+// and erosion cannot move a difference more than |erosion_size| lines, so
+// lines outside the changed bands contribute nothing.
+static bool GrayscaleDiffChangedRows(curve::DiffAlgorithm algo,
+                                     curve::SimpleBitmap &image1,
+                                     curve::SimpleBitmap &image2,
+                                     curve::DiffOutput &result,
+                                     TileGrid *tiles) {
+  cv::Mat im1(image1.height_,
+              image1.width_,
+              CV_8UC1,
+              image1.bits_,
+              image1.GetLineSize()),
+          im2(image2.height_,
+              image2.width_,
+              CV_8UC1,
+              image2.bits_,
+              image2.GetLineSize()),
+          im_diff;
+  const cv::Mat zeros = cv::Mat::zeros(1, im1.cols, CV_8U);
+
+  const auto rows1 = image1.fingerprint_->rowHashes;
+  const auto rows2 = image2.fingerprint_->rowHashes;
+  const int height = image1.height_;
+  const int margin = algo == curve::erosionDiff ? erosion_size : 0;
+
+  double sse = 0;
+  for (int y = 0; y < height; ++y) {
+    if (rows1[y] == rows2[y]) continue;
+
+    // Bands closer than twice the margin share their context lines.
+    int last = y;
+    for (int i = y + 1; i < height && i - last <= 2 * margin; ++i) {
+      if (rows1[i] != rows2[i]) last = i;
+    }
+
+    const int top = y > margin ? y - margin : 0;
+    const int bottom = last + 1 + margin < height ? last + 1 + margin : height;
+    cv::absdiff(im1.rowRange(top, bottom), im2.rowRange(top, bottom), im_diff);
+    if (algo == curve::erosionDiff) {
+      cv::erode(im_diff, im_diff, GetErosionElement());
+    }
+    sse += cv::norm(im_diff.rowRange(y - top, last + 1 - top), cv::NORM_L2SQR);
+    if (tiles) {
+      tiles->Accumulate(im_diff.ptr(y - top),
+                        static_cast<LONG>(im_diff.step),
+                        zeros.data,
+                        /*stride2*/0,
+                        y,
+                        last + 1);
+    }
+    y = last;
+  }
+
+  ScoreSameSize(algo, sse, static_cast<double>(im1.total()), result);
+  return true;
+}
+
 Blob toString(LPCWSTR wideString);
 
-bool GrayscaleDiff(curve::DiffAlgorithm algo,
-                   curve::SimpleBitmap &image1,
-                   curve::SimpleBitmap &image2,
-                   curve::DiffOutput &result,
-                   LPCWSTR diffImagePath) {
+// Buffers of the diffs run on a thread, kept for its next pair of frames
+// so that a batch or a benchmark does not build them for every frame.
+struct DiffWorkspace {
+  FrameReduction reduction;
+  EdgeDiffer edges;
+};
+
+static DiffWorkspace &GetWorkspace() {
+  static thread_local DiffWorkspace workspace;
+  return workspace;
+}
+
+static bool GrayscaleDiffInternal(curve::DiffAlgorithm algo,
+                                  curve::SimpleBitmap &image1,
+                                  curve::SimpleBitmap &image2,
+                                  curve::DiffOutput &result,
+                                  LPCWSTR diffImagePath,
+                                  TileGrid *tiles) {
   if (image1.bitCount_ != 8 || image2.bitCount_ != 8
       || image1.width_ == 0 || image1.height_ == 0
       || image2.width_ == 0 || image2.height_ == 0) {
@@ -174,60 +315,110 @@ bool GrayscaleDiff(curve::DiffAlgorithm algo,
     return false;
   }
 
-  if (algo == curve::triangle
-      || algo == curve::erosionDiff) {
+  // With fingerprints from the capture path, identical frames and lines of
+  // same-size frames are told by their hashes without reading the pixels.
+  const auto fingerprint1 = image1.fingerprint_;
+  const auto fingerprint2 = image2.fingerprint_;
+  const bool compareRows = fingerprint1
+                           && fingerprint2
+                           && image1.width_ == image2.width_
+                           && image1.height_ == image2.height_
+                           && !diffImagePath;
+  // The OpenCV algorithms compare at the size of the larger frame, and the
+  // native ones at the size of the smaller frame.
+  const bool useOpenCV = algo == curve::triangle
+                         || algo == curve::erosionDiff;
+  if (tiles) {
+    const auto &gridImage = useOpenCV ? image2 : image1;
+    if (!tiles->Reset(gridImage.width_, gridImage.height_)) {
+      return false;
+    }
+  }
+
+  if (compareRows && fingerprint1->frameHash == fingerprint2->frameHash) {
+    result.psnr_area_vs_smooth
+      = result.psnr_target_vs_area
+      = result.psnr_target_vs_smooth = 0;
+    return true;
+  }
+
+  if (algo == curve::ssim || algo == curve::msssim) {
+    double similarity;
+    if (!(algo == curve::ssim
+          ? StructuralSimilarity(image1, image2, similarity, tiles)
+          : MultiScaleSimilarity(image1, image2, similarity, tiles))) {
+      return false;
+    }
+    result.psnr_area_vs_smooth
+      = result.psnr_target_vs_area
+      = result.psnr_target_vs_smooth = 1 - similarity;
+    return true;
+  }
+
+  if (algo == curve::antialiasDiff) {
+    AntialiasDiffResult antialias;
+    if (!AntialiasDiff(image1, image2, antialias, tiles)) {
+      return false;
+    }
+    const double total =
+      static_cast<double>(image1.width_) * image1.height_;
+    result.psnr_area_vs_smooth
+      = result.psnr_target_vs_area = SSEToPSNR(antialias.realSSE, total);
+    result.psnr_target_vs_smooth = SSEToPSNR(antialias.totalSSE, total);
+    result.changedPixels =
+      antialias.realPixels + antialias.antialiasedPixels;
+    result.antialiasedPixels = antialias.antialiasedPixels;
+    return true;
+  }
+
+  if (algo == curve::edgeDiff) {
+    double psnr;
+    if (!DiffEdgeFrames(image1, image2, psnr, tiles)) {
+      return false;
+    }
+    result.psnr_area_vs_smooth
+      = result.psnr_target_vs_area
+      = result.psnr_target_vs_smooth = psnr;
+    return true;
+  }
+
+  if (compareRows && useOpenCV) {
+    return GrayscaleDiffChangedRows(algo, image1, image2, result, tiles);
+  }
+
+  if (useOpenCV) {
     auto path_ascii = toString(diffImagePath);
     return GrayscaleDiffOpenCV(algo,
                                image1,
                                image2,
                                result,
-                               path_ascii.As<char>());
+                               path_ascii.As<char>(),
+                               tiles);
   }
 
   const auto lineSize1 = image1.GetLineSize();
-  const auto lineSize2 = image2.GetLineSize();
 
   DIB diffBitmap;
   if (diffImagePath)
     diffBitmap = CreateRedBlueBitmap(image1.width_, image1.height_);
 
+  auto &reduction = GetWorkspace().reduction;
+  if (!reduction.Build(1 << algo, image1, image2)) {
+    return false;
+  }
+
   double ret = 0;
-  int scaleX = image2.width_ / image1.width_;
-  int scaleY = image2.height_ / image1.height_;
   for (DWORD y = 0; y < image1.height_; ++y) {
-    int y2 = y * scaleY;
+    if (compareRows
+        && fingerprint1->rowHashes[y] == fingerprint2->rowHashes[y]) {
+      continue;
+    }
     for (DWORD x = 0; x < image1.width_; ++x) {
-      double diff = 0;
-      switch (algo) {
-      case curve::averageDiff:
-        for (int i = 0; i < scaleX; ++i) {
-          diff += image2.bits_[y2 * lineSize2 + x * scaleX + i];
-        }
-        diff = diff / scaleX - image1.bits_[y * lineSize1 + x];
-        break;
-      case curve::maxDiff:
-        for (int i = 0; i < scaleX; ++i) {
-          double d = image1.bits_[y * lineSize1 + x]
-                     - image2.bits_[y2 * lineSize2 + x * scaleX + i];
-          if (std::abs(d) > std::abs(diff))
-            diff = d;
-        }
-        break;
-      case curve::minDiff:
-        diff = DBL_MAX;
-        for (int i = 0; i < scaleX; ++i) {
-          double d = image1.bits_[y * lineSize1 + x]
-                     - image2.bits_[y2 * lineSize2 + x * scaleX + i];
-          if (std::abs(d) < std::abs(diff))
-            diff = d;
-        }
-        break;
-      default:
-        diff = image2.bits_[y2 * lineSize2 + x * scaleX]
-               - image1.bits_[y * lineSize1 + x];
-        break;
-      }
+      const double diff = reduction.Diff(algo, x, y);
       ret += (diff * diff);
+      if (tiles) {
+        tiles->Add(x, y, diff);
+      }
 
       if (diffBitmap) {
         diffBitmap.GetBits()[y * lineSize1 + x] =
@@ -249,6 +440,883 @@ bool GrayscaleDiff(curve::DiffAlgorithm algo,
   return true;
 }
 
+bool GrayscaleDiff(curve::DiffAlgorithm algo,
+                   curve::SimpleBitmap &image1,
+                   curve::SimpleBitmap &image2,
+                   curve::DiffOutput &result,
+                   LPCWSTR diffImagePath) {
+  return GrayscaleDiffInternal(algo,
+                               image1,
+                               image2,
+                               result,
+                               diffImagePath,
+                               /*tiles*/nullptr);
+}
+
+bool GrayscaleDiffTiles(curve::DiffAlgorithm algo,
+                        curve::SimpleBitmap &image1,
+                        curve::SimpleBitmap &image2,
+                        curve::DiffOutput &result,
+                        LPCWSTR diffImagePath,
+                        TileGrid &tiles) {
+  return GrayscaleDiffInternal(algo,
+                               image1,
+                               image2,
+                               result,
+                               diffImagePath,
+                               &tiles);
+}
+
+// Diffs one tile of two frames of the same size into |grid| and returns
+// its SSE.  erosionDiff erodes with |erosion_size| lines of context around
+// the tile, as in GrayscaleDiffChangedRows.  The pixels |mask| excludes are
+// left out after the erosion, so they can keep a difference next to them
+// from being eroded, but never add one of their own.
+static ULONGLONG DiffTileAtFullSize(curve::DiffAlgorithm algo,
+                                    const cv::Mat &im1,
+                                    const cv::Mat &im2,
+                                    TileGrid &grid,
+                                    DWORD column,
+                                    DWORD row,
+                                    const DiffMask *mask,
+                                    cv::Mat &im_diff) {
+  if (algo != curve::erosionDiff) {
+    return grid.AccumulateTile(column,
+                               row,
+                               im1.data,
+                               static_cast<LONG>(im1.step),
+                               im2.data,
+                               static_cast<LONG>(im2.step),
+                               mask);
+  }
+
+  const auto coverage =
+    mask ? mask->GetCoverage(column, row) : DiffMask::coverNone;
+  if (coverage == DiffMask::coverFull) {
+    return 0;
+  }
+
+  static const BYTE zeros[TileGrid::tileSize] = {};
+  const int tileSize = TileGrid::tileSize;
+  const int x = column * tileSize;
+  const int y = row * tileSize;
+  const int tileWidth = x + tileSize < im1.cols ? tileSize : im1.cols - x;
+  const int tileHeight = y + tileSize < im1.rows ? tileSize : im1.rows - y;
+  const int left = x > erosion_size ? x - erosion_size : 0;
+  const int top = y > erosion_size ? y - erosion_size : 0;
+  const int right = x + tileWidth + erosion_size < im1.cols
+                    ? x + tileWidth + erosion_size : im1.cols;
+  const int bottom = y + tileHeight + erosion_size < im1.rows
+                     ? y + tileHeight + erosion_size : im1.rows;
+  const cv::Rect context(left, top, right - left, bottom - top);
+  cv::absdiff(im1(context), im2(context), im_diff);
+  cv::erode(im_diff, im_diff, GetErosionElement());
+  ULONGLONG sse = 0;
+  TileGrid::DiffTile(im_diff.ptr(y - top) + (x - left),
+                     static_cast<LONG>(im_diff.step),
+                     zeros,
+                     /*stride2*/0,
+                     tileWidth,
+                     tileHeight,
+                     coverage == DiffMask::coverPartial
+                       ? mask->Line(y) + x / 8 : nullptr,
+                     coverage == DiffMask::coverPartial ? mask->Stride() : 0,
+                     grid.RowHistogram(row),
+                     grid.At(column, row),
+                     sse);
+  return sse;
+}
+
+bool GrayscaleDiffPyramid(curve::DiffAlgorithm algo,
+                          curve::SimpleBitmap &image1,
+                          curve::SimpleBitmap &image2,
+                          curve::DiffOutput &result,
+                          DWORD factor,
+                          double threshold,
+                          TileGrid *tiles) {
+  if (image1.bitCount_ != 8 || image2.bitCount_ != 8
+      || image1.width_ != image2.width_
+      || image1.height_ != image2.height_
+      || image1.width_ < factor || image1.height_ < factor
+      || (image1.fingerprint_
+          && image2.fingerprint_
+          && image1.fingerprint_->frameHash
+             == image2.fingerprint_->frameHash)) {
+    return GrayscaleDiffInternal(algo,
+                                 image1,
+                                 image2,
+                                 result,
+                                 /*diffImagePath*/nullptr,
+                                 tiles);
+  }
+
+  Mipmap mipmap1, mipmap2;
+  TileGrid localTiles;
+  auto &grid = tiles ? *tiles : localTiles;
+  if (!mipmap1.Build(image1, factor)
+      || !mipmap2.Build(image2, factor)
+      || !grid.Reset(image1.width_, image1.height_)
+      || !EstimateTiles(mipmap1, mipmap2, grid)) {
+    return false;
+  }
+
+  const LONG lineSize = image1.GetLineSize();
+  cv::Mat im1(image1.height_, image1.width_, CV_8UC1, image1.bits_, lineSize),
+          im2(image2.height_, image2.width_, CV_8UC1, image2.bits_, lineSize),
+          im_diff;
+  const int tileSize = TileGrid::tileSize;
+  const int width = image1.width_;
+  const int height = image1.height_;
+
+  double sse = 0;
+  for (DWORD row = 0; row < grid.Rows(); ++row) {
+    for (DWORD column = 0; column < grid.Columns(); ++column) {
+      auto &tile = grid.At(column, row);
+      const int x = column * tileSize;
+      const int y = row * tileSize;
+      const int tileWidth = x + tileSize < width ? tileSize : width - x;
+      const int tileHeight = y + tileSize < height ? tileSize : height - y;
+      if (IsCoveredByMipmap(grid, column, row, factor)
+          && tile.sse <= threshold * tileWidth * tileHeight) {
+        sse += tile.sse;
+        continue;
+      }
+
+      tile.sse = 0;
+      sse += DiffTileAtFullSize(algo,
+                                im1,
+                                im2,
+                                grid,
+                                column,
+                                row,
+                                /*mask*/nullptr,
+                                im_diff);
+    }
+  }
+
+  ScoreSameSize(algo, sse, static_cast<double>(im1.total()), result);
+  return true;
+}
+
+// The largest SSE of |pixels| pixels that passes |threshold|.
+static double GetMaxSSE(const curve::FailThreshold &threshold, double pixels) {
+  return threshold.minPSNR > 0
+         ? 255.0 * 255.0 / std::pow(10.0, threshold.minPSNR / 10) * pixels
+         : HUGE_VAL;
+}
+
+static bool IsOverThreshold(const curve::FailThreshold &threshold,
+                            double maxSSE,
+                            double sse,
+                            ULONGLONG changedPixels) {
+  return sse > maxSSE
+         || (threshold.maxChangedPixels
+             && changedPixels > threshold.maxChangedPixels);
+}
+
+bool GrayscaleDiffUntil(curve::DiffAlgorithm algo,
+                        curve::SimpleBitmap &image1,
+                        curve::SimpleBitmap &image2,
+                        const curve::FailThreshold &threshold,
+                        const DiffMask *mask,
+                        curve::DiffOutput &result,
+                        TileGrid *tiles) {
+  TileGrid localTiles;
+  auto &grid = tiles ? *tiles : localTiles;
+  result.coverage = 1;
+  if (mask
+      && (image1.bitCount_ != 8 || image2.bitCount_ != 8
+          || image1.width_ != image2.width_
+          || image1.height_ != image2.height_
+          || mask->Width() != image1.width_
+          || mask->Height() != image1.height_
+          || algo > curve::erosionDiff)) {
+    Log(L"A mask applies to frames of its size diffed by an algorithm up to"
+        L" erosionDiff.\n");
+    return false;
+  }
+  if (image1.bitCount_ != 8 || image2.bitCount_ != 8
+      || image1.width_ != image2.width_
+      || image1.height_ != image2.height_) {
+    // The frames are resampled to a common size, which takes the whole
+    // frame anyway.  Decide from the statistics of all tiles.
+    if (!GrayscaleDiffInternal(algo,
+                               image1,
+                               image2,
+                               result,
+                               /*diffImagePath*/nullptr,
+                               &grid)) {
+      return false;
+    }
+    double sse = 0;
+    ULONGLONG changedPixels = 0;
+    for (DWORD row = 0; row < grid.Rows(); ++row) {
+      for (DWORD column = 0; column < grid.Columns(); ++column) {
+        sse += grid.At(column, row).sse;
+        changedPixels += grid.At(column, row).changedPixels;
+      }
+    }
+    const double pixels = static_cast<double>(grid.Width()) * grid.Height();
+    result.verdict = IsOverThreshold(threshold,
+                                     GetMaxSSE(threshold, pixels),
+                                     sse,
+                                     changedPixels)
+                     ? curve::verdictFailed
+                     : curve::verdictPassed;
+    return true;
+  }
+
+  if (!grid.Reset(image1.width_, image1.height_)) {
+    return false;
+  }
+
+  const auto fingerprint1 = image1.fingerprint_;
+  const auto fingerprint2 = image2.fingerprint_;
+  const bool compareRows = fingerprint1 && fingerprint2;
+  const LONG lineSize = image1.GetLineSize();
+  cv::Mat im1(image1.height_, image1.width_, CV_8UC1, image1.bits_, lineSize),
+          im2(image2.height_, image2.width_, CV_8UC1, image2.bits_, lineSize),
+          im_diff;
+  const double pixels = mask
+                        ? static_cast<double>(mask->IncludedPixels())
+                        : static_cast<double>(im1.total());
+  const double maxSSE = GetMaxSSE(threshold, pixels);
+  const int margin = algo == curve::erosionDiff ? erosion_size : 0;
+  const int height = image1.height_;
+
+  // Pixels of a tile that are diffed, which is all of them without a mask.
+  const auto tilePixels = [&](DWORD column, DWORD row, int lines) {
+    if (mask) {
+      return static_cast<double>(mask->IncludedPixels(column, row));
+    }
+    const DWORD x = column * TileGrid::tileSize;
+    return static_cast<double>(lines)
+           * (x + TileGrid::tileSize < image1.width_
+              ? TileGrid::tileSize : image1.width_ - x);
+  };
+
+  // Tiles are visited band by band so that the lines of a band stay in the
+  // cache.  The SSE and changed pixels seen so far are lower bounds of the
+  // totals, so the row fails as soon as either of them is over the limit.
+  double sse = 0;
+  ULONGLONG changedPixels = 0;
+  double examined = 0;
+  bool failed = false;
+  for (DWORD row = 0; row < grid.Rows() && !failed; ++row) {
+    const int top = row * TileGrid::tileSize;
+    const int bottom = top + TileGrid::tileSize < height
+                       ? top + TileGrid::tileSize : height;
+    if (compareRows) {
+      const int first = top > margin ? top - margin : 0;
+      const int last = bottom + margin < height ? bottom + margin : height;
+      int y = first;
+      while (y < last
+             && fingerprint1->rowHashes[y] == fingerprint2->rowHashes[y]) {
+        ++y;
+      }
+      if (y == last) {
+        for (DWORD column = 0; column < grid.Columns(); ++column) {
+          examined += tilePixels(column, row, bottom - top);
+        }
+        continue;
+      }
+    }
+
+    for (DWORD column = 0; column < grid.Columns(); ++column) {
+      sse += DiffTileAtFullSize(algo,
+                                im1,
+                                im2,
+                                grid,
+                                column,
+                                row,
+                                mask,
+                                im_diff);
+      const auto &tile = grid.At(column, row);
+      changedPixels += tile.changedPixels;
+      examined += tilePixels(column, row, bottom - top);
+      if (IsOverThreshold(threshold, maxSSE, sse, changedPixels)) {
+        failed = true;
+        break;
+      }
+    }
+  }
+
+  // A partial score is of the part that was diffed.
+  ScoreSameSize(algo, sse, examined, result);
+  result.verdict = failed ? curve::verdictFailed : curve::verdictPassed;
+  result.coverage = pixels > 0 ? examined / pixels : 1;
+  return true;
+}
+
+bool GrayscaleDiffMasked(curve::DiffAlgorithm algo,
+                         curve::SimpleBitmap &image1,
+                         curve::SimpleBitmap &image2,
+                         const DiffMask &mask,
+                         curve::DiffOutput &result,
+                         LPCWSTR diffImagePath,
+                         TileGrid *tiles) {
+  // A diff without a limit never stops, and covers the whole frame.
+  const curve::FailThreshold noLimit = {};
+  if (!GrayscaleDiffUntil(algo,
+                          image1,
+                          image2,
+                          noLimit,
+                          &mask,
+                          result,
+                          tiles)) {
+    return false;
+  }
+  result.verdict = curve::verdictNone;
+  result.coverage = 1;
+  if (!diffImagePath) {
+    return true;
+  }
+
+  // The diff image shows the plain difference of the pixels that were
+  // diffed, as the native algorithms write it.
+  DIB diffBitmap = CreateRedBlueBitmap(image1.width_, image1.height_);
+  FrameReduction reduction;
+  if (!diffBitmap || !reduction.Build(0, image1, image2)) {
+    return true;
+  }
+  const auto lineSize = image1.GetLineSize();
+  const auto plainAlgo = algo < curve::triangle ? algo : curve::averageDiff;
+  for (DWORD y = 0; y < image1.height_; ++y) {
+    for (DWORD x = 0; x < image1.width_; ++x) {
+      if (!mask.IsExcluded(x, y)) {
+        diffBitmap.GetBits()[y * lineSize + x] = static_cast<BYTE>(
+          static_cast<char>(reduction.Diff(plainAlgo, x, y)));
+      }
+    }
+  }
+  std::ofstream os(diffImagePath, std::ios::binary);
+  if (os.is_open()) {
+    diffBitmap.Save(os);
+  }
+  return true;
+}
+
+static ULONGLONG NextRandom(ULONGLONG &state) {
+  ULONGLONG x = (state += 0x9e3779b97f4a7c15ull);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+// Running sums of one stratum for the variance of its total.
+struct StratumSums {
+  // Samples that differ from 0 below which the normal approximation does
+  // not hold, as when a change is small enough to be missed by the sample.
+  static const int minChangedSamples = 5;
+
+  double count; // Tiles in the stratum
+  double samples;
+  double changedSamples;
+  double sum;
+  double sumOfSquares;
+
+  void Add(double value) {
+    samples += 1;
+    changedSamples += value > 0;
+    sum += value;
+    sumOfSquares += value * value;
+  }
+  bool IsApproximable() const {
+    return changedSamples >= minChangedSamples || samples >= count;
+  }
+  // Upper bound of the total of a stratum that is not approximable.  The
+  // rule of three bounds the rate of tiles that differ among those not
+  // sampled, each up to |maxValue|.
+  double UpperBound(double maxValue) const {
+    const double rate = samples > 0 ? (changedSamples + 3) / samples : 1;
+    return sum + (count - samples) * (rate < 1 ? rate : 1) * maxValue;
+  }
+  double EstimateTotal() const {
+    return samples > 0 ? sum / samples * count : 0;
+  }
+  // Variance of EstimateTotal() with the finite population correction.
+  double EstimateVariance() const {
+    if (samples < 2 || samples >= count) return 0;
+    const double mean = sum / samples;
+    const double variance =
+      (sumOfSquares - samples * mean * mean) / (samples - 1);
+    return count * count * (1 - samples / count) * variance / samples;
+  }
+};
+
+// Estimate of a total over strata, and the bounds of its 95% confidence
+// interval.  Strata that are not approximable take their sample sum and
+// upper bound instead of their variance.
+struct SampledTotal {
+  double estimate;
+  double variance;
+  double lower;
+  double upper;
+
+  void Add(const StratumSums &stratum, double maxValue) {
+    const double total = stratum.EstimateTotal();
+    estimate += total;
+    if (stratum.IsApproximable()) {
+      variance += stratum.EstimateVariance();
+      lower += total;
+      upper += total;
+    }
+    else {
+      lower += stratum.sum;
+      upper += stratum.UpperBound(maxValue);
+    }
+  }
+  double Min(double z) const {
+    const double margin = z * std::sqrt(variance);
+    return lower > margin ? lower - margin : 0;
+  }
+  double Max(double z) const {
+    return upper + z * std::sqrt(variance);
+  }
+};
+
+bool GrayscaleDiffSampled(curve::DiffAlgorithm algo,
+                          curve::SimpleBitmap &image1,
+                          curve::SimpleBitmap &image2,
+                          UINT sampleTiles,
+                          UINT seed,
+                          const curve::FailThreshold &threshold,
+                          curve::DiffOutput &result,
+                          TileGrid *tiles) {
+  const bool hasThreshold = threshold.minPSNR > 0
+                            || threshold.maxChangedPixels > 0;
+  result.escalated = false;
+  if (image1.bitCount_ != 8 || image2.bitCount_ != 8
+      || image1.width_ != image2.width_
+      || image1.height_ != image2.height_
+      || sampleTiles < 2) {
+    // Frames to be resampled are read whole anyway.
+    const bool succeeded =
+      hasThreshold
+      ? GrayscaleDiffUntil(algo,
+                           image1,
+                           image2,
+                           threshold,
+                           /*mask*/nullptr,
+                           result,
+                           tiles)
+      : GrayscaleDiffInternal(algo,
+                              image1,
+                              image2,
+                              result,
+                              /*diffImagePath*/nullptr,
+                              tiles);
+    result.score_at_min_sse =
+      result.score_at_max_sse = result.psnr_area_vs_smooth;
+    return succeeded;
+  }
+
+  TileGrid localTiles;
+  auto &grid = tiles ? *tiles : localTiles;
+  if (!grid.Reset(image1.width_, image1.height_)) {
+    return false;
+  }
+
+  const LONG lineSize = image1.GetLineSize();
+  cv::Mat im1(image1.height_, image1.width_, CV_8UC1, image1.bits_, lineSize),
+          im2(image2.height_, image2.width_, CV_8UC1, image2.bits_, lineSize),
+          im_diff;
+
+  // Strata are bands of tile rows, each sampled without replacement by
+  // a partial Fisher-Yates shuffle of its tiles.  Two samples at least go
+  // to each stratum for its variance.
+  const DWORD rows = grid.Rows();
+  const DWORD columns = grid.Columns();
+  const DWORD strata = rows < sampleTiles / 2 ? rows : sampleTiles / 2;
+  ULONGLONG state = seed;
+  std::vector<DWORD> candidates;
+  const double tilePixels = TileGrid::tileSize * TileGrid::tileSize;
+  SampledTotal sse = {}, changed = {};
+  double examined = 0;
+  for (DWORD h = 0; h < strata; ++h) {
+    const DWORD firstRow = h * rows / strata;
+    const DWORD endRow = (h + 1) * rows / strata;
+    const DWORD quota = sampleTiles / strata + (h < sampleTiles % strata);
+    candidates.resize((endRow - firstRow) * columns);
+    for (DWORD i = 0; i < candidates.size(); ++i) {
+      candidates[i] = firstRow * columns + i;
+    }
+
+    StratumSums sseSums = {static_cast<double>(candidates.size())};
+    StratumSums changedSums = sseSums;
+    const DWORD count = quota < candidates.size()
+                        ? quota
+                        : static_cast<DWORD>(candidates.size());
+    for (DWORD i = 0; i < count; ++i) {
+      const auto j = i + static_cast<DWORD>(
+        NextRandom(state) % (candidates.size() - i));
+      std::swap(candidates[i], candidates[j]);
+      const DWORD column = candidates[i] % columns;
+      const DWORD row = candidates[i] / columns;
+      sseSums.Add(static_cast<double>(
+        DiffTileAtFullSize(algo, im1, im2, grid, column, row,
+                           /*mask*/nullptr, im_diff)));
+      changedSums.Add(grid.At(column, row).changedPixels);
+
+      const DWORD x = column * TileGrid::tileSize;
+      const DWORD y = row * TileGrid::tileSize;
+      examined +=
+        static_cast<double>(x + TileGrid::tileSize < image1.width_
+                            ? TileGrid::tileSize : image1.width_ - x)
+        * (y + TileGrid::tileSize < image1.height_
+           ? TileGrid::tileSize : image1.height_ - y);
+    }
+    sse.Add(sseSums, 255.0 * 255.0 * tilePixels);
+    changed.Add(changedSums, tilePixels);
+  }
+
+  // 95% confidence intervals by the normal approximation.
+  const double z = 1.96;
+  const double pixels = static_cast<double>(im1.total());
+  const double minSSE = sse.Min(z);
+  const double maxSSE = sse.Max(z);
+
+  curve::DiffOutput bound;
+  ScoreSameSize(algo, minSSE, pixels, bound);
+  result.score_at_min_sse = bound.psnr_area_vs_smooth;
+  ScoreSameSize(algo, maxSSE, pixels, bound);
+  result.score_at_max_sse = bound.psnr_area_vs_smooth;
+  ScoreSameSize(algo, sse.estimate, pixels, result);
+  result.coverage = examined / pixels;
+  result.verdict = curve::verdictNone;
+  if (!hasThreshold) {
+    return true;
+  }
+
+  const double limit = GetMaxSSE(threshold, pixels);
+  const double minChanged = changed.Min(z);
+  const double maxChanged = changed.Max(z);
+  if (IsOverThreshold(threshold,
+                      limit,
+                      minSSE,
+                      static_cast<ULONGLONG>(minChanged))) {
+    result.verdict = curve::verdictFailed;
+  }
+  else if (!IsOverThreshold(threshold,
+                            limit,
+                            maxSSE,
+                            static_cast<ULONGLONG>(std::ceil(maxChanged)))) {
+    result.verdict = curve::verdictPassed;
+  }
+  else {
+    // The interval straddles the threshold.  Keep the interval of the
+    // sample for tuning, and take the score and verdict of a full diff.
+    const auto minScore = result.score_at_min_sse;
+    const auto maxScore = result.score_at_max_sse;
+    if (!GrayscaleDiffUntil(algo,
+                            image1,
+                            image2,
+                            threshold,
+                            /*mask*/nullptr,
+                            result,
+                            tiles)) {
+      return false;
+    }
+    result.score_at_min_sse = minScore;
+    result.score_at_max_sse = maxScore;
+    result.escalated = true;
+  }
+  return true;
+}
+
+bool DiffEdgeFrames(const curve::SimpleBitmap &image1,
+                    const curve::SimpleBitmap &image2,
+                    double &psnr,
+                    TileGrid *tiles) {
+  if (tiles && !tiles->Reset(image1.width_, image1.height_)) {
+    return false;
+  }
+  ULONGLONG sse;
+  if (!GetWorkspace().edges.Diff(image1, image2, sse, tiles)) {
+    Log(L"Edges are diffed between 8bpp frames of the same size.\n");
+    return false;
+  }
+  psnr = SSEToPSNR(static_cast<double>(sse),
+                   static_cast<double>(image1.width_) * image1.height_);
+  return true;
+}
+
+bool GrayscaleDiffMatrix(const curve::SimpleBitmap *frames,
+                         DWORD count,
+                         std::vector<double> &psnr) {
+  std::vector<curve::SimpleBitmap> same;
+  std::vector<DWORD> indices;
+  for (DWORD i = 0; i < count; ++i) {
+    if (frames[i].width_ == frames[0].width_
+        && frames[i].height_ == frames[0].height_) {
+      same.push_back(frames[i]);
+      indices.push_back(i);
+    }
+  }
+  psnr.assign(count * (count - 1) / 2,
+              std::numeric_limits<double>::quiet_NaN());
+  if (same.size() < 2) {
+    return true;
+  }
+
+  std::vector<ULONGLONG> sse;
+  const DWORD sameCount = static_cast<DWORD>(same.size());
+  if (!PairwiseDiff(same.data(), sameCount, sse)) {
+    return false;
+  }
+  const double total =
+    static_cast<double>(frames[0].width_) * frames[0].height_;
+  for (DWORD i = 0; i + 1 < sameCount; ++i) {
+    for (DWORD j = i + 1; j < sameCount; ++j) {
+      psnr[PairIndex(indices[i], indices[j], count)] =
+        SSEToPSNR(static_cast<double>(sse[PairIndex(i, j, sameCount)]),
+                  total);
+    }
+  }
+  return true;
+}
+
+bool DiffColorFrames(const curve::SimpleBitmap &image1,
+                     const curve::SimpleBitmap &image2,
+                     bool ycbcr,
+                     curve::DiffOutput &result) {
+  if (ycbcr) {
+    YCbCrDiffResult yuv;
+    if (!YCbCrDiff(image1, image2, yuv)) {
+      return false;
+    }
+    const double luma = static_cast<double>(yuv.lumaSamples);
+    const double chroma = static_cast<double>(yuv.chromaSamples);
+    result.channel_psnr[0] =
+      SSEToPSNR(static_cast<double>(yuv.lumaSSE), luma);
+    result.channel_psnr[1] = SSEToPSNR(static_cast<double>(yuv.cbSSE), chroma);
+    result.channel_psnr[2] = SSEToPSNR(static_cast<double>(yuv.crSSE), chroma);
+    result.psnr_area_vs_smooth
+      = result.psnr_target_vs_area
+      = result.psnr_target_vs_smooth
+      = SSEToPSNR(static_cast<double>(yuv.lumaSSE + yuv.cbSSE + yuv.crSSE),
+                  luma + 2 * chroma);
+    return true;
+  }
+
+  ColorDiffResult color;
+  if (!ColorDiff(image1, image2, color)) {
+    return false;
+  }
+  const double pixels =
+    static_cast<double>(image1.width_) * image1.height_;
+  double sse = 0;
+  for (DWORD channel = 0; channel < 3; ++channel) {
+    sse += static_cast<double>(color.sse[channel]);
+    result.channel_psnr[channel] =
+      channel < color.channels
+      ? SSEToPSNR(static_cast<double>(color.sse[channel]), pixels)
+      : 0;
+  }
+  result.psnr_area_vs_smooth
+    = result.psnr_target_vs_area
+    = result.psnr_target_vs_smooth = SSEToPSNR(sse, pixels * color.channels);
+  return true;
+}
+
+bool GrayscaleDiffMetrics(UINT metrics,
+                          curve::SimpleBitmap &image1,
+                          curve::SimpleBitmap &image2,
+                          curve::DiffMetricsOutput &output) {
+  if (image1.bitCount_ != 8 || image2.bitCount_ != 8
+      || image1.width_ == 0 || image1.height_ == 0
+      || image2.width_ == 0 || image2.height_ == 0) {
+    return false;
+  }
+
+  if (image1.width_ <= image2.width_
+      && image1.height_ <= image2.height_) {
+    ; // ok
+  }
+  else if (image1.width_ >= image2.width_
+           && image1.height_ >= image2.height_) {
+    std::swap(image1, image2);
+  }
+  else {
+    return false;
+  }
+
+  output.metrics = metrics & ((1 << (curve::erosionDiff + 1)) - 1);
+  for (auto &result : output.results) {
+    result = curve::DiffOutput{};
+    result.coverage = 1;
+  }
+
+  const auto fingerprint1 = image1.fingerprint_;
+  const auto fingerprint2 = image2.fingerprint_;
+  const bool sameSize = image1.width_ == image2.width_
+                        && image1.height_ == image2.height_;
+  const bool compareRows = fingerprint1 && fingerprint2 && sameSize;
+  if (compareRows && fingerprint1->frameHash == fingerprint2->frameHash) {
+    return true;
+  }
+
+  const bool wantsTriangle = (output.metrics & (1 << curve::triangle)) != 0;
+  const bool wantsErosion = (output.metrics & (1 << curve::erosionDiff)) != 0;
+  cv::Mat im1(image1.height_,
+              image1.width_,
+              CV_8UC1,
+              image1.bits_,
+              image1.GetLineSize()),
+          im2(image2.height_,
+              image2.width_,
+              CV_8UC1,
+              image2.bits_,
+              image2.GetLineSize()),
+          im_diff, im_resize_area, im_resize_linear;
+  // Resizing to the same size is a copy, so the frame itself stands for
+  // both resized images.
+  if (sameSize) {
+    im_resize_area = im_resize_linear = im1;
+  }
+  else {
+    if (wantsTriangle || wantsErosion) {
+      cv::resize(im1, im_resize_linear, im2.size(), 0, 0, cv::INTER_LINEAR);
+    }
+    if (wantsTriangle) {
+      cv::resize(im1, im_resize_area, im2.size(), 0, 0, cv::INTER_AREA);
+    }
+  }
+
+  auto &reduction = GetWorkspace().reduction;
+  if (!reduction.Build(output.metrics, image1, image2)) {
+    return false;
+  }
+
+  // Every metric is taken band by band over the larger frame, so each band
+  // of both frames is read from the mapped views once and stays in the
+  // cache while all the metrics use it.  Frames of different sizes are
+  // resized and reduced to blocks up front instead.
+  const int bandHeight = TileGrid::tileSize;
+  const int height = im2.rows;
+  double sse[curve::erosionDiff + 1] = {};
+  double sseAreaVsSmooth = 0, sseTargetVsSmooth = 0;
+  DWORD nextLine = 0;
+  for (int top = 0; top < height; top += bandHeight) {
+    const int bottom = top + bandHeight < height ? top + bandHeight : height;
+    // Lines of the smaller frame whose blocks start in this band
+    const DWORD begin = nextLine;
+    for (; nextLine < image1.height_; ++nextLine) {
+      DWORD first, end;
+      Resampler::GetFootprint(nextLine, height, image1.height_, first, end);
+      if (static_cast<int>(first) >= bottom) break;
+    }
+    const DWORD end = nextLine;
+    if (compareRows) {
+      int y = top;
+      while (y < bottom
+             && fingerprint1->rowHashes[y] == fingerprint2->rowHashes[y]) {
+        ++y;
+      }
+      // Identical lines have no difference even after erosion.
+      if (y == bottom) continue;
+    }
+
+    for (DWORD y = begin; y < end; ++y) {
+      if (compareRows
+          && fingerprint1->rowHashes[y] == fingerprint2->rowHashes[y]) {
+        continue;
+      }
+      for (DWORD x = 0; x < image1.width_; ++x) {
+        for (int algo = curve::skipDiff; algo <= curve::minDiff; ++algo) {
+          if (output.metrics & (1 << algo)) {
+            const double diff =
+              reduction.Diff(static_cast<curve::DiffAlgorithm>(algo), x, y);
+            sse[algo] += diff * diff;
+          }
+        }
+      }
+    }
+
+    const cv::Range band(top, bottom);
+    if (wantsTriangle) {
+      sse[curve::triangle] +=
+        cv::norm(im2.rowRange(band), im_resize_area.rowRange(band),
+                 cv::NORM_L2SQR);
+      if (!sameSize) {
+        sseTargetVsSmooth +=
+          cv::norm(im2.rowRange(band), im_resize_linear.rowRange(band),
+                   cv::NORM_L2SQR);
+        sseAreaVsSmooth +=
+          cv::norm(im_resize_area.rowRange(band),
+                   im_resize_linear.rowRange(band),
+                   cv::NORM_L2SQR);
+      }
+    }
+    if (wantsErosion) {
+      const int contextTop = top > erosion_size ? top - erosion_size : 0;
+      const int contextBottom = bottom + erosion_size < height
+                                ? bottom + erosion_size : height;
+      const cv::Range context(contextTop, contextBottom);
+      cv::absdiff(im2.rowRange(context),
+                  im_resize_linear.rowRange(context),
+                  im_diff);
+      cv::erode(im_diff, im_diff, GetErosionElement());
+      sse[curve::erosionDiff] +=
+        cv::norm(im_diff.rowRange(top - contextTop, bottom - contextTop),
+                 cv::NORM_L2SQR);
+    }
+  }
+
+  for (int algo = curve::skipDiff; algo <= curve::minDiff; ++algo) {
+    auto &result = output.results[algo];
+    result.psnr_area_vs_smooth
+      = result.psnr_target_vs_area
+      = result.psnr_target_vs_smooth = std::sqrt(sse[algo]);
+  }
+  const double total = static_cast<double>(im2.total());
+  auto &triangle = output.results[curve::triangle];
+  triangle.psnr_area_vs_smooth = SSEToPSNR(sseAreaVsSmooth, total);
+  triangle.psnr_target_vs_area = SSEToPSNR(sse[curve::triangle], total);
+  triangle.psnr_target_vs_smooth =
+    SSEToPSNR(sameSize ? sse[curve::triangle] : sseTargetVsSmooth, total);
+  auto &erosion = output.results[curve::erosionDiff];
+  erosion.psnr_area_vs_smooth
+    = erosion.psnr_target_vs_area
+    = erosion.psnr_target_vs_smooth
+    = SSEToPSNR(sse[curve::erosionDiff], total);
+  return true;
+}
+
+void Test_GrayscaleDiffMetrics() {
+  BYTE bits1[40 * 24], bits2[80 * 48];
+  for (DWORD i = 0; i < sizeof(bits1); ++i) {
+    bits1[i] = static_cast<BYTE>(i * 7);
+  }
+  for (DWORD i = 0; i < sizeof(bits2); ++i) {
+    bits2[i] = static_cast<BYTE>(i * 5 + (i % 13 == 0 ? 40 : 0));
+  }
+
+  // Every metric of the bundle matches the one computed alone, for frames
+  // of the same size and of different sizes.
+  const UINT all = (1 << (curve::erosionDiff + 1)) - 1;
+  for (DWORD scale = 1; scale <= 2; ++scale) {
+    curve::SimpleBitmap image1(8, 40, 24, bits1),
+                        image2(8, 40 * scale, 24 * scale, bits2);
+    curve::DiffMetricsOutput bundle;
+    assert(GrayscaleDiffMetrics(all, image1, image2, bundle));
+    assert(bundle.metrics == all);
+    for (int algo = curve::skipDiff; algo <= curve::erosionDiff; ++algo) {
+      curve::DiffOutput output;
+      assert(GrayscaleDiff(static_cast<curve::DiffAlgorithm>(algo),
+                           image1,
+                           image2,
+                           output,
+                           nullptr));
+      const auto &result = bundle.results[algo];
+      assert(is_near(result.psnr_area_vs_smooth, output.psnr_area_vs_smooth));
+      assert(is_near(result.psnr_target_vs_area, output.psnr_target_vs_area));
+      assert(is_near(result.psnr_target_vs_smooth,
+                     output.psnr_target_vs_smooth));
+    }
+  }
+}
+
 void Test_GrayscaleDiff() {
   BYTE bitmap_5x3[] = {
     0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0x00, 0x00, 0x00,
@@ -278,7 +1346,7 @@ void Test_GrayscaleDiff() {
 
   bitmap_10x6[0] = 0xf1;
   assert(GrayscaleDiff(algo, image1, image2, output, nullptr));
-  assert(is_near(output_d, .5));
+  assert(is_near(output_d, .25)); // Average of a 2x2 block
   double d_copy = output_d;
   assert(GrayscaleDiff(algo, image2, image1, output, nullptr));
   assert(output_d == d_copy);
@@ -293,8 +1361,212 @@ void Test_GrayscaleDiff() {
   bitmap_10x6[12 * 4 + 1] = 0xf1;
   bitmap_10x6[12 * 4 + 2] = 0xf3;
   assert(GrayscaleDiff(algo, image1, image2, output, nullptr));
-  assert(is_near(output_d, 1.5811)); // sqrt(0.5^2 + 0.15^2)
+  assert(is_near(output_d, .7906)); // sqrt(0.25^2 + 0.75^2)
   d_copy = output_d;
   assert(GrayscaleDiff(algo, image2, image1, output, nullptr));
   assert(output_d == d_copy);
 }
+
+void Test_GrayscaleDiffSampled() {
+  // 8x8 tiles, of which 8 are sampled, and a change in one of the others.
+  const DWORD size = 8 * TileGrid::tileSize;
+  std::vector<BYTE> bits1(size * size, 0x80), bits2(bits1);
+  curve::SimpleBitmap image1(8, size, size, bits1.data()),
+                      image2(8, size, size, bits2.data());
+  const auto algo = curve::averageDiff;
+  const curve::FailThreshold none = {};
+  curve::DiffOutput output;
+  DWORD tile = 0;
+  for (; tile < 64; ++tile) {
+    bits2.assign(bits2.size(), 0x80);
+    const DWORD left = tile % 8 * TileGrid::tileSize;
+    const DWORD top = tile / 8 * TileGrid::tileSize;
+    for (DWORD y = top; y < top + TileGrid::tileSize; ++y) {
+      for (DWORD x = left; x < left + TileGrid::tileSize; ++x) {
+        bits2[y * size + x] = 0x80 + 100;
+      }
+    }
+    assert(GrayscaleDiffSampled(algo, image1, image2, 8, 1, none, output,
+                                nullptr));
+    if (output.psnr_area_vs_smooth == 0) break;
+  }
+  assert(tile < 64);
+
+  // No sampled tile differs, which does not tell that none of the others
+  // does.  The row is diffed in full instead of passing, and fails.
+  const curve::FailThreshold threshold = {40, 0};
+  assert(GrayscaleDiffSampled(algo, image1, image2, 8, 1, threshold, output,
+                              nullptr));
+  assert(output.escalated);
+  assert(output.verdict == curve::verdictFailed);
+}
+
+// Writes the fingerprint that a server would after the pixels of |image|,
+// which start |bits| and leave room for it.
+static void AttachFingerprint(curve::SimpleBitmap &image,
+                              std::vector<BYTE> &bits) {
+  std::vector<ULONGLONG> rowHashes(image.height_);
+  for (DWORD y = 0; y < image.height_; ++y) {
+    rowHashes[y] = HashRow(image, y);
+  }
+  assert(WriteFingerprint(image, rowHashes.data(), bits.data(), bits.size()));
+  image.fingerprint_ = FindFingerprint(image, bits.size());
+  assert(image.fingerprint_);
+}
+
+void Test_GrayscaleDiffChangedRows() {
+  // Bands of changed lines at the top, in the middle, closer to each other
+  // than twice the erosion margin, and at the bottom.  The thick bands
+  // survive the erosion only where the lines around them allow.
+  const DWORD width = 64, height = 48;
+  curve::SimpleBitmap image1(8, width, height, nullptr),
+                      image2(8, width, height, nullptr);
+  std::vector<BYTE> bits1(FrameFingerprint::GetOffset(image1)
+                          + FrameFingerprint::GetSize(height));
+  for (DWORD y = 0; y < height; ++y) {
+    for (DWORD x = 0; x < width; ++x) {
+      bits1[y * width + x] = static_cast<BYTE>(x * 7 + y * 3);
+    }
+  }
+  std::vector<BYTE> bits2(bits1);
+  const DWORD bands[][2] = {{0, 3}, {10, 16}, {19, 20}, {22, 28}, {45, 48}};
+  for (const auto &band : bands) {
+    for (DWORD y = band[0]; y < band[1]; ++y) {
+      for (DWORD x = 8; x < 40; ++x) {
+        bits2[y * width + x] += 60;
+      }
+    }
+  }
+  image1.bits_ = bits1.data();
+  image2.bits_ = bits2.data();
+
+  // The changed lines and their margins give the scores and tiles of the
+  // whole frames.
+  for (auto algo : {curve::triangle, curve::erosionDiff}) {
+    curve::DiffOutput full, fast;
+    TileGrid fullTiles, fastTiles;
+    image1.fingerprint_ = image2.fingerprint_ = nullptr;
+    assert(GrayscaleDiffTiles(algo, image1, image2, full, nullptr, fullTiles));
+    AttachFingerprint(image1, bits1);
+    AttachFingerprint(image2, bits2);
+    assert(GrayscaleDiffTiles(algo, image1, image2, fast, nullptr, fastTiles));
+    assert(full.psnr_target_vs_area > 0);
+    assert(is_near(fast.psnr_area_vs_smooth, full.psnr_area_vs_smooth));
+    assert(is_near(fast.psnr_target_vs_area, full.psnr_target_vs_area));
+    assert(is_near(fast.psnr_target_vs_smooth, full.psnr_target_vs_smooth));
+    for (DWORD row = 0; row < fullTiles.Rows(); ++row) {
+      for (DWORD column = 0; column < fullTiles.Columns(); ++column) {
+        const auto &fullTile = fullTiles.At(column, row);
+        const auto &fastTile = fastTiles.At(column, row);
+        assert(is_near(fastTile.sse, fullTile.sse));
+        assert(fastTile.changedPixels == fullTile.changedPixels);
+        assert(fastTile.maxAbsDiff == fullTile.maxAbsDiff);
+      }
+    }
+  }
+
+  // Frames whose fingerprints tell that they are identical are not read,
+  // so a frame given the fingerprint of the other scores as identical.
+  image2.fingerprint_ = image1.fingerprint_;
+  for (auto algo : {curve::averageDiff, curve::triangle}) {
+    curve::DiffOutput output;
+    assert(GrayscaleDiff(algo, image1, image2, output, nullptr));
+    assert(output.psnr_area_vs_smooth == 0);
+    assert(output.psnr_target_vs_area == 0);
+    assert(output.psnr_target_vs_smooth == 0);
+  }
+  image1.fingerprint_ = image2.fingerprint_ = nullptr;
+  curve::DiffOutput output;
+  assert(GrayscaleDiff(curve::averageDiff, image1, image2, output, nullptr));
+  assert(output.psnr_area_vs_smooth > 0);
+}
+
+void Test_GrayscaleDiffUntil() {
+  // 4x4 tiles, of which three differ by 10 levels in every pixel.
+  const DWORD tile = TileGrid::tileSize, size = 4 * tile;
+  const double tilePixels = tile * tile, pixels = size * size;
+  curve::SimpleBitmap image1(8, size, size, nullptr),
+                      image2(8, size, size, nullptr);
+  std::vector<BYTE> bits1(FrameFingerprint::GetOffset(image1)
+                          + FrameFingerprint::GetSize(size),
+                          0x80),
+                    bits2(bits1);
+  const auto fillTile = [&](DWORD column, DWORD row, BYTE level) {
+    for (DWORD y = row * tile; y < (row + 1) * tile; ++y) {
+      memset(&bits2[y * size + column * tile], level, tile);
+    }
+  };
+  fillTile(1, 0, 0x8a);
+  fillTile(3, 2, 0x8a);
+  fillTile(0, 3, 0x8a);
+  image1.bits_ = bits1.data();
+  image2.bits_ = bits2.data();
+
+  // The diff stops at the first tile over either limit, and leaves the
+  // tiles after it empty.  Lines skipped by their hashes count as diffed,
+  // so the fingerprints do not change where it stops.
+  curve::DiffOutput output;
+  TileGrid grid;
+  for (int pass = 0; pass < 2; ++pass) {
+    const curve::FailThreshold changed = {0, 1000};
+    assert(GrayscaleDiffUntil(curve::averageDiff, image1, image2, changed,
+                              nullptr, output, &grid));
+    assert(output.verdict == curve::verdictFailed);
+    assert(is_near(output.coverage, 2 * tilePixels / pixels));
+    assert(grid.At(1, 0).changedPixels == tile * tile);
+    assert(grid.At(3, 2).changedPixels == 0);
+
+    // One changed tile keeps the frame above 40dB, and two do not.
+    const curve::FailThreshold psnr = {40, 0};
+    assert(GrayscaleDiffUntil(curve::averageDiff, image1, image2, psnr,
+                              nullptr, output, &grid));
+    assert(output.verdict == curve::verdictFailed);
+    assert(is_near(output.coverage, 12 * tilePixels / pixels));
+    assert(grid.At(3, 2).changedPixels == tile * tile);
+    assert(grid.At(0, 3).changedPixels == 0);
+
+    // A row that passes is diffed in full, to the score of GrayscaleDiff.
+    const curve::FailThreshold loose = {20, 0};
+    for (auto algo : {curve::averageDiff, curve::erosionDiff}) {
+      curve::DiffOutput whole;
+      assert(GrayscaleDiffUntil(algo, image1, image2, loose, nullptr,
+                                output, nullptr));
+      assert(GrayscaleDiff(algo, image1, image2, whole, nullptr));
+      assert(output.verdict == curve::verdictPassed);
+      assert(output.coverage == 1);
+      assert(is_near(output.psnr_target_vs_area, whole.psnr_target_vs_area));
+    }
+
+    AttachFingerprint(image1, bits1);
+    AttachFingerprint(image2, bits2);
+  }
+
+  // With a mask, the limits and the coverage are of the pixels it leaves.
+  // Leaving out the first changed tile, at the bottom of the page, moves
+  // the stop to the second one.
+  DiffMask mask;
+  assert(mask.Parse("32,96,32,32", size, size));
+  assert(mask.GetCoverage(1, 0) == DiffMask::coverFull);
+  const double included = static_cast<double>(mask.IncludedPixels());
+  assert(included == pixels - tilePixels);
+  const curve::FailThreshold changed = {0, 1000};
+  assert(GrayscaleDiffUntil(curve::averageDiff, image1, image2, changed,
+                            &mask, output, &grid));
+  assert(output.verdict == curve::verdictFailed);
+  assert(is_near(output.coverage, 11 * tilePixels / included));
+
+  // The PSNR of a masked frame is of the pixels the mask leaves, which is
+  // that of the frame without the masked change, over fewer pixels.
+  const curve::FailThreshold none = {};
+  assert(GrayscaleDiffUntil(curve::erosionDiff, image1, image2, none,
+                            &mask, output, nullptr));
+  assert(output.coverage == 1);
+  fillTile(1, 0, 0x80);
+  image1.fingerprint_ = image2.fingerprint_ = nullptr;
+  curve::DiffOutput unmasked;
+  assert(GrayscaleDiff(curve::erosionDiff, image1, image2, unmasked,
+                       nullptr));
+  assert(is_near(output.psnr_target_vs_area,
+                 unmasked.psnr_target_vs_area
+                 + 10 * std::log10(included / pixels)));
+}
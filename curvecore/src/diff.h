@@ -0,0 +1,110 @@
+// Compares two 8bpp frames with |algo|.  The frames may be given in either
+// order; they are swapped so that |image1| is the smaller one.  The native
+// algorithms compare each pixel of the smaller frame with the block of the
+// larger frame it covers, as FrameReduction does.
+bool GrayscaleDiff(curve::DiffAlgorithm algo,
+                   curve::SimpleBitmap &image1,
+                   curve::SimpleBitmap &image2,
+                   curve::DiffOutput &result,
+                   LPCWSTR diffImagePath);
+
+// Same as GrayscaleDiff, and fills |tiles| in the same pass with statistics
+// of the difference that |algo| scores.  The grid covers the larger frame
+// for triangle and erosionDiff, and the smaller frame for the others.
+bool GrayscaleDiffTiles(curve::DiffAlgorithm algo,
+                        curve::SimpleBitmap &image1,
+                        curve::SimpleBitmap &image2,
+                        curve::DiffOutput &result,
+                        LPCWSTR diffImagePath,
+                        TileGrid &tiles);
+
+// Diffs two frames of the same size at 1/|factor| (4 or 8) resolution
+// first, and revisits at full resolution only the tiles whose estimated MSE
+// exceeds |threshold| or that the coarse level does not cover.  The score
+// adds up the SSE of the refined tiles and the estimates of the others, and
+// the tiles that were not refined carry only their estimated SSE.  Frames
+// of different sizes are diffed as GrayscaleDiff does.
+bool GrayscaleDiffPyramid(curve::DiffAlgorithm algo,
+                          curve::SimpleBitmap &image1,
+                          curve::SimpleBitmap &image2,
+                          curve::DiffOutput &result,
+                          DWORD factor,
+                          double threshold,
+                          TileGrid *tiles);
+
+// Diffs two frames of the same size tile by tile and stops as soon as they
+// fail |threshold|.  Sets the verdict, a score of the part diffed so far,
+// and the fraction of the frame diffed.  Tiles after the stop are left
+// empty.  Frames of different sizes are diffed whole and then judged.
+// With |mask|, which must be of the size of the frames, only the pixels
+// it does not exclude are diffed, and the score and the threshold are of
+// those pixels.  Algorithms after erosionDiff do not take a mask.
+bool GrayscaleDiffUntil(curve::DiffAlgorithm algo,
+                        curve::SimpleBitmap &image1,
+                        curve::SimpleBitmap &image2,
+                        const curve::FailThreshold &threshold,
+                        const DiffMask *mask,
+                        curve::DiffOutput &result,
+                        TileGrid *tiles);
+
+// Same as GrayscaleDiff for two frames of the size of |mask|, except that
+// the pixels |mask| excludes are left out of the score, |tiles|, and the
+// diff image.  The kernels clear their differences in the registers, and
+// tiles excluded as a whole are not read.  The diff image shows the plain
+// difference of pixels whichever the algorithm is.
+bool GrayscaleDiffMasked(curve::DiffAlgorithm algo,
+                         curve::SimpleBitmap &image1,
+                         curve::SimpleBitmap &image2,
+                         const DiffMask &mask,
+                         curve::DiffOutput &result,
+                         LPCWSTR diffImagePath,
+                         TileGrid *tiles);
+
+// Estimates the score of two frames of the same size from a stratified
+// sample of |sampleTiles| tiles chosen by |seed|, with the scores at both
+// ends of the 95% confidence interval of the SSE.  Given a threshold, the
+// row is judged from the interval, and diffed as GrayscaleDiffUntil does
+// only when the interval straddles the threshold.  A stratum where too few
+// sampled tiles differ for the normal approximation, a small change the
+// sample missed in particular, is bounded by the rule of three instead.
+bool GrayscaleDiffSampled(curve::DiffAlgorithm algo,
+                          curve::SimpleBitmap &image1,
+                          curve::SimpleBitmap &image2,
+                          UINT sampleTiles,
+                          UINT seed,
+                          const curve::FailThreshold &threshold,
+                          curve::DiffOutput &result,
+                          TileGrid *tiles);
+
+// Sets |psnr| to the PSNR of the edge maps of two 8bpp frames of the same
+// size as EdgeDiffer computes them, with the differ of the thread, which
+// keeps its buffers for the next pair of frames.  With |tiles|, they are
+// reset to the frames and hold the statistics of the edge maps.
+bool DiffEdgeFrames(const curve::SimpleBitmap &image1,
+                    const curve::SimpleBitmap &image2,
+                    double &psnr,
+                    TileGrid *tiles);
+
+// Sets |psnr| to the PSNR of every pair of |count| 8bpp frames in the
+// order of PairIndex, diffing all of them in one pass with PairwiseDiff.
+// Pairs with a frame of another size than the first frame are NaN.
+bool GrayscaleDiffMatrix(const curve::SimpleBitmap *frames,
+                         DWORD count,
+                         std::vector<double> &psnr);
+
+// Diffs the channels of two frames of the same size and format with
+// ColorDiff, or YCbCrDiff if |ycbcr| is true.  The scores are the PSNR of
+// all the channels, and each channel of a 24 or 32bpp frame has its own
+// PSNR as well.
+bool DiffColorFrames(const curve::SimpleBitmap &image1,
+                     const curve::SimpleBitmap &image2,
+                     bool ycbcr,
+                     curve::DiffOutput &result);
+
+// Computes every algorithm in |metrics|, a set of 1 << DiffAlgorithm bits,
+// in one pass over both frames.  Each result matches GrayscaleDiff of the
+// same algorithm.
+bool GrayscaleDiffMetrics(UINT metrics,
+                          curve::SimpleBitmap &image1,
+                          curve::SimpleBitmap &image2,
+                          curve::DiffMetricsOutput &output);
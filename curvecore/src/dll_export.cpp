@@ -2,21 +2,35 @@
 #include <windows.h>
 #include <atlbase.h>
 #include <assert.h>
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <limits>
 #include <string>
-#include <sstream>
+#include <memory>
+#include <string_view>
 #include <vector>
 #include <curve_rpc.h>
 #include "filemapping.h"
 #include "blob.h"
+#include "synchronization.h"
+#include "manifest.h"
 #include "curvecore.h"
+#include "fingerprint.h"
+#include "phash.h"
+#include "resultcache.h"
+#include "tiles.h"
+#include "mask.h"
+#include "volatility.h"
+#include "regions.h"
+#include "resample.h"
+#include "align.h"
+#include "matrix.h"
+#include "baseline.h"
+#include "diff.h"
 
 void Log(LPCWSTR format, ...);
-bool GrayscaleDiff(curve::DiffAlgorithm algo,
-                   curve::SimpleBitmap &image1,
-                   curve::SimpleBitmap &image2,
-                   curve::DiffOutput &result,
-                   LPCWSTR diffImagePath);
+void ConfigureRenderCache(DWORD ttl);
 
 class RpcClientBinding {
 private:
@@ -160,61 +174,529 @@ Blob toWideString(LPCSTR string) {
   return blob;
 }
 
-static HRESULT NavigateAndCapture(RpcClientBinding &cl1,
-                                  RpcClientBinding &cl2,
+static SIZE_T GetViewSize(LPCVOID view) {
+  MEMORY_BASIC_INFORMATION mbi;
+  return view && VirtualQuery(view, &mbi, sizeof(mbi)) ? mbi.RegionSize : 0;
+}
+
+// Converts a non-terminated string into |buffer|, which is grown but never
+// shrunk so that a batch run does not allocate per row.
+static LPCWSTR toWideString(std::string_view string, Blob &buffer) {
+  const int len = MultiByteToWideChar(CP_OEMCP,
+                                      /*dwFlags*/0,
+                                      string.data(),
+                                      static_cast<int>(string.size()),
+                                      /*lpWideCharStr*/nullptr,
+                                      /*cchWideChar*/0);
+  const SIZE_T required = (len + 1) * sizeof(WCHAR);
+  if (buffer.Size() < required && !buffer.Alloc(required)) {
+    return nullptr;
+  }
+  auto p = buffer.As<WCHAR>();
+  MultiByteToWideChar(CP_OEMCP,
+                      0,
+                      string.data(),
+                      static_cast<int>(string.size()),
+                      p,
+                      len);
+  p[len] = 0;
+  return p;
+}
+
+// Navigates |count| endpoints to |url| together, waits for |wait| msec
+// after the last one finished, and captures all of them in turn.
+static HRESULT NavigateAndCapture(RpcClientBinding *const *clients,
+                                  UINT count,
                                   LPCWSTR url,
                                   UINT viewWidth,
                                   UINT viewHeight,
                                   DWORD wait,
-                                  curve::SimpleBitmap &outCapturedSize1,
-                                  curve::SimpleBitmap &outCapturedSize2) {
-  HRESULT hr = ExceptionSafe([&]() {
-    return c_Navigate(cl1, url, viewWidth, viewHeight, /*async*/true);
-  });
-  if (FAILED(hr)) goto cleanup;
-  hr = ExceptionSafe([&]() {
-    return c_Navigate(cl2, url, viewWidth, viewHeight, /*async*/false);
-  });
+                                  WORD bitCount,
+                                  curve::SimpleBitmap *outCapturedSizes) {
+  HRESULT hr = S_OK;
+  for (UINT i = 0; i < count && SUCCEEDED(hr); ++i) {
+    hr = ExceptionSafe([&]() {
+      return c_Navigate(*clients[i],
+                        url,
+                        viewWidth,
+                        viewHeight,
+                        /*async*/i + 1 < count);
+    });
+  }
   if (FAILED(hr)) goto cleanup;
 
   Sleep(wait);
 
-  WORD bitCount =
-    outCapturedSize1.bitCount_ =
-    outCapturedSize2.bitCount_ = 8; // Capture as a grayscale image
-  UINT width, height;
-  hr = ExceptionSafe([&]() {
-    return c_Capture(cl1,
-                     bitCount,
-                     &width,
-                     &height,
-                     /*saveOnServer*/nullptr);
-  });
-  if (FAILED(hr)) goto cleanup;
-  outCapturedSize1.width_ = width;
-  outCapturedSize1.height_ = height;
-  // Log(L"Cap from %s: %d x %d\n", cl1.bindName(), width, height);
-
-  hr = ExceptionSafe([&]() {
-    return c_Capture(cl2,
-                     bitCount,
-                     &width,
-                     &height,
-                     /*saveOnServer*/nullptr);
-  });
-  if (FAILED(hr)) goto cleanup;
-  outCapturedSize2.width_ = width;
-  outCapturedSize2.height_ = height;
-  // Log(L"Cap from %s: %d x %d\n", cl2.bindName(), width, height);
+  // Capture as a grayscale image unless colors are asked for
+  if (bitCount == 0) bitCount = 8;
+  for (UINT i = 0; i < count; ++i) {
+    auto &captured = outCapturedSizes[i];
+    captured.bitCount_ = bitCount;
+    UINT width, height;
+    hr = ExceptionSafe([&]() {
+      return c_Capture(*clients[i],
+                       bitCount,
+                       &width,
+                       &height,
+                       /*saveOnServer*/nullptr);
+    });
+    if (FAILED(hr)) goto cleanup;
+    captured.width_ = width;
+    captured.height_ = height;
+    // Log(L"Cap from %s: %d x %d\n", clients[i]->bindName(), width, height);
+  }
 
 cleanup:
   return hr;
 }
 
+static HRESULT NavigateAndCapture(RpcClientBinding &cl1,
+                                  RpcClientBinding &cl2,
+                                  LPCWSTR url,
+                                  UINT viewWidth,
+                                  UINT viewHeight,
+                                  DWORD wait,
+                                  WORD bitCount,
+                                  curve::SimpleBitmap &outCapturedSize1,
+                                  curve::SimpleBitmap &outCapturedSize2) {
+  RpcClientBinding *clients[] = {&cl1, &cl2};
+  curve::SimpleBitmap captured[2];
+  const HRESULT hr = NavigateAndCapture(clients,
+                                        2,
+                                        url,
+                                        viewWidth,
+                                        viewHeight,
+                                        wait,
+                                        bitCount,
+                                        captured);
+  outCapturedSize1 = captured[0];
+  outCapturedSize2 = captured[1];
+  return hr;
+}
+
+// A mask learned for a URL and a viewport is saved in |directory| under
+// the hash of both.
+static std::string GetLearnedMaskPath(LPCWSTR directory,
+                                      LPCWSTR url,
+                                      UINT viewWidth,
+                                      UINT viewHeight) {
+  const ULONGLONG hash =
+    HashBytes(reinterpret_cast<LPCBYTE>(url),
+              wcslen(url) * sizeof(WCHAR),
+              (static_cast<ULONGLONG>(viewWidth) << 32) | viewHeight);
+  char name[32];
+  sprintf_s(name, "\\%016I64x.bmp", hash);
+  const auto directoryAscii = toString(directory);
+  return std::string(directoryAscii.As<char>()) + name;
+}
+
+// Loads the mask learned for |url| if there is one for frames of the size
+// of |image|.
+static bool LoadLearnedMask(LPCWSTR directory,
+                            LPCWSTR url,
+                            UINT viewWidth,
+                            UINT viewHeight,
+                            const curve::SimpleBitmap &image,
+                            DiffMask &mask) {
+  const auto path =
+    GetLearnedMaskPath(directory, url, viewWidth, viewHeight);
+  return GetFileAttributesA(path.c_str()) != INVALID_FILE_ATTRIBUTES
+         && mask.Load(path.c_str(), image.width_, image.height_);
+}
+
+// A baseline of DiffImage is kept for a URL and a viewport, as a learned
+// mask is.
+static std::string GetBaselineId(LPCWSTR url,
+                                 UINT viewWidth,
+                                 UINT viewHeight) {
+  char viewport[32];
+  sprintf_s(viewport, " %ux%u", viewWidth, viewHeight);
+  const auto urlAscii = toString(url);
+  return std::string(urlAscii.As<char>() ? urlAscii.As<char>() : "")
+         + viewport;
+}
+
+// Maps the baseline of |id| into |baseline|.  A baseline captured with
+// other bits per pixel than |captured| is unusable as a broken file is, so
+// that a run with other options does not overwrite it.
+static BaselineStore::Status LoadBaseline(BaselineStore &baselines,
+                                          std::string_view id,
+                                          const curve::SimpleBitmap &captured,
+                                          curve::SimpleBitmap &baseline) {
+  const auto status = baselines.Load(id, baseline);
+  if (status == BaselineStore::loaded
+      && baseline.bitCount_ != captured.bitCount_) {
+    return BaselineStore::unusable;
+  }
+  return status;
+}
+
+// Replaces the baseline of |id| with |captured| after they were diffed,
+// unless their hashes tell that they are the same frame already.
+static bool RefreshBaseline(BaselineStore &baselines,
+                            std::string_view id,
+                            const curve::SimpleBitmap &captured,
+                            const curve::SimpleBitmap &baseline) {
+  if (captured.fingerprint_ && baseline.fingerprint_
+      && captured.width_ == baseline.width_
+      && captured.height_ == baseline.height_
+      && captured.fingerprint_->frameHash
+         == baseline.fingerprint_->frameHash) {
+    return true;
+  }
+  return baselines.Save(id, captured);
+}
+
+// Folds the options that change a diff result into a cache key.
+static ULONGLONG GetCacheVariant(const curve::DiffOptions &options,
+                                 bool usePyramid,
+                                 bool useThreshold,
+                                 bool useSample,
+                                 const DiffMask *mask) {
+  struct {
+    ULONGLONG maskHash;
+    double pyramidThreshold;
+    double minPSNR;
+    ULONGLONG maxChangedPixels;
+    UINT pyramidFactor;
+    UINT sampleTiles;
+    UINT sampleSeed;
+    UINT alignMaxOffset;
+    UINT alignRowEdits;
+    UINT ycbcr;
+  } variant = {0};
+  if (mask) {
+    variant.maskHash = HashBytes(mask->Line(0),
+                                 static_cast<SIZE_T>(mask->Stride())
+                                 * mask->Height(),
+                                 0);
+  }
+  variant.alignMaxOffset = options.alignMaxOffset;
+  variant.alignRowEdits = options.alignRowEdits;
+  variant.ycbcr = options.ycbcr;
+  if (useSample) {
+    variant.minPSNR = options.failThreshold.minPSNR;
+    variant.maxChangedPixels = options.failThreshold.maxChangedPixels;
+    variant.sampleTiles = options.sampleTiles;
+    variant.sampleSeed = options.sampleSeed;
+  }
+  else if (useThreshold) {
+    variant.minPSNR = options.failThreshold.minPSNR;
+    variant.maxChangedPixels = options.failThreshold.maxChangedPixels;
+  }
+  else if (usePyramid) {
+    variant.pyramidFactor = options.pyramidFactor;
+    variant.pyramidThreshold = options.pyramidThreshold;
+  }
+  return useSample
+         || useThreshold
+         || usePyramid
+         || mask
+         || options.alignMaxOffset
+         || options.alignRowEdits
+         || options.ycbcr
+         ? HashBytes(reinterpret_cast<LPCBYTE>(&variant), sizeof(variant), 0)
+         : 0;
+}
+
+// Fills DiffOutput::distribution from |tiles| over the pixels diffed.
+static void FillDistribution(const curve::DiffOptions &options,
+                             const TileGrid *tiles,
+                             const DiffMask *mask,
+                             curve::DiffOutput &output) {
+  if (!options.histogram || !tiles) return;
+
+  const double pixels =
+    (mask ? static_cast<double>(mask->IncludedPixels())
+          : static_cast<double>(tiles->Width()) * tiles->Height())
+    * output.coverage;
+  tiles->GetDistribution(static_cast<ULONGLONG>(pixels + .5),
+                         options.histogramTolerance,
+                         output.distribution);
+}
+
+// Fills DiffOutput::edge_psnr of 8bpp frames of the same size if asked.
+static bool FillEdgeScore(const curve::DiffOptions &options,
+                          const curve::SimpleBitmap &image1,
+                          const curve::SimpleBitmap &image2,
+                          curve::DiffOutput &output) {
+  if (!options.edgeScore
+      || image1.bitCount_ != 8 || image2.bitCount_ != 8
+      || image1.width_ != image2.width_
+      || image1.height_ != image2.height_) {
+    return true;
+  }
+  return DiffEdgeFrames(image1, image2, output.edge_psnr, /*tiles*/nullptr);
+}
+
+// Decides the diff by perceptual hashes if |options| allows.  Otherwise
+// runs GrayscaleDiff unless |cache| already has the result for the same
+// URL, viewport, algorithm, options, and frame contents.  |aligner| keeps
+// its plans across calls.  A |mask| skips the prefilter and alignment,
+// which see whole frames.
+static bool DiffFrames(ResultCache *cache,
+                       const curve::DiffOptions &options,
+                       LPCWSTR url,
+                       UINT viewWidth,
+                       UINT viewHeight,
+                       curve::DiffAlgorithm algo,
+                       curve::SimpleBitmap &image1,
+                       curve::SimpleBitmap &image2,
+                       curve::DiffOutput &output,
+                       LPCWSTR diffImage,
+                       const DiffMask *mask,
+                       TileGrid *tiles,
+                       FrameAligner &aligner) {
+  const auto &prefilter = options.prefilter;
+  output.verdict = curve::verdictNone;
+  output.coverage = 1;
+  output.score_at_min_sse = output.score_at_max_sse = 0;
+  output.escalated = false;
+  output.changedPixels = output.antialiasedPixels = 0;
+  output.changedRegions = 0;
+  output.offset_x = output.offset_y = 0;
+  output.inserted_rows = output.deleted_rows = 0;
+  output.distribution = {};
+  output.channel_psnr[0] = output.channel_psnr[1] = output.channel_psnr[2] = 0;
+  output.edge_psnr = 0;
+  aligner.ClearBands();
+  if (tiles) {
+    tiles->EnableHistogram(options.histogram);
+  }
+  // Colors are diffed channel by channel, and nothing else applies.
+  const bool color = image1.bitCount_ != 8;
+  if (color && mask) {
+    Log(L"A mask applies to 8bpp frames.\n");
+    return false;
+  }
+  if (!diffImage
+      && !mask
+      && !color
+      && (prefilter.sameBelow || prefilter.differentFrom)) {
+    const auto distance = HammingDistance(GetPerceptualHash(image1),
+                                          GetPerceptualHash(image2));
+    if (distance < prefilter.sameBelow) {
+      output.psnr_area_vs_smooth =
+        output.psnr_target_vs_area =
+        output.psnr_target_vs_smooth = 0;
+      output.verdict = curve::verdictSame;
+    }
+    else if (prefilter.differentFrom && distance >= prefilter.differentFrom) {
+      const auto nan = std::numeric_limits<double>::quiet_NaN();
+      output.psnr_area_vs_smooth =
+        output.psnr_target_vs_area =
+        output.psnr_target_vs_smooth = nan;
+      output.verdict = curve::verdictDifferent;
+    }
+    if (output.verdict != curve::verdictNone) {
+      return !tiles || tiles->Reset(0, 0);
+    }
+  }
+
+  // Sampling, thresholds, the pyramid, and masks work on the SSE of the
+  // algorithms up to erosionDiff.  Masked tiles are diffed one by one, so
+  // neither sampling nor the pyramid applies to them.
+  const bool scoresSSE = algo <= curve::erosionDiff && !color;
+  if (mask && !scoresSSE) {
+    Log(L"A mask applies to algorithms up to erosionDiff.\n");
+    return false;
+  }
+  const bool useSample = options.sampleTiles
+                         && !diffImage
+                         && scoresSSE
+                         && !mask;
+  const bool useThreshold = (options.failThreshold.minPSNR > 0
+                             || options.failThreshold.maxChangedPixels)
+                            && !diffImage
+                            && scoresSSE
+                            && !useSample;
+  const bool usePyramid = options.pyramidFactor
+                          && !diffImage
+                          && scoresSSE
+                          && !mask
+                          && !useSample
+                          && !useThreshold;
+  const auto diff = [&]() {
+    // The frames are replaced with their paired rows, or the region they
+    // share, when aligned.
+    auto frame1 = image1, frame2 = image2;
+    if (color) {
+      return DiffColorFrames(frame1, frame2, options.ycbcr, output)
+             && (!tiles || tiles->Reset(0, 0));
+    }
+    if (mask) {
+      return useThreshold
+             ? GrayscaleDiffUntil(algo,
+                                  frame1,
+                                  frame2,
+                                  options.failThreshold,
+                                  mask,
+                                  output,
+                                  tiles)
+             : GrayscaleDiffMasked(algo,
+                                   frame1,
+                                   frame2,
+                                   *mask,
+                                   output,
+                                   diffImage,
+                                   tiles);
+    }
+    if (options.alignRowEdits
+        && !aligner.AlignRows(options.alignRowEdits,
+                              frame1,
+                              frame2,
+                              output.inserted_rows,
+                              output.deleted_rows)) {
+      return false;
+    }
+    if (options.alignMaxOffset
+        && !aligner.Align(options.alignMaxOffset,
+                          frame1,
+                          frame2,
+                          output.offset_x,
+                          output.offset_y)) {
+      return false;
+    }
+    if (algo == curve::edgeDiff) {
+      double psnr;
+      if (!DiffEdgeFrames(frame1, frame2, psnr, tiles)) {
+        return false;
+      }
+      output.psnr_area_vs_smooth
+        = output.psnr_target_vs_area
+        = output.psnr_target_vs_smooth = psnr;
+      return true;
+    }
+    if (useSample) {
+      return GrayscaleDiffSampled(algo,
+                                  frame1,
+                                  frame2,
+                                  options.sampleTiles,
+                                  options.sampleSeed,
+                                  options.failThreshold,
+                                  output,
+                                  tiles);
+    }
+    if (useThreshold) {
+      return GrayscaleDiffUntil(algo,
+                                frame1,
+                                frame2,
+                                options.failThreshold,
+                                /*mask*/nullptr,
+                                output,
+                                tiles);
+    }
+    if (usePyramid) {
+      return GrayscaleDiffPyramid(algo,
+                                  frame1,
+                                  frame2,
+                                  output,
+                                  options.pyramidFactor,
+                                  options.pyramidThreshold,
+                                  tiles);
+    }
+    return tiles
+           ? GrayscaleDiffTiles(algo, frame1, frame2, output, diffImage, *tiles)
+           : GrayscaleDiff(algo, frame1, frame2, output, diffImage);
+  };
+  if (!cache) {
+    if (!diff()) {
+      return false;
+    }
+    FillDistribution(options, tiles, mask, output);
+    return FillEdgeScore(options, image1, image2, output);
+  }
+
+  const auto key = ResultCache::MakeKey(url,
+                                        viewWidth,
+                                        viewHeight,
+                                        algo,
+                                        HashFrame(image1),
+                                        HashFrame(image2),
+                                        GetCacheVariant(options,
+                                                        usePyramid,
+                                                        useThreshold,
+                                                        useSample,
+                                                        mask));
+  Blob *payload = tiles ? &tiles->GetBuffer() : nullptr;
+  if ((!diffImage
+       || GetFileAttributes(diffImage) != INVALID_FILE_ATTRIBUTES)
+      && cache->Lookup(key, output, payload)
+      && (!tiles
+          || (tiles->IsValid()
+              && tiles->HasHistogram() == options.histogram))) {
+    FillDistribution(options, tiles, mask, output);
+    return FillEdgeScore(options, image1, image2, output);
+  }
+
+  if (!diff()) {
+    return false;
+  }
+  cache->Store(key, output, payload);
+  FillDistribution(options, tiles, mask, output);
+  return FillEdgeScore(options, image1, image2, output);
+}
+
+static bool IsFailure(const curve::DiffOutput &output) {
+  switch (output.verdict) {
+  case curve::verdictNone:
+    return output.psnr_area_vs_smooth != 0;
+  case curve::verdictDifferent:
+  case curve::verdictFailed:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static void LogWorstTiles(std::string_view id,
+                          const TileGrid &tiles,
+                          SIZE_T count,
+                          std::vector<DWORD> &worst) {
+  tiles.GetWorstTiles(count, worst);
+  for (auto i : worst) {
+    const DWORD column = i % tiles.Columns();
+    const DWORD row = i / tiles.Columns();
+    const auto &tile = tiles.At(column, row);
+    Log(L"T> %.*hs\t%u\t%u\t%.0f\t%u\t%u\n",
+        static_cast<int>(id.size()), id.data(),
+        column * TileGrid::tileSize,
+        row * TileGrid::tileSize,
+        tile.sse,
+        tile.maxAbsDiff,
+        tile.changedPixels);
+  }
+}
+
+// Logs failing rows grouped by the perceptual hashes of their frames, so
+// that one regression showing up on many pages is triaged once.
+static void LogFailureGroups(const Manifest &manifest,
+                             const PerceptualIndex &failures,
+                             UINT radius) {
+  std::vector<SIZE_T> groupOfNode;
+  const auto groups = failures.Group(radius, groupOfNode);
+
+  std::vector<std::pair<SIZE_T, SIZE_T>> order(groupOfNode.size());
+  for (SIZE_T i = 0; i < groupOfNode.size(); ++i) {
+    order[i] = std::make_pair(groupOfNode[i], failures.GetItem(i));
+  }
+  std::sort(order.begin(), order.end());
+
+  Log(L"G> %Iu failures in %Iu groups\n", order.size(), groups);
+  for (const auto &entry : order) {
+    const auto id = manifest.GetRow(entry.second)[Manifest::colId];
+    Log(L"G> %Iu\t%.*hs\n",
+        entry.first,
+        static_cast<int>(id.size()), id.data());
+  }
+}
+
 namespace curve {
 
-void RunAsServer(LPCWSTR endpoint) {
+void RunAsServer(LPCWSTR endpoint, DWORD renderCacheTtl) {
   const DWORD MinimumCallThreads = 1;
+  ConfigureRenderCache(renderCacheTtl);
+
   WCHAR ProtocolSequence[] = L"ncalrpc";
   CComBSTR endpointBuffer(endpoint);
   RPC_STATUS status;
@@ -294,12 +776,27 @@ HRESULT Shutdown(LPCWSTR endpoint) {
   });
 }
 
-HRESULT DiffImage(const DiffInput &input, DiffOutput &output) {
+// Navigates both endpoints to |input.url| and runs |diff| on the frames
+// captured into the backing files.  With a baseline directory, only the
+// first endpoint is captured, and its frame is diffed against the baseline.
+// Returns S_FALSE when the frame became the baseline instead.
+template<typename T>
+static HRESULT CaptureAndDiff(const DiffInput &input, T diff) {
   const SIZE_T defaultSize = 1 << 26; // Use 64MB as a new backfile
+  const auto &options = input.options;
+  const bool useBaseline = !!options.baselineDirectory;
   if (!EnsureFile(input.backFile1, defaultSize)
-      || !EnsureFile(input.backFile2, defaultSize)) {
+      || (!useBaseline && !EnsureFile(input.backFile2, defaultSize))) {
+    return E_FAIL;
+  }
+
+  BaselineStore baselines;
+  if (useBaseline && !baselines.Open(options.baselineDirectory)) {
     return E_FAIL;
   }
+  const std::string id = useBaseline
+    ? GetBaselineId(input.url, input.viewWidth, input.viewHeight)
+    : std::string();
 
   RpcClientBinding cl1(input.endpoint1);
   RpcClientBinding cl2(input.endpoint2);
@@ -318,69 +815,226 @@ HRESULT DiffImage(const DiffInput &input, DiffOutput &output) {
   });
   if (FAILED(hr)) goto cleanup;
 
-  hr = ExceptionSafe([&]() {
-    DWORD h;
-    HRESULT hr = c_EnsureFileMapping(cl2,
-                                     input.backFile2,
-                                     /*forceUpdate*/false,
-                                     &h);
-    if (SUCCEEDED(hr))
-      map2.Attach(ULongToHandle(h));
-    return hr;
-  });
-  if (FAILED(hr)) goto cleanup;
+  if (useBaseline) {
+    RpcClientBinding *clients[] = {&cl1};
+    hr = NavigateAndCapture(clients,
+                            1,
+                            input.url,
+                            input.viewWidth,
+                            input.viewHeight,
+                            input.waitInMilliseconds,
+                            options.bitCount,
+                            &image1);
+  }
+  else {
+    hr = ExceptionSafe([&]() {
+      DWORD h;
+      HRESULT hr = c_EnsureFileMapping(cl2,
+                                       input.backFile2,
+                                       /*forceUpdate*/false,
+                                       &h);
+      if (SUCCEEDED(hr))
+        map2.Attach(ULongToHandle(h));
+      return hr;
+    });
+    if (FAILED(hr)) goto cleanup;
 
-  hr = NavigateAndCapture(cl1, cl2,
-                          input.url,
-                          input.viewWidth,
-                          input.viewHeight,
-                          input.waitInMilliseconds,
-                          image1, image2);
+    hr = NavigateAndCapture(cl1, cl2,
+                            input.url,
+                            input.viewWidth,
+                            input.viewHeight,
+                            input.waitInMilliseconds,
+                            options.bitCount,
+                            image1, image2);
+  }
   if (SUCCEEDED(hr)) {
     auto view1 = map1.CreateMappedView(FILE_MAP_READ, 0);
-    auto view2 = map2.CreateMappedView(FILE_MAP_READ, 0);
+    FileMapping::View view2;
     image1.bits_ = view1;
-    image2.bits_ = view2;
-    auto result = GrayscaleDiff(input.algo,
-                                image1,
-                                image2,
-                                output,
-                                input.diffImage);
-    hr = result ? S_OK : E_FAIL;
+    image1.fingerprint_ = FindFingerprint(image1, GetViewSize(view1));
+    if (!useBaseline) {
+      view2 = map2.CreateMappedView(FILE_MAP_READ, 0);
+      image2.bits_ = view2;
+      image2.fingerprint_ = FindFingerprint(image2, GetViewSize(view2));
+    }
+    else {
+      // Only a missing baseline is taken from the capture.  An unusable one
+      // is left for a person to look at.
+      const auto status = LoadBaseline(baselines, id, image1, image2);
+      if (status == BaselineStore::unusable) {
+        Log(L"The baseline of %s is unusable\n", input.url);
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        goto cleanup;
+      }
+      if (status == BaselineStore::absent) {
+        if (options.baselineUpdate == baselineKeep) {
+          Log(L"No baseline of %s\n", input.url);
+          hr = HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+        }
+        else if (baselines.Save(id, image1)) {
+          Log(L"Stored the frame as the baseline of %s\n", input.url);
+          hr = S_FALSE;
+        }
+        else {
+          hr = E_FAIL;
+        }
+        goto cleanup;
+      }
+    }
+    hr = diff(image1, image2) ? S_OK : E_FAIL;
+    if (SUCCEEDED(hr)
+        && useBaseline
+        && options.baselineUpdate == baselineAll
+        && !RefreshBaseline(baselines, id, image1, image2)) {
+      hr = E_FAIL;
+    }
   }
 
 cleanup:
   return hr;
 }
 
-enum InputColumn : int {
-  colId = 0,
-  colUrl,
-  colWait,
-  colWidth,
-  colHeight,
-  colMax
-};
+HRESULT DiffImage(const DiffInput &input, DiffOutput &output) {
+  ResultCache cache;
+  const bool useCache =
+    input.cacheFile
+    && cache.Open(input.cacheFile, ResultCache::defaultByteBudget);
+  TileGrid tiles;
+  FrameAligner aligner;
+  DiffMask mask;
+  RegionFinder finder;
+  return CaptureAndDiff(input, [&](SimpleBitmap &image1,
+                                   SimpleBitmap &image2) {
+    bool masked = false;
+    if (input.mask) {
+      const auto spec = toString(input.mask);
+      if (!spec.As<char>()
+          || !mask.Parse(spec.As<char>(), image1.width_, image1.height_)) {
+        return false;
+      }
+      masked = true;
+    }
+    else if (input.options.maskDirectory) {
+      masked = LoadLearnedMask(input.options.maskDirectory,
+                               input.url,
+                               input.viewWidth,
+                               input.viewHeight,
+                               image1,
+                               mask);
+    }
+    auto result = DiffFrames(useCache ? &cache : nullptr,
+                             input.options,
+                             input.url,
+                             input.viewWidth,
+                             input.viewHeight,
+                             input.algo,
+                             image1,
+                             image2,
+                             output,
+                             input.diffImage,
+                             masked ? &mask : nullptr,
+                             input.tileFile || input.options.histogram
+                               ? &tiles : nullptr,
+                             aligner);
+    if (result && (input.changeMask || input.regionFile)) {
+      ChangeMask changes;
+      if (!changes.Build(image1,
+                         image2,
+                         input.changeTolerance,
+                         masked ? &mask : nullptr)) {
+        Log(L"Failed to build the change mask.\n");
+        return false;
+      }
+      if (input.algo != antialiasDiff) {
+        output.changedPixels = changes.Count();
+      }
+      if (input.changeMask) {
+        const auto path = toString(input.changeMask);
+        if (!path.As<char>() || !changes.Save(path.As<char>())) {
+          Log(L"Failed to write %s\n", input.changeMask);
+          return false;
+        }
+      }
+      if (input.regionFile) {
+        std::vector<ChangedRegion> regions;
+        std::ofstream os(input.regionFile);
+        if (!finder.Find(changes, image1, image2, regions)
+            || !os.is_open()
+            || !SaveRegions(os, regions)) {
+          Log(L"Failed to write %s\n", input.regionFile);
+          return false;
+        }
+        output.changedRegions = static_cast<DWORD>(regions.size());
+      }
+    }
+    if (result && input.tileFile && output.verdict == verdictNone) {
+      std::ofstream os(input.tileFile);
+      if (!os.is_open() || !tiles.Save(os)) {
+        Log(L"Failed to write %s\n", input.tileFile);
+      }
+    }
+    return result;
+  });
+}
+
+HRESULT DiffMetrics(const DiffInput &input,
+                    UINT metrics,
+                    DiffMetricsOutput &output) {
+  return CaptureAndDiff(input, [&](SimpleBitmap &image1,
+                                   SimpleBitmap &image2) {
+    return GrayscaleDiffMetrics(metrics, image1, image2, output);
+  });
+}
+
+static void LogMetrics(std::string_view id, const DiffMetricsOutput &output) {
+  for (UINT algo = skipDiff; algo <= erosionDiff; ++algo) {
+    if (!(output.metrics & (1 << algo))) continue;
+
+    const auto &result = output.results[algo];
+    Log(L"M> %.*hs\t%u\t%f\t%f\t%f\n",
+        static_cast<int>(id.size()), id.data(),
+        algo,
+        result.psnr_area_vs_smooth,
+        result.psnr_target_vs_area,
+        result.psnr_target_vs_smooth);
+  }
+}
 
-void BatchRun(std::istream &is,
-              LPCWSTR endpoint1,
-              LPCWSTR endpoint2,
-              LPCWSTR backFile1,
-              LPCWSTR backFile2) {
+void BatchRun(const BatchInput &input, std::istream &is) {
   const SIZE_T defaultSize = 1 << 26; // Use 64MB as a new backfile
-  if (!EnsureFile(backFile1, defaultSize)
-      || !EnsureFile(backFile2, defaultSize)) {
+  const bool useBaseline = !!input.options.baselineDirectory;
+  if (!EnsureFile(input.backFile1, defaultSize)
+      || (!useBaseline && !EnsureFile(input.backFile2, defaultSize))) {
+    return;
+  }
+
+  Manifest manifest;
+  if (input.manifest ? !manifest.Load(input.manifest)
+                     : !manifest.Load(is)) {
+    Log(L"Failed to load the manifest.\n");
+    return;
+  }
+
+  ResultCache cache;
+  if (input.cacheFile
+      && !cache.Open(input.cacheFile, ResultCache::defaultByteBudget)) {
+    Log(L"Failed to open the result cache.\n");
     return;
   }
 
-  RpcClientBinding cl1(endpoint1);
-  RpcClientBinding cl2(endpoint2);
+  BaselineStore baselines;
+  if (useBaseline && !baselines.Open(input.options.baselineDirectory)) {
+    return;
+  }
+
+  RpcClientBinding cl1(input.endpoint1);
+  RpcClientBinding cl2(input.endpoint2);
 
   FileMapping map1;
   HRESULT hr = ExceptionSafe([&]() {
     DWORD h;
     HRESULT hr = c_EnsureFileMapping(cl1,
-                                     backFile1,
+                                     input.backFile1,
                                      /*forceUpdate*/false,
                                      &h);
     if (SUCCEEDED(hr))
@@ -390,69 +1044,505 @@ void BatchRun(std::istream &is,
   if (FAILED(hr)) return;
 
   FileMapping map2;
-  hr = ExceptionSafe([&]() {
-    DWORD h;
-    HRESULT hr = c_EnsureFileMapping(cl2,
-                                     backFile2,
-                                     /*forceUpdate*/false,
-                                     &h);
-    if (SUCCEEDED(hr))
-      map2.Attach(ULongToHandle(h));
-    return hr;
-  });
-  if (FAILED(hr)) return;
+  FileMapping::View view2;
+  if (!useBaseline) {
+    hr = ExceptionSafe([&]() {
+      DWORD h;
+      HRESULT hr = c_EnsureFileMapping(cl2,
+                                       input.backFile2,
+                                       /*forceUpdate*/false,
+                                       &h);
+      if (SUCCEEDED(hr))
+        map2.Attach(ULongToHandle(h));
+      return hr;
+    });
+    if (FAILED(hr)) return;
+
+    view2 = map2.CreateMappedView(FILE_MAP_READ, 0);
+  }
 
   auto view1 = map1.CreateMappedView(FILE_MAP_READ, 0);
-  auto view2 = map2.CreateMappedView(FILE_MAP_READ, 0);
-
-  for (std::string line; std::getline(is, line); ) {
-    if (line.size() > 0
-        && line[0] != '#'
-        && line[0] != ';') {
-      std::istringstream iss(line);
-      std::vector<std::string> cols;
-      for (std::string token; std::getline(iss, token, '\t'); )
-        cols.push_back(token);
-
-      const auto id = cols[colId].c_str();
-      if (cols.size() > colHeight) {
-        const auto urlBlob = toWideString(cols[colUrl].c_str());
-        const auto url = urlBlob.As<WCHAR>();
-        SimpleBitmap image1, image2;
+  const auto viewSize1 = GetViewSize(view1);
+  const auto viewSize2 = GetViewSize(view2);
+
+  static const LPCWSTR verdictLabels[] = {
+    L"",
+    L"\t(same by perceptual hash)",
+    L"\t(different by perceptual hash)",
+    L"\tpassed",
+    L"\tfailed",
+  };
+  const Manifest::Shard shard = {input.shardIndex, input.shardCount};
+  PerceptualIndex failures;
+  TileGrid tiles;
+  FrameAligner aligner;
+  DiffMask mask;
+  std::vector<DWORD> worstTiles;
+  Blob urlBuffer;
+  SIZE_T sampledRows = 0, escalatedRows = 0;
+  for (SIZE_T i = 0; i < manifest.Count(); ++i) {
+    const auto row = manifest.GetRow(i);
+    if (!manifest.IsInShard(row, shard)) continue;
+
+    const auto id = row[Manifest::colId];
+    if (row.Count() > Manifest::colHeight) {
+      const auto urlAscii = row[Manifest::colUrl];
+      const auto url = toWideString(urlAscii, urlBuffer);
+      if (!url) break;
+
+      const auto viewWidth = row.GetUInt(Manifest::colWidth);
+      const auto viewHeight = row.GetUInt(Manifest::colHeight);
+      SimpleBitmap image1, image2;
+      if (useBaseline) {
+        RpcClientBinding *clients[] = {&cl1};
+        hr = NavigateAndCapture(clients,
+                                1,
+                                url,
+                                viewWidth,
+                                viewHeight,
+                                row.GetUInt(Manifest::colWait),
+                                input.options.bitCount,
+                                &image1);
+      }
+      else {
         hr = NavigateAndCapture(cl1, cl2,
                                 url,
-                                atoi(cols[colWidth].c_str()),
-                                atoi(cols[colHeight].c_str()),
-                                atoi(cols[colWait].c_str()),
+                                viewWidth,
+                                viewHeight,
+                                row.GetUInt(Manifest::colWait),
+                                input.options.bitCount,
                                 image1, image2);
-        if (SUCCEEDED(hr)) {
-          image1.bits_ = view1;
+      }
+      if (SUCCEEDED(hr)) {
+        image1.bits_ = view1;
+        image1.fingerprint_ = FindFingerprint(image1, viewSize1);
+        if (!useBaseline) {
           image2.bits_ = view2;
-          DiffOutput output;
-          if (GrayscaleDiff(erosionDiff,
-                            image1,
-                            image2,
-                            output,
-                            /*diffImage*/nullptr)) {
-            Log(L"%hs\t%hs\t%f\n",
-                cols[colId].c_str(),
-                cols[colUrl].c_str(),
-                output.psnr_area_vs_smooth);
-          }
+          image2.fingerprint_ = FindFingerprint(image2, viewSize2);
         }
         else {
-          Log(L"E> id:%hs NavigateAndCapture failed - %08x\n", id, hr);
-          if (HRESULT_CODE(hr) == RPC_S_SERVER_UNAVAILABLE
-              || HRESULT_CODE(hr) == ERROR_BUSY) {
-            break;
+          const auto status = LoadBaseline(baselines, id, image1, image2);
+          if (status == BaselineStore::unusable) {
+            Log(L"E> id:%.*hs Unusable baseline\n",
+                static_cast<int>(id.size()), id.data());
+            continue;
+          }
+          if (status == BaselineStore::absent) {
+            if (input.options.baselineUpdate == baselineKeep) {
+              Log(L"E> id:%.*hs No baseline\n",
+                  static_cast<int>(id.size()), id.data());
+            }
+            else if (baselines.Save(id, image1)) {
+              Log(L"N> %.*hs\tnew baseline\n",
+                  static_cast<int>(id.size()), id.data());
+            }
+            else {
+              Log(L"E> id:%.*hs Failed to save the baseline\n",
+                  static_cast<int>(id.size()), id.data());
+            }
+            continue;
+          }
+        }
+        // A mask is built for the size of the captured frames.
+        const auto maskSpec = row[Manifest::colMask];
+        bool masked = false;
+        if (!maskSpec.empty()) {
+          if (!mask.Parse(maskSpec, image1.width_, image1.height_)) {
+            Log(L"E> id:%.*hs Invalid mask\n",
+                static_cast<int>(id.size()), id.data());
+            continue;
+          }
+          masked = true;
+        }
+        else if (input.options.maskDirectory) {
+          masked = LoadLearnedMask(input.options.maskDirectory,
+                                   url,
+                                   viewWidth,
+                                   viewHeight,
+                                   image1,
+                                   mask);
+        }
+        DiffOutput output;
+        if (DiffFrames(input.cacheFile ? &cache : nullptr,
+                       input.options,
+                       url,
+                       viewWidth,
+                       viewHeight,
+                       input.algo,
+                       image1,
+                       image2,
+                       output,
+                       /*diffImage*/nullptr,
+                       masked ? &mask : nullptr,
+                       input.worstTiles || input.options.histogram
+                         ? &tiles : nullptr,
+                       aligner)) {
+          // A failed row also tells how much of the frame was diffed.
+          Log(output.verdict == verdictFailed
+                ? L"%.*hs\t%.*hs\t%f%s\t%.1f%%\n"
+                : L"%.*hs\t%.*hs\t%f%s\n",
+              static_cast<int>(id.size()), id.data(),
+              static_cast<int>(urlAscii.size()), urlAscii.data(),
+              output.psnr_area_vs_smooth,
+              verdictLabels[output.verdict],
+              output.coverage * 100);
+          if (output.offset_x || output.offset_y) {
+            Log(L"A> %.*hs\t%d\t%d\n",
+                static_cast<int>(id.size()), id.data(),
+                output.offset_x,
+                output.offset_y);
+          }
+          for (const auto &band : aligner.Bands()) {
+            Log(L"R> %.*hs\t%s\t%u\t%u\n",
+                static_cast<int>(id.size()), id.data(),
+                band.inserted ? L"inserted" : L"deleted",
+                band.first,
+                band.count);
+          }
+          if (input.options.histogram && output.distribution.pixels) {
+            const auto &distribution = output.distribution;
+            Log(L"H> %.*hs\t%u\t%u\t%u\t%u\t%I64u\n",
+                static_cast<int>(id.size()), id.data(),
+                distribution.p50,
+                distribution.p95,
+                distribution.p99,
+                distribution.maxAbsDiff,
+                distribution.overTolerance);
+          }
+          if (input.options.edgeScore) {
+            Log(L"D> %.*hs\t%f\n",
+                static_cast<int>(id.size()), id.data(),
+                output.edge_psnr);
+          }
+          if (input.options.sampleTiles
+              && (output.verdict == verdictPassed
+                  || output.verdict == verdictFailed)) {
+            ++sampledRows;
+            if (output.escalated) {
+              ++escalatedRows;
+            }
+          }
+          if (IsFailure(output)) {
+            if (input.worstTiles) {
+              LogWorstTiles(id, tiles, input.worstTiles, worstTiles);
+            }
+            DiffMetricsOutput metrics;
+            if (input.failureMetrics
+                && GrayscaleDiffMetrics(input.failureMetrics,
+                                        image1,
+                                        image2,
+                                        metrics)) {
+              LogMetrics(id, metrics);
+            }
+            if (input.groupRadius) {
+              failures.Insert(GetPerceptualHash(image1),
+                              GetPerceptualHash(image2),
+                              i);
+            }
+          }
+          // The baseline is replaced last, as the frame of image2 is
+          // unmapped with it.
+          if (useBaseline
+              && input.options.baselineUpdate == baselineAll
+              && !RefreshBaseline(baselines, id, image1, image2)) {
+            Log(L"E> id:%.*hs Failed to save the baseline\n",
+                static_cast<int>(id.size()), id.data());
           }
         }
       }
       else {
-        Log(L"E> %id:%hs Skipping invalid line\n", id);
+        Log(L"E> id:%.*hs NavigateAndCapture failed - %08x\n",
+            static_cast<int>(id.size()), id.data(),
+            hr);
+        if (HRESULT_CODE(hr) == RPC_S_SERVER_UNAVAILABLE
+            || HRESULT_CODE(hr) == ERROR_BUSY) {
+          break;
+        }
+      }
+    }
+    else {
+      Log(L"E> id:%.*hs Skipping invalid line\n",
+          static_cast<int>(id.size()), id.data());
+    }
+  }
+
+  if (sampledRows > 0) {
+    Log(L"S> %Iu of %Iu sampled rows escalated to a full diff (%.1f%%)\n",
+        escalatedRows,
+        sampledRows,
+        100.0 * escalatedRows / sampledRows);
+  }
+  if (failures.Count() > 0) {
+    LogFailureGroups(manifest, failures, input.groupRadius);
+  }
+}
+
+void MatrixRun(const MatrixInput &input, std::istream &is) {
+  const SIZE_T defaultSize = 1 << 26; // Use 64MB as a new backfile
+  const UINT count = input.count;
+  if (count < 2 || count > MatrixInput::maxEndpoints) {
+    Log(L"A matrix takes 2 to %u endpoints.\n", MatrixInput::maxEndpoints);
+    return;
+  }
+  for (UINT i = 0; i < count; ++i) {
+    if (!EnsureFile(input.backFiles[i], defaultSize)) {
+      return;
+    }
+  }
+
+  Manifest manifest;
+  if (input.manifest ? !manifest.Load(input.manifest)
+                     : !manifest.Load(is)) {
+    Log(L"Failed to load the manifest.\n");
+    return;
+  }
+
+  // A binding frees its handle when destroyed, so bindings are not moved.
+  std::vector<std::unique_ptr<RpcClientBinding>> bindings;
+  std::vector<RpcClientBinding*> clients;
+  std::vector<FileMapping> maps(count);
+  std::vector<FileMapping::View> views;
+  std::vector<SIZE_T> viewSizes;
+  for (UINT i = 0; i < count; ++i) {
+    bindings.emplace_back(new RpcClientBinding(input.endpoints[i]));
+    clients.push_back(bindings.back().get());
+    const HRESULT hr = ExceptionSafe([&]() {
+      DWORD h;
+      HRESULT hr = c_EnsureFileMapping(*clients[i],
+                                       input.backFiles[i],
+                                       /*forceUpdate*/false,
+                                       &h);
+      if (SUCCEEDED(hr))
+        maps[i].Attach(ULongToHandle(h));
+      return hr;
+    });
+    if (FAILED(hr)) return;
+
+    views.push_back(maps[i].CreateMappedView(FILE_MAP_READ, 0));
+    viewSizes.push_back(GetViewSize(views.back()));
+  }
+
+  const Manifest::Shard shard = {input.shardIndex, input.shardCount};
+  std::vector<SimpleBitmap> frames(count);
+  std::vector<double> scores;
+  std::wstring line;
+  Blob urlBuffer;
+  for (SIZE_T i = 0; i < manifest.Count(); ++i) {
+    const auto row = manifest.GetRow(i);
+    if (!manifest.IsInShard(row, shard)) continue;
+
+    const auto id = row[Manifest::colId];
+    if (row.Count() <= Manifest::colHeight) {
+      Log(L"E> id:%.*hs Skipping invalid line\n",
+          static_cast<int>(id.size()), id.data());
+      continue;
+    }
+
+    const auto url = toWideString(row[Manifest::colUrl], urlBuffer);
+    if (!url) break;
+
+    const HRESULT hr = NavigateAndCapture(clients.data(),
+                                          count,
+                                          url,
+                                          row.GetUInt(Manifest::colWidth),
+                                          row.GetUInt(Manifest::colHeight),
+                                          row.GetUInt(Manifest::colWait),
+                                          /*bitCount*/8,
+                                          frames.data());
+    if (FAILED(hr)) {
+      Log(L"E> id:%.*hs NavigateAndCapture failed - %08x\n",
+          static_cast<int>(id.size()), id.data(),
+          hr);
+      if (HRESULT_CODE(hr) == RPC_S_SERVER_UNAVAILABLE
+          || HRESULT_CODE(hr) == ERROR_BUSY) {
+        break;
+      }
+      continue;
+    }
+
+    for (UINT j = 0; j < count; ++j) {
+      frames[j].bits_ = views[j];
+      frames[j].fingerprint_ = FindFingerprint(frames[j], viewSizes[j]);
+    }
+    if (!GrayscaleDiffMatrix(frames.data(), count, scores)) {
+      Log(L"E> id:%.*hs Failed to diff the frames\n",
+          static_cast<int>(id.size()), id.data());
+      continue;
+    }
+    line.clear();
+    for (auto score : scores) {
+      WCHAR buffer[32];
+      swprintf_s(buffer, L"\t%f", score);
+      line += buffer;
+    }
+    Log(L"X> %.*hs%s\n",
+        static_cast<int>(id.size()), id.data(),
+        line.c_str());
+  }
+}
+
+void LearnMasks(const LearnMaskInput &input, std::istream &is) {
+  const SIZE_T defaultSize = 1 << 26; // Use 64MB as a new backfile
+  if (input.captures < 2 || !input.maskDirectory) {
+    Log(L"A mask is learned from two captures or more into a directory.\n");
+    return;
+  }
+  if (!EnsureFile(input.backFile, defaultSize)) {
+    return;
+  }
+
+  Manifest manifest;
+  if (input.manifest ? !manifest.Load(input.manifest)
+                     : !manifest.Load(is)) {
+    Log(L"Failed to load the manifest.\n");
+    return;
+  }
+
+  RpcClientBinding cl(input.endpoint);
+  FileMapping map;
+  HRESULT hr = ExceptionSafe([&]() {
+    DWORD h;
+    HRESULT hr = c_EnsureFileMapping(cl,
+                                     input.backFile,
+                                     /*forceUpdate*/false,
+                                     &h);
+    if (SUCCEEDED(hr))
+      map.Attach(ULongToHandle(h));
+    return hr;
+  });
+  if (FAILED(hr)) return;
+
+  auto view = map.CreateMappedView(FILE_MAP_READ, 0);
+  RpcClientBinding *clients[] = {&cl};
+  VolatilityAccumulator accumulator;
+  DiffMask mask;
+  Blob urlBuffer;
+  for (SIZE_T i = 0; i < manifest.Count(); ++i) {
+    const auto row = manifest.GetRow(i);
+    const auto id = row[Manifest::colId];
+    if (row.Count() <= Manifest::colHeight) {
+      Log(L"E> id:%.*hs Skipping invalid line\n",
+          static_cast<int>(id.size()), id.data());
+      continue;
+    }
+
+    const auto urlAscii = row[Manifest::colUrl];
+    const auto url = toWideString(urlAscii, urlBuffer);
+    if (!url) break;
+
+    // Each capture is added before the next one overwrites the view.  The
+    // page is invalidated first, or a server with a render cache would
+    // serve the first frame again and nothing would vary.
+    const auto viewWidth = row.GetUInt(Manifest::colWidth);
+    const auto viewHeight = row.GetUInt(Manifest::colHeight);
+    SimpleBitmap image;
+    UINT captured = 0;
+    for (; captured < input.captures; ++captured) {
+      hr = ExceptionSafe([&]() {
+        return c_Invalidate(cl, url, viewWidth, viewHeight);
+      });
+      if (FAILED(hr)) break;
+
+      hr = NavigateAndCapture(clients,
+                              1,
+                              url,
+                              viewWidth,
+                              viewHeight,
+                              row.GetUInt(Manifest::colWait),
+                              /*bitCount*/8,
+                              &image);
+      if (FAILED(hr)) break;
+
+      image.bits_ = view;
+      if ((captured == 0
+           && !accumulator.Reset(image.width_, image.height_))
+          || !accumulator.Add(image)) {
+        hr = E_FAIL;
+        break;
+      }
+    }
+    const auto path = GetLearnedMaskPath(input.maskDirectory,
+                                         url,
+                                         viewWidth,
+                                         viewHeight);
+    if (FAILED(hr)
+        || !accumulator.BuildMask(input.maxStdDev, mask)
+        || !mask.Save(path.c_str())) {
+      Log(L"E> id:%.*hs Failed to learn a mask - %08x\n",
+          static_cast<int>(id.size()), id.data(),
+          hr);
+      if (HRESULT_CODE(hr) == RPC_S_SERVER_UNAVAILABLE
+          || HRESULT_CODE(hr) == ERROR_BUSY) {
+        break;
+      }
+      continue;
+    }
+
+    const double pixels =
+      static_cast<double>(mask.Width()) * mask.Height();
+    const ULONGLONG excluded =
+      static_cast<ULONGLONG>(pixels) - mask.IncludedPixels();
+    Log(L"L> %.*hs\t%.*hs\t%I64u\t%.2f%%\t%hs\n",
+        static_cast<int>(id.size()), id.data(),
+        static_cast<int>(urlAscii.size()), urlAscii.data(),
+        excluded,
+        100.0 * excluded / pixels,
+        path.c_str());
+  }
+}
+
+void BenchmarkDiff(UINT width, UINT height, UINT iterations) {
+  // Strokes of a few pixels on a light background stand for text, and
+  // the second frame differs in the levels of the edges of every stroke,
+  // as anti-aliasing differs between endpoints, and in one solid block.
+  SimpleBitmap image1(8, width, height, nullptr);
+  SimpleBitmap image2(8, width, height, nullptr);
+  const SIZE_T size = static_cast<SIZE_T>(image1.GetLineSize()) * height;
+  Blob bits1(size), bits2(size);
+  if (iterations == 0 || bits1.Size() < size || bits2.Size() < size) {
+    return;
+  }
+  image1.bits_ = bits1;
+  image2.bits_ = bits2;
+  for (UINT y = 0; y < height; ++y) {
+    const auto line1 = image1.bits_ + y * image1.GetLineSize();
+    const auto line2 = image2.bits_ + y * image2.GetLineSize();
+    for (UINT x = 0; x < width; ++x) {
+      const UINT phase = (x + y / 3) % 11;
+      const bool stroke = y % 24 < 16 && phase < 3;
+      const bool edge = y % 24 < 16 && (phase == 3 || phase == 10);
+      line1[x] = static_cast<BYTE>(stroke ? 0x20 : edge ? 0x90 : 0xf8);
+      line2[x] = static_cast<BYTE>(stroke ? 0x20 : edge ? 0x70 : 0xf8);
+      if (x >= width / 2 && x < width / 2 + 40
+          && y >= height / 2 && y < height / 2 + 40) {
+        line2[x] = 0x40;
+      }
+    }
+  }
+
+  LARGE_INTEGER frequency;
+  QueryPerformanceFrequency(&frequency);
+  Log(L"B> %ux%u, %u iterations\n", width, height, iterations);
+  for (UINT algo = skipDiff; algo <= edgeDiff; ++algo) {
+    DiffOutput output = {};
+    LARGE_INTEGER start, end;
+    QueryPerformanceCounter(&start);
+    for (UINT i = 0; i < iterations; ++i) {
+      if (!GrayscaleDiff(static_cast<DiffAlgorithm>(algo),
+                         image1,
+                         image2,
+                         output,
+                         /*diffImagePath*/nullptr)) {
+        break;
       }
     }
+    QueryPerformanceCounter(&end);
+    Log(L"B> algo %u\t%.2f msec/frame\t%f\n",
+        algo,
+        (end.QuadPart - start.QuadPart) * 1000.0
+          / frequency.QuadPart / iterations,
+        output.psnr_area_vs_smooth);
   }
 }
 
-} // namespace curve
\ No newline at end of file
+} // namespace curve
@@ -0,0 +1,270 @@
+#include <windows.h>
+#include <emmintrin.h>
+#include <assert.h>
+#include <string.h>
+#include <vector>
+#include "blob.h"
+#include "curvecore.h"
+#include "tiles.h"
+#include "parallel.h"
+#include "edges.h"
+
+// Sets |smooth| to a + 2b + c and |delta| to c - a of lines a, b, and c
+// around a line, one sum a pixel from index 1 on.  Index 0 and |width| + 1
+// repeat the pixels at the edge.
+static void SumColumns(LPCBYTE a,
+                       LPCBYTE b,
+                       LPCBYTE c,
+                       DWORD width,
+                       short *smooth,
+                       short *delta) {
+  const __m128i zero = _mm_setzero_si128();
+  DWORD x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const __m128i va =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x));
+    const __m128i vb =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+    const __m128i vc =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(c + x));
+    const __m128i a0 = _mm_unpacklo_epi8(va, zero);
+    const __m128i a1 = _mm_unpackhi_epi8(va, zero);
+    const __m128i b0 = _mm_unpacklo_epi8(vb, zero);
+    const __m128i b1 = _mm_unpackhi_epi8(vb, zero);
+    const __m128i c0 = _mm_unpacklo_epi8(vc, zero);
+    const __m128i c1 = _mm_unpackhi_epi8(vc, zero);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(smooth + x + 1),
+                     _mm_add_epi16(_mm_add_epi16(a0, c0),
+                                   _mm_add_epi16(b0, b0)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(smooth + x + 9),
+                     _mm_add_epi16(_mm_add_epi16(a1, c1),
+                                   _mm_add_epi16(b1, b1)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(delta + x + 1),
+                     _mm_sub_epi16(c0, a0));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(delta + x + 9),
+                     _mm_sub_epi16(c1, a1));
+  }
+  for (; x < width; ++x) {
+    smooth[x + 1] = static_cast<short>(a[x] + 2 * b[x] + c[x]);
+    delta[x + 1] = static_cast<short>(c[x] - a[x]);
+  }
+  smooth[0] = smooth[1];
+  delta[0] = delta[1];
+  smooth[width + 1] = smooth[width];
+  delta[width + 1] = delta[width];
+}
+
+// Sets |magnitudes| to (|gx| + |gy|) / 8 of a line from the sums of
+// SumColumns, where gx is the [-1 0 1] difference of |smooth| and gy the
+// [1 2 1] sum of |delta|.  Both are within +-1020, so their sum fits 16-bit
+// lanes and the magnitude a byte.
+static void SumRows(const short *smooth,
+                    const short *delta,
+                    DWORD width,
+                    PBYTE magnitudes) {
+  const __m128i zero = _mm_setzero_si128();
+  DWORD x = 0;
+  for (; x + 8 <= width; x += 8) {
+    const __m128i left =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(smooth + x));
+    const __m128i right =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(smooth + x + 2));
+    const __m128i d0 =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(delta + x));
+    const __m128i d1 =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(delta + x + 1));
+    const __m128i d2 =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(delta + x + 2));
+    const __m128i gx = _mm_sub_epi16(right, left);
+    const __m128i gy = _mm_add_epi16(_mm_add_epi16(d0, d2),
+                                     _mm_add_epi16(d1, d1));
+    const __m128i magnitude =
+      _mm_add_epi16(_mm_max_epi16(gx, _mm_sub_epi16(zero, gx)),
+                    _mm_max_epi16(gy, _mm_sub_epi16(zero, gy)));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(magnitudes + x),
+                     _mm_packus_epi16(_mm_srli_epi16(magnitude, 3), zero));
+  }
+  for (; x < width; ++x) {
+    const int gx = smooth[x + 2] - smooth[x];
+    const int gy = delta[x] + 2 * delta[x + 1] + delta[x + 2];
+    magnitudes[x] =
+      static_cast<BYTE>(((gx < 0 ? -gx : gx) + (gy < 0 ? -gy : gy)) >> 3);
+  }
+}
+
+EdgeDiffer::EdgeDiffer()
+  : stride_(0)
+{}
+
+// A slot is the lines of one thread: the two lines of sums of each frame,
+// and a line of magnitudes of each frame.  The buffer only grows.
+bool EdgeDiffer::Prepare(DWORD width, DWORD height, DWORD slots) {
+  stride_ = (width + 2 + 7) & ~7u;
+  const SIZE_T slotSize = stride_ * (4 * sizeof(short) + 2);
+  if (buffers_.Size() < slotSize * slots
+      && !buffers_.Alloc(slotSize * slots)) {
+    return false;
+  }
+  sums_.assign((height + TileGrid::tileSize - 1) / TileGrid::tileSize, 0);
+  return true;
+}
+
+void EdgeDiffer::DiffLine(const curve::SimpleBitmap &image1,
+                          const curve::SimpleBitmap &image2,
+                          DWORD y,
+                          PBYTE buffer,
+                          ULONGLONG &sse,
+                          TileGrid *tiles) const {
+  const DWORD width = image1.width_;
+  const DWORD above = y > 0 ? y - 1 : y;
+  const DWORD below = y + 1 < image1.height_ ? y + 1 : y;
+  const LONG lineSize1 = image1.GetLineSize();
+  const LONG lineSize2 = image2.GetLineSize();
+  const auto line1 = [&](DWORD i) {
+    return image1.bits_ + static_cast<LONG_PTR>(i) * lineSize1;
+  };
+  const auto line2 = [&](DWORD i) {
+    return image2.bits_ + static_cast<LONG_PTR>(i) * lineSize2;
+  };
+  if (memcmp(line1(above), line2(above), width) == 0
+      && memcmp(line1(y), line2(y), width) == 0
+      && memcmp(line1(below), line2(below), width) == 0) {
+    return;
+  }
+
+  const auto sums = reinterpret_cast<short*>(buffer);
+  const auto magnitudes1 = buffer + stride_ * 4 * sizeof(short);
+  const auto magnitudes2 = magnitudes1 + stride_;
+  SumColumns(line1(above),
+             line1(y),
+             line1(below),
+             width,
+             sums,
+             sums + stride_);
+  SumRows(sums, sums + stride_, width, magnitudes1);
+  SumColumns(line2(above),
+             line2(y),
+             line2(below),
+             width,
+             sums + stride_ * 2,
+             sums + stride_ * 3);
+  SumRows(sums + stride_ * 2, sums + stride_ * 3, width, magnitudes2);
+  if (tiles) {
+    sse += tiles->Accumulate(magnitudes1, 0, magnitudes2, 0, y, y + 1);
+  }
+  else {
+    // The squares of a line of up to 66,000 pixels fit DiffTile's sums.
+    TileGrid::Tile line = {};
+    TileGrid::DiffTile(magnitudes1,
+                       0,
+                       magnitudes2,
+                       0,
+                       width,
+                       /*height*/1,
+                       /*mask*/nullptr,
+                       /*maskStride*/0,
+                       /*histogram*/nullptr,
+                       line,
+                       sse);
+  }
+}
+
+bool EdgeDiffer::Diff(const curve::SimpleBitmap &image1,
+                      const curve::SimpleBitmap &image2,
+                      ULONGLONG &sse,
+                      TileGrid *tiles) {
+  if (image1.bitCount_ != 8 || image2.bitCount_ != 8
+      || image1.width_ != image2.width_
+      || image1.height_ != image2.height_
+      || image1.width_ == 0 || image1.height_ == 0) {
+    return false;
+  }
+
+  // A slot for each thread takes the next row of tiles from a counter they
+  // share, so that uneven rows balance out as with ParallelFor alone.
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  const DWORD tileRows =
+    (image1.height_ + TileGrid::tileSize - 1) / TileGrid::tileSize;
+  const DWORD slots = info.dwNumberOfProcessors < tileRows
+                      ? info.dwNumberOfProcessors : tileRows;
+  if (!Prepare(image1.width_, image1.height_, slots ? slots : 1)) {
+    return false;
+  }
+  const SIZE_T slotSize = stride_ * (4 * sizeof(short) + 2);
+  volatile LONG next = 0;
+  auto diffSlot = [&](LONG slot) {
+    const PBYTE buffer = buffers_ + slotSize * slot;
+    for (;;) {
+      const LONG row = InterlockedIncrement(&next) - 1;
+      if (row >= static_cast<LONG>(tileRows)) break;
+
+      const DWORD top = row * TileGrid::tileSize;
+      const DWORD bottom = top + TileGrid::tileSize < image1.height_
+                           ? top + TileGrid::tileSize : image1.height_;
+      ULONGLONG rowSSE = 0;
+      for (DWORD y = top; y < bottom; ++y) {
+        DiffLine(image1, image2, y, buffer, rowSSE, tiles);
+      }
+      sums_[row] = rowSSE;
+    }
+  };
+  ParallelFor(static_cast<LONG>(slots ? slots : 1), diffSlot);
+
+  sse = 0;
+  for (auto rowSSE : sums_) {
+    sse += rowSSE;
+  }
+  return true;
+}
+
+void Test_EdgeDiffer() {
+  // A box outlined in black on white, whose right border moves by a pixel
+  // in the second frame, and a frame that is only darker than the first.
+  const DWORD width = 40, height = 20, lineSize = 40;
+  BYTE bits1[lineSize * height];
+  BYTE bits2[lineSize * height];
+  BYTE bits3[lineSize * height];
+  for (DWORD y = 0; y < height; ++y) {
+    for (DWORD x = 0; x < width; ++x) {
+      const bool inside = y >= 4 && y < 16;
+      bits1[y * lineSize + x] = inside && (x == 4 || x == 30) ? 0 : 0xf0;
+      bits2[y * lineSize + x] = inside && (x == 4 || x == 31) ? 0 : 0xf0;
+      bits3[y * lineSize + x] = bits1[y * lineSize + x] / 2 + 8;
+    }
+  }
+  curve::SimpleBitmap image1(8, width, height, bits1);
+  curve::SimpleBitmap image2(8, width, height, bits2);
+  curve::SimpleBitmap image3(8, width, height, bits3);
+
+  EdgeDiffer differ;
+  ULONGLONG sse = 1;
+  assert(differ.Diff(image1, image1, sse, nullptr) && sse == 0);
+
+  // Inside the box, the edges of the first frame are at x = 29 and 31,
+  // and those of the second at x = 30 and 32, of 4 * 0xf0 / 8 each.
+  TileGrid tiles;
+  assert(tiles.Reset(width, height));
+  assert(differ.Diff(image1, image2, sse, &tiles));
+  assert(tiles.At(0, 0).maxAbsDiff == 0x78);
+  assert(tiles.At(1, 0).changedPixels >= 12);
+  assert(tiles.At(1, 0).maxAbsDiff == 0x78);
+
+  // The result does not depend on the slot a row was diffed in, nor on
+  // the tiles.
+  ULONGLONG again = 0;
+  assert(differ.Diff(image1, image2, again, nullptr) && again == sse);
+
+  // Darkening halves the edges, but the levels differ everywhere.
+  ULONGLONG plain = 0;
+  for (DWORD i = 0; i < lineSize * height; ++i) {
+    const int d = bits1[i] - bits3[i];
+    plain += d * d;
+  }
+  assert(differ.Diff(image1, image3, sse, nullptr));
+  assert(sse > 0 && sse * 10 < plain);
+
+  // Frames of different sizes fail.
+  curve::SimpleBitmap part(8, 32, height, bits1);
+  assert(!differ.Diff(image1, part, sse, nullptr));
+}
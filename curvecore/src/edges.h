@@ -0,0 +1,39 @@
+// Compares the edges of two 8bpp frames of the same size instead of their
+// levels, so that a border or a box that moved by a pixel stands out even
+// where the levels barely differ.  The edge map of a frame is the Sobel
+// gradient magnitude (|gx| + |gy|) / 8, a level of 0 to 255, and its
+// difference is scored as the difference of two frames is.
+//
+// The gradients are computed a line at a time in the pass that diffs them,
+// with SSE2 on 8 pixels at a time, from the vertical [1 2 1] and [-1 0 1]
+// sums of the three lines around it.  Neither edge map is stored as a
+// whole; each thread has lines of sums and magnitudes of its own, which are
+// kept for the next pair of frames.  Lines whose three source lines are
+// equal in both frames are skipped, and rows of tiles run in parallel.
+class EdgeDiffer {
+private:
+  Blob buffers_; // Lines of sums and magnitudes of each thread
+  DWORD stride_; // Elements of a line of sums
+  std::vector<ULONGLONG> sums_; // SSE of each row of tiles
+
+  bool Prepare(DWORD width, DWORD height, DWORD slots);
+  void DiffLine(const curve::SimpleBitmap &image1,
+                const curve::SimpleBitmap &image2,
+                DWORD y,
+                PBYTE buffer,
+                ULONGLONG &sse,
+                TileGrid *tiles) const;
+
+public:
+  EdgeDiffer();
+
+  // Sets |sse| to the sum of squared differences of the edge maps of
+  // |image1| and |image2|.  Pixels at the edge of a frame take the pixels
+  // beyond it from the nearest ones.  With |tiles|, which must cover the
+  // frames, they hold the statistics of the edge maps.  Returns false if
+  // the frames are not 8bpp frames of the same size.
+  bool Diff(const curve::SimpleBitmap &image1,
+            const curve::SimpleBitmap &image2,
+            ULONGLONG &sse,
+            TileGrid *tiles);
+};
@@ -132,6 +132,55 @@ cleanup:
   return !!section_;
 }
 
+bool FileMapping::CreateReadOnly(LPCWSTR filename,
+                                 ULARGE_INTEGER &fileSize) {
+  Release();
+  section_ = nullptr;
+  fileSize.QuadPart = 0;
+
+  HANDLE mappedFile = CreateFile(filename,
+                                 GENERIC_READ,
+                                 FILE_SHARE_READ,
+                                 /*lpSecurityAttributes*/nullptr,
+                                 OPEN_EXISTING,
+                                 FILE_ATTRIBUTE_NORMAL,
+                                 /*hTemplateFile*/nullptr);
+  if (mappedFile == INVALID_HANDLE_VALUE) {
+    Log(L"CreateFile(%s) failed - %08x\n", filename, GetLastError());
+    goto cleanup;
+  }
+
+  LARGE_INTEGER ll;
+  if (!GetFileSizeEx(mappedFile, &ll)) {
+    Log(L"GetFileSizeEx failed - %08x\n", GetLastError());
+    goto cleanup;
+  }
+  fileSize.QuadPart = ll.QuadPart;
+
+  // CreateFileMapping fails on an empty file.  Succeed without a section
+  // so that the caller can treat it as an empty mapping.
+  if (fileSize.QuadPart == 0) {
+    CloseHandle(mappedFile);
+    return true;
+  }
+
+  section_ = CreateFileMapping(mappedFile,
+                               /*lpFileMappingAttributes*/nullptr,
+                               PAGE_READONLY,
+                               /*dwMaximumSizeHigh*/0,
+                               /*dwMaximumSizeLow*/0,
+                               /*lpName*/nullptr);
+  if (!section_) {
+    Log(L"CreateFileMapping failed - %08x\n", GetLastError());
+  }
+
+cleanup:
+  if (mappedFile != INVALID_HANDLE_VALUE) {
+    CloseHandle(mappedFile);
+  }
+  return !!section_;
+}
+
 bool FileMapping::Open(LPCWSTR sectionName, DWORD desiredAccess) {
   Release();
   section_ = OpenFileMapping(desiredAccess,
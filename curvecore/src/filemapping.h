@@ -35,5 +35,6 @@ public:
   bool Create(LPCWSTR filename,
               LPCWSTR sectionName,
               ULARGE_INTEGER mappingAreaSize);
+  bool CreateReadOnly(LPCWSTR filename, ULARGE_INTEGER &fileSize);
   bool Open(LPCWSTR sectionName, DWORD desiredAccess);
 };
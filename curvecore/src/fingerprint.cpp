@@ -0,0 +1,268 @@
+#include <windows.h>
+#include <assert.h>
+#include <intrin.h>
+#include <nmmintrin.h>
+#include <stddef.h>
+#include <iostream>
+#include <vector>
+#include "blob.h"
+#include "curvecore.h"
+#include "fingerprint.h"
+#include "phash.h"
+
+// Frames are hashed with CRC32C, which SSE4.2 computes at several bytes per
+// cycle.  Two CRC lanes run over alternate 8-byte words and make up a 64-bit
+// hash.  The lanes are independent, so the CPU can overlap them.
+
+static bool HasSSE42() {
+  static INIT_ONCE initOnce = INIT_ONCE_STATIC_INIT;
+  static bool hasSSE42 = false;
+  InitOnceExecuteOnce(&initOnce,
+    [](PINIT_ONCE, PVOID, PVOID*) -> BOOL {
+      int info[4];
+      __cpuid(info, 1);
+      hasSSE42 = (info[2] & (1 << 20)) != 0;
+      return TRUE;
+    },
+    /*Parameter*/nullptr,
+    /*Context*/nullptr);
+  return hasSSE42;
+}
+
+static const UINT *GetCrc32cTable() {
+  static INIT_ONCE initOnce = INIT_ONCE_STATIC_INIT;
+  static UINT table[256];
+  InitOnceExecuteOnce(&initOnce,
+    [](PINIT_ONCE, PVOID, PVOID*) -> BOOL {
+      for (UINT i = 0; i < 256; ++i) {
+        UINT crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+          crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+        }
+        table[i] = crc;
+      }
+      return TRUE;
+    },
+    /*Parameter*/nullptr,
+    /*Context*/nullptr);
+  return table;
+}
+
+static UINT Crc32cSoftware(UINT crc, LPCBYTE p, SIZE_T size) {
+  const auto table = GetCrc32cTable();
+  while (size--) {
+    crc = table[(crc ^ *(p++)) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+static UINT Crc32cHardware(UINT crc, LPCBYTE p, SIZE_T size) {
+  while (size--) {
+    crc = _mm_crc32_u8(crc, *(p++));
+  }
+  return crc;
+}
+
+static void Crc32cPairSoftware(UINT &lane1, UINT &lane2, LPCBYTE p, SIZE_T size) {
+  for (; size >= 16; size -= 16, p += 16) {
+    lane1 = Crc32cSoftware(lane1, p, 8);
+    lane2 = Crc32cSoftware(lane2, p + 8, 8);
+  }
+  lane1 = Crc32cSoftware(lane1, p, size);
+}
+
+static void Crc32cPairHardware(UINT &lane1, UINT &lane2, LPCBYTE p, SIZE_T size) {
+#ifdef _M_X64
+  ULONGLONG c1 = lane1, c2 = lane2;
+  for (; size >= 16; size -= 16, p += 16) {
+    c1 = _mm_crc32_u64(c1, *reinterpret_cast<const ULONGLONG*>(p));
+    c2 = _mm_crc32_u64(c2, *reinterpret_cast<const ULONGLONG*>(p + 8));
+  }
+  lane1 = static_cast<UINT>(c1);
+  lane2 = static_cast<UINT>(c2);
+#else
+  for (; size >= 16; size -= 16, p += 16) {
+    lane1 = _mm_crc32_u32(lane1, *reinterpret_cast<const UINT*>(p));
+    lane1 = _mm_crc32_u32(lane1, *reinterpret_cast<const UINT*>(p + 4));
+    lane2 = _mm_crc32_u32(lane2, *reinterpret_cast<const UINT*>(p + 8));
+    lane2 = _mm_crc32_u32(lane2, *reinterpret_cast<const UINT*>(p + 12));
+  }
+#endif
+  lane1 = Crc32cHardware(lane1, p, size);
+}
+
+ULONGLONG HashBytes(LPCBYTE data, SIZE_T size, ULONGLONG seed) {
+  UINT lane1 = static_cast<UINT>(seed);
+  UINT lane2 = static_cast<UINT>(seed >> 32) ^ 0x9e3779b9;
+  if (HasSSE42()) {
+    Crc32cPairHardware(lane1, lane2, data, size);
+  }
+  else {
+    Crc32cPairSoftware(lane1, lane2, data, size);
+  }
+  return (static_cast<ULONGLONG>(lane1) << 32 | lane2) ^ size;
+}
+
+SIZE_T FrameFingerprint::GetSize(DWORD height) {
+  return offsetof(FrameFingerprint, rowHashes) + sizeof(ULONGLONG) * height;
+}
+
+// The fingerprint follows the pixels, aligned to 8 bytes.
+SIZE_T FrameFingerprint::GetOffset(const curve::SimpleBitmap &image) {
+  const SIZE_T pixels = static_cast<SIZE_T>(image.GetLineSize()) * image.height_;
+  return (pixels + 7) & ~static_cast<SIZE_T>(7);
+}
+
+// Hashes the visible pixels of a line.  The DWORD padding at the end of
+// a line is excluded because GDI does not initialize it.
+ULONGLONG HashRow(const curve::SimpleBitmap &image, DWORD y) {
+  const SIZE_T visibleBytes = (image.width_ * image.bitCount_ + 7) / 8;
+  return HashBytes(image.bits_ + y * image.GetLineSize(), visibleBytes, 0);
+}
+
+ULONGLONG CombineRowHashes(const curve::SimpleBitmap &image,
+                           const ULONGLONG *rowHashes) {
+  const ULONGLONG seed =
+    (static_cast<ULONGLONG>(image.width_) << 32 | image.height_)
+    ^ image.bitCount_;
+  return HashBytes(reinterpret_cast<LPCBYTE>(rowHashes),
+                   sizeof(ULONGLONG) * image.height_,
+                   seed);
+}
+
+ULONGLONG HashFrame(const curve::SimpleBitmap &image) {
+  if (image.fingerprint_) {
+    return image.fingerprint_->frameHash;
+  }
+
+  Blob rowHashes;
+  if (!image.bits_
+      || !rowHashes.Alloc(sizeof(ULONGLONG) * (image.height_ + 1))) {
+    return 0;
+  }
+  auto p = rowHashes.As<ULONGLONG>();
+  for (DWORD y = 0; y < image.height_; ++y) {
+    p[y] = HashRow(image, y);
+  }
+  return CombineRowHashes(image, p);
+}
+
+bool WriteFingerprint(const curve::SimpleBitmap &image,
+                      const ULONGLONG *rowHashes,
+                      LPBYTE view,
+                      SIZE_T viewSize) {
+  const auto offset = FrameFingerprint::GetOffset(image);
+  if (!view || offset + FrameFingerprint::GetSize(image.height_) > viewSize) {
+    return false;
+  }
+
+  auto fingerprint = reinterpret_cast<FrameFingerprint*>(view + offset);
+  fingerprint->magic = 0;
+  fingerprint->bitCount = image.bitCount_;
+  fingerprint->reserved = 0;
+  fingerprint->width = image.width_;
+  fingerprint->height = image.height_;
+  fingerprint->frameHash = CombineRowHashes(image, rowHashes);
+  fingerprint->perceptualHash = PerceptualHash(image);
+  memcpy(fingerprint->rowHashes, rowHashes, sizeof(ULONGLONG) * image.height_);
+  fingerprint->magic = FrameFingerprint::validMagic;
+  return true;
+}
+
+const FrameFingerprint *FindFingerprint(const curve::SimpleBitmap &image,
+                                        SIZE_T viewSize) {
+  const auto offset = FrameFingerprint::GetOffset(image);
+  if (!image.bits_
+      || offset + FrameFingerprint::GetSize(image.height_) > viewSize) {
+    return nullptr;
+  }
+
+  auto fingerprint =
+    reinterpret_cast<const FrameFingerprint*>(image.bits_ + offset);
+  return fingerprint->magic == FrameFingerprint::validMagic
+         && fingerprint->bitCount == image.bitCount_
+         && fingerprint->width == image.width_
+         && fingerprint->height == image.height_
+         ? fingerprint
+         : nullptr;
+}
+
+void Test_FrameFingerprint() {
+  // Both implementations give the CRC32C of the check string, and agree on
+  // any length and alignment, so a client without SSE4.2 gets the hashes
+  // of the server.
+  const char digits[] = "123456789";
+  const auto digitBytes = reinterpret_cast<LPCBYTE>(digits);
+  assert((Crc32cSoftware(~0u, digitBytes, 9) ^ ~0u) == 0xe3069283);
+  if (HasSSE42()) {
+    assert((Crc32cHardware(~0u, digitBytes, 9) ^ ~0u) == 0xe3069283);
+    BYTE bytes[67];
+    for (SIZE_T i = 0; i < sizeof(bytes); ++i) {
+      bytes[i] = static_cast<BYTE>(i * 37);
+    }
+    for (SIZE_T offset = 0; offset < 3; ++offset) {
+      for (SIZE_T size = 0; offset + size <= sizeof(bytes); ++size) {
+        UINT software1 = 1, software2 = 2, hardware1 = 1, hardware2 = 2;
+        Crc32cPairSoftware(software1, software2, bytes + offset, size);
+        Crc32cPairHardware(hardware1, hardware2, bytes + offset, size);
+        assert(software1 == hardware1 && software2 == hardware2);
+      }
+    }
+  }
+
+  // The padding at the end of a line is not hashed.
+  const DWORD width = 5, height = 4, lineSize = 8;
+  BYTE bits1[lineSize * height], bits2[lineSize * height];
+  for (DWORD i = 0; i < sizeof(bits1); ++i) {
+    bits1[i] = static_cast<BYTE>(i * 13);
+  }
+  memcpy(bits2, bits1, sizeof(bits1));
+  for (DWORD y = 0; y < height; ++y) {
+    memset(bits2 + y * lineSize + width, 0xcc, lineSize - width);
+  }
+  curve::SimpleBitmap image1(8, width, height, bits1),
+                      image2(8, width, height, bits2);
+  ULONGLONG rowHashes[height];
+  for (DWORD y = 0; y < height; ++y) {
+    rowHashes[y] = HashRow(image1, y);
+    assert(rowHashes[y] == HashRow(image2, y));
+  }
+  assert(rowHashes[0] != rowHashes[1]);
+  assert(HashFrame(image1) == CombineRowHashes(image1, rowHashes));
+  assert(HashFrame(image1) == HashFrame(image2));
+
+  // A visible pixel or the shape of the frame changes the hashes.
+  curve::SimpleBitmap shorter(8, width, height - 1, bits1);
+  assert(HashFrame(shorter) != HashFrame(image1));
+  bits2[lineSize + 2] ^= 1;
+  assert(HashRow(image2, 1) != rowHashes[1]);
+  assert(HashRow(image2, 2) == rowHashes[2]);
+  assert(HashFrame(image2) != HashFrame(image1));
+
+  // A fingerprint is found after the pixels it was written for only, and
+  // only within the view.
+  const SIZE_T offset = FrameFingerprint::GetOffset(image1);
+  std::vector<BYTE> view(offset + FrameFingerprint::GetSize(height));
+  memcpy(view.data(), bits1, sizeof(bits1));
+  curve::SimpleBitmap mapped(8, width, height, view.data());
+  assert(!FindFingerprint(mapped, view.size()));
+  assert(!WriteFingerprint(mapped, rowHashes, view.data(), view.size() - 1));
+  assert(WriteFingerprint(mapped, rowHashes, view.data(), view.size()));
+  const auto found = FindFingerprint(mapped, view.size());
+  assert(found == reinterpret_cast<FrameFingerprint*>(view.data() + offset));
+  assert(found->frameHash == HashFrame(image1));
+  assert(found->rowHashes[height - 1] == rowHashes[height - 1]);
+  assert(!FindFingerprint(mapped, view.size() - 1));
+
+  auto written = reinterpret_cast<FrameFingerprint*>(view.data() + offset);
+  written->magic ^= 1;
+  assert(!FindFingerprint(mapped, view.size()));
+  written->magic ^= 1;
+  written->bitCount = 24;
+  assert(!FindFingerprint(mapped, view.size()));
+  written->bitCount = 8;
+  written->width = width + 1;
+  assert(!FindFingerprint(mapped, view.size()));
+  written->width = width;
+  assert(FindFingerprint(mapped, view.size()) == found);
+}
@@ -0,0 +1,32 @@
+// Hashes of a captured frame, written by the server right after the pixels
+// in the section shared with clients.  The pixels are hashed line by line
+// while they are still in the cache, so that a client can tell identical
+// frames or lines apart without reading the pixels again.  The perceptual
+// hash from phash.h comes along so that clients need not compute it.
+struct FrameFingerprint {
+  static const DWORD validMagic = 0x32525046; // 'FPR2'
+
+  DWORD magic;
+  WORD bitCount;
+  WORD reserved;
+  DWORD width;
+  DWORD height;
+  ULONGLONG frameHash;
+  ULONGLONG perceptualHash;
+  ULONGLONG rowHashes[1]; // [height]
+
+  static SIZE_T GetSize(DWORD height);
+  static SIZE_T GetOffset(const curve::SimpleBitmap &image);
+};
+
+ULONGLONG HashBytes(LPCBYTE data, SIZE_T size, ULONGLONG seed);
+ULONGLONG HashRow(const curve::SimpleBitmap &image, DWORD y);
+ULONGLONG CombineRowHashes(const curve::SimpleBitmap &image,
+                           const ULONGLONG *rowHashes);
+ULONGLONG HashFrame(const curve::SimpleBitmap &image);
+bool WriteFingerprint(const curve::SimpleBitmap &image,
+                      const ULONGLONG *rowHashes,
+                      LPBYTE view,
+                      SIZE_T viewSize);
+const FrameFingerprint *FindFingerprint(const curve::SimpleBitmap &image,
+                                        SIZE_T viewSize);
@@ -3,7 +3,10 @@
 #include <exdisp.h>
 #include <mshtmhst.h>
 #include <memory>
+#include <string>
+#include <vector>
 #include "resource.h"
+#include "blob.h"
 #include "filemapping.h"
 #include "synchronization.h"
 #include "basewindow.h"
@@ -12,9 +15,57 @@
 #include "container.h"
 #include "mainwindow.h"
 #include "globalcontext.h"
+#include "rendercache.h"
 
 void Log(LPCWSTR format, ...);
 
+// Renders with MainWindow into the section shared with clients.
+class MainWindowRenderer : public Renderer {
+private:
+  GlobalContext &context_;
+
+public:
+  MainWindowRenderer(GlobalContext &context) : context_(context) {}
+
+  HRESULT Navigate(LPCWSTR url,
+                   UINT viewWidth,
+                   UINT viewHeight,
+                   boolean async) {
+    return context_.GetMainWindow().StartNavigate(url,
+                                                  viewWidth,
+                                                  viewHeight,
+                                                  async);
+  }
+
+  HRESULT Capture(WORD bitCount,
+                  UINT &width,
+                  UINT &height,
+                  LPCWSTR saveOnServer) {
+    return context_.GetMainWindow().StartCapture(bitCount,
+                                                 width,
+                                                 height,
+                                                 saveOnServer);
+  }
+
+  bool SaveFrame(Blob &frame, SIZE_T size) {
+    auto view = context_.GetFileMapping().CreateMappedView(FILE_MAP_READ,
+                                                           size);
+    LPCBYTE bits = view;
+    if (!bits || !frame.Alloc(size)) return false;
+    memcpy(frame, bits, size);
+    return true;
+  }
+
+  bool LoadFrame(const Blob &frame) {
+    auto view = context_.GetFileMapping().CreateMappedView(FILE_MAP_WRITE,
+                                                           frame.Size());
+    LPBYTE bits = view;
+    if (!bits) return false;
+    memcpy(bits, frame, frame.Size());
+    return true;
+  }
+};
+
 DWORD WINAPI GlobalContext::UIThreadStart(LPVOID lpParameter) {
   DWORD ret = 0;
   if (auto p = reinterpret_cast<GlobalContext*>(lpParameter)) {
@@ -31,7 +82,9 @@ GlobalContext::GlobalContext()
     uiThread_(nullptr),
     uiThreadId_(0),
     waitUntilMainWindowReady_(/*manualReset*/TRUE,
-                              /*initialState*/TRUE)
+                              /*initialState*/TRUE),
+    renderer_(std::make_unique<MainWindowRenderer>(*this)),
+    coordinator_(std::make_unique<RenderCoordinator>(*renderer_, /*ttl*/0))
 {}
 
 DWORD WINAPI GlobalContext::UIThread() {
@@ -134,6 +187,18 @@ FileMapping &GlobalContext::GetFileMapping() {
   return mapping_;
 }
 
+RenderCoordinator &GlobalContext::GetRenderCoordinator() {
+  return *coordinator_;
+}
+
+// Must be called before the server starts listening.
+void GlobalContext::SetRenderCacheTtl(DWORD ttl) {
+  coordinator_ = std::make_unique<RenderCoordinator>(*renderer_, ttl);
+  if (ttl > 0) {
+    Log(L"Render cache enabled (TTL=%u msec)\n", ttl);
+  }
+}
+
 static RPC_STATUS GetRpcClientPid(DWORD &clientPid) {
   RPC_CALL_ATTRIBUTES attrib = { 0 };
   attrib.Version = RPC_CALL_ATTRIBUTES_VERSION;
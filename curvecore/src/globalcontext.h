@@ -1,3 +1,6 @@
+class Renderer;
+class RenderCoordinator;
+
 class GlobalContext {
 private:
   static DWORD WINAPI UIThreadStart(LPVOID lpParameter);
@@ -10,6 +13,8 @@ private:
   std::unique_ptr<MainWindow> mainWindow_;
 
   FileMapping mapping_;
+  std::unique_ptr<Renderer> renderer_;
+  std::unique_ptr<RenderCoordinator> coordinator_;
 
   // Updated per RPC call
 
@@ -27,6 +32,8 @@ public:
   void RPCThreadEnd();
   MainWindow &GetMainWindow();
   FileMapping &GetFileMapping();
+  RenderCoordinator &GetRenderCoordinator();
+  void SetRenderCacheTtl(DWORD ttl);
   HRESULT GenerateHandleForClient(HANDLE *sectionObject) const;
   HRESULT EnsureFileMapping(LPCWSTR backFile, bool forceUpdate);
 };
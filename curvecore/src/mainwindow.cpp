@@ -16,9 +16,34 @@
 #include "container.h"
 #include "mainwindow.h"
 #include "globalcontext.h"
+#include "curvecore.h"
+#include "fingerprint.h"
 
 void Log(LPCWSTR format, ...);
 
+// Writes the fingerprint of a frame captured into the section right after
+// its pixels.  |rowHashes| is computed here unless the capture path already
+// filled it.
+static bool WriteFingerprintToSection(DIB &dib,
+                                      WORD bitCount,
+                                      DWORD width,
+                                      DWORD height,
+                                      Blob &rowHashes) {
+  curve::SimpleBitmap image(bitCount, width, height, dib.GetBits());
+  if (rowHashes.Size() < sizeof(ULONGLONG) * height) {
+    if (!rowHashes.Alloc(sizeof(ULONGLONG) * height)) return false;
+    for (DWORD y = 0; y < height; ++y) {
+      rowHashes.As<ULONGLONG>()[y] = HashRow(image, y);
+    }
+  }
+
+  const auto size = FrameFingerprint::GetOffset(image)
+                    + FrameFingerprint::GetSize(height);
+  auto &section = GlobalContext::Instance().GetFileMapping();
+  auto view = section.CreateMappedView(FILE_MAP_WRITE, size);
+  return WriteFingerprint(image, rowHashes.As<ULONGLONG>(), view, size);
+}
+
 MainWindow::Command::Command()
   : waitUntilCommandIsDone_(/*manualReset*/TRUE,
                             /*initialState*/TRUE),
@@ -195,15 +220,19 @@ bool MainWindow::Capture(WORD bitCount, LPCWSTR localFile) {
         auto &section = GlobalContext::Instance().GetFileMapping();
         DWORD uw = width, uh = height;
         DIB dib;
+        Blob rowHashes;
         if (bitCount == 8) {
           dib = DIB::CaptureFromHDC(target, 32, uw, uh, /*section*/nullptr);
-          dib.ConvertToGrayscale(target, section);
+          dib.ConvertToGrayscale(target, section, &rowHashes);
         }
         else {
           dib = DIB::CaptureFromHDC(target, bitCount, uw, uh, section);
         }
         if (dib) {
           command_.set_size(uw, uh);
+          if (!WriteFingerprintToSection(dib, bitCount, uw, uh, rowHashes)) {
+            Log(L"No room for the frame fingerprint in the section.\n");
+          }
           if (localFile) {
             std::ofstream os(localFile, std::ios::binary);
             if (os.is_open()) {
@@ -0,0 +1,227 @@
+#include <windows.h>
+#include <assert.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "blob.h"
+#include "filemapping.h"
+#include "manifest.h"
+
+void Log(LPCWSTR format, ...);
+
+Manifest::Row::Row() : count_(0)
+{}
+
+Manifest::Row::Row(std::string_view line) : count_(0) {
+  if (line.size() > 0 && line.back() == '\r') {
+    line.remove_suffix(1);
+  }
+  for (;;) {
+    const auto tab = line.find('\t');
+    if (count_ < colMax) {
+      cols_[count_] = line.substr(0, tab);
+    }
+    ++count_;
+    if (tab == std::string_view::npos) break;
+    line.remove_prefix(tab + 1);
+  }
+}
+
+int Manifest::Row::Count() const {
+  return count_;
+}
+
+std::string_view Manifest::Row::operator[](int col) const {
+  return col >= 0 && col < colMax && col < count_
+         ? cols_[col]
+         : std::string_view();
+}
+
+UINT Manifest::Row::GetUInt(int col) const {
+  UINT ret = 0;
+  for (auto c : (*this)[col]) {
+    if (c < '0' || c > '9') break;
+    ret = ret * 10 + (c - '0');
+  }
+  return ret;
+}
+
+// FNV-1a.  Shard assignment depends only on the id, so it stays the same
+// when rows are added, removed, or reordered in the manifest.
+UINT Manifest::HashId(std::string_view id) {
+  UINT hash = 2166136261u;
+  for (auto c : id) {
+    hash ^= static_cast<BYTE>(c);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+Manifest::Manifest() : data_(nullptr), size_(0)
+{}
+
+void Manifest::BuildIndex() {
+  lines_.clear();
+  SIZE_T pos = 0;
+  while (pos < size_) {
+    auto eol = reinterpret_cast<LPCSTR>(memchr(data_ + pos, '\n', size_ - pos));
+    const SIZE_T next = eol ? (eol - data_) + 1 : size_;
+    const char c = data_[pos];
+    if (c != '\n' && c != '\r' && c != '#' && c != ';') {
+      lines_.push_back(pos);
+    }
+    pos = next;
+  }
+  Log(L"Manifest: %Iu bytes, %Iu rows\n", size_, lines_.size());
+}
+
+bool Manifest::Load(LPCWSTR filepath) {
+  ULARGE_INTEGER fileSize;
+  if (!mapping_.CreateReadOnly(filepath, fileSize)) return false;
+
+  // An empty file has no section to map.
+  view_ = FileMapping::View();
+  if (fileSize.QuadPart == 0) {
+    data_ = nullptr;
+    size_ = 0;
+  }
+  else {
+    view_ = mapping_.CreateMappedView(FILE_MAP_READ, /*sizeToMap*/0);
+    data_ = reinterpret_cast<LPCSTR>(static_cast<LPCBYTE>(view_));
+    if (!data_) return false;
+    size_ = static_cast<SIZE_T>(fileSize.QuadPart);
+  }
+  BuildIndex();
+  return true;
+}
+
+bool Manifest::Load(std::istream &is) {
+  // A stream cannot be mapped.  Read it into one buffer and index that.
+  SIZE_T used = 0;
+  const SIZE_T chunk = 1 << 20;
+  for (;;) {
+    if (!buffer_.Alloc(used + chunk)) return false;
+    is.read(buffer_.As<char>() + used, chunk);
+    used += static_cast<SIZE_T>(is.gcount());
+    if (!is) break;
+  }
+  data_ = buffer_.As<char>();
+  size_ = used;
+  BuildIndex();
+  return true;
+}
+
+SIZE_T Manifest::Count() const {
+  return lines_.size();
+}
+
+std::string_view Manifest::GetLine(SIZE_T index) const {
+  if (index >= lines_.size()) return std::string_view();
+  const auto start = lines_[index];
+  auto eol = reinterpret_cast<LPCSTR>(memchr(data_ + start,
+                                             '\n',
+                                             size_ - start));
+  const SIZE_T end = eol ? eol - data_ : size_;
+  return std::string_view(data_ + start, end - start);
+}
+
+Manifest::Row Manifest::GetRow(SIZE_T index) const {
+  return Row(GetLine(index));
+}
+
+bool Manifest::IsInShard(const Row &row, const Shard &shard) const {
+  return shard.count <= 1
+         || HashId(row[colId]) % shard.count == shard.index;
+}
+
+void Test_Manifest() {
+  // Comments and blank lines are skipped, a CR before the LF is trimmed,
+  // and columns beyond colMax are counted but not kept.
+  std::istringstream text("# comment\n"
+                          "id1\thttp://a/\t100\t800\t600\r\n"
+                          "\r\n"
+                          "\n"
+                          "; comment\n"
+                          "id2\thttp://b/\t5x\t\n"
+                          "id3\tu\t1\t2\t3\t9\textra");
+  Manifest manifest;
+  assert(manifest.Load(text));
+  assert(manifest.Count() == 3);
+  auto row = manifest.GetRow(0);
+  assert(row.Count() == 5 && row[Manifest::colId] == "id1");
+  assert(row[Manifest::colHeight] == "600");
+  assert(row.GetUInt(Manifest::colWidth) == 800);
+  row = manifest.GetRow(2);
+  assert(row.Count() == 7 && row[Manifest::colMask] == "9");
+  assert(manifest.GetLine(3).empty());
+
+  // A column that is not a number reads as its leading digits, and one
+  // that is empty or missing as 0.
+  row = manifest.GetRow(1);
+  assert(row.Count() == 4);
+  assert(row.GetUInt(Manifest::colWait) == 5);
+  assert(row.GetUInt(Manifest::colWidth) == 0);
+  assert(row.GetUInt(Manifest::colHeight) == 0);
+  assert(row.GetUInt(Manifest::colMax) == 0 && row.GetUInt(-1) == 0);
+  assert(row[Manifest::colHeight].empty());
+
+  // A stream is read in chunks of 1MB, and rows across them are whole.
+  const int rows = 40000;
+  std::string large;
+  char line[64];
+  for (int i = 0; i < rows; ++i) {
+    sprintf_s(line, "id%06d\thttp://example/%06d\t0\t10\t%d\n", i, i, i);
+    large += line;
+  }
+  assert(large.size() > 1 << 20);
+  std::istringstream largeText(large);
+  assert(manifest.Load(largeText));
+  assert(manifest.Count() == rows);
+  for (int i = 0; i < rows; ++i) {
+    sprintf_s(line, "id%06d", i);
+    row = manifest.GetRow(i);
+    assert(row.Count() == 5 && row[Manifest::colId] == line);
+    assert(row.GetUInt(Manifest::colHeight) == static_cast<UINT>(i));
+  }
+
+  // Every id is in one shard, and the shards are about even.
+  const UINT shardCount = 7;
+  UINT inShard[shardCount] = {};
+  for (int i = 0; i < rows; ++i) {
+    row = manifest.GetRow(i);
+    UINT shards = 0;
+    for (UINT j = 0; j < shardCount; ++j) {
+      if (manifest.IsInShard(row, {j, shardCount})) {
+        ++inShard[j];
+        ++shards;
+      }
+    }
+    assert(shards == 1);
+    assert(manifest.IsInShard(row, {0, 1}));
+  }
+  for (auto count : inShard) {
+    assert(count > rows / shardCount * 9 / 10
+           && count < rows / shardCount * 11 / 10);
+  }
+
+  // An empty file is a manifest without rows, and a missing file fails.
+  // Loading the empty file unmaps the other, so that it can be deleted.
+  WCHAR temp[MAX_PATH], path[MAX_PATH], emptyPath[MAX_PATH];
+  assert(GetTempPath(ARRAYSIZE(temp), temp));
+  swprintf_s(path, L"%scurve.manifest.%u", temp, GetCurrentProcessId());
+  swprintf_s(emptyPath, L"%s.empty", path);
+  {
+    std::ofstream os(path, std::ios::binary | std::ios::trunc);
+    os << "id1\thttp://a/\t0\t10\t10\n";
+  }
+  {
+    std::ofstream os(emptyPath, std::ios::binary | std::ios::trunc);
+  }
+  assert(manifest.Load(path) && manifest.Count() == 1);
+  assert(manifest.Load(emptyPath) && manifest.Count() == 0);
+  assert(DeleteFile(path) && DeleteFile(emptyPath));
+  assert(!manifest.Load(path));
+}
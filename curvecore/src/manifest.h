@@ -0,0 +1,53 @@
+class Manifest {
+public:
+  enum Column : int {
+    colId = 0,
+    colUrl,
+    colWait,
+    colWidth,
+    colHeight,
+    colMask, // Optional
+    colMax
+  };
+
+  // A view of one manifest line split on tabs.  Columns point into the
+  // manifest buffer, so a Row must not outlive the Manifest it came from.
+  class Row {
+  private:
+    std::string_view cols_[colMax];
+    int count_;
+
+  public:
+    Row();
+    Row(std::string_view line);
+    int Count() const;
+    std::string_view operator[](int col) const;
+    UINT GetUInt(int col) const;
+  };
+
+  struct Shard {
+    UINT index;
+    UINT count;
+  };
+
+private:
+  FileMapping mapping_;
+  FileMapping::View view_;
+  Blob buffer_;
+  LPCSTR data_;
+  SIZE_T size_;
+  std::vector<SIZE_T> lines_;
+
+  void BuildIndex();
+
+public:
+  static UINT HashId(std::string_view id);
+
+  Manifest();
+  bool Load(LPCWSTR filepath);
+  bool Load(std::istream &is);
+  SIZE_T Count() const;
+  std::string_view GetLine(SIZE_T index) const;
+  Row GetRow(SIZE_T index) const;
+  bool IsInShard(const Row &row, const Shard &shard) const;
+};
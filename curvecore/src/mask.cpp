@@ -0,0 +1,626 @@
+#include <windows.h>
+#include <nmmintrin.h>
+#include <assert.h>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "blob.h"
+#include "curvecore.h"
+#include "tiles.h"
+#include "mask.h"
+
+void Log(LPCWSTR format, ...);
+
+// Bits of a nibble in the opposite order
+static const BYTE reversedNibbles[16] = {
+  0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe,
+  0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf,
+};
+
+static BYTE ReverseBits(BYTE b) {
+  return static_cast<BYTE>(reversedNibbles[b & 0xf] << 4
+                           | reversedNibbles[b >> 4]);
+}
+
+static DWORD PopCount(ULONGLONG word) {
+#ifdef _M_X64
+  return static_cast<DWORD>(_mm_popcnt_u64(word));
+#else
+  return _mm_popcnt_u32(static_cast<UINT>(word))
+         + _mm_popcnt_u32(static_cast<UINT>(word >> 32));
+#endif
+}
+
+// Lines of a mask are aligned to DWORDs as in a 1bpp bitmap, and the buffer
+// is padded with zeros to whole 64-bit words, so that masks of the same
+// size are combined and counted a word at a time.
+static DWORD GetMaskStride(DWORD width) {
+  return (width + 31) / 32 * 4;
+}
+
+static bool AllocMask(DWORD width, DWORD height, Blob &bits) {
+  const SIZE_T size =
+    (static_cast<SIZE_T>(GetMaskStride(width)) * height + 7) / 8 * 8;
+  if (bits.Size() != size && !bits.Alloc(size)) {
+    return false;
+  }
+  ZeroMemory(bits.As<BYTE>(), size);
+  return true;
+}
+
+// Loads a 1bpp bitmap into |bits| with its black pixels set, whichever of
+// its two colors is black.  A |width| and |height| of 0 take the size of
+// the bitmap, and others must match it.
+static bool LoadMaskBitmap(LPCSTR path,
+                           DWORD &width,
+                           DWORD &height,
+                           Blob &bits) {
+  BITMAPFILEHEADER fh = {0};
+  BITMAPINFOHEADER ih = {0};
+  RGBQUAD colors[2] = {};
+  std::ifstream is(path, std::ios::binary);
+  if (!is.is_open()) {
+    Log(L"Failed to open the mask %hs\n", path);
+    return false;
+  }
+
+  is.read(reinterpret_cast<LPSTR>(&fh), sizeof(fh));
+  is.read(reinterpret_cast<LPSTR>(&ih), sizeof(ih));
+  const LONG bitmapHeight = std::abs(ih.biHeight);
+  if (!is
+      || fh.bfType != 0x4D42
+      || ih.biBitCount != 1
+      || ih.biCompression != BI_RGB
+      || ih.biWidth <= 0
+      || bitmapHeight == 0
+      || (width && ih.biWidth != static_cast<LONG>(width))
+      || (height && bitmapHeight != static_cast<LONG>(height))) {
+    Log(L"The mask must be a 1bpp bitmap of %u x %u.\n", width, height);
+    return false;
+  }
+  width = ih.biWidth;
+  height = bitmapHeight;
+
+  if (!is.seekg(sizeof(fh) + ih.biSize, std::ios::beg)
+      || !is.read(reinterpret_cast<LPSTR>(colors), sizeof(colors))
+      || !is.seekg(fh.bfOffBits, std::ios::beg)
+      || !AllocMask(width, height, bits)) {
+    return false;
+  }
+
+  // Bitmap lines are stored in the order of the frames unless the height
+  // is negative.
+  const DWORD stride = GetMaskStride(width);
+  for (DWORD y = 0; y < height; ++y) {
+    const DWORD line = ih.biHeight < 0 ? height - 1 - y : y;
+    if (!is.read(bits.As<char>() + line * stride, stride)) {
+      Log(L"Failed to load the mask.\n");
+      return false;
+    }
+  }
+
+  // Set bits must stand for black.  The bits past the width of a line are
+  // cleared either way so that they never count.
+  const auto luminance = [](const RGBQUAD &c) {
+    return c.rgbRed * 299 + c.rgbGreen * 587 + c.rgbBlue * 114;
+  };
+  const bool invert = luminance(colors[0]) < luminance(colors[1]);
+  const DWORD usedBytes = (width + 7) / 8;
+  const DWORD lastBits = width - (usedBytes - 1) * 8;
+  const BYTE lastByte = static_cast<BYTE>(0xff00 >> lastBits);
+  for (DWORD y = 0; y < height; ++y) {
+    const auto line = bits.As<BYTE>() + y * stride;
+    for (DWORD i = 0; i < stride; ++i) {
+      const BYTE b = invert ? static_cast<BYTE>(~line[i]) : line[i];
+      line[i] = i + 1 < usedBytes ? b : i + 1 == usedBytes ? b & lastByte : 0;
+    }
+  }
+  return true;
+}
+
+// Saves |bits| as a 1bpp bitmap whose set bits are black.
+static bool SaveMaskBitmap(LPCSTR path,
+                           DWORD width,
+                           DWORD height,
+                           const Blob &bits) {
+  const RGBQUAD colors[2] = {{0xff, 0xff, 0xff, 0}, {0, 0, 0, 0}};
+  const DWORD bitsSize = GetMaskStride(width) * height;
+  BITMAPFILEHEADER fh = {0};
+  BITMAPINFOHEADER ih = {0};
+  fh.bfType = 0x4D42;
+  fh.bfOffBits = sizeof(fh) + sizeof(ih) + sizeof(colors);
+  fh.bfSize = fh.bfOffBits + bitsSize;
+  ih.biSize = sizeof(ih);
+  ih.biWidth = width;
+  ih.biHeight = height;
+  ih.biPlanes = 1;
+  ih.biBitCount = 1;
+  ih.biCompression = BI_RGB;
+  ih.biSizeImage = bitsSize;
+
+  std::ofstream os(path, std::ios::binary);
+  os.write(reinterpret_cast<LPCSTR>(&fh), sizeof(fh));
+  os.write(reinterpret_cast<LPCSTR>(&ih), sizeof(ih));
+  os.write(reinterpret_cast<LPCSTR>(colors), sizeof(colors));
+  os.write(bits.As<char>(), bitsSize);
+  if (!os) {
+    Log(L"Failed to save the mask %hs\n", path);
+    return false;
+  }
+  return true;
+}
+
+DiffMask::DiffMask()
+  : width_(0),
+    height_(0),
+    stride_(0),
+    columns_(0),
+    includedPixels_(0)
+{}
+
+bool DiffMask::Reset(DWORD width, DWORD height) {
+  Clear();
+  if (width == 0 || height == 0 || !AllocMask(width, height, bits_)) {
+    return false;
+  }
+  width_ = width;
+  height_ = height;
+  stride_ = GetMaskStride(width);
+  return true;
+}
+
+// [left, right) x [top, bottom) from the top of the page, which is the last
+// line of the mask.
+void DiffMask::Exclude(DWORD left, DWORD top, DWORD right, DWORD bottom) {
+  for (DWORD y = top; y < bottom; ++y) {
+    const auto line = bits_.As<BYTE>() + (height_ - 1 - y) * stride_;
+    for (DWORD x = left; x < right; ++x) {
+      line[x >> 3] |= 0x80 >> (x & 7);
+    }
+  }
+}
+
+void DiffMask::Count() {
+  const DWORD tileSize = TileGrid::tileSize;
+  columns_ = (width_ + tileSize - 1) / tileSize;
+  const DWORD rows = (height_ + tileSize - 1) / tileSize;
+  included_.assign(static_cast<SIZE_T>(columns_) * rows, 0);
+  includedPixels_ = 0;
+  for (DWORD y = 0; y < height_; ++y) {
+    for (DWORD x = 0; x < width_; ++x) {
+      if (!IsExcluded(x, y)) {
+        ++included_[(y / tileSize) * columns_ + x / tileSize];
+        ++includedPixels_;
+      }
+    }
+  }
+}
+
+bool DiffMask::Build(DWORD width,
+                     DWORD height,
+                     const std::vector<RECT> &rects) {
+  if (!Reset(width, height)) {
+    return false;
+  }
+  for (const auto &rect : rects) {
+    const LONG w = static_cast<LONG>(width), h = static_cast<LONG>(height);
+    const LONG left = rect.left > 0 ? rect.left : 0;
+    const LONG top = rect.top > 0 ? rect.top : 0;
+    const LONG right = rect.right < w ? rect.right : w;
+    const LONG bottom = rect.bottom < h ? rect.bottom : h;
+    if (left < right && top < bottom) {
+      Exclude(left, top, right, bottom);
+    }
+  }
+  Count();
+  return true;
+}
+
+// Four comparisons of floats at a time give the bits of four pixels in the
+// opposite order of the mask.
+bool DiffMask::Build(DWORD width,
+                     DWORD height,
+                     const float *values,
+                     float threshold) {
+  if (!Reset(width, height)) {
+    return false;
+  }
+  const __m128 limit = _mm_set1_ps(threshold);
+  for (DWORD y = 0; y < height; ++y, values += width) {
+    const auto line = bits_.As<BYTE>() + static_cast<SIZE_T>(y) * stride_;
+    DWORD x = 0;
+    for (; x + 8 <= width; x += 8) {
+      const int first =
+        _mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(values + x), limit));
+      const int second =
+        _mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(values + x + 4), limit));
+      line[x >> 3] = static_cast<BYTE>(reversedNibbles[first] << 4
+                                       | reversedNibbles[second]);
+    }
+    for (; x < width; ++x) {
+      if (values[x] > threshold) {
+        line[x >> 3] |= 0x80 >> (x & 7);
+      }
+    }
+  }
+  Count();
+  return true;
+}
+
+bool DiffMask::Load(LPCSTR path, DWORD width, DWORD height) {
+  Clear();
+  if (width == 0 || height == 0
+      || !LoadMaskBitmap(path, width, height, bits_)) {
+    return false;
+  }
+  width_ = width;
+  height_ = height;
+  stride_ = GetMaskStride(width);
+  Count();
+  return true;
+}
+
+bool DiffMask::Save(LPCSTR path) const {
+  return IsValid() && SaveMaskBitmap(path, width_, height_, bits_);
+}
+
+bool DiffMask::Parse(std::string_view spec, DWORD width, DWORD height) {
+  Clear();
+  if (spec.empty() || spec[0] < '0' || spec[0] > '9') {
+    const std::string path(spec);
+    return Load(path.c_str(), width, height);
+  }
+
+  std::vector<RECT> rects;
+  const auto all = spec;
+  while (!spec.empty()) {
+    const auto end = spec.find(';');
+    auto item = spec.substr(0, end);
+    LONG values[4];
+    int count = 0;
+    for (; count < 4 && !item.empty(); ++count) {
+      LONG value = 0;
+      SIZE_T i = 0;
+      for (; i < item.size() && item[i] >= '0' && item[i] <= '9'; ++i) {
+        value = value * 10 + (item[i] - '0');
+      }
+      if (i == 0 || (i < item.size() && item[i] != ',')) break;
+      values[count] = value;
+      item.remove_prefix(i < item.size() ? i + 1 : i);
+    }
+    if (count < 4 || !item.empty()) {
+      Log(L"Invalid mask: %.*hs\n", static_cast<int>(all.size()), all.data());
+      return false;
+    }
+    rects.push_back({values[0],
+                     values[1],
+                     values[0] + values[2],
+                     values[1] + values[3]});
+    spec.remove_prefix(end == std::string_view::npos ? spec.size() : end + 1);
+  }
+  return Build(width, height, rects);
+}
+
+void DiffMask::Clear() {
+  width_ = height_ = stride_ = columns_ = 0;
+  included_.clear();
+  includedPixels_ = 0;
+}
+
+bool DiffMask::IsValid() const {
+  return width_ > 0;
+}
+
+DWORD DiffMask::Width() const {
+  return width_;
+}
+
+DWORD DiffMask::Height() const {
+  return height_;
+}
+
+LONG DiffMask::Stride() const {
+  return static_cast<LONG>(stride_);
+}
+
+LPCBYTE DiffMask::Line(DWORD y) const {
+  return bits_.As<BYTE>() + static_cast<SIZE_T>(y) * stride_;
+}
+
+bool DiffMask::IsExcluded(DWORD x, DWORD y) const {
+  return (Line(y)[x >> 3] & (0x80 >> (x & 7))) != 0;
+}
+
+DiffMask::Coverage DiffMask::GetCoverage(DWORD column, DWORD row) const {
+  const DWORD included = IncludedPixels(column, row);
+  if (included == 0) {
+    return coverFull;
+  }
+  const DWORD tileSize = TileGrid::tileSize;
+  const DWORD x = column * tileSize;
+  const DWORD y = row * tileSize;
+  const DWORD tileWidth = x + tileSize < width_ ? tileSize : width_ - x;
+  const DWORD tileHeight = y + tileSize < height_ ? tileSize : height_ - y;
+  return included == tileWidth * tileHeight ? coverNone : coverPartial;
+}
+
+DWORD DiffMask::IncludedPixels(DWORD column, DWORD row) const {
+  return included_[static_cast<SIZE_T>(row) * columns_ + column];
+}
+
+ULONGLONG DiffMask::IncludedPixels() const {
+  return includedPixels_;
+}
+
+ChangeMask::ChangeMask()
+  : width_(0),
+    height_(0),
+    stride_(0)
+{}
+
+// 16 pixels at a time, the bytes that differ by more than the tolerance
+// are those that the saturated subtraction of the tolerance leaves above
+// zero.  Their bits come out of PMOVMSKB in the opposite order of the mask.
+bool ChangeMask::Build(const curve::SimpleBitmap &image1,
+                       const curve::SimpleBitmap &image2,
+                       BYTE tolerance,
+                       const DiffMask *ignore) {
+  const DWORD width = image1.width_;
+  const DWORD height = image1.height_;
+  width_ = height_ = stride_ = 0;
+  if (image1.bitCount_ != 8 || image2.bitCount_ != 8
+      || image2.width_ != width || image2.height_ != height
+      || width == 0 || height == 0
+      || (ignore && (ignore->Width() != width || ignore->Height() != height))
+      || !AllocMask(width, height, bits_)) {
+    return false;
+  }
+  width_ = width;
+  height_ = height;
+  stride_ = GetMaskStride(width);
+
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i limit = _mm_set1_epi8(static_cast<char>(tolerance));
+  const LONG lineSize1 = image1.GetLineSize();
+  const LONG lineSize2 = image2.GetLineSize();
+  for (DWORD y = 0; y < height; ++y) {
+    const auto line1 = image1.bits_ + static_cast<LONG_PTR>(y) * lineSize1;
+    const auto line2 = image2.bits_ + static_cast<LONG_PTR>(y) * lineSize2;
+    const auto ignored = ignore ? ignore->Line(y) : nullptr;
+    const auto line = bits_.As<BYTE>() + static_cast<SIZE_T>(y) * stride_;
+    DWORD x = 0;
+    for (; x + 16 <= width; x += 16) {
+      const __m128i a =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(line1 + x));
+      const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(line2 + x));
+      const __m128i d =
+        _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+      const int changed = ~_mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_subs_epu8(d, limit), zero));
+      line[x >> 3] = ReverseBits(static_cast<BYTE>(changed));
+      line[(x >> 3) + 1] = ReverseBits(static_cast<BYTE>(changed >> 8));
+    }
+    for (; x < width; ++x) {
+      const BYTE d = line1[x] > line2[x]
+                     ? line1[x] - line2[x] : line2[x] - line1[x];
+      if (d > tolerance) {
+        line[x >> 3] |= 0x80 >> (x & 7);
+      }
+    }
+    if (ignored) {
+      for (DWORD i = 0; i < (width + 7) / 8; ++i) {
+        line[i] &= ~ignored[i];
+      }
+    }
+  }
+  return true;
+}
+
+bool ChangeMask::Load(LPCSTR path) {
+  DWORD width = 0, height = 0;
+  width_ = height_ = stride_ = 0;
+  if (!LoadMaskBitmap(path, width, height, bits_)) {
+    return false;
+  }
+  width_ = width;
+  height_ = height;
+  stride_ = GetMaskStride(width);
+  return true;
+}
+
+bool ChangeMask::Save(LPCSTR path) const {
+  return IsValid() && SaveMaskBitmap(path, width_, height_, bits_);
+}
+
+bool ChangeMask::Intersect(const ChangeMask &other) {
+  if (!IsValid() || other.width_ != width_ || other.height_ != height_) {
+    return false;
+  }
+  const auto words = bits_.As<ULONGLONG>();
+  const auto otherWords = other.bits_.As<ULONGLONG>();
+  for (SIZE_T i = 0; i < bits_.Size() / sizeof(ULONGLONG); ++i) {
+    words[i] &= otherWords[i];
+  }
+  return true;
+}
+
+bool ChangeMask::Unite(const ChangeMask &other) {
+  if (!IsValid() || other.width_ != width_ || other.height_ != height_) {
+    return false;
+  }
+  const auto words = bits_.As<ULONGLONG>();
+  const auto otherWords = other.bits_.As<ULONGLONG>();
+  for (SIZE_T i = 0; i < bits_.Size() / sizeof(ULONGLONG); ++i) {
+    words[i] |= otherWords[i];
+  }
+  return true;
+}
+
+bool ChangeMask::IsValid() const {
+  return width_ > 0;
+}
+
+DWORD ChangeMask::Width() const {
+  return width_;
+}
+
+DWORD ChangeMask::Height() const {
+  return height_;
+}
+
+LPCBYTE ChangeMask::Line(DWORD y) const {
+  return bits_.As<BYTE>() + static_cast<SIZE_T>(y) * stride_;
+}
+
+bool ChangeMask::IsChanged(DWORD x, DWORD y) const {
+  const auto line = Line(y);
+  return (line[x >> 3] & (0x80 >> (x & 7))) != 0;
+}
+
+ULONGLONG ChangeMask::Count() const {
+  ULONGLONG count = 0;
+  const auto words = bits_.As<ULONGLONG>();
+  for (SIZE_T i = 0; IsValid() && i < bits_.Size() / sizeof(ULONGLONG); ++i) {
+    count += PopCount(words[i]);
+  }
+  return count;
+}
+
+// The padding of a DiffMask may have bits set, but that of a ChangeMask
+// does not, so they do not count.
+ULONGLONG ChangeMask::CountIncluded(const DiffMask &mask) const {
+  if (!IsValid() || mask.Width() != width_ || mask.Height() != height_) {
+    return 0;
+  }
+  ULONGLONG count = 0;
+  const auto words = bits_.As<ULONGLONG>();
+  const auto excluded = reinterpret_cast<const ULONGLONG*>(mask.Line(0));
+  for (SIZE_T i = 0; i < bits_.Size() / sizeof(ULONGLONG); ++i) {
+    count += PopCount(words[i] & ~excluded[i]);
+  }
+  return count;
+}
+
+// The bits of a tile line are a DWORD, so a 64-bit word holds two tiles,
+// the even column in its lower half.
+void ChangeMask::CountTiles(std::vector<WORD> &counts) const {
+  const DWORD tileSize = TileGrid::tileSize;
+  const DWORD columns = (width_ + tileSize - 1) / tileSize;
+  const DWORD rows = (height_ + tileSize - 1) / tileSize;
+  counts.assign(static_cast<SIZE_T>(columns) * rows, 0);
+  for (DWORD y = 0; y < height_; ++y) {
+    const auto line = bits_.As<BYTE>() + static_cast<SIZE_T>(y) * stride_;
+    const auto tiles = counts.data() + (y / tileSize) * columns;
+    for (DWORD column = 0; column < columns; column += 2) {
+      ULONGLONG word;
+      if (column + 1 < columns) {
+        memcpy(&word, line + column * 4, sizeof(word));
+      }
+      else {
+        DWORD last;
+        memcpy(&last, line + column * 4, sizeof(last));
+        word = last;
+      }
+      tiles[column] =
+        static_cast<WORD>(tiles[column] + PopCount(word & 0xffffffff));
+      if (column + 1 < columns) {
+        tiles[column + 1] =
+          static_cast<WORD>(tiles[column + 1] + PopCount(word >> 32));
+      }
+    }
+  }
+}
+
+void Test_DiffMask() {
+  const DWORD width = 70, height = 40, lineSize = 72;
+  DiffMask mask;
+  assert(mask.Parse("3,0,10,2;64,35,100,100", width, height));
+  assert(mask.Stride() == 12);
+  // The top of the page is the last line of the frame.
+  assert(mask.IsExcluded(3, height - 1) && mask.IsExcluded(12, height - 2));
+  assert(!mask.IsExcluded(13, height - 1) && !mask.IsExcluded(3, height - 3));
+  assert(mask.IsExcluded(69, 0) && !mask.IsExcluded(63, 0));
+  assert(mask.IncludedPixels() == width * height - 20 - 30);
+  assert(mask.GetCoverage(0, 1) == DiffMask::coverPartial);
+  assert(mask.GetCoverage(1, 1) == DiffMask::coverNone);
+  assert(mask.GetCoverage(2, 0) == DiffMask::coverPartial);
+
+  // Excluded pixels add nothing to the statistics of a tile, and a tile
+  // excluded as a whole is not read.
+  BYTE bits1[lineSize * height] = {};
+  BYTE bits2[lineSize * height] = {};
+  for (DWORD x = 0; x < 20; ++x) {
+    bits2[(height - 1) * lineSize + x] = 10;
+  }
+  bits2[3 * lineSize + 62] = 5;
+  TileGrid grid;
+  assert(grid.Reset(width, height));
+  ULONGLONG sse = 0;
+  for (DWORD row = 0; row < grid.Rows(); ++row) {
+    for (DWORD column = 0; column < grid.Columns(); ++column) {
+      sse += grid.AccumulateTile(column, row,
+                                 bits1, lineSize,
+                                 bits2, lineSize,
+                                 &mask);
+    }
+  }
+  assert(sse == 10 * 100 + 25);
+  assert(grid.At(0, 1).changedPixels == 10);
+  assert(grid.At(1, 0).changedPixels == 1);
+
+  assert(!mask.Parse("1,2,3", width, height) && !mask.IsValid());
+  assert(!mask.Parse("1,2,3,4;x", width, height));
+  assert(mask.Parse("0,0,70,40", width, height));
+  assert(mask.IncludedPixels() == 0);
+  assert(mask.GetCoverage(2, 1) == DiffMask::coverFull);
+  assert(grid.AccumulateTile(0, 1, nullptr, 0, nullptr, 0, &mask) == 0);
+}
+
+void Test_ChangeMask() {
+  const DWORD width = 70, height = 40, lineSize = 72;
+  BYTE bits1[lineSize * height] = {};
+  BYTE bits2[lineSize * height] = {};
+  for (DWORD x = 0; x < 20; ++x) {
+    bits2[5 * lineSize + x] = 10;
+  }
+  bits2[5 * lineSize + 69] = 3;
+  bits2[39 * lineSize + 40] = 200;
+  bits1[39 * lineSize + 41] = 200;
+  curve::SimpleBitmap image1(8, width, height, bits1);
+  curve::SimpleBitmap image2(8, width, height, bits2);
+
+  ChangeMask changes;
+  assert(changes.Build(image1, image2, 3, nullptr));
+  assert(changes.Count() == 22);
+  assert(changes.IsChanged(0, 5) && changes.IsChanged(19, 5));
+  assert(!changes.IsChanged(20, 5) && !changes.IsChanged(69, 5));
+  assert(changes.IsChanged(40, 39) && changes.IsChanged(41, 39));
+
+  std::vector<WORD> counts;
+  changes.CountTiles(counts);
+  assert(counts.size() == 3 * 2);
+  assert(counts[0] == 20 && counts[1 * 3 + 1] == 2);
+  assert(counts[2] == 0 && counts[1 * 3 + 2] == 0);
+
+  // Line 39 is the top line of the page.
+  DiffMask ignore;
+  assert(ignore.Parse("40,0,1,1;0,34,10,1", width, height));
+  assert(changes.CountIncluded(ignore) == 11);
+  ChangeMask ignored;
+  assert(ignored.Build(image1, image2, 3, &ignore));
+  assert(ignored.Count() == 11 && !ignored.IsChanged(40, 39));
+
+  ChangeMask other;
+  assert(other.Build(image1, image2, 0, nullptr));
+  assert(other.Count() == 23);
+  assert(other.Intersect(ignored) && other.Count() == 11);
+  assert(other.Unite(changes) && other.Count() == 22);
+
+  ChangeMask small;
+  curve::SimpleBitmap part(8, 64, height, bits1);
+  assert(!small.Build(image1, part, 0, nullptr) && !small.IsValid());
+  assert(small.Build(part, part, 0, nullptr) && small.Count() == 0);
+  assert(!other.Unite(small));
+}
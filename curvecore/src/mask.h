@@ -0,0 +1,104 @@
+// Pixels left out of a diff, such as clocks, ads, and carousels that change
+// on every capture.  A mask covers frames of one size with a bit per pixel,
+// the most significant bit first as in a 1bpp bitmap, and its lines are in
+// the order of the lines of the frames, the bottom line first.  A set bit
+// excludes the pixel.  The pixels left in each tile of TileGrid are counted
+// when the mask is built, so that a tile excluded as a whole is skipped
+// without reading the frames.
+class DiffMask {
+public:
+  enum Coverage {
+    coverNone,    // No pixel of the tile is excluded
+    coverPartial,
+    coverFull,    // Every pixel of the tile is excluded
+  };
+
+private:
+  DWORD width_;
+  DWORD height_;
+  DWORD stride_;
+  DWORD columns_;
+  Blob bits_;
+  std::vector<WORD> included_; // Pixels left in each tile
+  ULONGLONG includedPixels_;
+
+  bool Reset(DWORD width, DWORD height);
+  void Exclude(DWORD left, DWORD top, DWORD right, DWORD bottom);
+  void Count();
+
+public:
+  DiffMask();
+
+  // Excludes |rects|, given from the top left of the page, from frames of
+  // |width| x |height|.  Rectangles are clipped to the frame.
+  bool Build(DWORD width, DWORD height, const std::vector<RECT> &rects);
+  // Excludes the pixels whose value in |values|, |width| floats a line in
+  // the order of the lines of the frames, is above |threshold|.
+  bool Build(DWORD width,
+             DWORD height,
+             const float *values,
+             float threshold);
+  // Loads a 1bpp bitmap of |width| x |height| whose black pixels are
+  // excluded, whichever of its two colors is black.
+  bool Load(LPCSTR path, DWORD width, DWORD height);
+  // Saves the mask as a 1bpp bitmap for Load.
+  bool Save(LPCSTR path) const;
+  // Builds the mask from a manifest column or a command line option, which
+  // is either rectangles "x,y,width,height" separated with ';', or the path
+  // of a bitmap for Load.
+  bool Parse(std::string_view spec, DWORD width, DWORD height);
+  void Clear();
+
+  bool IsValid() const;
+  DWORD Width() const;
+  DWORD Height() const;
+  LONG Stride() const;
+  LPCBYTE Line(DWORD y) const;
+  bool IsExcluded(DWORD x, DWORD y) const;
+  Coverage GetCoverage(DWORD column, DWORD row) const;
+  // Pixels left in a tile of TileGrid, and in the whole frame.
+  DWORD IncludedPixels(DWORD column, DWORD row) const;
+  ULONGLONG IncludedPixels() const;
+};
+
+// Pixels that differ beyond a tolerance, a bit each as in DiffMask, so that
+// a mask of a 4K frame takes 1MB where a diff image takes 8MB.  Counts and
+// combinations of masks of the same size run on 64-bit words with the
+// hardware population count, and a mask is saved as a 1bpp bitmap whose
+// changed pixels are black, so that masks of many runs are combined cheaply.
+class ChangeMask {
+private:
+  DWORD width_;
+  DWORD height_;
+  DWORD stride_;
+  Blob bits_;
+
+public:
+  ChangeMask();
+
+  // Sets the pixels of two 8bpp frames of the same size that differ by
+  // more than |tolerance| levels, except those |ignore| excludes.  |ignore|
+  // may be null.
+  bool Build(const curve::SimpleBitmap &image1,
+             const curve::SimpleBitmap &image2,
+             BYTE tolerance,
+             const DiffMask *ignore);
+  // Loads a mask of any size saved by Save.
+  bool Load(LPCSTR path);
+  bool Save(LPCSTR path) const;
+  // Keeps the pixels set in both masks, or in either.  Fails unless the
+  // masks are of the same size.
+  bool Intersect(const ChangeMask &other);
+  bool Unite(const ChangeMask &other);
+
+  bool IsValid() const;
+  DWORD Width() const;
+  DWORD Height() const;
+  LPCBYTE Line(DWORD y) const;
+  bool IsChanged(DWORD x, DWORD y) const;
+  ULONGLONG Count() const;
+  // Changed pixels that |mask|, of the same size, does not exclude.
+  ULONGLONG CountIncluded(const DiffMask &mask) const;
+  // Changed pixels in each tile of TileGrid, row by row.
+  void CountTiles(std::vector<WORD> &counts) const;
+};
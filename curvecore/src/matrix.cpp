@@ -0,0 +1,154 @@
+#include <windows.h>
+#include <assert.h>
+#include <vector>
+#include "blob.h"
+#include "curvecore.h"
+#include "fingerprint.h"
+#include "tiles.h"
+#include "parallel.h"
+#include "matrix.h"
+
+DWORD PairIndex(DWORD i, DWORD j, DWORD count) {
+  return i * count - i * (i + 1) / 2 + j - i - 1;
+}
+
+// True if the lines [top, bottom) of both frames have the same hashes.
+static bool HasSameRows(const curve::SimpleBitmap &image1,
+                        const curve::SimpleBitmap &image2,
+                        DWORD top,
+                        DWORD bottom) {
+  const auto fingerprint1 = image1.fingerprint_;
+  const auto fingerprint2 = image2.fingerprint_;
+  if (!fingerprint1 || !fingerprint2) {
+    return false;
+  }
+  for (DWORD y = top; y < bottom; ++y) {
+    if (fingerprint1->rowHashes[y] != fingerprint2->rowHashes[y]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool PairwiseDiff(const curve::SimpleBitmap *frames,
+                  DWORD count,
+                  std::vector<ULONGLONG> &sse) {
+  if (count < 2) {
+    return false;
+  }
+  const DWORD width = frames[0].width_;
+  const DWORD height = frames[0].height_;
+  for (DWORD i = 0; i < count; ++i) {
+    if (frames[i].bitCount_ != 8
+        || frames[i].width_ != width
+        || frames[i].height_ != height) {
+      return false;
+    }
+  }
+
+  const DWORD pairs = count * (count - 1) / 2;
+  const DWORD tileSize = TileGrid::tileSize;
+  const LONG tileRows = static_cast<LONG>((height + tileSize - 1) / tileSize);
+  std::vector<ULONGLONG> sums(static_cast<SIZE_T>(tileRows) * pairs);
+  auto diffTileRow = [&](LONG tileRow) {
+    const DWORD top = tileRow * tileSize;
+    const DWORD bottom = top + tileSize < height ? top + tileSize : height;
+    const auto rowSums = sums.data() + static_cast<SIZE_T>(tileRow) * pairs;
+    std::vector<bool> skipped(pairs);
+    for (DWORD i = 0; i + 1 < count; ++i) {
+      for (DWORD j = i + 1; j < count; ++j) {
+        skipped[PairIndex(i, j, count)] =
+          HasSameRows(frames[i], frames[j], top, bottom);
+      }
+    }
+
+    std::vector<LPCBYTE> tiles(count);
+    std::vector<LONG> strides(count);
+    for (DWORD i = 0; i < count; ++i) {
+      strides[i] = frames[i].GetLineSize();
+    }
+    for (DWORD x = 0; x < width; x += tileSize) {
+      const DWORD tileWidth = x + tileSize < width ? tileSize : width - x;
+      for (DWORD i = 0; i < count; ++i) {
+        tiles[i] = frames[i].bits_
+                   + static_cast<LONG_PTR>(top) * strides[i] + x;
+      }
+      for (DWORD i = 0; i + 1 < count; ++i) {
+        for (DWORD j = i + 1; j < count; ++j) {
+          const DWORD pair = PairIndex(i, j, count);
+          if (skipped[pair]) continue;
+
+          TileGrid::Tile tile = {};
+          TileGrid::DiffTile(tiles[i],
+                             strides[i],
+                             tiles[j],
+                             strides[j],
+                             tileWidth,
+                             bottom - top,
+                             /*mask*/nullptr,
+                             /*maskStride*/0,
+                             /*histogram*/nullptr,
+                             tile,
+                             rowSums[pair]);
+        }
+      }
+    }
+  };
+  ParallelFor(tileRows, diffTileRow);
+
+  // Rows are added up in order so that the result does not depend on the
+  // order in which threads finished.
+  sse.assign(pairs, 0);
+  for (LONG row = 0; row < tileRows; ++row) {
+    for (DWORD pair = 0; pair < pairs; ++pair) {
+      sse[pair] += sums[static_cast<SIZE_T>(row) * pairs + pair];
+    }
+  }
+  return true;
+}
+
+void Test_PairwiseDiff() {
+  assert(PairIndex(0, 1, 4) == 0);
+  assert(PairIndex(0, 3, 4) == 2);
+  assert(PairIndex(1, 2, 4) == 3);
+  assert(PairIndex(2, 3, 4) == 5);
+
+  // Four frames of 70 x 40, the second of which differs from the first by
+  // 3 in one pixel, the third by 2 in every pixel of a tile, and the fourth
+  // as both.
+  const DWORD width = 70, height = 40, lineSize = 72;
+  BYTE bits[4][lineSize * height];
+  for (DWORD i = 0; i < lineSize * height; ++i) {
+    bits[0][i] = bits[1][i] = bits[2][i] = bits[3][i] =
+      static_cast<BYTE>(i * 7);
+  }
+  bits[1][39 * lineSize + 69] += 3;
+  bits[3][39 * lineSize + 69] += 3;
+  for (DWORD y = 0; y < 32; ++y) {
+    for (DWORD x = 32; x < 64; ++x) {
+      bits[2][y * lineSize + x] ^= 2;
+      bits[3][y * lineSize + x] ^= 2;
+    }
+  }
+  curve::SimpleBitmap frames[4] = {
+    curve::SimpleBitmap(8, width, height, bits[0]),
+    curve::SimpleBitmap(8, width, height, bits[1]),
+    curve::SimpleBitmap(8, width, height, bits[2]),
+    curve::SimpleBitmap(8, width, height, bits[3]),
+  };
+
+  std::vector<ULONGLONG> sse;
+  assert(PairwiseDiff(frames, 4, sse));
+  assert(sse.size() == 6);
+  const ULONGLONG tile = 32 * 32 * 4;
+  assert(sse[PairIndex(0, 1, 4)] == 9);
+  assert(sse[PairIndex(0, 2, 4)] == tile);
+  assert(sse[PairIndex(0, 3, 4)] == tile + 9);
+  assert(sse[PairIndex(1, 2, 4)] == tile + 9);
+  assert(sse[PairIndex(1, 3, 4)] == tile);
+  assert(sse[PairIndex(2, 3, 4)] == 9);
+
+  // Frames of different sizes fail.
+  frames[3].height_ = 20;
+  assert(!PairwiseDiff(frames, 4, sse));
+}
@@ -0,0 +1,14 @@
+// Index of the pair of frames |i| < |j| of |count| frames in the upper
+// triangle of a matrix read row by row: (0, 1), (0, 2), ..., (1, 2), ...
+DWORD PairIndex(DWORD i, DWORD j, DWORD count);
+
+// Sums the squared differences of every pair of |count| 8bpp frames of the
+// same size, in PairIndex order into |sse|, in one pass over the frames.
+// Each 32x32 tile of every frame is diffed with the same tile of all the
+// others while it is in the cache, so a frame is read from memory once
+// however many frames there are, where diffing pair by pair reads it
+// |count| - 1 times.  A pair of frames with fingerprints skips the rows of
+// tiles whose lines have the same hashes.  Rows of tiles run in parallel.
+bool PairwiseDiff(const curve::SimpleBitmap *frames,
+                  DWORD count,
+                  std::vector<ULONGLONG> &sse);
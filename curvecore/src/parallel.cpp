@@ -0,0 +1,72 @@
+#include <windows.h>
+#include "parallel.h"
+
+void Log(LPCWSTR format, ...);
+
+struct ParallelLoop {
+  LONG count;
+  volatile LONG next;
+  void (*body)(LONG index, LPVOID context);
+  LPVOID context;
+
+  void Run() {
+    for (;;) {
+      const LONG index = InterlockedIncrement(&next) - 1;
+      if (index >= count) break;
+      body(index, context);
+    }
+  }
+};
+
+static DWORD WINAPI LoopThread(LPVOID p) {
+  reinterpret_cast<ParallelLoop*>(p)->Run();
+  return 0;
+}
+
+void ParallelFor(LONG count,
+                 void (*body)(LONG index, LPVOID context),
+                 LPVOID context) {
+  ParallelLoop loop = {count, 0, body, context};
+
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  DWORD extraThreads = info.dwNumberOfProcessors > 1
+                       ? info.dwNumberOfProcessors - 1
+                       : 0;
+  if (count < 2) {
+    extraThreads = 0;
+  }
+  else if (extraThreads > static_cast<DWORD>(count - 1)) {
+    extraThreads = count - 1;
+  }
+  if (extraThreads > MAXIMUM_WAIT_OBJECTS) {
+    extraThreads = MAXIMUM_WAIT_OBJECTS;
+  }
+
+  // If a thread fails to start, the others take its share.
+  HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+  DWORD started = 0;
+  for (DWORD i = 0; i < extraThreads; ++i) {
+    threads[started] = CreateThread(/*lpThreadAttributes*/nullptr,
+                                    /*dwStackSize*/0,
+                                    LoopThread,
+                                    &loop,
+                                    /*dwCreationFlags*/0,
+                                    /*lpThreadId*/nullptr);
+    if (threads[started]) {
+      ++started;
+    }
+    else {
+      Log(L"CreateThread failed - %08x\n", GetLastError());
+    }
+  }
+
+  loop.Run();
+
+  if (started > 0) {
+    WaitForMultipleObjects(started, threads, /*bWaitAll*/TRUE, INFINITE);
+    for (DWORD i = 0; i < started; ++i) {
+      CloseHandle(threads[i]);
+    }
+  }
+}
@@ -0,0 +1,15 @@
+// Runs |body|(index, context) for every index in [0, count) on up to one
+// thread per processor, including the calling thread.  Threads take the
+// next index from a shared counter, so items of uneven cost balance out.
+void ParallelFor(LONG count,
+                 void (*body)(LONG index, LPVOID context),
+                 LPVOID context);
+
+template<typename T>
+void ParallelFor(LONG count, T &body) {
+  ParallelFor(count,
+              [](LONG index, LPVOID context) {
+                (*reinterpret_cast<T*>(context))(index);
+              },
+              &body);
+}
@@ -0,0 +1,209 @@
+#include <windows.h>
+#include <emmintrin.h>
+#include <assert.h>
+#include <iostream>
+#include <vector>
+#include "curvecore.h"
+#include "fingerprint.h"
+#include "phash.h"
+
+static const DWORD gridWidth = 9;
+static const DWORD gridHeight = 8;
+
+static ULONGLONG SumBytes(LPCBYTE p, SIZE_T size) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sum = zero;
+  for (; size >= 16; size -= 16, p += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(v, zero));
+  }
+  ULONGLONG total =
+    static_cast<UINT>(_mm_cvtsi128_si32(sum))
+    + static_cast<UINT>(_mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+  while (size--) {
+    total += *(p++);
+  }
+  return total;
+}
+
+// Channels are summed together, so 24bpp and 32bpp frames are hashed by
+// the sum of their channels, which orders blocks like their brightness.
+ULONGLONG PerceptualHash(const curve::SimpleBitmap &image) {
+  if (!image.bits_
+      || image.bitCount_ % 8 != 0
+      || image.width_ < gridWidth
+      || image.height_ < gridHeight) {
+    return 0;
+  }
+
+  const DWORD bytesPerPixel = image.bitCount_ / 8;
+  const DWORD lineSize = image.GetLineSize();
+  DWORD columns[gridWidth + 1];
+  for (DWORD i = 0; i <= gridWidth; ++i) {
+    columns[i] = static_cast<DWORD>(
+      static_cast<ULONGLONG>(image.width_) * i / gridWidth);
+  }
+
+  ULONGLONG sums[gridHeight][gridWidth] = {};
+  for (DWORD y = 0; y < image.height_; ++y) {
+    const auto line = image.bits_ + static_cast<SIZE_T>(y) * lineSize;
+    auto &sum = sums[static_cast<ULONGLONG>(y) * gridHeight / image.height_];
+    for (DWORD i = 0; i < gridWidth; ++i) {
+      sum[i] += SumBytes(line + columns[i] * bytesPerPixel,
+                         (columns[i + 1] - columns[i]) * bytesPerPixel);
+    }
+  }
+
+  // Blocks in a grid row have the same height but may differ in width by
+  // a pixel, so averages are compared by cross-multiplying with widths.
+  ULONGLONG hash = 0;
+  for (DWORD y = 0; y < gridHeight; ++y) {
+    for (DWORD x = 0; x + 1 < gridWidth; ++x) {
+      const ULONGLONG left = sums[y][x] * (columns[x + 2] - columns[x + 1]);
+      const ULONGLONG right = sums[y][x + 1] * (columns[x + 1] - columns[x]);
+      hash = hash << 1 | (left < right ? 1 : 0);
+    }
+  }
+  return hash;
+}
+
+ULONGLONG GetPerceptualHash(const curve::SimpleBitmap &image) {
+  return image.fingerprint_
+         ? image.fingerprint_->perceptualHash
+         : PerceptualHash(image);
+}
+
+UINT HammingDistance(ULONGLONG hash1, ULONGLONG hash2) {
+  ULONGLONG x = hash1 ^ hash2;
+  x = x - ((x >> 1) & 0x5555555555555555ull);
+  x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+  return static_cast<UINT>((x * 0x0101010101010101ull) >> 56);
+}
+
+UINT PerceptualIndex::Distance(const Node &node,
+                               ULONGLONG hash1,
+                               ULONGLONG hash2) {
+  return HammingDistance(node.hash1, hash1) + HammingDistance(node.hash2, hash2);
+}
+
+SIZE_T PerceptualIndex::Count() const {
+  return nodes_.size();
+}
+
+SIZE_T PerceptualIndex::GetItem(SIZE_T i) const {
+  return nodes_[i].item;
+}
+
+void PerceptualIndex::Insert(ULONGLONG hash1, ULONGLONG hash2, SIZE_T item) {
+  Node node = {hash1, hash2, item, 0, 0, 0};
+  const auto index = static_cast<DWORD>(nodes_.size());
+  if (index == 0) {
+    nodes_.push_back(node);
+    return;
+  }
+
+  DWORD parent = 0;
+  for (;;) {
+    const auto distance = Distance(nodes_[parent], hash1, hash2);
+    DWORD child = nodes_[parent].firstChild;
+    while (child && nodes_[child].distance != distance) {
+      child = nodes_[child].nextSibling;
+    }
+    if (!child) {
+      node.distance = distance;
+      node.nextSibling = nodes_[parent].firstChild;
+      nodes_[parent].firstChild = index;
+      nodes_.push_back(node);
+      return;
+    }
+    parent = child;
+  }
+}
+
+void PerceptualIndex::Query(ULONGLONG hash1,
+                            ULONGLONG hash2,
+                            UINT radius,
+                            std::vector<SIZE_T> &nodes) const {
+  if (nodes_.empty()) return;
+
+  std::vector<DWORD> pending(1, 0);
+  while (!pending.empty()) {
+    const auto index = pending.back();
+    pending.pop_back();
+    const auto &node = nodes_[index];
+    const auto distance = Distance(node, hash1, hash2);
+    if (distance <= radius) {
+      nodes.push_back(index);
+    }
+    for (auto child = node.firstChild;
+         child;
+         child = nodes_[child].nextSibling) {
+      const auto d = nodes_[child].distance;
+      if (d + radius >= distance && d <= distance + radius) {
+        pending.push_back(child);
+      }
+    }
+  }
+}
+
+SIZE_T PerceptualIndex::Group(UINT radius,
+                              std::vector<SIZE_T> &groupOfNode) const {
+  const SIZE_T ungrouped = ~static_cast<SIZE_T>(0);
+  groupOfNode.assign(nodes_.size(), ungrouped);
+
+  SIZE_T groups = 0;
+  std::vector<SIZE_T> neighbors;
+  for (SIZE_T i = 0; i < nodes_.size(); ++i) {
+    if (groupOfNode[i] != ungrouped) continue;
+
+    groupOfNode[i] = groups;
+    neighbors.clear();
+    Query(nodes_[i].hash1, nodes_[i].hash2, radius, neighbors);
+    for (auto j : neighbors) {
+      if (groupOfNode[j] == ungrouped) {
+        groupOfNode[j] = groups;
+      }
+    }
+    ++groups;
+  }
+  return groups;
+}
+
+void Test_PerceptualHash() {
+  const DWORD width = 90, height = 40, lineSize = 92;
+  BYTE bits1[lineSize * height];
+  BYTE bits2[lineSize * height];
+  for (DWORD y = 0; y < height; ++y) {
+    for (DWORD x = 0; x < lineSize; ++x) {
+      bits1[y * lineSize + x] = static_cast<BYTE>(x < width ? x * 2 : 0xcc);
+      bits2[y * lineSize + x] = static_cast<BYTE>(x < width ? 200 - x * 2 : 0);
+    }
+  }
+  curve::SimpleBitmap image1(8, width, height, bits1);
+  curve::SimpleBitmap image2(8, width, height, bits2);
+
+  // Brightness increases along every row of image1, and decreases in image2.
+  assert(PerceptualHash(image1) == ~0ull);
+  assert(PerceptualHash(image2) == 0);
+  assert(HammingDistance(PerceptualHash(image1), PerceptualHash(image2)) == 64);
+
+  // A small change keeps the hash.
+  bits1[lineSize * 3 + 5] ^= 0x01;
+  assert(PerceptualHash(image1) == ~0ull);
+
+  PerceptualIndex index;
+  index.Insert(0x00ff, 0, 0);
+  index.Insert(0x01ff, 0, 1);
+  index.Insert(0xff00, 0, 2);
+  index.Insert(0x00ff, 1, 3);
+  index.Insert(0xff01, 0, 4);
+  std::vector<SIZE_T> nodes;
+  index.Query(0x00ff, 0, 1, nodes);
+  assert(nodes.size() == 3);
+
+  std::vector<SIZE_T> groups;
+  assert(index.Group(2, groups) == 2);
+  assert(groups[0] == 0 && groups[1] == 0 && groups[3] == 0);
+  assert(groups[2] == 1 && groups[4] == 1);
+}
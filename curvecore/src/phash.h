@@ -0,0 +1,41 @@
+// A 64-bit difference hash (dHash) of a frame.  The frame is reduced to
+// a 9x8 grid of block averages, and each bit tells whether brightness
+// increases from one block to the next in a row.  Frames that look alike
+// have hashes a few bits apart, unlike the exact hashes in fingerprint.h.
+ULONGLONG PerceptualHash(const curve::SimpleBitmap &image);
+ULONGLONG GetPerceptualHash(const curve::SimpleBitmap &image);
+UINT HammingDistance(ULONGLONG hash1, ULONGLONG hash2);
+
+// A BK-tree over pairs of perceptual hashes, one for each side of a diff.
+// The distance between two pairs is the sum of the Hamming distances of
+// their sides, which is a metric, so a radius query visits only children
+// whose distance from their parent is within the radius of the query's.
+class PerceptualIndex {
+private:
+  struct Node {
+    ULONGLONG hash1;
+    ULONGLONG hash2;
+    SIZE_T item;
+    UINT distance; // from the parent
+    DWORD firstChild; // 0 if none; the root is never a child
+    DWORD nextSibling;
+  };
+
+  std::vector<Node> nodes_;
+
+  static UINT Distance(const Node &node, ULONGLONG hash1, ULONGLONG hash2);
+
+public:
+  SIZE_T Count() const;
+  SIZE_T GetItem(SIZE_T i) const;
+  void Insert(ULONGLONG hash1, ULONGLONG hash2, SIZE_T item);
+  // Appends the indices of nodes within |radius| of the given pair.
+  void Query(ULONGLONG hash1,
+             ULONGLONG hash2,
+             UINT radius,
+             std::vector<SIZE_T> &nodes) const;
+  // Assigns each node to a group.  A node that is not yet grouped starts
+  // a new group, which takes every ungrouped node within |radius| of it.
+  // Returns the number of groups.
+  SIZE_T Group(UINT radius, std::vector<SIZE_T> &groupOfNode) const;
+};
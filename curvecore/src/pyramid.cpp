@@ -0,0 +1,194 @@
+#include <windows.h>
+#include <emmintrin.h>
+#include <assert.h>
+#include <iostream>
+#include <vector>
+#include "blob.h"
+#include "curvecore.h"
+#include "tiles.h"
+#include "pyramid.h"
+
+Mipmap::Mipmap()
+  : factor_(0),
+    width_(0),
+    height_(0)
+{}
+
+// PSADBW against zero sums eight bytes into a 64-bit lane.  For blocks of
+// four, the other half of each eight bytes is masked out first.
+static void SumBlocksOf8(LPCBYTE p, DWORD lineSize, WORD *out) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sum = zero;
+  for (int y = 0; y < 8; ++y, p += lineSize) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(v, zero));
+  }
+  out[0] = static_cast<WORD>(_mm_cvtsi128_si32(sum));
+  out[1] = static_cast<WORD>(_mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+}
+
+static void SumBlocksOf4(LPCBYTE p, DWORD lineSize, WORD *out) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i lowHalves = _mm_set_epi32(0, -1, 0, -1);
+  __m128i sumLow = zero;
+  __m128i sumHigh = zero;
+  for (int y = 0; y < 4; ++y, p += lineSize) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    sumLow = _mm_add_epi64(sumLow,
+                           _mm_sad_epu8(_mm_and_si128(v, lowHalves), zero));
+    sumHigh = _mm_add_epi64(sumHigh,
+                            _mm_sad_epu8(_mm_andnot_si128(lowHalves, v), zero));
+  }
+  out[0] = static_cast<WORD>(_mm_cvtsi128_si32(sumLow));
+  out[1] = static_cast<WORD>(_mm_cvtsi128_si32(sumHigh));
+  out[2] = static_cast<WORD>(_mm_cvtsi128_si32(_mm_srli_si128(sumLow, 8)));
+  out[3] = static_cast<WORD>(_mm_cvtsi128_si32(_mm_srli_si128(sumHigh, 8)));
+}
+
+bool Mipmap::Build(const curve::SimpleBitmap &image, DWORD factor) {
+  if (image.bitCount_ != 8 || !image.bits_ || (factor != 4 && factor != 8)) {
+    return false;
+  }
+
+  factor_ = factor;
+  width_ = image.width_ / factor;
+  height_ = image.height_ / factor;
+  const SIZE_T size = sizeof(WORD) * width_ * height_;
+  if (sums_.Size() < size && !sums_.Alloc(size)) {
+    return false;
+  }
+
+  const DWORD lineSize = image.GetLineSize();
+  const DWORD blocksPerLoad = 16 / factor;
+  for (DWORD cy = 0; cy < height_; ++cy) {
+    auto out = sums_.As<WORD>() + cy * width_;
+    const auto top = image.bits_ + static_cast<SIZE_T>(cy) * factor * lineSize;
+    DWORD cx = 0;
+    for (; cx + blocksPerLoad <= width_; cx += blocksPerLoad) {
+      if (factor == 8) {
+        SumBlocksOf8(top + cx * factor, lineSize, out + cx);
+      }
+      else {
+        SumBlocksOf4(top + cx * factor, lineSize, out + cx);
+      }
+    }
+    for (; cx < width_; ++cx) {
+      DWORD sum = 0;
+      for (DWORD y = 0; y < factor; ++y) {
+        const auto p = top + y * lineSize + cx * factor;
+        for (DWORD x = 0; x < factor; ++x) {
+          sum += p[x];
+        }
+      }
+      out[cx] = static_cast<WORD>(sum);
+    }
+  }
+  return true;
+}
+
+DWORD Mipmap::Factor() const {
+  return factor_;
+}
+
+DWORD Mipmap::Width() const {
+  return width_;
+}
+
+DWORD Mipmap::Height() const {
+  return height_;
+}
+
+const WORD *Mipmap::Line(DWORD y) const {
+  return sums_.As<WORD>() + y * width_;
+}
+
+bool EstimateTiles(const Mipmap &mipmap1,
+                   const Mipmap &mipmap2,
+                   TileGrid &estimates) {
+  const DWORD factor = mipmap1.Factor();
+  if (factor == 0
+      || mipmap2.Factor() != factor
+      || mipmap1.Width() != mipmap2.Width()
+      || mipmap1.Height() != mipmap2.Height()
+      || mipmap1.Width() != estimates.Width() / factor
+      || mipmap1.Height() != estimates.Height() / factor) {
+    return false;
+  }
+
+  const DWORD blocksPerTile = TileGrid::tileSize / factor;
+  const float scale = 1.0f / (factor * factor);
+  for (DWORD cy = 0; cy < mipmap1.Height(); ++cy) {
+    const auto line1 = mipmap1.Line(cy);
+    const auto line2 = mipmap2.Line(cy);
+    const DWORD row = cy / blocksPerTile;
+    for (DWORD cx = 0; cx < mipmap1.Width();) {
+      const DWORD column = cx / blocksPerTile;
+      const DWORD end = (column + 1) * blocksPerTile < mipmap1.Width()
+                        ? (column + 1) * blocksPerTile
+                        : mipmap1.Width();
+      DWORD squares = 0;
+      for (; cx < end; ++cx) {
+        const int d = static_cast<int>(line1[cx]) - line2[cx];
+        squares += static_cast<DWORD>(d * d);
+      }
+      estimates.At(column, row).sse += squares * scale;
+    }
+  }
+  return true;
+}
+
+bool IsCoveredByMipmap(const TileGrid &grid,
+                       DWORD column,
+                       DWORD row,
+                       DWORD factor) {
+  const DWORD right = (column + 1) * TileGrid::tileSize;
+  const DWORD bottom = (row + 1) * TileGrid::tileSize;
+  const DWORD coveredWidth = grid.Width() / factor * factor;
+  const DWORD coveredHeight = grid.Height() / factor * factor;
+  return (right < grid.Width() ? right : grid.Width()) <= coveredWidth
+         && (bottom < grid.Height() ? bottom : grid.Height()) <= coveredHeight;
+}
+
+void Test_Mipmap() {
+  const DWORD width = 70, height = 40, lineSize = 72;
+  BYTE bits1[lineSize * height];
+  BYTE bits2[lineSize * height];
+  for (DWORD i = 0; i < sizeof(bits1); ++i) {
+    bits1[i] = bits2[i] = static_cast<BYTE>(i * 7);
+  }
+  curve::SimpleBitmap image1(8, width, height, bits1);
+  curve::SimpleBitmap image2(8, width, height, bits2);
+
+  for (DWORD factor = 4; factor <= 8; factor += 4) {
+    Mipmap mipmap1, mipmap2;
+    assert(mipmap1.Build(image1, factor));
+    assert(mipmap1.Width() == width / factor);
+    assert(mipmap1.Height() == height / factor);
+    for (DWORD cy = 0; cy < mipmap1.Height(); ++cy) {
+      for (DWORD cx = 0; cx < mipmap1.Width(); ++cx) {
+        DWORD sum = 0;
+        for (DWORD y = 0; y < factor; ++y) {
+          for (DWORD x = 0; x < factor; ++x) {
+            sum += bits1[(cy * factor + y) * lineSize + cx * factor + x];
+          }
+        }
+        assert(mipmap1.Line(cy)[cx] == sum);
+      }
+    }
+
+    // A pixel brighter by 16 in a block of 4x4 is one level brighter on
+    // average, i.e. 1*1 * 16 pixels of squared error.
+    bits2[5 * lineSize + 9] += 16;
+    assert(mipmap2.Build(image2, factor));
+    TileGrid estimates;
+    assert(estimates.Reset(width, height));
+    assert(EstimateTiles(mipmap1, mipmap2, estimates));
+    assert(estimates.At(0, 0).sse == 16.0f * 16 / (factor * factor));
+    assert(estimates.At(1, 0).sse == 0);
+    bits2[5 * lineSize + 9] -= 16;
+
+    assert(IsCoveredByMipmap(estimates, 0, 0, factor));
+    assert(!IsCoveredByMipmap(estimates, 2, 0, factor)); // 70 % 4 != 0
+    assert(IsCoveredByMipmap(estimates, 1, 1, factor) == (40 % factor == 0));
+  }
+}
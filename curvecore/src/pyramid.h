@@ -0,0 +1,34 @@
+// One coarse level of a frame for the pyramid diff.  Each coarse pixel is
+// the sum of a |factor| x |factor| block of an 8bpp frame, kept as a sum
+// rather than a mean so that small differences are not rounded away.
+// Pixels at the right and bottom edges that do not fill a block are not
+// covered by the mipmap.
+class Mipmap {
+private:
+  Blob sums_;
+  DWORD factor_;
+  DWORD width_;
+  DWORD height_;
+
+public:
+  Mipmap();
+  // |factor| is 4 or 8.
+  bool Build(const curve::SimpleBitmap &image, DWORD factor);
+  DWORD Factor() const;
+  DWORD Width() const;
+  DWORD Height() const;
+  const WORD *Line(DWORD y) const;
+};
+
+// Estimates the SSE of every full-resolution tile of |estimates| from two
+// mipmaps of the same frame size.  A coarse difference of sums d stands for
+// f*f pixels that differ by d/(f*f) each, i.e. d*d/(f*f) of squared error.
+// Returns false if the mipmaps do not match.
+bool EstimateTiles(const Mipmap &mipmap1,
+                   const Mipmap &mipmap2,
+                   TileGrid &estimates);
+// True if every pixel of the tile is covered by a mipmap of |factor|.
+bool IsCoveredByMipmap(const TileGrid &grid,
+                       DWORD column,
+                       DWORD row,
+                       DWORD factor);
@@ -0,0 +1,209 @@
+#include <windows.h>
+#include <assert.h>
+#include <algorithm>
+#include <iostream>
+#include <string_view>
+#include <vector>
+#include "blob.h"
+#include "curvecore.h"
+#include "tiles.h"
+#include "mask.h"
+#include "regions.h"
+
+DWORD RegionFinder::FindRoot(DWORD run) {
+  while (parents_[run] != run) {
+    parents_[run] = parents_[parents_[run]];
+    run = parents_[run];
+  }
+  return run;
+}
+
+// The earlier run stays the root, so a root is the first run of a region.
+void RegionFinder::Unite(DWORD run1, DWORD run2) {
+  run1 = FindRoot(run1);
+  run2 = FindRoot(run2);
+  if (run1 < run2) {
+    parents_[run2] = run1;
+  }
+  else if (run2 < run1) {
+    parents_[run1] = run2;
+  }
+}
+
+bool RegionFinder::Find(const ChangeMask &changes,
+                        const curve::SimpleBitmap &image1,
+                        const curve::SimpleBitmap &image2,
+                        std::vector<ChangedRegion> &regions) {
+  const DWORD width = changes.Width();
+  const DWORD height = changes.Height();
+  regions.clear();
+  if (!changes.IsValid()
+      || image1.bitCount_ != 8 || image2.bitCount_ != 8
+      || image1.width_ != width || image1.height_ != height
+      || image2.width_ != width || image2.height_ != height) {
+    return false;
+  }
+
+  runs_.clear();
+  parents_.clear();
+  const DWORD lineBytes = (width + 7) / 8;
+  const LONG lineSize1 = image1.GetLineSize();
+  const LONG lineSize2 = image2.GetLineSize();
+  SIZE_T previous = 0; // First run of the previous line
+  for (DWORD y = 0; y < height; ++y) {
+    const auto line = changes.Line(y);
+    const auto line1 = image1.bits_ + static_cast<LONG_PTR>(y) * lineSize1;
+    const auto line2 = image2.bits_ + static_cast<LONG_PTR>(y) * lineSize2;
+    const SIZE_T current = runs_.size();
+    auto addRun = [&](DWORD begin, DWORD end) {
+      Run run = {y, begin, end, 0};
+      for (DWORD x = begin; x < end; ++x) {
+        run.sumAbsDiff += line1[x] > line2[x]
+                          ? line1[x] - line2[x] : line2[x] - line1[x];
+      }
+      runs_.push_back(run);
+      parents_.push_back(static_cast<DWORD>(parents_.size()));
+    };
+
+    // Bits past the width are clear, so a run ends there at the latest.
+    bool inRun = false;
+    DWORD begin = 0;
+    for (DWORD i = 0; i < lineBytes;) {
+      if (!inRun && i + 8 <= lineBytes) {
+        ULONGLONG word;
+        memcpy(&word, line + i, sizeof(word));
+        if (word == 0) {
+          i += 8;
+          continue;
+        }
+      }
+      const BYTE bits = line[i];
+      if (bits == (inRun ? 0xff : 0)) {
+        ++i;
+        continue;
+      }
+      for (DWORD bit = 0; bit < 8; ++bit) {
+        const bool changed = (bits & (0x80 >> bit)) != 0;
+        if (changed != inRun) {
+          if (changed) {
+            begin = i * 8 + bit;
+          }
+          else {
+            addRun(begin, i * 8 + bit);
+          }
+          inRun = changed;
+        }
+      }
+      ++i;
+    }
+    if (inRun) {
+      addRun(begin, width);
+    }
+
+    // Runs of the two lines touch if they overlap when one is widened by
+    // a pixel on each side.
+    SIZE_T above = previous;
+    for (SIZE_T i = current; i < runs_.size(); ++i) {
+      while (above < current && runs_[above].end < runs_[i].begin) {
+        ++above;
+      }
+      for (SIZE_T j = above;
+           j < current && runs_[j].begin <= runs_[i].end;
+           ++j) {
+        Unite(static_cast<DWORD>(i), static_cast<DWORD>(j));
+      }
+    }
+    previous = current;
+  }
+
+  const DWORD none = ~0u;
+  labels_.assign(runs_.size(), none);
+  for (DWORD i = 0; i < runs_.size(); ++i) {
+    const auto &run = runs_[i];
+    const LONG left = static_cast<LONG>(run.begin);
+    const LONG right = static_cast<LONG>(run.end);
+    const LONG top = static_cast<LONG>(height - 1 - run.y);
+    const DWORD root = FindRoot(i);
+    if (labels_[root] == none) {
+      labels_[root] = static_cast<DWORD>(regions.size());
+      regions.push_back({{left, top, right, top + 1}, 0, 0});
+    }
+    auto &region = regions[labels_[root]];
+    auto &bounds = region.bounds;
+    bounds.left = left < bounds.left ? left : bounds.left;
+    bounds.right = right > bounds.right ? right : bounds.right;
+    bounds.top = top < bounds.top ? top : bounds.top;
+    bounds.bottom = top + 1 > bounds.bottom ? top + 1 : bounds.bottom;
+    region.pixels += run.end - run.begin;
+    // The sum is kept here until it is divided below.
+    region.meanAbsDiff += static_cast<double>(run.sumAbsDiff);
+  }
+  for (auto &region : regions) {
+    region.meanAbsDiff /= static_cast<double>(region.pixels);
+  }
+  std::stable_sort(regions.begin(),
+                   regions.end(),
+                   [](const ChangedRegion &a, const ChangedRegion &b) {
+                     return a.pixels > b.pixels;
+                   });
+  return true;
+}
+
+bool SaveRegions(std::ostream &os, const std::vector<ChangedRegion> &regions) {
+  os << "x\ty\twidth\theight\tpixels\tmeanAbsDiff\n";
+  for (const auto &region : regions) {
+    const auto &bounds = region.bounds;
+    os << bounds.left << '\t'
+       << bounds.top << '\t'
+       << bounds.right - bounds.left << '\t'
+       << bounds.bottom - bounds.top << '\t'
+       << region.pixels << '\t'
+       << region.meanAbsDiff << '\n';
+  }
+  return !!os;
+}
+
+void Test_RegionFinder() {
+  const DWORD width = 70, height = 12, lineSize = 72;
+  BYTE bits1[lineSize * height] = {};
+  BYTE bits2[lineSize * height] = {};
+  auto set = [&](DWORD x, DWORD y, BYTE value) {
+    bits2[y * lineSize + x] = value;
+  };
+  // A U on the page, whose arms are labeled apart until its bottom line,
+  for (DWORD x = 2; x < 10; ++x) set(x, 6, 4);
+  for (DWORD y = 2; y < 6; ++y) {
+    set(2, y, 4);
+    set(9, y, 4);
+  }
+  // a diagonal line touching at corners, a single pixel at the edge, and
+  // a run crossing a 64-pixel word.
+  for (DWORD i = 0; i < 4; ++i) set(20 + i, 8 + i, 10);
+  set(69, 0, 1);
+  for (DWORD x = 60; x < 68; ++x) set(x, 6, 2);
+  curve::SimpleBitmap image1(8, width, height, bits1);
+  curve::SimpleBitmap image2(8, width, height, bits2);
+
+  ChangeMask changes;
+  assert(changes.Build(image1, image2, 0, nullptr));
+  RegionFinder finder;
+  std::vector<ChangedRegion> regions;
+  assert(finder.Find(changes, image1, image2, regions));
+  assert(regions.size() == 4);
+  assert(regions[0].pixels == 16 && regions[0].meanAbsDiff == 4);
+  assert(regions[0].bounds.left == 2 && regions[0].bounds.right == 10);
+  assert(regions[0].bounds.top == 5 && regions[0].bounds.bottom == 10);
+  assert(regions[1].pixels == 8 && regions[1].bounds.top == 5);
+  assert(regions[1].bounds.left == 60 && regions[1].bounds.right == 68);
+  assert(regions[2].pixels == 4 && regions[2].meanAbsDiff == 10);
+  assert(regions[2].bounds.top == 0 && regions[2].bounds.bottom == 4);
+  assert(regions[2].bounds.left == 20 && regions[2].bounds.right == 24);
+  assert(regions[3].pixels == 1 && regions[3].bounds.top == 11);
+  assert(regions[3].bounds.left == 69 && regions[3].bounds.right == 70);
+
+  // Identical frames have no region, and frames of another size fail.
+  assert(changes.Build(image1, image1, 0, nullptr));
+  assert(finder.Find(changes, image1, image1, regions) && regions.empty());
+  curve::SimpleBitmap part(8, 64, height, bits1);
+  assert(!finder.Find(changes, part, part, regions));
+}
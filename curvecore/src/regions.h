@@ -0,0 +1,41 @@
+// A region of changed pixels that touch each other, including diagonally.
+struct ChangedRegion {
+  RECT bounds; // From the top left of the page
+  ULONGLONG pixels;
+  double meanAbsDiff;
+};
+
+// Labels the changed pixels of a ChangeMask by union-find over the runs of
+// changed pixels in each line.  Lines are scanned 64 bits at a time, so
+// the time is linear in the number of runs plus the words of the mask, and
+// frames that barely differ take about as long as reading the mask.  The
+// buffers are kept for the next pair of frames.
+class RegionFinder {
+private:
+  struct Run {
+    DWORD y;
+    DWORD begin;
+    DWORD end;
+    ULONGLONG sumAbsDiff;
+  };
+
+  std::vector<Run> runs_;
+  std::vector<DWORD> parents_;
+  std::vector<DWORD> labels_;
+
+  DWORD FindRoot(DWORD run);
+  void Unite(DWORD run1, DWORD run2);
+
+public:
+  // Sets |regions|, the largest first, to the regions of |changes|, the
+  // change mask of |image1| and |image2|.  Returns false unless the frames
+  // are 8bpp frames of the size of the mask.
+  bool Find(const ChangeMask &changes,
+            const curve::SimpleBitmap &image1,
+            const curve::SimpleBitmap &image2,
+            std::vector<ChangedRegion> &regions);
+};
+
+// Writes |regions| as tab-separated values, whose first four columns are
+// a rectangle of a mask.
+bool SaveRegions(std::ostream &os, const std::vector<ChangedRegion> &regions);
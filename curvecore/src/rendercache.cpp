@@ -0,0 +1,433 @@
+#include <windows.h>
+#include <assert.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "blob.h"
+#include "synchronization.h"
+#include "curvecore.h"
+#include "fingerprint.h"
+#include "rendercache.h"
+
+void Log(LPCWSTR format, ...);
+
+struct RenderCoordinator::Operation {
+  enum Type {
+    navigate,
+    capture,
+  };
+
+  const Type type;
+  const std::wstring url;
+  const UINT viewWidth;
+  const UINT viewHeight;
+  const WORD bitCount;
+  Event done;
+  HRESULT result;
+  UINT width;
+  UINT height;
+
+  Operation(Type type,
+            const std::wstring &url,
+            UINT viewWidth,
+            UINT viewHeight,
+            WORD bitCount)
+    : type(type),
+      url(url),
+      viewWidth(viewWidth),
+      viewHeight(viewHeight),
+      bitCount(bitCount),
+      done(/*manualReset*/TRUE, /*initialState*/FALSE),
+      result(E_PENDING),
+      width(0),
+      height(0)
+  {}
+
+  bool Matches(Type type,
+               LPCWSTR url,
+               UINT viewWidth,
+               UINT viewHeight,
+               WORD bitCount) const {
+    return this->type == type
+           && this->url == url
+           && this->viewWidth == viewWidth
+           && this->viewHeight == viewHeight
+           && this->bitCount == bitCount;
+  }
+
+  void Complete(HRESULT hr, UINT width, UINT height) {
+    this->result = hr;
+    this->width = width;
+    this->height = height;
+    done.Signal();
+  }
+};
+
+RenderCoordinator::RenderCoordinator(Renderer &renderer, DWORD ttl)
+  : renderer_(renderer),
+    ttl_(ttl),
+    frameBytes_(0),
+    clock_(0),
+    viewWidth_(0),
+    viewHeight_(0),
+    rendered_(false),
+    renderedAt_(0) {
+  InitializeCriticalSection(&lock_);
+}
+
+RenderCoordinator::~RenderCoordinator() {
+  DeleteCriticalSection(&lock_);
+}
+
+RenderCoordinator::Frame *RenderCoordinator::FindFrame(LPCWSTR url,
+                                                       UINT viewWidth,
+                                                       UINT viewHeight,
+                                                       WORD bitCount,
+                                                       bool anyBitCount) {
+  const auto now = GetTickCount64();
+  for (auto &frame : frames_) {
+    if (frame.expiry > now
+        && frame.url == url
+        && frame.viewWidth == viewWidth
+        && frame.viewHeight == viewHeight
+        && (anyBitCount || frame.bitCount == bitCount)) {
+      return &frame;
+    }
+  }
+  return nullptr;
+}
+
+void RenderCoordinator::StoreFrame(WORD bitCount, UINT width, UINT height) {
+  // Keep the fingerprint that follows the pixels so that clients get a
+  // matching one when the frame is served again.
+  const curve::SimpleBitmap image(bitCount, width, height, nullptr);
+  const SIZE_T pixelSize = image.GetLineSize() * height;
+  SIZE_T size = FrameFingerprint::GetOffset(image)
+                + FrameFingerprint::GetSize(height);
+  if (pixelSize == 0 || size > maxFrameBytes) return;
+
+  Frame frame;
+  if (!renderer_.SaveFrame(frame.bits, size)) {
+    size = pixelSize;
+    if (!renderer_.SaveFrame(frame.bits, size)) return;
+  }
+  frame.url = url_;
+  frame.viewWidth = viewWidth_;
+  frame.viewHeight = viewHeight_;
+  frame.bitCount = bitCount;
+  frame.width = width;
+  frame.height = height;
+  frame.expiry = GetTickCount64() + ttl_;
+  frame.lastUsed = ++clock_;
+
+  // Drop expired frames and the frame being replaced, then the least
+  // recently used ones until the new frame fits.
+  const auto now = GetTickCount64();
+  for (auto it = frames_.begin(); it != frames_.end(); ) {
+    if (it->expiry <= now
+        || (it->url == frame.url
+            && it->viewWidth == frame.viewWidth
+            && it->viewHeight == frame.viewHeight
+            && it->bitCount == frame.bitCount)) {
+      frameBytes_ -= it->bits.Size();
+      it = frames_.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+  while (frames_.size() > 0
+         && (frames_.size() >= maxFrames
+             || frameBytes_ + size > maxFrameBytes)) {
+    auto oldest = frames_.begin();
+    for (auto it = frames_.begin(); it != frames_.end(); ++it) {
+      if (it->lastUsed < oldest->lastUsed) oldest = it;
+    }
+    frameBytes_ -= oldest->bits.Size();
+    frames_.erase(oldest);
+  }
+
+  frameBytes_ += size;
+  frames_.push_back(std::move(frame));
+}
+
+HRESULT RenderCoordinator::Join(std::shared_ptr<Operation> op,
+                                UINT *width,
+                                UINT *height) {
+  Log(L"Joining the in-flight %s of %s\n",
+      op->type == Operation::navigate ? L"navigation" : L"capture",
+      op->url.c_str());
+  op->done.Wait(INFINITE);
+  if (width) *width = op->width;
+  if (height) *height = op->height;
+  return op->result;
+}
+
+HRESULT RenderCoordinator::Navigate(LPCWSTR url,
+                                    UINT viewWidth,
+                                    UINT viewHeight,
+                                    boolean async) {
+  std::shared_ptr<Operation> op;
+  bool owner = false;
+  {
+    CriticalSectionHelper cs(lock_);
+    if (inFlight_) {
+      if (!inFlight_->Matches(Operation::navigate,
+                              url,
+                              viewWidth,
+                              viewHeight,
+                              /*bitCount*/0)) {
+        Log(L"Another command is in progress.  Aborting the request.\n");
+        return E_PENDING;
+      }
+      op = inFlight_;
+    }
+    else {
+      const bool isLoaded = rendered_
+                            && url_ == url
+                            && viewWidth_ == viewWidth
+                            && viewHeight_ == viewHeight
+                            && GetTickCount64() - renderedAt_ < ttl_;
+      if (isLoaded) {
+        Log(L"%s is already loaded.\n", url);
+        return S_OK;
+      }
+
+      url_ = url;
+      viewWidth_ = viewWidth;
+      viewHeight_ = viewHeight;
+      rendered_ = false;
+      if (FindFrame(url, viewWidth, viewHeight, 0, /*anyBitCount*/true)) {
+        // Defer the navigation until a capture misses the cache.
+        Log(L"Navigation to %s is served from the render cache.\n", url);
+        return S_OK;
+      }
+
+      op = std::make_shared<Operation>(Operation::navigate,
+                                       url,
+                                       viewWidth,
+                                       viewHeight,
+                                       /*bitCount*/0);
+      inFlight_ = op;
+      owner = true;
+    }
+  }
+  if (!owner) {
+    return Join(op, nullptr, nullptr);
+  }
+
+  HRESULT hr = renderer_.Navigate(url, viewWidth, viewHeight, async);
+  {
+    CriticalSectionHelper cs(lock_);
+    rendered_ = SUCCEEDED(hr);
+    renderedAt_ = GetTickCount64();
+    inFlight_.reset();
+  }
+  op->Complete(hr, 0, 0);
+  return hr;
+}
+
+HRESULT RenderCoordinator::Capture(WORD bitCount,
+                                   UINT &width,
+                                   UINT &height,
+                                   LPCWSTR saveOnServer) {
+  std::shared_ptr<Operation> op;
+  bool owner = false;
+  bool navigateFirst = false;
+  {
+    CriticalSectionHelper cs(lock_);
+    if (!saveOnServer) {
+      if (auto frame = FindFrame(url_.c_str(),
+                                 viewWidth_,
+                                 viewHeight_,
+                                 bitCount,
+                                 /*anyBitCount*/false)) {
+        if (renderer_.LoadFrame(frame->bits)) {
+          Log(L"Capture of %s is served from the render cache.\n",
+              url_.c_str());
+          frame->lastUsed = ++clock_;
+          width = frame->width;
+          height = frame->height;
+          return S_OK;
+        }
+      }
+    }
+
+    if (inFlight_) {
+      if (saveOnServer
+          || !inFlight_->Matches(Operation::capture,
+                                 url_.c_str(),
+                                 viewWidth_,
+                                 viewHeight_,
+                                 bitCount)) {
+        Log(L"Another command is in progress.  Aborting the request.\n");
+        return E_PENDING;
+      }
+      op = inFlight_;
+    }
+    else {
+      op = std::make_shared<Operation>(Operation::capture,
+                                       url_,
+                                       viewWidth_,
+                                       viewHeight_,
+                                       bitCount);
+      inFlight_ = op;
+      owner = true;
+      navigateFirst = !rendered_ && !url_.empty();
+    }
+  }
+  if (!owner) {
+    return Join(op, &width, &height);
+  }
+
+  HRESULT hr = S_OK;
+  if (navigateFirst) {
+    // The navigation was deferred but the cache does not have this frame.
+    hr = renderer_.Navigate(op->url.c_str(),
+                            op->viewWidth,
+                            op->viewHeight,
+                            /*async*/false);
+  }
+  if (SUCCEEDED(hr)) {
+    hr = renderer_.Capture(bitCount, width, height, saveOnServer);
+  }
+  {
+    CriticalSectionHelper cs(lock_);
+    if (navigateFirst && SUCCEEDED(hr)) {
+      rendered_ = true;
+      renderedAt_ = GetTickCount64();
+    }
+    if (SUCCEEDED(hr) && ttl_ > 0) {
+      StoreFrame(bitCount, width, height);
+    }
+    inFlight_.reset();
+  }
+  op->Complete(hr, width, height);
+  return hr;
+}
+
+void RenderCoordinator::Invalidate(LPCWSTR url,
+                                   UINT viewWidth,
+                                   UINT viewHeight) {
+  CriticalSectionHelper cs(lock_);
+  for (auto it = frames_.begin(); it != frames_.end(); ) {
+    if (it->url == url
+        && it->viewWidth == viewWidth
+        && it->viewHeight == viewHeight) {
+      frameBytes_ -= it->bits.Size();
+      it = frames_.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+  if (url_ == url && viewWidth_ == viewWidth && viewHeight_ == viewHeight) {
+    rendered_ = false;
+  }
+}
+
+class CountingRenderer : public Renderer {
+public:
+  LONG navigations;
+  LONG captures;
+  DWORD delay;
+  BYTE section[8];
+
+  CountingRenderer() : navigations(0), captures(0), delay(0) {}
+
+  HRESULT Navigate(LPCWSTR, UINT, UINT, boolean) {
+    InterlockedIncrement(&navigations);
+    Sleep(delay);
+    return S_OK;
+  }
+  HRESULT Capture(WORD bitCount, UINT &width, UINT &height, LPCWSTR) {
+    auto n = InterlockedIncrement(&captures);
+    width = 32 / bitCount;
+    height = 2;
+    memset(section, n, sizeof(section));
+    return S_OK;
+  }
+  bool SaveFrame(Blob &frame, SIZE_T size) {
+    if (size > sizeof(section) || !frame.Alloc(size)) return false;
+    memcpy(frame, section, size);
+    return true;
+  }
+  bool LoadFrame(const Blob &frame) {
+    memcpy(section, frame, frame.Size());
+    return true;
+  }
+};
+
+void Test_RenderCoordinator() {
+  CountingRenderer renderer;
+  RenderCoordinator coordinator(renderer, /*ttl*/60 * 1000);
+  UINT width, height;
+
+  assert(coordinator.Navigate(L"a", 100, 100, false) == S_OK);
+  assert(coordinator.Capture(8, width, height, nullptr) == S_OK);
+  assert(renderer.navigations == 1 && renderer.captures == 1);
+  assert(width == 4 && height == 2);
+
+  assert(coordinator.Navigate(L"b", 100, 100, false) == S_OK);
+  assert(coordinator.Capture(8, width, height, nullptr) == S_OK);
+  assert(renderer.navigations == 2 && renderer.captures == 2);
+  assert(renderer.section[0] == 2);
+
+  // Served from the cache without rendering
+  assert(coordinator.Navigate(L"a", 100, 100, false) == S_OK);
+  assert(coordinator.Capture(8, width, height, nullptr) == S_OK);
+  assert(renderer.navigations == 2 && renderer.captures == 2);
+  assert(renderer.section[0] == 1);
+
+  // A different viewport or bitCount is rendered
+  assert(coordinator.Capture(32, width, height, nullptr) == S_OK);
+  assert(renderer.navigations == 3 && renderer.captures == 3);
+  assert(width == 1);
+  assert(coordinator.Navigate(L"a", 200, 100, false) == S_OK);
+  assert(renderer.navigations == 4);
+
+  // An invalidated page is rendered again within the TTL
+  assert(coordinator.Capture(8, width, height, nullptr) == S_OK);
+  assert(coordinator.Navigate(L"a", 200, 100, false) == S_OK);
+  assert(coordinator.Capture(8, width, height, nullptr) == S_OK);
+  assert(renderer.navigations == 4 && renderer.captures == 4);
+  coordinator.Invalidate(L"a", 200, 100);
+  assert(coordinator.Navigate(L"a", 200, 100, false) == S_OK);
+  assert(coordinator.Capture(8, width, height, nullptr) == S_OK);
+  assert(renderer.navigations == 5 && renderer.captures == 5);
+  assert(renderer.section[0] == 5);
+
+  // Concurrent identical navigations are rendered once
+  struct Context {
+    RenderCoordinator *coordinator;
+    HRESULT result;
+  } contexts[4];
+  HANDLE threads[ARRAYSIZE(contexts)];
+  renderer.delay = 200;
+  for (SIZE_T i = 0; i < ARRAYSIZE(contexts); ++i) {
+    contexts[i].coordinator = &coordinator;
+    contexts[i].result = E_FAIL;
+    threads[i] = CreateThread(/*lpThreadAttributes*/nullptr,
+                              /*dwStackSize*/0,
+                              [](LPVOID p) -> DWORD {
+                                auto context = reinterpret_cast<Context*>(p);
+                                context->result =
+                                  context->coordinator->Navigate(L"c",
+                                                                 100,
+                                                                 100,
+                                                                 false);
+                                return 0;
+                              },
+                              &contexts[i],
+                              /*dwCreationFlags*/0,
+                              /*lpThreadId*/nullptr);
+    assert(threads[i]);
+  }
+  WaitForMultipleObjects(ARRAYSIZE(threads), threads, TRUE, INFINITE);
+  for (SIZE_T i = 0; i < ARRAYSIZE(contexts); ++i) {
+    assert(contexts[i].result == S_OK);
+    CloseHandle(threads[i]);
+  }
+  assert(renderer.navigations == 6);
+}
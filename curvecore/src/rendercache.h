@@ -0,0 +1,80 @@
+// What RenderCoordinator drives.  MainWindow renders for real; tests plug in
+// a stand-in that only counts calls.
+class Renderer {
+public:
+  virtual ~Renderer() {}
+  virtual HRESULT Navigate(LPCWSTR url,
+                           UINT viewWidth,
+                           UINT viewHeight,
+                           boolean async) = 0;
+  virtual HRESULT Capture(WORD bitCount,
+                          UINT &width,
+                          UINT &height,
+                          LPCWSTR saveOnServer) = 0;
+  // Copy a captured frame out of / into the section shared with clients.
+  virtual bool SaveFrame(Blob &frame, SIZE_T size) = 0;
+  virtual bool LoadFrame(const Blob &frame) = 0;
+};
+
+// Sits between the RPC methods and a Renderer.  Concurrent identical
+// requests are coalesced into one navigation or capture, and recent frames
+// are kept for |ttl| so that a repeated URL is served without rendering.
+class RenderCoordinator {
+private:
+  struct Operation;
+
+  struct Frame {
+    std::wstring url;
+    UINT viewWidth;
+    UINT viewHeight;
+    WORD bitCount;
+    UINT width;
+    UINT height;
+    ULONGLONG expiry;
+    ULONGLONG lastUsed;
+    Blob bits;
+  };
+
+  static const SIZE_T maxFrames = 16;
+  static const SIZE_T maxFrameBytes = 1 << 28;
+
+  Renderer &renderer_;
+  const DWORD ttl_;
+  CRITICAL_SECTION lock_;
+  std::shared_ptr<Operation> inFlight_;
+  std::vector<Frame> frames_;
+  SIZE_T frameBytes_;
+  ULONGLONG clock_;
+
+  // The page the client believes is loaded.  |rendered_| is false when the
+  // navigation was skipped because the cache had a frame for it.
+  std::wstring url_;
+  UINT viewWidth_;
+  UINT viewHeight_;
+  bool rendered_;
+  ULONGLONG renderedAt_;
+
+  Frame *FindFrame(LPCWSTR url,
+                   UINT viewWidth,
+                   UINT viewHeight,
+                   WORD bitCount,
+                   bool anyBitCount);
+  void StoreFrame(WORD bitCount, UINT width, UINT height);
+  HRESULT Join(std::shared_ptr<Operation> op, UINT *width, UINT *height);
+
+public:
+  RenderCoordinator(Renderer &renderer, DWORD ttl);
+  ~RenderCoordinator();
+
+  HRESULT Navigate(LPCWSTR url,
+                   UINT viewWidth,
+                   UINT viewHeight,
+                   boolean async);
+  HRESULT Capture(WORD bitCount,
+                  UINT &width,
+                  UINT &height,
+                  LPCWSTR saveOnServer);
+  // Drops the frames of the page so that the next navigation and capture
+  // of it are rendered even within |ttl|.
+  void Invalidate(LPCWSTR url, UINT viewWidth, UINT viewHeight);
+};
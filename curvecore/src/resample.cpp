@@ -0,0 +1,596 @@
+#include <windows.h>
+#include <emmintrin.h>
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <iostream>
+#include <vector>
+#include "blob.h"
+#include "curvecore.h"
+#include "resample.h"
+
+void Resampler::GetFootprint(DWORD i,
+                             DWORD sourceSize,
+                             DWORD size,
+                             DWORD &first,
+                             DWORD &end) {
+  first = static_cast<DWORD>(static_cast<ULONGLONG>(i) * sourceSize / size);
+  end = static_cast<DWORD>(
+    (static_cast<ULONGLONG>(i + 1) * sourceSize + size - 1) / size);
+}
+
+Resampler::Resampler()
+  : kernel_(area),
+    sourceWidth_(0),
+    sourceHeight_(0),
+    width_(0),
+    height_(0),
+    ratioX_(0),
+    ratioY_(0)
+{}
+
+// Coefficients of each span add up to 1 << coefficientBits exactly, so
+// a flat area stays at its level.
+void Resampler::MakeSpans(DWORD sourceSize,
+                          DWORD size,
+                          std::vector<Span> &spans) {
+  const LONGLONG one = 1 << coefficientBits;
+  const LONGLONG source = sourceSize;
+  const LONGLONG target = size;
+  spans.resize(size);
+  for (DWORD i = 0; i < size; ++i) {
+    auto &span = spans[i];
+    span.coefficients = static_cast<DWORD>(coefficients_.size());
+    if (kernel_ == area) {
+      DWORD end;
+      GetFootprint(i, sourceSize, size, span.first, end);
+      span.count = end - span.first;
+      for (DWORD j = span.first; j < end; ++j) {
+        const LONGLONG right = (j + 1) * target < (i + 1) * source
+                               ? (j + 1) * target : (i + 1) * source;
+        const LONGLONG left = j * target > i * source
+                              ? j * target : i * source;
+        coefficients_.push_back(
+          static_cast<short>(((right - left) * one + source / 2) / source));
+      }
+    }
+    else if (kernel_ == box) {
+      // Pixel j is centered in [i, i + 1) * source / target if
+      // 2 * i * source <= (2 * j + 1) * target < 2 * (i + 1) * source.
+      const LONGLONG first =
+        (2 * i * source - target + 2 * target - 1) / (2 * target);
+      LONGLONG end =
+        (2 * (i + 1) * source - target + 2 * target - 1) / (2 * target);
+      end = end < source ? end : source;
+      span.first = static_cast<DWORD>(first > 0 ? first : 0);
+      span.count = static_cast<DWORD>(end) - span.first;
+      for (DWORD j = 0; j < span.count; ++j) {
+        coefficients_.push_back(static_cast<short>(one / span.count));
+      }
+    }
+    else {
+      // The center of pixel i is at c = (2 * i + 1) * source / target / 2
+      // in the source, between the centers of pixels c - 1/2 and c + 1/2.
+      const LONGLONG center = (2 * i + 1) * source - target;
+      span.first = static_cast<DWORD>(center / (2 * target));
+      const LONGLONG weight =
+        (center % (2 * target) * one + target) / (2 * target);
+      if (weight == 0 || span.first + 1 >= sourceSize) {
+        span.count = 1;
+        coefficients_.push_back(static_cast<short>(one));
+      }
+      else if (weight == one) {
+        span.first += 1;
+        span.count = 1;
+        coefficients_.push_back(static_cast<short>(one));
+      }
+      else {
+        span.count = 2;
+        coefficients_.push_back(static_cast<short>(one - weight));
+        coefficients_.push_back(static_cast<short>(weight));
+      }
+    }
+
+    // Rounding error goes to the largest coefficient.
+    auto weights = coefficients_.data() + span.coefficients;
+    LONGLONG sum = 0;
+    DWORD largest = 0;
+    for (DWORD j = 0; j < span.count; ++j) {
+      sum += weights[j];
+      if (weights[j] > weights[largest]) largest = j;
+    }
+    weights[largest] = static_cast<short>(weights[largest] + one - sum);
+  }
+}
+
+bool Resampler::Init(Kernel kernel,
+                     DWORD sourceWidth,
+                     DWORD sourceHeight,
+                     DWORD width,
+                     DWORD height) {
+  if (width == 0 || height == 0
+      || width > sourceWidth || height > sourceHeight) {
+    return false;
+  }
+  if (kernel == kernel_
+      && sourceWidth == sourceWidth_
+      && sourceHeight == sourceHeight_
+      && width == width_
+      && height == height_) {
+    return true;
+  }
+
+  kernel_ = kernel;
+  sourceWidth_ = sourceWidth;
+  sourceHeight_ = sourceHeight;
+  width_ = width;
+  height_ = height;
+
+  // A block sum of up to 257 lines fits in a WORD.
+  const bool byRatio = kernel != bilinear
+                       && sourceWidth % width == 0
+                       && sourceHeight % height == 0
+                       && sourceHeight / height <= 257;
+  ratioX_ = byRatio ? sourceWidth / width : 0;
+  ratioY_ = byRatio ? sourceHeight / height : 0;
+
+  coefficients_.clear();
+  MakeSpans(sourceWidth, width, columns_);
+  MakeSpans(sourceHeight, height, rows_);
+  line_.resize(sourceWidth);
+  lineMin_.resize(sourceWidth);
+  lineMax_.resize(sourceWidth);
+  return true;
+}
+
+void Resampler::ResampleByRatio(LPCBYTE source,
+                                LONG sourceStride,
+                                WORD *output,
+                                LONG outputStride) {
+  const __m128i zero = _mm_setzero_si128();
+  const DWORD count = ratioX_ * ratioY_;
+  for (DWORD y = 0; y < height_; ++y, output += outputStride) {
+    const auto top =
+      source + static_cast<LONG_PTR>(y) * ratioY_ * sourceStride;
+    auto line = line_.data();
+    DWORD x = 0;
+    for (; x + 16 <= sourceWidth_; x += 16) {
+      __m128i sumLow = zero;
+      __m128i sumHigh = zero;
+      auto p = top + x;
+      for (DWORD i = 0; i < ratioY_; ++i, p += sourceStride) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        sumLow = _mm_add_epi16(sumLow, _mm_unpacklo_epi8(v, zero));
+        sumHigh = _mm_add_epi16(sumHigh, _mm_unpackhi_epi8(v, zero));
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(line + x), sumLow);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(line + x + 8), sumHigh);
+    }
+    for (; x < sourceWidth_; ++x) {
+      WORD sum = 0;
+      auto p = top + x;
+      for (DWORD i = 0; i < ratioY_; ++i, p += sourceStride) {
+        sum = static_cast<WORD>(sum + *p);
+      }
+      line[x] = sum;
+    }
+
+    for (DWORD i = 0; i < width_; ++i, line += ratioX_) {
+      DWORD sum = 0;
+      for (DWORD j = 0; j < ratioX_; ++j) {
+        sum += line[j];
+      }
+      output[i] = static_cast<WORD>(
+        ((sum << fractionBits) + count / 2) / count);
+    }
+  }
+}
+
+void Resampler::Resample(LPCBYTE source,
+                         LONG sourceStride,
+                         WORD *output,
+                         LONG outputStride) {
+  if (ratioX_) {
+    ResampleByRatio(source, sourceStride, output, outputStride);
+    return;
+  }
+
+  const int shift = coefficientBits - fractionBits;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i half = _mm_set1_epi32(1 << (shift - 1));
+  for (DWORD y = 0; y < height_; ++y, output += outputStride) {
+    const auto &span = rows_[y];
+    const auto weights = coefficients_.data() + span.coefficients;
+    const auto top = source + static_cast<LONG_PTR>(span.first) * sourceStride;
+
+    // Vertical pass: two lines at a time by PMADDWD of interleaved pixels
+    // and a pair of weights.
+    DWORD x = 0;
+    for (; x + 8 <= sourceWidth_; x += 8) {
+      __m128i sumLow = zero;
+      __m128i sumHigh = zero;
+      for (DWORD i = 0; i < span.count; i += 2) {
+        const auto p = top + static_cast<LONG_PTR>(i) * sourceStride + x;
+        const __m128i a = _mm_unpacklo_epi8(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), zero);
+        const __m128i b = i + 1 < span.count
+          ? _mm_unpacklo_epi8(
+              _mm_loadl_epi64(
+                reinterpret_cast<const __m128i*>(p + sourceStride)),
+              zero)
+          : zero;
+        const WORD weightB = i + 1 < span.count ? weights[i + 1] : 0;
+        const __m128i pair = _mm_set1_epi32(
+          static_cast<int>(static_cast<DWORD>(weightB) << 16
+                           | static_cast<WORD>(weights[i])));
+        sumLow = _mm_add_epi32(sumLow,
+                               _mm_madd_epi16(_mm_unpacklo_epi16(a, b), pair));
+        sumHigh = _mm_add_epi32(sumHigh,
+                                _mm_madd_epi16(_mm_unpackhi_epi16(a, b), pair));
+      }
+      sumLow = _mm_srai_epi32(_mm_add_epi32(sumLow, half), shift);
+      sumHigh = _mm_srai_epi32(_mm_add_epi32(sumHigh, half), shift);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(line_.data() + x),
+                       _mm_packs_epi32(sumLow, sumHigh));
+    }
+    for (; x < sourceWidth_; ++x) {
+      int sum = 0;
+      for (DWORD i = 0; i < span.count; ++i) {
+        sum += weights[i] * top[static_cast<LONG_PTR>(i) * sourceStride + x];
+      }
+      line_[x] = static_cast<WORD>((sum + (1 << (shift - 1))) >> shift);
+    }
+
+    // Horizontal pass
+    for (DWORD i = 0; i < width_; ++i) {
+      const auto &column = columns_[i];
+      const auto columnWeights = coefficients_.data() + column.coefficients;
+      const auto line = line_.data() + column.first;
+      int sum = 0;
+      for (DWORD j = 0; j < column.count; ++j) {
+        sum += columnWeights[j] * line[j];
+      }
+      output[i] = static_cast<WORD>(
+        (sum + (1 << (coefficientBits - 1))) >> coefficientBits);
+    }
+  }
+}
+
+void Resampler::ReduceMinMax(LPCBYTE source,
+                             LONG sourceStride,
+                             LPBYTE mins,
+                             LPBYTE maxs,
+                             LONG outputStride) {
+  for (DWORD y = 0; y < height_; ++y, mins += outputStride,
+                                      maxs += outputStride) {
+    DWORD top, bottom;
+    GetFootprint(y, sourceHeight_, height_, top, bottom);
+    const auto first = source + static_cast<LONG_PTR>(top) * sourceStride;
+
+    DWORD x = 0;
+    for (; x + 16 <= sourceWidth_; x += 16) {
+      __m128i low = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(first + x));
+      __m128i high = low;
+      auto p = first + sourceStride + x;
+      for (DWORD i = top + 1; i < bottom; ++i, p += sourceStride) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        low = _mm_min_epu8(low, v);
+        high = _mm_max_epu8(high, v);
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(lineMin_.data() + x), low);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(lineMax_.data() + x), high);
+    }
+    for (; x < sourceWidth_; ++x) {
+      BYTE low = first[x], high = first[x];
+      auto p = first + sourceStride + x;
+      for (DWORD i = top + 1; i < bottom; ++i, p += sourceStride) {
+        low = *p < low ? *p : low;
+        high = *p > high ? *p : high;
+      }
+      lineMin_[x] = low;
+      lineMax_[x] = high;
+    }
+
+    for (DWORD i = 0; i < width_; ++i) {
+      DWORD left, right;
+      GetFootprint(i, sourceWidth_, width_, left, right);
+      BYTE low = lineMin_[left], high = lineMax_[left];
+      for (DWORD j = left + 1; j < right; ++j) {
+        low = lineMin_[j] < low ? lineMin_[j] : low;
+        high = lineMax_[j] > high ? lineMax_[j] : high;
+      }
+      mins[i] = low;
+      maxs[i] = high;
+    }
+  }
+}
+
+FrameReduction::FrameReduction()
+  : image1_(nullptr),
+    image2_(nullptr),
+    sameSize_(false)
+{}
+
+bool FrameReduction::Build(UINT metrics,
+                           const curve::SimpleBitmap &image1,
+                           const curve::SimpleBitmap &image2) {
+  image1_ = &image1;
+  image2_ = &image2;
+  sameSize_ = image1.width_ == image2.width_
+              && image1.height_ == image2.height_;
+  if (sameSize_) {
+    return true;
+  }
+
+  if (!resampler_.Init(Resampler::area,
+                       image2.width_,
+                       image2.height_,
+                       image1.width_,
+                       image1.height_)) {
+    return false;
+  }
+
+  const SIZE_T pixels = static_cast<SIZE_T>(image1.width_) * image1.height_;
+  const LONG lineSize2 = image2.GetLineSize();
+  if (metrics & (1 << curve::averageDiff)) {
+    if (averages_.Size() < pixels * sizeof(WORD)
+        && !averages_.Alloc(pixels * sizeof(WORD))) {
+      return false;
+    }
+    resampler_.Resample(image2.bits_,
+                        lineSize2,
+                        averages_.As<WORD>(),
+                        image1.width_);
+  }
+  if (metrics & (1 << curve::maxDiff)) {
+    if ((mins_.Size() < pixels && !mins_.Alloc(pixels))
+        || (maxs_.Size() < pixels && !maxs_.Alloc(pixels))) {
+      return false;
+    }
+    resampler_.ReduceMinMax(image2.bits_,
+                            lineSize2,
+                            mins_,
+                            maxs_,
+                            image1.width_);
+  }
+  return true;
+}
+
+double FrameReduction::Diff(curve::DiffAlgorithm algo,
+                            DWORD x,
+                            DWORD y) const {
+  const auto &image1 = *image1_;
+  const auto &image2 = *image2_;
+  const LONG lineSize2 = image2.GetLineSize();
+  const double value1 = image1.bits_[y * image1.GetLineSize() + x];
+  if (sameSize_) {
+    const double value2 = image2.bits_[y * lineSize2 + x];
+    return algo == curve::maxDiff || algo == curve::minDiff
+           ? value1 - value2
+           : value2 - value1;
+  }
+
+  const SIZE_T i = static_cast<SIZE_T>(y) * image1.width_ + x;
+  DWORD left, right, top, bottom;
+  Resampler::GetFootprint(x, image2.width_, image1.width_, left, right);
+  Resampler::GetFootprint(y, image2.height_, image1.height_, top, bottom);
+  switch (algo) {
+  case curve::averageDiff:
+    return averages_.As<WORD>()[i] / static_cast<double>(
+             1 << Resampler::fractionBits)
+           - value1;
+  case curve::maxDiff: {
+    const double toMin = value1 - mins_.As<BYTE>()[i];
+    const double toMax = value1 - maxs_.As<BYTE>()[i];
+    return fabs(toMax) > fabs(toMin) ? toMax : toMin;
+  }
+  case curve::minDiff: {
+    // The closest level in a block is not told by its range.
+    double diff = DBL_MAX;
+    for (DWORD sy = top; sy < bottom; ++sy) {
+      const auto line = image2.bits_ + static_cast<SIZE_T>(sy) * lineSize2;
+      for (DWORD sx = left; sx < right; ++sx) {
+        const double d = value1 - line[sx];
+        if (fabs(d) < fabs(diff)) diff = d;
+      }
+    }
+    return diff;
+  }
+  default:
+    return image2.bits_[static_cast<SIZE_T>(top) * lineSize2 + left] - value1;
+  }
+}
+
+bool ReducePlane(const Plane &source,
+                 DWORD width,
+                 DWORD height,
+                 Resampler &resampler,
+                 Blob &levels,
+                 Blob &bits,
+                 Plane &reduced) {
+  const SIZE_T pixels = static_cast<SIZE_T>(width) * height;
+  if (!resampler.Init(Resampler::area,
+                      source.width,
+                      source.height,
+                      width,
+                      height)
+      || (levels.Size() < pixels * sizeof(WORD)
+          && !levels.Alloc(pixels * sizeof(WORD)))
+      || (bits.Size() < pixels && !bits.Alloc(pixels))) {
+    return false;
+  }
+
+  resampler.Resample(source.bits, source.stride, levels.As<WORD>(), width);
+  const auto in = levels.As<WORD>();
+  const auto out = bits.As<BYTE>();
+  const int half = 1 << (Resampler::fractionBits - 1);
+  for (SIZE_T i = 0; i < pixels; ++i) {
+    out[i] = static_cast<BYTE>((in[i] + half) >> Resampler::fractionBits);
+  }
+  reduced = {bits.As<BYTE>(), static_cast<LONG>(width), width, height};
+  return true;
+}
+
+bool PlanePair::Init(const curve::SimpleBitmap &image1,
+                     const curve::SimpleBitmap &image2) {
+  if (image1.bitCount_ != 8 || image2.bitCount_ != 8
+      || image1.width_ > image2.width_
+      || image1.height_ > image2.height_) {
+    return false;
+  }
+  plane1_ = {image1.bits_,
+             static_cast<LONG>(image1.GetLineSize()),
+             image1.width_,
+             image1.height_};
+  plane2_ = {image2.bits_,
+             static_cast<LONG>(image2.GetLineSize()),
+             image2.width_,
+             image2.height_};
+  return (image1.width_ == image2.width_ && image1.height_ == image2.height_)
+         || ReducePlane(plane2_,
+                        image1.width_,
+                        image1.height_,
+                        resampler_,
+                        levels_,
+                        bits_,
+                        plane2_);
+}
+
+const Plane &PlanePair::First() const {
+  return plane1_;
+}
+
+const Plane &PlanePair::Second() const {
+  return plane2_;
+}
+
+void Test_Resampler() {
+  const DWORD width = 70, height = 44, lineSize = 72;
+  BYTE bits[lineSize * height];
+  for (DWORD i = 0; i < sizeof(bits); ++i) {
+    bits[i] = static_cast<BYTE>(i * 37 + (i >> 5));
+  }
+
+  // Every kernel keeps a flat frame flat.
+  BYTE flat[lineSize * height];
+  memset(flat, 0x9c, sizeof(flat));
+  WORD output[70 * 44];
+  Resampler resampler;
+  for (int kernel = Resampler::box; kernel <= Resampler::area; ++kernel) {
+    assert(resampler.Init(static_cast<Resampler::Kernel>(kernel),
+                          width, height, 47, 30));
+    resampler.Resample(flat, lineSize, output, 47);
+    for (DWORD i = 0; i < 47 * 30; ++i) {
+      assert(output[i] == 0x9c << Resampler::fractionBits);
+    }
+  }
+
+  // For integer ratios, the block sums give the exact averages.
+  assert(resampler.Init(Resampler::area, width, height, 35, 22));
+  resampler.Resample(bits, lineSize, output, 35);
+  for (DWORD y = 0; y < 22; ++y) {
+    for (DWORD x = 0; x < 35; ++x) {
+      const auto p = bits + y * 2 * lineSize + x * 2;
+      const DWORD sum = p[0] + p[1] + p[lineSize] + p[lineSize + 1];
+      assert(output[y * 35 + x] == sum << (Resampler::fractionBits - 2));
+    }
+  }
+
+  // Otherwise the taps of area are within the rounding of fixed point from
+  // the average weighted by the shared areas.
+  const DWORD width2 = 47, height2 = 30;
+  assert(resampler.Init(Resampler::area, width, height, width2, height2));
+  resampler.Resample(bits, lineSize, output, width2);
+  for (DWORD y = 0; y < height2; ++y) {
+    for (DWORD x = 0; x < width2; ++x) {
+      double expected = 0;
+      for (DWORD sy = 0; sy < height; ++sy) {
+        const double top = sy * height2 > y * height ? sy * height2 : y * height;
+        const double bottom = (sy + 1) * height2 < (y + 1) * height
+                              ? (sy + 1) * height2 : (y + 1) * height;
+        if (bottom <= top) continue;
+        for (DWORD sx = 0; sx < width; ++sx) {
+          const double left = sx * width2 > x * width ? sx * width2 : x * width;
+          const double right = (sx + 1) * width2 < (x + 1) * width
+                               ? (sx + 1) * width2 : (x + 1) * width;
+          if (right <= left) continue;
+          expected += (bottom - top) / height * (right - left) / width
+                      * bits[sy * lineSize + sx];
+        }
+      }
+      expected *= 1 << Resampler::fractionBits;
+      assert(fabs(output[y * width2 + x] - expected) <= 2);
+    }
+  }
+
+  // 5 to 2 has footprints [0, 3) and [2, 5), sharing pixel 2.
+  DWORD first, end;
+  Resampler::GetFootprint(0, 5, 2, first, end);
+  assert(first == 0 && end == 3);
+  Resampler::GetFootprint(1, 5, 2, first, end);
+  assert(first == 2 && end == 5);
+
+  BYTE mins[35 * 22], maxs[35 * 22];
+  assert(resampler.Init(Resampler::area, width, height, 28, 17));
+  resampler.ReduceMinMax(bits, lineSize, mins, maxs, 28);
+  for (DWORD y = 0; y < 17; ++y) {
+    DWORD top, bottom;
+    Resampler::GetFootprint(y, height, 17, top, bottom);
+    for (DWORD x = 0; x < 28; ++x) {
+      DWORD left, right;
+      Resampler::GetFootprint(x, width, 28, left, right);
+      BYTE low = 255, high = 0;
+      for (DWORD sy = top; sy < bottom; ++sy) {
+        for (DWORD sx = left; sx < right; ++sx) {
+          const BYTE v = bits[sy * lineSize + sx];
+          low = v < low ? v : low;
+          high = v > high ? v : high;
+        }
+      }
+      assert(mins[y * 28 + x] == low && maxs[y * 28 + x] == high);
+    }
+  }
+}
+
+void Test_FrameReduction() {
+  BYTE bitmap_5x3[] = {
+    0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0x00, 0x00, 0x00,
+    0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0x00, 0x00, 0x00,
+    0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0x00, 0x00, 0x00,
+  };
+  BYTE bitmap_10x6[12 * 6];
+  memset(bitmap_10x6, 0xf0, sizeof(bitmap_10x6));
+  curve::SimpleBitmap image1(8, 5, 3, bitmap_5x3),
+                      image2(8, 10, 6, bitmap_10x6);
+
+  // Every line of a block counts, not only the first one.
+  bitmap_10x6[12 * 5 + 2] = 0xf4;
+  bitmap_10x6[12 * 5 + 3] = 0xe0;
+  FrameReduction reduction;
+  const UINT all = (1 << curve::averageDiff) | (1 << curve::maxDiff);
+  assert(reduction.Build(all, image1, image2));
+  assert(reduction.Diff(curve::averageDiff, 1, 2) == -3);
+  assert(reduction.Diff(curve::maxDiff, 1, 2) == 16);
+  assert(reduction.Diff(curve::minDiff, 1, 2) == 0);
+  assert(reduction.Diff(curve::skipDiff, 1, 2) == 0);
+  assert(reduction.Diff(curve::averageDiff, 0, 2) == 0);
+
+  // 10 to 4 columns is not an integer ratio.  Column 1 covers 2.5 to 5,
+  // so pixels 2, 3, and 4 weigh .2, .4, and .4.
+  curve::SimpleBitmap image3(8, 4, 3, bitmap_5x3);
+  assert(reduction.Build(all, image3, image2));
+  assert(fabs(reduction.Diff(curve::averageDiff, 1, 2)
+              - (.2 * 4 - .4 * 16) / 2) < 1.0 / 64);
+  assert(reduction.Diff(curve::maxDiff, 1, 2) == 16);
+  assert(reduction.Diff(curve::minDiff, 1, 2) == 0);
+  bitmap_10x6[12 * 4 + 2] = 0xf1;
+  assert(reduction.Diff(curve::skipDiff, 1, 2) == 1);
+
+  // Frames of the sizes of an earlier pair keep the coefficients, but are
+  // reduced again.
+  bitmap_10x6[12 * 5 + 3] = 0xf0;
+  assert(reduction.Build(all, image1, image2));
+  assert(fabs(reduction.Diff(curve::averageDiff, 1, 2) - 1.25) < 1.0 / 64);
+  assert(reduction.Diff(curve::maxDiff, 1, 2) == -4);
+}
@@ -0,0 +1,141 @@
+// Reduces an 8bpp frame to a smaller grid with a separable kernel in fixed
+// point.  The coefficients of every column and row are computed once by
+// Init and reused for every frame of the same pair of sizes.  The vertical
+// pass runs over whole lines with SSE2, and ratios that are integers on
+// both axes take a plain block sum instead of taps.  Outputs keep
+// |fractionBits| bits of fraction, so a block average is not rounded to a
+// whole level.
+class Resampler {
+public:
+  enum Kernel {
+    box,      // Equal weights of source pixels centered in the footprint
+    bilinear, // Two taps around the center of the footprint
+    area,     // Weights of the area each source pixel shares with it
+  };
+
+  static const int fractionBits = 7;
+
+  // Source pixels [first, end) that a destination pixel |i| overlaps when
+  // |sourceSize| pixels are reduced to |size|.
+  static void GetFootprint(DWORD i,
+                           DWORD sourceSize,
+                           DWORD size,
+                           DWORD &first,
+                           DWORD &end);
+
+private:
+  struct Span {
+    DWORD first;
+    DWORD count;
+    DWORD coefficients; // Offset in coefficients_
+  };
+
+  static const int coefficientBits = 14;
+
+  Kernel kernel_;
+  DWORD sourceWidth_;
+  DWORD sourceHeight_;
+  DWORD width_;
+  DWORD height_;
+  DWORD ratioX_; // Integer ratios for the fast path, or 0
+  DWORD ratioY_;
+  std::vector<Span> columns_;
+  std::vector<Span> rows_;
+  std::vector<short> coefficients_;
+  std::vector<WORD> line_;
+  std::vector<BYTE> lineMin_;
+  std::vector<BYTE> lineMax_;
+
+  void MakeSpans(DWORD sourceSize, DWORD size, std::vector<Span> &spans);
+  void ResampleByRatio(LPCBYTE source,
+                       LONG sourceStride,
+                       WORD *output,
+                       LONG outputStride);
+
+public:
+  Resampler();
+  // |width| x |height| must not be larger than the source on either axis.
+  // The coefficients of the last call are kept if the kernel and the sizes
+  // are the same.
+  bool Init(Kernel kernel,
+            DWORD sourceWidth,
+            DWORD sourceHeight,
+            DWORD width,
+            DWORD height);
+  // Writes |height| lines of |width| values in units of 1/2^fractionBits.
+  // |outputStride| is in WORDs.
+  void Resample(LPCBYTE source,
+                LONG sourceStride,
+                WORD *output,
+                LONG outputStride);
+  // Writes the smallest and the largest source pixel in the footprint of
+  // every destination pixel.
+  void ReduceMinMax(LPCBYTE source,
+                    LONG sourceStride,
+                    LPBYTE mins,
+                    LPBYTE maxs,
+                    LONG outputStride);
+};
+
+// The larger of two 8bpp frames reduced to the grid of the smaller one for
+// the native algorithms, which compare each pixel of the smaller frame with
+// the block of the larger frame it covers.  A block is the footprint of the
+// pixel, so both axes are aggregated and ratios need not be integers.
+// The resampler and the buffers are kept for the next pair of frames.
+class FrameReduction {
+private:
+  const curve::SimpleBitmap *image1_;
+  const curve::SimpleBitmap *image2_;
+  bool sameSize_;
+  Resampler resampler_;
+  Blob averages_;
+  Blob mins_;
+  Blob maxs_;
+
+public:
+  FrameReduction();
+  // Prepares for the native algorithms in |metrics|, a set of bits of
+  // 1 << DiffAlgorithm.  |image1| must not be larger than |image2|.
+  bool Build(UINT metrics,
+             const curve::SimpleBitmap &image1,
+             const curve::SimpleBitmap &image2);
+  // The difference of |algo| at a pixel of the smaller frame, signed as
+  // the native path of GrayscaleDiff always did.
+  double Diff(curve::DiffAlgorithm algo, DWORD x, DWORD y) const;
+};
+
+// An 8bpp plane of pixels, such as a frame or a reduced copy of one.
+struct Plane {
+  LPCBYTE bits;
+  LONG stride;
+  DWORD width;
+  DWORD height;
+};
+
+// Reduces |source| by area to |width| x |height| whole levels in |bits|,
+// using |levels| as the buffer of the fixed-point output.
+bool ReducePlane(const Plane &source,
+                 DWORD width,
+                 DWORD height,
+                 Resampler &resampler,
+                 Blob &levels,
+                 Blob &bits,
+                 Plane &reduced);
+
+// Two 8bpp frames as planes of the size of the smaller one, |image1|, to
+// which the larger one is reduced by area.  Frames of the same size are
+// used as they are.
+class PlanePair {
+private:
+  Resampler resampler_;
+  Blob levels_;
+  Blob bits_;
+  Plane plane1_;
+  Plane plane2_;
+
+public:
+  bool Init(const curve::SimpleBitmap &image1,
+            const curve::SimpleBitmap &image2);
+  const Plane &First() const;
+  const Plane &Second() const;
+};
@@ -0,0 +1,401 @@
+#include <windows.h>
+#include <assert.h>
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include "blob.h"
+#include "filemapping.h"
+#include "synchronization.h"
+#include "curvecore.h"
+#include "fingerprint.h"
+#include "resultcache.h"
+
+void Log(LPCWSTR format, ...);
+
+struct ResultCache::Header {
+  DWORD magic;
+  DWORD slotSize;
+  DWORD slotCount;
+  DWORD reserved;
+  ULONGLONG clock;
+  ULONGLONG bytesUsed;
+  ULONGLONG byteBudget;
+};
+
+struct ResultCache::Slot {
+  ULONGLONG key; // 0 if the slot is empty
+  ULONGLONG check;
+  ULONGLONG lastUsed;
+  ULONGLONG payloadSize;
+  curve::DiffOutput output;
+};
+
+static const DWORD cacheMagic = 0x43565243; // 'CRVC'
+static const DWORD defaultSlotCount = 1 << 16;
+
+static ULONGLONG Mix64(ULONGLONG x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+}
+
+ResultCache::Key ResultCache::MakeKey(LPCWSTR url,
+                                      UINT viewWidth,
+                                      UINT viewHeight,
+                                      curve::DiffAlgorithm algo,
+                                      ULONGLONG frameHash1,
+                                      ULONGLONG frameHash2,
+                                      ULONGLONG variant) {
+  const auto urlBytes = wcslen(url) * sizeof(WCHAR);
+  const auto urlHash = HashBytes(reinterpret_cast<LPCBYTE>(url), urlBytes, 0);
+
+  // The check word uses FNV-1a so that it does not share the linearity of
+  // the CRC used for the key.
+  ULONGLONG urlCheck = 14695981039346656037ull;
+  for (auto p = url; *p; ++p) {
+    urlCheck ^= *p;
+    urlCheck *= 1099511628211ull;
+  }
+
+  const auto viewport = static_cast<ULONGLONG>(viewWidth) << 32 | viewHeight;
+  const auto params = Mix64(viewport ^ (static_cast<ULONGLONG>(algo) << 56))
+                      ^ Mix64(variant + 0x632be59bd9b4e019ull);
+  Key key;
+  key.key = Mix64(urlHash ^ params)
+            ^ Mix64(frameHash1)
+            ^ Mix64(frameHash2 + 1);
+  key.check = Mix64(urlCheck + params)
+              ^ Mix64(frameHash1 ^ 0x5bd1e995)
+              ^ Mix64(~frameHash2);
+  if (key.key == 0) key.key = 1;
+  return key;
+}
+
+ResultCache::ResultCache()
+  : header_(nullptr),
+    slots_(nullptr) {
+  dataDir_[0] = 0;
+}
+
+bool ResultCache::Open(LPCWSTR indexFile, ULONGLONG byteBudget) {
+  // Processes sharing the same index file share the lock.
+  WCHAR mutexName[64];
+  const auto nameHash = HashBytes(reinterpret_cast<LPCBYTE>(indexFile),
+                                  wcslen(indexFile) * sizeof(WCHAR),
+                                  0);
+  swprintf_s(mutexName, L"Local\\curve-cache-%016I64x", nameHash);
+  mutex_ = std::make_unique<Mutex>(mutexName);
+  if (!*mutex_) {
+    Log(L"CreateMutex failed - %08x\n", GetLastError());
+    return false;
+  }
+  MutexHelper lock(*mutex_);
+
+  const ULONGLONG indexSize = sizeof(Header)
+                              + sizeof(Slot) * defaultSlotCount;
+  HANDLE file = CreateFile(indexFile,
+                           GENERIC_READ | GENERIC_WRITE,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE,
+                           /*lpSecurityAttributes*/nullptr,
+                           OPEN_ALWAYS,
+                           FILE_ATTRIBUTE_NORMAL,
+                           /*hTemplateFile*/nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    Log(L"CreateFile(%s) failed - %08x\n", indexFile, GetLastError());
+    return false;
+  }
+
+  LARGE_INTEGER fileSize;
+  const bool isNew = !GetFileSizeEx(file, &fileSize)
+                     || static_cast<ULONGLONG>(fileSize.QuadPart) < indexSize;
+  HANDLE section = CreateFileMapping(file,
+                                     /*lpFileMappingAttributes*/nullptr,
+                                     PAGE_READWRITE,
+                                     static_cast<DWORD>(indexSize >> 32),
+                                     static_cast<DWORD>(indexSize),
+                                     /*lpName*/nullptr);
+  CloseHandle(file);
+  if (!section) {
+    Log(L"CreateFileMapping failed - %08x\n", GetLastError());
+    return false;
+  }
+  mapping_.Attach(section);
+
+  view_ = mapping_.CreateMappedView(FILE_MAP_READ | FILE_MAP_WRITE, indexSize);
+  if (!static_cast<LPBYTE>(view_)) return false;
+
+  header_ = reinterpret_cast<Header*>(static_cast<LPBYTE>(view_));
+  slots_ = reinterpret_cast<Slot*>(header_ + 1);
+  if (isNew
+      || header_->magic != cacheMagic
+      || header_->slotSize != sizeof(Slot)
+      || header_->slotCount != defaultSlotCount) {
+    // A new file, or one written with a different layout.  Payload files
+    // left from the old layout are overwritten as keys are reused.
+    Log(L"Initializing the result cache %s\n", indexFile);
+    ZeroMemory(header_, static_cast<SIZE_T>(indexSize));
+    header_->slotSize = sizeof(Slot);
+    header_->slotCount = defaultSlotCount;
+    header_->magic = cacheMagic;
+  }
+  header_->byteBudget = byteBudget;
+
+  swprintf_s(dataDir_, L"%s.data", indexFile);
+  if (!CreateDirectory(dataDir_, /*lpSecurityAttributes*/nullptr)
+      && GetLastError() != ERROR_ALREADY_EXISTS) {
+    Log(L"CreateDirectory(%s) failed - %08x\n", dataDir_, GetLastError());
+    return false;
+  }
+
+  EvictToBudget();
+  return true;
+}
+
+// A payload is named by the check word too, so that evicting an entry
+// of the same key does not delete the payload of another.
+void ResultCache::GetPayloadPath(ULONGLONG key,
+                                 ULONGLONG check,
+                                 LPWSTR path,
+                                 SIZE_T count) const {
+  swprintf_s(path, count, L"%s\\%016I64x%016I64x.bin", dataDir_, key, check);
+}
+
+ResultCache::Slot *ResultCache::Find(const Key &key) {
+  const auto bucketCount = header_->slotCount / waysPerBucket;
+  auto bucket = slots_ + (key.key % bucketCount) * waysPerBucket;
+  for (DWORD i = 0; i < waysPerBucket; ++i) {
+    if (bucket[i].key == key.key && bucket[i].check == key.check) {
+      return &bucket[i];
+    }
+  }
+  return nullptr;
+}
+
+void ResultCache::Evict(Slot &slot) {
+  if (slot.payloadSize > 0) {
+    WCHAR path[MAX_PATH];
+    GetPayloadPath(slot.key, slot.check, path, ARRAYSIZE(path));
+    DeleteFile(path);
+  }
+  header_->bytesUsed -= sizeof(Slot) + slot.payloadSize;
+  slot.key = 0;
+}
+
+// Evicts least recently used entries until the cache fits in 90% of its
+// budget so that a full cache does not scan the index on every store.  The
+// index is scanned once for all the victims, as the lock stalls lookups of
+// every process meanwhile.
+void ResultCache::EvictToBudget() {
+  if (header_->bytesUsed <= header_->byteBudget) return;
+
+  std::vector<Slot*> used;
+  for (DWORD i = 0; i < header_->slotCount; ++i) {
+    if (slots_[i].key) {
+      used.push_back(&slots_[i]);
+    }
+  }
+  const auto older = [](const Slot *a, const Slot *b) {
+    return a->lastUsed < b->lastUsed;
+  };
+  std::sort(used.begin(), used.end(), older);
+
+  const auto target = header_->byteBudget / 10 * 9;
+  for (auto slot : used) {
+    if (header_->bytesUsed <= target) break;
+    Evict(*slot);
+  }
+}
+
+bool ResultCache::Lookup(const Key &key,
+                         curve::DiffOutput &output,
+                         Blob *payload) {
+  if (!header_) return false;
+
+  ULONGLONG payloadSize = 0;
+  {
+    MutexHelper lock(*mutex_);
+    auto slot = Find(key);
+    if (!slot) return false;
+    slot->lastUsed = ++header_->clock;
+    output = slot->output;
+    payloadSize = slot->payloadSize;
+  }
+
+  if (payload) {
+    payload->Alloc(0);
+    if (payloadSize > 0) {
+      WCHAR path[MAX_PATH];
+      GetPayloadPath(key.key, key.check, path, ARRAYSIZE(path));
+      std::ifstream is(path, std::ios::binary);
+      if (!is.is_open()
+          || !payload->Alloc(static_cast<SIZE_T>(payloadSize))
+          || !is.read(payload->As<char>(), payload->Size())) {
+        // The entry is still valid without its payload, but the caller
+        // wanted the payload.  Report a miss to let it recompute.
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool ResultCache::Store(const Key &key,
+                        const curve::DiffOutput &output,
+                        const Blob *payload) {
+  if (!header_) return false;
+
+  const SIZE_T payloadSize = payload ? payload->Size() : 0;
+  if (payloadSize > 0) {
+    // Write the payload before publishing the slot so that a reader in
+    // another process never sees a slot without its file.
+    WCHAR path[MAX_PATH];
+    GetPayloadPath(key.key, key.check, path, ARRAYSIZE(path));
+    std::ofstream os(path, std::ios::binary | std::ios::trunc);
+    if (!os.is_open()
+        || !os.write(payload->As<char>(), payloadSize)) {
+      Log(L"Failed to write %s\n", path);
+      return false;
+    }
+  }
+
+  MutexHelper lock(*mutex_);
+  auto slot = Find(key);
+  if (slot) {
+    if (slot->payloadSize > 0 && payloadSize == 0) {
+      WCHAR path[MAX_PATH];
+      GetPayloadPath(slot->key, slot->check, path, ARRAYSIZE(path));
+      DeleteFile(path);
+    }
+    header_->bytesUsed -= sizeof(Slot) + slot->payloadSize;
+  }
+  else {
+    const auto bucketCount = header_->slotCount / waysPerBucket;
+    auto bucket = slots_ + (key.key % bucketCount) * waysPerBucket;
+    for (DWORD i = 0; i < waysPerBucket; ++i) {
+      if (!bucket[i].key) {
+        slot = &bucket[i];
+        break;
+      }
+      if (!slot || bucket[i].lastUsed < slot->lastUsed) {
+        slot = &bucket[i];
+      }
+    }
+    if (slot->key) {
+      Evict(*slot);
+    }
+  }
+
+  slot->key = 0;
+  slot->check = key.check;
+  slot->lastUsed = ++header_->clock;
+  slot->payloadSize = payloadSize;
+  slot->output = output;
+  slot->key = key.key;
+  header_->bytesUsed += sizeof(Slot) + payloadSize;
+
+  EvictToBudget();
+  return true;
+}
+
+ULONGLONG ResultCache::BytesUsed() const {
+  return header_ ? header_->bytesUsed : 0;
+}
+
+void Test_ResultCache() {
+  WCHAR temp[MAX_PATH], indexFile[MAX_PATH], dataDir[MAX_PATH];
+  assert(GetTempPath(ARRAYSIZE(temp), temp));
+  swprintf_s(indexFile, L"%scurve.results.%u", temp, GetCurrentProcessId());
+  swprintf_s(dataDir, L"%s.data", indexFile);
+
+  curve::DiffOutput output = {}, found = {};
+  Blob payload(100), smaller(40), loaded;
+  memset(payload, 0x5a, payload.Size());
+  memset(smaller, 0xa5, smaller.Size());
+  {
+    ResultCache cache;
+    assert(cache.Open(indexFile, ResultCache::defaultByteBudget));
+    assert(cache.BytesUsed() == 0);
+
+    // A result is found by both words of its key.
+    const auto a =
+      ResultCache::MakeKey(L"a", 100, 100, curve::averageDiff, 1, 2, 0);
+    auto other = a;
+    other.check ^= 1;
+    output.psnr_target_vs_area = 12.5;
+    assert(!cache.Lookup(a, found, nullptr));
+    assert(cache.Store(a, output, nullptr));
+    assert(cache.Lookup(a, found, &loaded));
+    assert(found.psnr_target_vs_area == 12.5 && loaded.Size() == 0);
+    assert(!cache.Lookup(other, found, nullptr));
+    const ULONGLONG slotBytes = cache.BytesUsed();
+    assert(slotBytes > 0);
+
+    // A payload comes back as stored, and storing the key again counts
+    // only the new payload.
+    assert(cache.Store(a, output, &payload));
+    assert(cache.BytesUsed() == slotBytes + payload.Size());
+    assert(cache.Lookup(a, found, &loaded));
+    assert(loaded.Size() == payload.Size());
+    assert(memcmp(loaded.As<BYTE>(), payload.As<BYTE>(), 100) == 0);
+    assert(cache.Store(a, output, &smaller));
+    assert(cache.BytesUsed() == slotBytes + smaller.Size());
+    assert(cache.Store(a, output, nullptr));
+    assert(cache.BytesUsed() == slotBytes);
+    assert(cache.Lookup(a, found, &loaded) && loaded.Size() == 0);
+
+    // Keys that differ by a multiple of the bucket count share a bucket.
+    // A full bucket replaces its least recently used way, which keeps the
+    // payload just written even when the victim has the same key.
+    const ULONGLONG bucketCount = defaultSlotCount / 8;
+    const ULONGLONG bucket = (a.key + 1) % bucketCount;
+    ResultCache::Key ways[9];
+    for (ULONGLONG i = 0; i < ARRAYSIZE(ways); ++i) {
+      ways[i].key = bucket + bucketCount * (i + 1);
+      ways[i].check = i;
+    }
+    ways[8].key = ways[0].key;
+    for (DWORD i = 0; i < 8; ++i) {
+      assert(cache.Store(ways[i], output, &payload));
+    }
+    assert(cache.Store(ways[8], output, &smaller));
+    assert(!cache.Lookup(ways[0], found, nullptr));
+    for (DWORD i = 1; i < 8; ++i) {
+      assert(cache.Lookup(ways[i], found, nullptr));
+    }
+    assert(cache.Lookup(ways[8], found, &loaded));
+    assert(loaded.Size() == smaller.Size());
+    assert(memcmp(loaded.As<BYTE>(), smaller.As<BYTE>(), 40) == 0);
+    assert(cache.BytesUsed() == slotBytes * 9
+                                + payload.Size() * 7
+                                + smaller.Size());
+
+    // Another process sets a budget of what is used.  Going over it evicts
+    // the least recently used entries until 90% of it is used, and no more.
+    const ULONGLONG budget = cache.BytesUsed();
+    ResultCache shared;
+    assert(shared.Open(indexFile, budget));
+    assert(shared.BytesUsed() == budget);
+    assert(cache.Lookup(a, found, nullptr));
+    const auto b =
+      ResultCache::MakeKey(L"b", 100, 100, curve::averageDiff, 1, 2, 0);
+    assert(cache.Store(b, output, nullptr));
+    const ULONGLONG target = budget / 10 * 9;
+    assert(cache.BytesUsed() <= target);
+    assert(cache.BytesUsed() + slotBytes + payload.Size() > target);
+    assert(cache.Lookup(a, found, nullptr));
+    assert(cache.Lookup(b, found, nullptr));
+    assert(!cache.Lookup(ways[1], found, nullptr));
+
+    // No budget evicts every entry with its payload.
+    ResultCache empty;
+    assert(empty.Open(indexFile, 0));
+    assert(cache.BytesUsed() == 0);
+    assert(!cache.Lookup(a, found, nullptr));
+  }
+  assert(RemoveDirectory(dataDir));
+  assert(DeleteFile(indexFile));
+}
@@ -0,0 +1,53 @@
+// On-disk cache of diff results.  The index is a memory-mapped table of
+// fixed-size slots shared by all client processes, so a lookup is a few
+// memory reads.  Variable-size data attached to a result is stored as a
+// separate file next to the index and counts toward the size budget.
+class ResultCache {
+public:
+  struct Key {
+    ULONGLONG key;
+    ULONGLONG check;
+  };
+
+  // |variant| stands for any other option that changes the result.
+  static Key MakeKey(LPCWSTR url,
+                     UINT viewWidth,
+                     UINT viewHeight,
+                     curve::DiffAlgorithm algo,
+                     ULONGLONG frameHash1,
+                     ULONGLONG frameHash2,
+                     ULONGLONG variant);
+
+private:
+  struct Header;
+  struct Slot;
+
+  static const DWORD waysPerBucket = 8;
+
+  std::unique_ptr<Mutex> mutex_;
+  FileMapping mapping_;
+  FileMapping::View view_;
+  Header *header_;
+  Slot *slots_;
+  WCHAR dataDir_[MAX_PATH];
+
+  Slot *Find(const Key &key);
+  void GetPayloadPath(ULONGLONG key,
+                      ULONGLONG check,
+                      LPWSTR path,
+                      SIZE_T count) const;
+  void Evict(Slot &slot);
+  void EvictToBudget();
+
+public:
+  static const ULONGLONG defaultByteBudget = 1ull << 30;
+
+  ResultCache();
+  bool Open(LPCWSTR indexFile, ULONGLONG byteBudget);
+  bool Lookup(const Key &key, curve::DiffOutput &output, Blob *payload);
+  bool Store(const Key &key,
+             const curve::DiffOutput &output,
+             const Blob *payload);
+  // Bytes of the entries and their payloads, as counted toward the budget.
+  ULONGLONG BytesUsed() const;
+};
@@ -3,7 +3,10 @@
 #include <exdisp.h>
 #include <mshtmhst.h>
 #include <memory>
+#include <string>
+#include <vector>
 #include <curve_rpc.h>
+#include "blob.h"
 #include "filemapping.h"
 #include "synchronization.h"
 #include "basewindow.h"
@@ -12,9 +15,14 @@
 #include "container.h"
 #include "mainwindow.h"
 #include "globalcontext.h"
+#include "rendercache.h"
 
 void Log(LPCWSTR format, ...);
 
+void ConfigureRenderCache(DWORD ttl) {
+  GlobalContext::Instance().SetRenderCacheTtl(ttl);
+}
+
 class RpcThreadLock {
 public:
   RpcThreadLock() {
@@ -60,8 +68,8 @@ HRESULT s_Navigate(handle_t IDL_handle,
       viewWidth,
       viewHeight,
       async ? L"async" : L"sync");
-  auto &mainWindow = GlobalContext::Instance().GetMainWindow();
-  return mainWindow.StartNavigate(url, viewWidth, viewHeight, async);
+  auto &coordinator = GlobalContext::Instance().GetRenderCoordinator();
+  return coordinator.Navigate(url, viewWidth, viewHeight, async);
 }
 
 HRESULT s_Capture(handle_t IDL_handle,
@@ -71,8 +79,8 @@ HRESULT s_Capture(handle_t IDL_handle,
                   const wchar_t *saveOnServer) {
   RpcThreadLock lock;
   Log(L"Start: Capture(%s)\n", saveOnServer);
-  auto &mainWindow = GlobalContext::Instance().GetMainWindow();
-  return mainWindow.StartCapture(bitCount, *width, *height, saveOnServer);
+  auto &coordinator = GlobalContext::Instance().GetRenderCoordinator();
+  return coordinator.Capture(bitCount, *width, *height, saveOnServer);
 }
 
 HRESULT s_EnsureFileMapping(handle_t IDL_handle,
@@ -92,4 +100,15 @@ HRESULT s_EnsureFileMapping(handle_t IDL_handle,
   return hr;
 }
 
+HRESULT s_Invalidate(handle_t IDL_handle,
+                     const wchar_t *url,
+                     unsigned int viewWidth,
+                     unsigned int viewHeight) {
+  RpcThreadLock lock;
+  Log(L"Start: Invalidate(%s, %u, %u)\n", url, viewWidth, viewHeight);
+  auto &coordinator = GlobalContext::Instance().GetRenderCoordinator();
+  coordinator.Invalidate(url, viewWidth, viewHeight);
+  return S_OK;
+}
+
 }
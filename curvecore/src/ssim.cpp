@@ -0,0 +1,295 @@
+#include <windows.h>
+#include <emmintrin.h>
+#include <assert.h>
+#include <math.h>
+#include <iostream>
+#include <vector>
+#include "blob.h"
+#include "curvecore.h"
+#include "tiles.h"
+#include "resample.h"
+#include "parallel.h"
+#include "ssim.h"
+
+static const DWORD blockSize = 4;
+static const DWORD blocksPerTile = TileGrid::tileSize / blockSize;
+
+struct BlockSums {
+  int sum1;
+  int sum2;
+  int squares1;
+  int squares2;
+  int products;
+};
+
+// Sums of |count| blocks in a row.  Four blocks are 16 pixels, whose pairs
+// PMADDWD adds up into the four lanes of each half.
+static void SumBlocks(LPCBYTE p1,
+                      LONG stride1,
+                      LPCBYTE p2,
+                      LONG stride2,
+                      DWORD count,
+                      BlockSums *out) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  DWORD i = 0;
+  for (; i + 4 <= count; i += 4, out += 4) {
+    __m128i sums[2][5] = {};
+    auto q1 = p1 + i * blockSize;
+    auto q2 = p2 + i * blockSize;
+    for (DWORD y = 0; y < blockSize; ++y, q1 += stride1, q2 += stride2) {
+      const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(q1));
+      const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(q2));
+      const __m128i halves[2][2] = {
+        {_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)},
+        {_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)},
+      };
+      for (int h = 0; h < 2; ++h) {
+        const auto &x = halves[h][0];
+        const auto &z = halves[h][1];
+        auto &s = sums[h];
+        s[0] = _mm_add_epi32(s[0], _mm_madd_epi16(x, ones));
+        s[1] = _mm_add_epi32(s[1], _mm_madd_epi16(z, ones));
+        s[2] = _mm_add_epi32(s[2], _mm_madd_epi16(x, x));
+        s[3] = _mm_add_epi32(s[3], _mm_madd_epi16(z, z));
+        s[4] = _mm_add_epi32(s[4], _mm_madd_epi16(x, z));
+      }
+    }
+    for (int h = 0; h < 2; ++h) {
+      int lanes[5][4];
+      for (int k = 0; k < 5; ++k) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[k]), sums[h][k]);
+      }
+      for (int j = 0; j < 2; ++j) {
+        auto &block = out[h * 2 + j];
+        block.sum1 = lanes[0][j * 2] + lanes[0][j * 2 + 1];
+        block.sum2 = lanes[1][j * 2] + lanes[1][j * 2 + 1];
+        block.squares1 = lanes[2][j * 2] + lanes[2][j * 2 + 1];
+        block.squares2 = lanes[3][j * 2] + lanes[3][j * 2 + 1];
+        block.products = lanes[4][j * 2] + lanes[4][j * 2 + 1];
+      }
+    }
+  }
+  for (; i < count; ++i, ++out) {
+    BlockSums block = {};
+    auto q1 = p1 + i * blockSize;
+    auto q2 = p2 + i * blockSize;
+    for (DWORD y = 0; y < blockSize; ++y, q1 += stride1, q2 += stride2) {
+      for (DWORD x = 0; x < blockSize; ++x) {
+        const int a = q1[x], b = q2[x];
+        block.sum1 += a;
+        block.sum2 += b;
+        block.squares1 += a * a;
+        block.squares2 += b * b;
+        block.products += a * b;
+      }
+    }
+    *out = block;
+  }
+}
+
+// Luminance and contrast-structure terms of a window of 2x2 blocks.
+static void MeasureWindow(const BlockSums &b00,
+                          const BlockSums &b01,
+                          const BlockSums &b10,
+                          const BlockSums &b11,
+                          double &luminance,
+                          double &contrastStructure) {
+  const double n = 4 * blockSize * blockSize;
+  const double c1 = (.01 * 255) * (.01 * 255) * n * n;
+  const double c2 = (.03 * 255) * (.03 * 255) * n * n;
+  const double s1 = b00.sum1 + b01.sum1 + b10.sum1 + b11.sum1;
+  const double s2 = b00.sum2 + b01.sum2 + b10.sum2 + b11.sum2;
+  const double s11 =
+    b00.squares1 + b01.squares1 + b10.squares1 + b11.squares1;
+  const double s22 =
+    b00.squares2 + b01.squares2 + b10.squares2 + b11.squares2;
+  const double s12 =
+    b00.products + b01.products + b10.products + b11.products;
+  luminance = (2 * s1 * s2 + c1) / (s1 * s1 + s2 * s2 + c1);
+  contrastStructure = (2 * (n * s12 - s1 * s2) + c2)
+                      / (n * s11 - s1 * s1 + n * s22 - s2 * s2 + c2);
+}
+
+// Mean SSIM and mean contrast-structure term of all windows of a scale.
+// Returns false if no window fits.
+static bool MeasureScale(const Plane &plane1,
+                         const Plane &plane2,
+                         double &similarity,
+                         double &contrastStructure,
+                         TileGrid *tiles) {
+  const DWORD columns = plane1.width / blockSize;
+  const DWORD rows = plane1.height / blockSize;
+  if (columns < 2 || rows < 2) {
+    return false;
+  }
+
+  const LONG tileRows = (rows - 1 + blocksPerTile - 1) / blocksPerTile;
+  std::vector<double> sums(tileRows * 2);
+  auto measureTileRow = [&](LONG tileRow) {
+    // Windows that start in this row of tiles, and one more row of blocks
+    // under them.
+    const DWORD top = tileRow * blocksPerTile;
+    const DWORD end = top + blocksPerTile < rows - 1
+                      ? top + blocksPerTile : rows - 1;
+    std::vector<BlockSums> blocks((end - top + 1) * columns);
+    for (DWORD y = top; y <= end; ++y) {
+      SumBlocks(plane1.bits + y * blockSize * plane1.stride,
+                plane1.stride,
+                plane2.bits + y * blockSize * plane2.stride,
+                plane2.stride,
+                columns,
+                blocks.data() + (y - top) * columns);
+    }
+
+    double rowSimilarity = 0, rowContrastStructure = 0;
+    double tileSimilarity = 0;
+    DWORD tileWindows = 0;
+    for (DWORD x = 0; x + 1 < columns; ++x) {
+      for (DWORD y = top; y < end; ++y) {
+        const auto above = blocks.data() + (y - top) * columns + x;
+        const auto below = above + columns;
+        double l, cs;
+        MeasureWindow(above[0], above[1], below[0], below[1], l, cs);
+        rowSimilarity += l * cs;
+        rowContrastStructure += cs;
+        tileSimilarity += l * cs;
+        ++tileWindows;
+      }
+      if (tiles && (x + 2 == columns || (x + 1) % blocksPerTile == 0)) {
+        tiles->At(x / blocksPerTile, tileRow).sse =
+          static_cast<float>(1 - tileSimilarity / tileWindows);
+        tileSimilarity = 0;
+        tileWindows = 0;
+      }
+    }
+    sums[tileRow * 2] = rowSimilarity;
+    sums[tileRow * 2 + 1] = rowContrastStructure;
+  };
+  ParallelFor(tileRows, measureTileRow);
+
+  // Rows are added up in order so that the result does not depend on
+  // the order in which threads finished.
+  double totalSimilarity = 0, totalContrastStructure = 0;
+  for (LONG i = 0; i < tileRows; ++i) {
+    totalSimilarity += sums[i * 2];
+    totalContrastStructure += sums[i * 2 + 1];
+  }
+  const double windows = static_cast<double>(columns - 1) * (rows - 1);
+  similarity = totalSimilarity / windows;
+  contrastStructure = totalContrastStructure / windows;
+  return true;
+}
+
+bool StructuralSimilarity(const curve::SimpleBitmap &image1,
+                          const curve::SimpleBitmap &image2,
+                          double &similarity,
+                          TileGrid *tiles) {
+  PlanePair pair;
+  double contrastStructure;
+  return pair.Init(image1, image2)
+         && (!tiles || tiles->Reset(image1.width_, image1.height_))
+         && MeasureScale(pair.First(),
+                         pair.Second(),
+                         similarity,
+                         contrastStructure,
+                         tiles);
+}
+
+bool MultiScaleSimilarity(const curve::SimpleBitmap &image1,
+                          const curve::SimpleBitmap &image2,
+                          double &similarity,
+                          TileGrid *tiles) {
+  static const double weights[] = {.0448, .2856, .3001, .2363, .1333};
+  const int maxScales = ARRAYSIZE(weights);
+
+  PlanePair pair;
+  if (!pair.Init(image1, image2)
+      || (tiles && !tiles->Reset(image1.width_, image1.height_))) {
+    return false;
+  }
+
+  // Each scale is reduced from the previous one.  Two pairs of buffers
+  // take turns so the source of a reduction is not overwritten.
+  double contrastStructures[maxScales], lastSimilarity = 0;
+  Plane plane1 = pair.First(), plane2 = pair.Second();
+  Resampler resampler;
+  Blob levels, bits[2][2];
+  int scales = 0;
+  for (; scales < maxScales; ++scales) {
+    if (scales > 0
+        && (!ReducePlane(plane1, plane1.width / 2, plane1.height / 2,
+                         resampler, levels, bits[scales % 2][0], plane1)
+            || !ReducePlane(plane2, plane2.width / 2, plane2.height / 2,
+                            resampler, levels, bits[scales % 2][1], plane2))) {
+      break;
+    }
+    double ssim;
+    if (!MeasureScale(plane1,
+                      plane2,
+                      ssim,
+                      contrastStructures[scales],
+                      scales == 0 ? tiles : nullptr)) {
+      break;
+    }
+    lastSimilarity = ssim;
+  }
+  if (scales == 0) {
+    return false;
+  }
+
+  // The weights of the scales that fit are normalized to add up to 1, and
+  // the last scale contributes luminance as well.
+  double totalWeight = 0;
+  for (int i = 0; i < scales; ++i) {
+    totalWeight += weights[i];
+  }
+  similarity = 1;
+  for (int i = 0; i < scales; ++i) {
+    const double term = i + 1 < scales ? contrastStructures[i] : lastSimilarity;
+    similarity *= pow(term > 0 ? term : 0, weights[i] / totalWeight);
+  }
+  return true;
+}
+
+void Test_StructuralSimilarity() {
+  const DWORD width = 100, height = 70, lineSize = 100;
+  static BYTE bits1[lineSize * height];
+  static BYTE bits2[lineSize * height];
+  for (DWORD i = 0; i < sizeof(bits1); ++i) {
+    bits1[i] = bits2[i] = static_cast<BYTE>(i * 7 + (i / lineSize) * 3);
+  }
+  curve::SimpleBitmap image1(8, width, height, bits1);
+  curve::SimpleBitmap image2(8, width, height, bits2);
+
+  TileGrid tiles;
+  double similarity;
+  assert(StructuralSimilarity(image1, image2, similarity, &tiles));
+  assert(fabs(similarity - 1) < 1e-9);
+  assert(tiles.Columns() == 4 && tiles.At(3, 2).sse == 0);
+  assert(MultiScaleSimilarity(image1, image2, similarity, nullptr));
+  assert(fabs(similarity - 1) < 1e-9);
+
+  // The SIMD sums match the plain ones for any number of blocks.
+  BlockSums fast[25], plain[25];
+  SumBlocks(bits1, lineSize, bits2 + 3, lineSize, 25, fast);
+  for (DWORD i = 0; i < 25; ++i) {
+    SumBlocks(bits1 + i * blockSize, lineSize,
+              bits2 + 3 + i * blockSize, lineSize,
+              1, plain + i);
+    assert(memcmp(fast + i, plain + i, sizeof(BlockSums)) == 0);
+  }
+
+  // A change lowers the similarity of its tile only.
+  for (DWORD y = 40; y < 48; ++y) {
+    for (DWORD x = 40; x < 48; ++x) {
+      bits2[y * lineSize + x] = static_cast<BYTE>(~bits2[y * lineSize + x]);
+    }
+  }
+  assert(StructuralSimilarity(image1, image2, similarity, &tiles));
+  assert(similarity < 1);
+  assert(tiles.At(1, 1).sse > 0 && tiles.At(0, 0).sse == 0);
+  double multiScale;
+  assert(MultiScaleSimilarity(image1, image2, multiScale, nullptr));
+  assert(multiScale < 1);
+}
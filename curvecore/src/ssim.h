@@ -0,0 +1,20 @@
+// Structural similarity (SSIM) of two 8bpp frames over 8x8 windows at a
+// step of 4 pixels.  A window is made of 2x2 blocks of 4x4 pixels, so the
+// sums of every block are taken once with SSE2 and shared by the four
+// windows that overlap it.  Rows of tiles run in parallel.  Frames of
+// different sizes are compared at the size of the smaller one, to which
+// the larger one is reduced by area.  |image1| must be the smaller one.
+//
+// With |tiles|, which must cover |image1|, the sse of each tile holds
+// 1 - the mean SSIM of the windows that start in the tile.
+bool StructuralSimilarity(const curve::SimpleBitmap &image1,
+                          const curve::SimpleBitmap &image2,
+                          double &similarity,
+                          TileGrid *tiles);
+// Multi-scale SSIM over up to five scales, each half the size of the
+// previous one, weighted as Wang et al. did.  |tiles| get the map of the
+// first scale.
+bool MultiScaleSimilarity(const curve::SimpleBitmap &image1,
+                          const curve::SimpleBitmap &image2,
+                          double &similarity,
+                          TileGrid *tiles);
@@ -28,6 +28,49 @@ DWORD Event::Wait(DWORD dwMilliseconds) {
   return WaitForSingleObject(h_, dwMilliseconds);
 }
 
+Mutex::Mutex(LPCWSTR name) : h_(nullptr) {
+  h_ = CreateMutex(/*lpMutexAttributes*/nullptr,
+                   /*bInitialOwner*/FALSE,
+                   /*lpName*/name);
+}
+
+Mutex::~Mutex() {
+  if (h_) {
+    CloseHandle(h_);
+    h_ = nullptr;
+  }
+}
+
+Mutex::operator bool() const {
+  return !!h_;
+}
+
+DWORD Mutex::Lock(DWORD dwMilliseconds) {
+  return WaitForSingleObject(h_, dwMilliseconds);
+}
+
+BOOL Mutex::Unlock() {
+  return ReleaseMutex(h_);
+}
+
+MutexHelper::MutexHelper(Mutex &mutex)
+  : mutex_(mutex), locked_(false) {
+  const auto waitResult = mutex_.Lock(INFINITE);
+  // WAIT_ABANDONED still grants ownership.  The data protected by the mutex
+  // is written in a crash-safe order, so carry on.
+  locked_ = waitResult == WAIT_OBJECT_0 || waitResult == WAIT_ABANDONED;
+}
+
+MutexHelper::~MutexHelper() {
+  if (locked_) {
+    mutex_.Unlock();
+  }
+}
+
+bool MutexHelper::IsLocked() const {
+  return locked_;
+}
+
 CriticalSectionHelper::CriticalSectionHelper(CRITICAL_SECTION &cs)
   : cs_(cs) {
   EnterCriticalSection(&cs_);
@@ -10,6 +10,29 @@ public:
   DWORD Wait(DWORD dwMilliseconds);
 };
 
+class Mutex {
+private:
+  HANDLE h_;
+
+public:
+  Mutex(LPCWSTR name);
+  ~Mutex();
+  operator bool() const;
+  DWORD Lock(DWORD dwMilliseconds);
+  BOOL Unlock();
+};
+
+class MutexHelper {
+private:
+  Mutex &mutex_;
+  bool locked_;
+
+public:
+  MutexHelper(Mutex &);
+  ~MutexHelper();
+  bool IsLocked() const;
+};
+
 class CriticalSectionHelper {
 private:
   CRITICAL_SECTION &cs_;
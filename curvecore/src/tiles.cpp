@@ -0,0 +1,460 @@
+#include <windows.h>
+#include <emmintrin.h>
+#include <assert.h>
+#include <algorithm>
+#include <iostream>
+#include <string_view>
+#include <vector>
+#include "blob.h"
+#include "curvecore.h"
+#include "tiles.h"
+#include "mask.h"
+
+TileGrid::TileGrid()
+  : histogram_(false)
+{}
+
+TileGrid::Header *TileGrid::GetHeader() {
+  return buffer_.As<Header>();
+}
+
+const TileGrid::Header *TileGrid::GetHeader() const {
+  return buffer_.As<Header>();
+}
+
+bool TileGrid::Reset(DWORD width, DWORD height) {
+  const DWORD columns = (width + tileSize - 1) / tileSize;
+  const DWORD rows = (height + tileSize - 1) / tileSize;
+  const DWORD bins = histogram_ ? histogramBins : 0;
+  const SIZE_T size = sizeof(Header)
+                      + sizeof(Tile) * static_cast<SIZE_T>(columns) * rows
+                      + sizeof(DWORD) * static_cast<SIZE_T>(bins) * rows;
+  if (buffer_.Size() != size && !buffer_.Alloc(size)) {
+    return false;
+  }
+  ZeroMemory(buffer_.As<BYTE>(), size);
+  auto header = GetHeader();
+  header->width = width;
+  header->height = height;
+  header->columns = columns;
+  header->rows = rows;
+  header->bins = bins;
+  return true;
+}
+
+void TileGrid::EnableHistogram(bool enable) {
+  histogram_ = enable;
+}
+
+bool TileGrid::IsValid() const {
+  if (buffer_.Size() < sizeof(Header)) return false;
+  const auto header = GetHeader();
+  return header->columns == (header->width + tileSize - 1) / tileSize
+         && header->rows == (header->height + tileSize - 1) / tileSize
+         && (header->bins == 0 || header->bins == histogramBins)
+         && buffer_.Size() == sizeof(Header)
+                              + sizeof(Tile)
+                                * static_cast<SIZE_T>(header->columns)
+                                * header->rows
+                              + sizeof(DWORD)
+                                * static_cast<SIZE_T>(header->bins)
+                                * header->rows;
+}
+
+Blob &TileGrid::GetBuffer() {
+  return buffer_;
+}
+
+const Blob &TileGrid::GetBuffer() const {
+  return buffer_;
+}
+
+DWORD TileGrid::Width() const {
+  return IsValid() ? GetHeader()->width : 0;
+}
+
+DWORD TileGrid::Height() const {
+  return IsValid() ? GetHeader()->height : 0;
+}
+
+DWORD TileGrid::Columns() const {
+  return IsValid() ? GetHeader()->columns : 0;
+}
+
+DWORD TileGrid::Rows() const {
+  return IsValid() ? GetHeader()->rows : 0;
+}
+
+TileGrid::Tile &TileGrid::At(DWORD column, DWORD row) {
+  return reinterpret_cast<Tile*>(GetHeader() + 1)
+    [row * GetHeader()->columns + column];
+}
+
+const TileGrid::Tile &TileGrid::At(DWORD column, DWORD row) const {
+  return reinterpret_cast<const Tile*>(GetHeader() + 1)
+    [row * GetHeader()->columns + column];
+}
+
+bool TileGrid::HasHistogram() const {
+  return IsValid() && GetHeader()->bins != 0;
+}
+
+DWORD *TileGrid::RowHistogram(DWORD row) {
+  const auto header = GetHeader();
+  if (header->bins == 0) return nullptr;
+
+  const auto tiles = reinterpret_cast<Tile*>(header + 1);
+  return reinterpret_cast<DWORD*>(tiles + header->columns * header->rows)
+         + static_cast<SIZE_T>(row) * header->bins;
+}
+
+void TileGrid::GetHistogram(std::vector<ULONGLONG> &bins) const {
+  bins.assign(histogramBins, 0);
+  if (!HasHistogram()) return;
+
+  const auto header = GetHeader();
+  const auto tiles = reinterpret_cast<const Tile*>(header + 1);
+  auto row = reinterpret_cast<const DWORD*>(tiles
+                                            + header->columns * header->rows);
+  for (DWORD i = 0; i < header->rows; ++i, row += histogramBins) {
+    for (DWORD bin = 1; bin < histogramBins; ++bin) {
+      bins[bin] += row[bin];
+    }
+  }
+}
+
+// Percentiles are by the nearest rank, the smallest difference that at
+// least the fraction of the pixels do not exceed.
+bool TileGrid::GetDistribution(ULONGLONG pixels,
+                               BYTE tolerance,
+                               curve::DiffDistribution &distribution) const {
+  distribution = {};
+  if (!HasHistogram()) return false;
+
+  std::vector<ULONGLONG> bins;
+  GetHistogram(bins);
+  ULONGLONG changed = 0;
+  for (DWORD bin = 1; bin < histogramBins; ++bin) {
+    changed += bins[bin];
+    if (bins[bin]) distribution.maxAbsDiff = static_cast<BYTE>(bin);
+    if (bin > tolerance) distribution.overTolerance += bins[bin];
+  }
+  bins[0] = pixels > changed ? pixels - changed : 0;
+  distribution.pixels = bins[0] + changed;
+
+  const struct {
+    ULONGLONG rank;
+    BYTE *value;
+  } percentiles[] = {
+    {(distribution.pixels * 50 + 99) / 100, &distribution.p50},
+    {(distribution.pixels * 95 + 99) / 100, &distribution.p95},
+    {(distribution.pixels * 99 + 99) / 100, &distribution.p99},
+  };
+  ULONGLONG count = 0;
+  DWORD bin = 0;
+  for (const auto &percentile : percentiles) {
+    for (; bin < histogramBins; ++bin) {
+      if (count + bins[bin] >= percentile.rank) break;
+      count += bins[bin];
+    }
+    *percentile.value =
+      static_cast<BYTE>(bin < histogramBins ? bin : histogramBins - 1);
+  }
+  return true;
+}
+
+void TileGrid::Add(DWORD x, DWORD y, double diff) {
+  auto &tile = At(x / tileSize, y / tileSize);
+  const double absDiff = diff < 0 ? -diff : diff;
+  tile.sse += static_cast<float>(diff * diff);
+  if (absDiff > 0) {
+    ++tile.changedPixels;
+    const BYTE rounded =
+      absDiff >= 255 ? 255 : static_cast<BYTE>(absDiff + .5);
+    if (rounded > tile.maxAbsDiff) tile.maxAbsDiff = rounded;
+    // A difference below .5 still counts as one.
+    if (const auto histogram = RowHistogram(y / tileSize)) {
+      ++histogram[rounded ? rounded : 1];
+    }
+  }
+}
+
+// A tile has at most 32x32 pixels, so the squared differences of a tile fit
+// in the 32-bit lanes of the accumulator.  A mask clears the differences of
+// excluded pixels in the registers, so they count as equal pixels.
+void TileGrid::DiffTile(LPCBYTE p1,
+                        LONG stride1,
+                        LPCBYTE p2,
+                        LONG stride2,
+                        DWORD width,
+                        DWORD height,
+                        LPCBYTE mask,
+                        LONG maskStride,
+                        DWORD *histogram,
+                        Tile &tile,
+                        ULONGLONG &sse) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi8(1);
+  // The bit of each of 16 pixels in the two bytes of the mask for them
+  const __m128i maskBits = _mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1,
+                                         -128, 64, 32, 16, 8, 4, 2, 1);
+  __m128i squares = zero;
+  __m128i changed = zero;
+  __m128i maxima = zero;
+  DWORD tailSquares = 0;
+  DWORD tailChanged = 0;
+  BYTE tailMax = 0;
+  for (DWORD y = 0; y < height; ++y, p1 += stride1, p2 += stride2) {
+    DWORD x = 0;
+    const LPCBYTE maskLine =
+      mask ? mask + static_cast<LONG_PTR>(y) * maskStride : nullptr;
+    for (; x + 16 <= width; x += 16) {
+      const __m128i a =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p1 + x));
+      const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p2 + x));
+      __m128i d = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+      if (maskLine) {
+        // Spreads the first byte of the mask over the lower 8 lanes and
+        // the second over the upper 8, and keeps the bit of each lane.
+        __m128i m = _mm_cvtsi32_si128(maskLine[x >> 3]
+                                      | (maskLine[(x >> 3) + 1] << 8));
+        m = _mm_unpacklo_epi8(m, m);
+        m = _mm_unpacklo_epi16(m, m);
+        m = _mm_unpacklo_epi32(m, m);
+        m = _mm_cmpeq_epi8(_mm_and_si128(m, maskBits), maskBits);
+        d = _mm_andnot_si128(m, d);
+      }
+      if (histogram
+          && _mm_movemask_epi8(_mm_cmpeq_epi8(d, zero)) != 0xffff) {
+        BYTE bytes[16];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(bytes), d);
+        // Bin 0 takes the equal pixels, and is cleared rather than skipped.
+        for (int i = 0; i < 16; ++i) {
+          ++histogram[bytes[i]];
+        }
+        histogram[0] = 0;
+      }
+      maxima = _mm_max_epu8(maxima, d);
+      changed = _mm_add_epi64(changed,
+                              _mm_sad_epu8(_mm_min_epu8(d, ones), zero));
+      const __m128i lo = _mm_unpacklo_epi8(d, zero);
+      const __m128i hi = _mm_unpackhi_epi8(d, zero);
+      squares = _mm_add_epi32(squares,
+                              _mm_add_epi32(_mm_madd_epi16(lo, lo),
+                                            _mm_madd_epi16(hi, hi)));
+    }
+    for (; x < width; ++x) {
+      if (maskLine && (maskLine[x >> 3] & (0x80 >> (x & 7)))) continue;
+      const BYTE d = p1[x] > p2[x] ? p1[x] - p2[x] : p2[x] - p1[x];
+      tailSquares += d * d;
+      tailChanged += d ? 1 : 0;
+      if (d > tailMax) tailMax = d;
+      if (histogram && d) ++histogram[d];
+    }
+  }
+
+  DWORD lanes[4];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), squares);
+  const DWORD tileSquares =
+    lanes[0] + lanes[1] + lanes[2] + lanes[3] + tailSquares;
+  const DWORD tileChanged =
+    _mm_cvtsi128_si32(changed)
+    + _mm_cvtsi128_si32(_mm_srli_si128(changed, 8))
+    + tailChanged;
+  BYTE bytes[16];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(bytes), maxima);
+  BYTE tileMax = tailMax;
+  for (int i = 0; i < 16; ++i) {
+    if (bytes[i] > tileMax) tileMax = bytes[i];
+  }
+
+  tile.sse += static_cast<float>(tileSquares);
+  tile.changedPixels = static_cast<WORD>(tile.changedPixels + tileChanged);
+  if (tileMax > tile.maxAbsDiff) tile.maxAbsDiff = tileMax;
+  sse += tileSquares;
+}
+
+// Walks the lines tile by tile so that the accumulators stay in registers
+// for the whole tile and are reduced once per tile.
+ULONGLONG TileGrid::Accumulate(LPCBYTE p1,
+                               LONG stride1,
+                               LPCBYTE p2,
+                               LONG stride2,
+                               DWORD top,
+                               DWORD bottom) {
+  const auto header = GetHeader();
+  ULONGLONG sse = 0;
+  for (DWORD y = top; y < bottom;) {
+    const DWORD row = y / tileSize;
+    const DWORD bandEnd = (row + 1) * tileSize < bottom
+                          ? (row + 1) * tileSize
+                          : bottom;
+    const auto offset = static_cast<LONG_PTR>(y - top);
+    const auto line1 = p1 + stride1 * offset;
+    const auto line2 = p2 + stride2 * offset;
+    for (DWORD column = 0; column < header->columns; ++column) {
+      const DWORD x = column * tileSize;
+      DiffTile(line1 + x,
+               stride1,
+               line2 + x,
+               stride2,
+               x + tileSize < header->width ? tileSize : header->width - x,
+               bandEnd - y,
+               /*mask*/nullptr,
+               /*maskStride*/0,
+               RowHistogram(row),
+               At(column, row),
+               sse);
+    }
+    y = bandEnd;
+  }
+  return sse;
+}
+
+ULONGLONG TileGrid::AccumulateTile(DWORD column,
+                                   DWORD row,
+                                   LPCBYTE p1,
+                                   LONG stride1,
+                                   LPCBYTE p2,
+                                   LONG stride2,
+                                   const DiffMask *mask) {
+  const auto header = GetHeader();
+  const DWORD x = column * tileSize;
+  const DWORD y = row * tileSize;
+  const auto coverage =
+    mask ? mask->GetCoverage(column, row) : DiffMask::coverNone;
+  if (coverage == DiffMask::coverFull) {
+    return 0;
+  }
+  const auto offset1 = static_cast<LONG_PTR>(stride1) * y + x;
+  const auto offset2 = static_cast<LONG_PTR>(stride2) * y + x;
+  ULONGLONG sse = 0;
+  DiffTile(p1 + offset1,
+           stride1,
+           p2 + offset2,
+           stride2,
+           x + tileSize < header->width ? tileSize : header->width - x,
+           y + tileSize < header->height ? tileSize : header->height - y,
+           coverage == DiffMask::coverPartial ? mask->Line(y) + x / 8 : nullptr,
+           coverage == DiffMask::coverPartial ? mask->Stride() : 0,
+           RowHistogram(row),
+           At(column, row),
+           sse);
+  return sse;
+}
+
+void TileGrid::GetWorstTiles(SIZE_T k, std::vector<DWORD> &tiles) const {
+  tiles.clear();
+  if (!IsValid()) return;
+
+  const auto all = reinterpret_cast<const Tile*>(GetHeader() + 1);
+  const DWORD count = GetHeader()->columns * GetHeader()->rows;
+  for (DWORD i = 0; i < count; ++i) {
+    if (all[i].changedPixels > 0) {
+      tiles.push_back(i);
+    }
+  }
+
+  const auto worse = [all](DWORD a, DWORD b) {
+    return all[a].sse > all[b].sse;
+  };
+  if (tiles.size() > k) {
+    std::partial_sort(tiles.begin(), tiles.begin() + k, tiles.end(), worse);
+    tiles.resize(k);
+  }
+  else {
+    std::sort(tiles.begin(), tiles.end(), worse);
+  }
+}
+
+bool TileGrid::Save(std::ostream &os) const {
+  if (!IsValid()) return false;
+
+  const auto header = GetHeader();
+  os << "x\ty\twidth\theight\tsse\tmaxAbsDiff\tchangedPixels\n";
+  for (DWORD row = 0; row < header->rows; ++row) {
+    for (DWORD column = 0; column < header->columns; ++column) {
+      const auto &tile = At(column, row);
+      if (tile.changedPixels == 0) continue;
+
+      const DWORD x = column * tileSize;
+      const DWORD y = row * tileSize;
+      os << x << '\t'
+         << y << '\t'
+         << (x + tileSize < header->width ? tileSize : header->width - x)
+         << '\t'
+         << (y + tileSize < header->height ? tileSize : header->height - y)
+         << '\t'
+         << tile.sse << '\t'
+         << static_cast<UINT>(tile.maxAbsDiff) << '\t'
+         << tile.changedPixels << '\n';
+    }
+  }
+  return !!os;
+}
+
+void Test_TileGrid() {
+  const DWORD width = 70, height = 40, lineSize = 72;
+  BYTE bits1[lineSize * height] = {};
+  BYTE bits2[lineSize * height] = {};
+  bits2[5 * lineSize + 3] = 10;
+  bits2[5 * lineSize + 4] = 0xff;
+  bits1[33 * lineSize + 69] = 3;
+  bits1[39 * lineSize + 64] = 4;
+
+  TileGrid grid;
+  assert(grid.Reset(width, height));
+  assert(grid.Columns() == 3 && grid.Rows() == 2);
+  const auto sse = grid.Accumulate(bits1, lineSize, bits2, lineSize, 0, height);
+  assert(sse == 100 + 255 * 255 + 9 + 16);
+  assert(grid.At(0, 0).sse == 100 + 255 * 255);
+  assert(grid.At(0, 0).maxAbsDiff == 0xff);
+  assert(grid.At(0, 0).changedPixels == 2);
+  assert(grid.At(2, 1).sse == 25);
+  assert(grid.At(2, 1).changedPixels == 2);
+  assert(grid.At(1, 0).changedPixels == 0);
+
+  // Split ranges add up to the same statistics.
+  assert(grid.Reset(width, height));
+  grid.Accumulate(bits1, lineSize, bits2, lineSize, 0, 6);
+  grid.Accumulate(bits1 + 6 * lineSize, lineSize,
+                  bits2 + 6 * lineSize, lineSize,
+                  6, height);
+  assert(grid.At(0, 0).changedPixels == 2 && grid.At(2, 1).sse == 25);
+
+  // A stride of 0 compares with one line of zeros.
+  const BYTE zeros[lineSize] = {};
+  assert(grid.Reset(width, height));
+  assert(grid.Accumulate(bits2, lineSize, zeros, 0, 0, height)
+         == 100 + 255 * 255);
+
+  std::vector<DWORD> worst;
+  grid.GetWorstTiles(5, worst);
+  assert(worst.size() == 1 && worst[0] == 0);
+
+  // The histogram counts the pixels that differ, and the equal pixels are
+  // told from the number of pixels compared.
+  std::vector<ULONGLONG> bins;
+  assert(!grid.HasHistogram());
+  grid.EnableHistogram(true);
+  assert(grid.Reset(width, height) && grid.HasHistogram());
+  grid.Accumulate(bits1, lineSize, bits2, lineSize, 0, height);
+  grid.Add(68, 2, -0.2);
+  grid.GetHistogram(bins);
+  assert(bins.size() == TileGrid::histogramBins && bins[0] == 0);
+  assert(bins[1] == 1 && bins[3] == 1 && bins[4] == 1);
+  assert(bins[10] == 1 && bins[255] == 1);
+  curve::DiffDistribution distribution;
+  assert(grid.GetDistribution(100, 3, distribution));
+  assert(distribution.pixels == 100 && distribution.overTolerance == 3);
+  assert(distribution.p50 == 0 && distribution.p95 == 0);
+  assert(distribution.p99 == 10 && distribution.maxAbsDiff == 255);
+  assert(grid.GetDistribution(5, 0, distribution));
+  assert(distribution.p50 == 4 && distribution.p95 == 255);
+
+  assert(grid.Reset(0, 0) && grid.IsValid() && grid.Columns() == 0);
+  grid.EnableHistogram(false);
+  assert(grid.Reset(width, height) && !grid.HasHistogram());
+  assert(!grid.GetDistribution(100, 3, distribution));
+}
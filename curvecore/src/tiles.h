@@ -0,0 +1,120 @@
+class DiffMask;
+
+// Statistics of the difference between two frames over a grid of
+// |tileSize| x |tileSize| tiles.  The grid and its header live in one Blob,
+// so a TileGrid is reused across the rows of a batch without allocating,
+// and the same bytes are stored as a payload in ResultCache.  For ssim and
+// msssim, the sse of a tile holds 1 - its SSIM instead, and for edgeDiff,
+// the tiles are of the difference of the edge maps.
+//
+// With EnableHistogram, the buffer also holds a histogram of the absolute
+// differences of each row of tiles, filled in the same pass as the tiles.
+// A row of tiles is the unit of work of the diffs that run on threads, so
+// the rows are filled apart and merged only by GetHistogram.
+class TileGrid {
+public:
+  static const DWORD tileSize = 32;
+  static const DWORD histogramBins = 256;
+
+  struct Tile {
+    float sse;
+    WORD changedPixels;
+    BYTE maxAbsDiff;
+    BYTE reserved;
+  };
+
+private:
+  struct Header {
+    DWORD width;
+    DWORD height;
+    DWORD columns;
+    DWORD rows;
+    DWORD bins; // histogramBins with a histogram, 0 otherwise
+  };
+
+  Blob buffer_;
+  bool histogram_;
+
+  Header *GetHeader();
+  const Header *GetHeader() const;
+
+public:
+  TileGrid();
+
+  // Adds |p1| - |p2| over a |width| x |height| block to |tile| and |sse|,
+  // and the pixels that differ to |histogram| by their absolute difference.
+  // Pixels whose bits are set in |mask|, lines of a DiffMask that start at
+  // the block, are left out.  |mask| and |histogram| may be null.
+  static void DiffTile(LPCBYTE p1,
+                       LONG stride1,
+                       LPCBYTE p2,
+                       LONG stride2,
+                       DWORD width,
+                       DWORD height,
+                       LPCBYTE mask,
+                       LONG maskStride,
+                       DWORD *histogram,
+                       Tile &tile,
+                       ULONGLONG &sse);
+
+  // Keeps histograms from the next Reset on.
+  void EnableHistogram(bool enable);
+
+  // Clears the grid to cover a |width| x |height| frame.  0 x 0 leaves an
+  // empty grid, which tells that no statistics were taken.
+  bool Reset(DWORD width, DWORD height);
+  // True if the buffer holds a grid, e.g. after it was loaded from a cache.
+  bool IsValid() const;
+  Blob &GetBuffer();
+  const Blob &GetBuffer() const;
+
+  DWORD Width() const;
+  DWORD Height() const;
+  DWORD Columns() const;
+  DWORD Rows() const;
+  Tile &At(DWORD column, DWORD row);
+  const Tile &At(DWORD column, DWORD row) const;
+  bool HasHistogram() const;
+  // Histogram of a row of tiles for DiffTile, or null without histograms.
+  DWORD *RowHistogram(DWORD row);
+  // Sums the histograms of the rows into |histogramBins| bins.  Bin 0 is
+  // always 0, as the pixels that do not differ are not counted.
+  void GetHistogram(std::vector<ULONGLONG> &bins) const;
+  // Fills |distribution| from the histogram of a diff that compared
+  // |pixels| pixels, those that were not counted being equal.  Returns
+  // false without a histogram.
+  bool GetDistribution(ULONGLONG pixels,
+                       BYTE tolerance,
+                       curve::DiffDistribution &distribution) const;
+
+  // Adds the difference of one pixel, for algorithms that are not a plain
+  // difference of bytes.
+  void Add(DWORD x, DWORD y, double diff);
+  // Adds |p1| - |p2| over lines [top, bottom) of the full width, where |p1|
+  // and |p2| point to line |top|.  A stride of 0 repeats one line, so
+  // a line of zeros turns this into statistics of a difference image.
+  // Returns the sum of squared differences.
+  ULONGLONG Accumulate(LPCBYTE p1,
+                       LONG stride1,
+                       LPCBYTE p2,
+                       LONG stride2,
+                       DWORD top,
+                       DWORD bottom);
+  // Adds the difference of one tile, where |p1| and |p2| point to the
+  // origin of the frames.  Returns the sum of squared differences.  With
+  // |mask|, which must cover the grid, its excluded pixels are left out,
+  // and a tile excluded as a whole is skipped without reading the frames.
+  ULONGLONG AccumulateTile(DWORD column,
+                           DWORD row,
+                           LPCBYTE p1,
+                           LONG stride1,
+                           LPCBYTE p2,
+                           LONG stride2,
+                           const DiffMask *mask);
+
+  // Indices (row * Columns() + column) of up to |k| tiles with the largest
+  // SSE, worst first.  Tiles without differences are not included.
+  void GetWorstTiles(SIZE_T k, std::vector<DWORD> &tiles) const;
+  // Writes the tiles with differences as tab-separated values.
+  bool Save(std::ostream &os) const;
+};
@@ -0,0 +1,131 @@
+#include <windows.h>
+#include <emmintrin.h>
+#include <assert.h>
+#include <string_view>
+#include <vector>
+#include "blob.h"
+#include "curvecore.h"
+#include "mask.h"
+#include "volatility.h"
+
+VolatilityAccumulator::VolatilityAccumulator()
+  : width_(0),
+    height_(0),
+    count_(0)
+{}
+
+bool VolatilityAccumulator::Reset(DWORD width, DWORD height) {
+  width_ = height_ = count_ = 0;
+  const SIZE_T size = static_cast<SIZE_T>(width) * height * sizeof(float);
+  if (size == 0
+      || (means_.Size() != size && !means_.Alloc(size))
+      || (squares_.Size() != size && !squares_.Alloc(size))) {
+    return false;
+  }
+  ZeroMemory(means_.As<BYTE>(), size);
+  ZeroMemory(squares_.As<BYTE>(), size);
+  width_ = width;
+  height_ = height;
+  return true;
+}
+
+// For each pixel x of the n-th frame:
+//   delta = x - mean, mean += delta / n, squares += delta * (x - mean)
+bool VolatilityAccumulator::Add(const curve::SimpleBitmap &image) {
+  if (image.bitCount_ != 8
+      || image.width_ != width_
+      || image.height_ != height_
+      || width_ == 0) {
+    return false;
+  }
+
+  ++count_;
+  const float reciprocal = 1.0f / count_;
+  const __m128 scale = _mm_set1_ps(reciprocal);
+  const __m128i zero = _mm_setzero_si128();
+  const LONG lineSize = image.GetLineSize();
+  for (DWORD y = 0; y < height_; ++y) {
+    const LPCBYTE line = image.bits_ + static_cast<LONG_PTR>(y) * lineSize;
+    const SIZE_T offset = static_cast<SIZE_T>(y) * width_;
+    float *means = means_.As<float>() + offset;
+    float *squares = squares_.As<float>() + offset;
+    DWORD x = 0;
+    for (; x + 16 <= width_; x += 16) {
+      const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(line + x));
+      const __m128i words[2] = {
+        _mm_unpacklo_epi8(bytes, zero),
+        _mm_unpackhi_epi8(bytes, zero),
+      };
+      for (int i = 0; i < 4; ++i) {
+        const __m128i dwords = i % 2 == 0
+                               ? _mm_unpacklo_epi16(words[i / 2], zero)
+                               : _mm_unpackhi_epi16(words[i / 2], zero);
+        const __m128 value = _mm_cvtepi32_ps(dwords);
+        float *mean = means + x + i * 4;
+        float *square = squares + x + i * 4;
+        const __m128 oldMean = _mm_loadu_ps(mean);
+        const __m128 delta = _mm_sub_ps(value, oldMean);
+        const __m128 newMean = _mm_add_ps(oldMean, _mm_mul_ps(delta, scale));
+        _mm_storeu_ps(mean, newMean);
+        _mm_storeu_ps(square,
+                      _mm_add_ps(_mm_loadu_ps(square),
+                                 _mm_mul_ps(delta,
+                                            _mm_sub_ps(value, newMean))));
+      }
+    }
+    for (; x < width_; ++x) {
+      const float value = line[x];
+      const float delta = value - means[x];
+      means[x] += delta * reciprocal;
+      squares[x] += delta * (value - means[x]);
+    }
+  }
+  return true;
+}
+
+DWORD VolatilityAccumulator::Count() const {
+  return count_;
+}
+
+bool VolatilityAccumulator::BuildMask(double maxStdDev, DiffMask &mask) const {
+  if (count_ < 2) {
+    return false;
+  }
+  // The variance is squares / count.
+  return mask.Build(width_,
+                    height_,
+                    squares_.As<float>(),
+                    static_cast<float>(maxStdDev * maxStdDev * count_));
+}
+
+void Test_VolatilityAccumulator() {
+  const DWORD width = 21, height = 3, lineSize = 24;
+  BYTE bits[lineSize * height] = {};
+  curve::SimpleBitmap image(8, width, height, bits);
+
+  // Pixel 17 of the first line takes 10, 20, and 30, whose variance is
+  // 200 / 3, and pixel 2 of the last line is 5 in the second frame only.
+  VolatilityAccumulator accumulator;
+  assert(accumulator.Reset(width, height));
+  DiffMask mask;
+  for (int i = 0; i < 3; ++i) {
+    bits[17] = static_cast<BYTE>(10 * (i + 1));
+    bits[2 * lineSize + 2] = i == 1 ? 5 : 0;
+    assert(accumulator.Add(image));
+    assert(i > 0 || !accumulator.BuildMask(1, mask));
+  }
+  assert(accumulator.Count() == 3);
+
+  assert(accumulator.BuildMask(1, mask));
+  assert(mask.IncludedPixels() == width * height - 2);
+  assert(mask.IsExcluded(17, 0) && mask.IsExcluded(2, 2));
+  assert(accumulator.BuildMask(3, mask));
+  assert(mask.IncludedPixels() == width * height - 1);
+  assert(mask.IsExcluded(17, 0) && !mask.IsExcluded(2, 2));
+  assert(accumulator.BuildMask(9, mask));
+  assert(mask.IncludedPixels() == width * height);
+
+  curve::SimpleBitmap other(8, width + 1, height, bits);
+  assert(!accumulator.Add(other));
+}
@@ -0,0 +1,25 @@
+// Running mean and variance of every pixel over frames of one URL captured
+// again and again, by Welford's method.  The accumulator holds two floats
+// per pixel whatever the number of frames, so frames are added one by one
+// as they are captured and never kept.
+class VolatilityAccumulator {
+private:
+  DWORD width_;
+  DWORD height_;
+  DWORD count_;
+  Blob means_;
+  Blob squares_; // Sums of squared differences from the mean
+
+public:
+  VolatilityAccumulator();
+
+  // Starts over for frames of |width| x |height|.
+  bool Reset(DWORD width, DWORD height);
+  // Adds an 8bpp frame of the size given to Reset.  Lines are updated 16
+  // pixels at a time with SSE2.
+  bool Add(const curve::SimpleBitmap &image);
+  DWORD Count() const;
+  // Builds a mask that excludes the pixels whose standard deviation over
+  // the frames added so far is above |maxStdDev| levels.  Needs two frames.
+  bool BuildMask(double maxStdDev, DiffMask &mask) const;
+};